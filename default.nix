@@ -7,6 +7,7 @@ pkgs.mkShell {
     pkgs.glew
     pkgs.gtk4
     pkgs.pkg-config
+    pkgs.glslang
 
     #c compiler
     pkgs.gcc
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+
+#define ALIGN_UP(v, a) (((v) + (a) - 1) & ~((VkDeviceSize)(a) - 1))
+
+static void accel_create(struct renderinfo *render,
+                         VkAccelerationStructureTypeKHR type, VkDeviceSize size,
+                         struct accel_struct *as) {
+    VkResult err;
+
+    // Storage comes from the sub-allocator, so compacted structures end up
+    // packed next to each other instead of in one allocation each
+    create_buffer(render, size,
+                  VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &as->buffer);
+
+    const VkAccelerationStructureCreateInfoKHR create_info = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .pNext = NULL,
+        .createFlags = 0,
+        .buffer = as->buffer.buf,
+        .offset = 0,
+        .size = size,
+        .type = type,
+        .deviceAddress = 0,
+    };
+    err = vkCreateAccelerationStructureKHR(render->device, &create_info, NULL,
+                                           &as->handle);
+    assert(!err);
+
+    const VkAccelerationStructureDeviceAddressInfoKHR address_info = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+        .pNext = NULL,
+        .accelerationStructure = as->handle,
+    };
+    as->address =
+        vkGetAccelerationStructureDeviceAddressKHR(render->device, &address_info);
+}
+
+static void accel_destroy(struct renderinfo *render, struct accel_struct *as) {
+    if (as->handle != VK_NULL_HANDLE)
+        vkDestroyAccelerationStructureKHR(render->device, as->handle, NULL);
+    destroy_buffer(render, &as->buffer);
+    memset(as, 0, sizeof(*as));
+}
+
+static void accel_build_barrier(VkCommandBuffer cmd) {
+    const VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+    };
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+void accel_build_blas(struct renderinfo *render, struct scene *scene) {
+    struct accelinfo *accel = &scene->accel;
+    const uint32_t count = scene->mesh_count;
+    const VkDeviceSize scratch_align =
+        render->accel_props.minAccelerationStructureScratchOffsetAlignment;
+    VkAccelerationStructureGeometryKHR *geometries;
+    VkAccelerationStructureBuildGeometryInfoKHR *build_infos;
+    VkAccelerationStructureBuildRangeInfoKHR *ranges;
+    const VkAccelerationStructureBuildRangeInfoKHR **range_ptrs;
+    VkAccelerationStructureBuildSizesInfoKHR *sizes;
+    VkAccelerationStructureKHR *handles;
+    struct accel_struct *uncompacted;
+    uint64_t *compacted_sizes;
+    VkDeviceSize max_scratch = 0, total_scratch = 0, scratch_size;
+    struct gpu_buffer scratch;
+    VkQueryPool query_pool;
+    VkResult err;
+    uint32_t i, first, batch;
+
+    if (count == 0)
+        return;
+
+    geometries = calloc(count, sizeof(*geometries));
+    build_infos = calloc(count, sizeof(*build_infos));
+    ranges = calloc(count, sizeof(*ranges));
+    range_ptrs = calloc(count, sizeof(*range_ptrs));
+    sizes = calloc(count, sizeof(*sizes));
+    handles = calloc(count, sizeof(*handles));
+    uncompacted = calloc(count, sizeof(*uncompacted));
+    compacted_sizes = calloc(count, sizeof(*compacted_sizes));
+    accel->blas = calloc(count, sizeof(struct accel_struct));
+    assert(geometries && build_infos && ranges && range_ptrs && sizes &&
+           handles && uncompacted && compacted_sizes && accel->blas);
+    accel->blas_count = count;
+
+    for (i = 0; i < count; i++) {
+        const struct scene_gpu_mesh *mesh = &scene->gpu_meshes[i];
+        const uint32_t prim_count = mesh->index_count / 3;
+        VkAccelerationStructureGeometryTrianglesDataKHR *triangles =
+            &geometries[i].geometry.triangles;
+
+        geometries[i].sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+        geometries[i].geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+        geometries[i].flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+        triangles->sType =
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+        triangles->maxVertex = mesh->vertex_count - 1;
+        triangles->indexData.deviceAddress =
+            scene->index_buf.address + mesh->first_index * sizeof(uint16_t);
+        triangles->indexType = (mesh->flags & SCENE_MESH_INDEX16)
+                                   ? VK_INDEX_TYPE_UINT16
+                                   : VK_INDEX_TYPE_UINT32;
+        if (scene->quantized) {
+            // Positions relative to the mesh bounds, scaled back by its
+            // transform while building
+            triangles->vertexFormat = VK_FORMAT_R16G16B16A16_SNORM;
+            triangles->vertexData.deviceAddress =
+                scene->vertex_buf.address +
+                mesh->first_vertex * sizeof(struct scene_qvertex);
+            triangles->vertexStride = sizeof(struct scene_qvertex);
+            triangles->transformData.deviceAddress =
+                scene->mesh_transform_buf.address +
+                i * sizeof(VkTransformMatrixKHR);
+        } else {
+            triangles->vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+            triangles->vertexData.deviceAddress =
+                scene->vertex_buf.address +
+                mesh->first_vertex * sizeof(struct scene_vertex);
+            triangles->vertexStride = sizeof(struct scene_vertex);
+        }
+
+        // Every static BLAS is built once and never refit, so trade build
+        // time for trace speed and let the driver compact it afterwards
+        build_infos[i].sType =
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        build_infos[i].type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        build_infos[i].flags =
+            VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+            VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+        build_infos[i].mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        build_infos[i].geometryCount = 1;
+        build_infos[i].pGeometries = &geometries[i];
+
+        ranges[i].primitiveCount = prim_count;
+        range_ptrs[i] = &ranges[i];
+
+        sizes[i].sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        vkGetAccelerationStructureBuildSizesKHR(
+            render->device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &build_infos[i], &prim_count, &sizes[i]);
+
+        sizes[i].buildScratchSize = ALIGN_UP(sizes[i].buildScratchSize, scratch_align);
+        if (sizes[i].buildScratchSize > max_scratch)
+            max_scratch = sizes[i].buildScratchSize;
+        total_scratch += sizes[i].buildScratchSize;
+    }
+
+    // Builds that are recorded into the same command run concurrently and
+    // must not overlap in scratch memory. The shared scratch buffer is sized
+    // to the largest single build, or to what the whole scene needs when that
+    // fits the budget, and batches are packed into it.
+    scratch_size = total_scratch < ACCEL_BATCH_BUDGET ? total_scratch
+                                                      : ACCEL_BATCH_BUDGET;
+    if (scratch_size < max_scratch)
+        scratch_size = max_scratch;
+
+    create_buffer(render, scratch_size + scratch_align,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &scratch);
+
+    const VkQueryPoolCreateInfo query_pool_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+        .queryCount = count,
+    };
+    err = vkCreateQueryPool(render->device, &query_pool_info, NULL, &query_pool);
+    assert(!err);
+
+    for (first = 0; first < count; first += batch) {
+        const VkDeviceAddress scratch_base =
+            ALIGN_UP(scratch.address, scratch_align);
+        VkDeviceSize scratch_offset = 0, resident = 0;
+        VkCommandBuffer cmd;
+
+        // Pack as many builds as fit into the scratch buffer and the
+        // residency budget for uncompacted structures, at least one
+        for (batch = 0; first + batch < count; batch++) {
+            const VkAccelerationStructureBuildSizesInfoKHR *s = &sizes[first + batch];
+            if (batch > 0 &&
+                (scratch_offset + s->buildScratchSize > scratch_size ||
+                 resident + s->accelerationStructureSize > ACCEL_BATCH_BUDGET))
+                break;
+
+            i = first + batch;
+            accel_create(render, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                         s->accelerationStructureSize, &uncompacted[i]);
+            handles[i] = uncompacted[i].handle;
+            build_infos[i].dstAccelerationStructure = uncompacted[i].handle;
+            build_infos[i].scratchData.deviceAddress = scratch_base + scratch_offset;
+
+            scratch_offset += s->buildScratchSize;
+            resident += s->accelerationStructureSize;
+        }
+
+        cmd = get_setup_cmd(render);
+        vkCmdResetQueryPool(cmd, query_pool, 0, batch);
+        vkCmdBuildAccelerationStructuresKHR(cmd, batch, &build_infos[first],
+                                            &range_ptrs[first]);
+        accel_build_barrier(cmd);
+        vkCmdWriteAccelerationStructuresPropertiesKHR(
+            cmd, batch, &handles[first],
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, query_pool, 0);
+        flush_init_cmd(render);
+
+        err = vkGetQueryPoolResults(render->device, query_pool, 0, batch,
+                                    batch * sizeof(uint64_t),
+                                    &compacted_sizes[first], sizeof(uint64_t),
+                                    VK_QUERY_RESULT_64_BIT |
+                                        VK_QUERY_RESULT_WAIT_BIT);
+        assert(!err);
+
+        // Copy into tightly sized storage, then drop the build-sized originals
+        // before the next batch allocates its own
+        cmd = get_setup_cmd(render);
+        for (i = first; i < first + batch; i++) {
+            accel_create(render, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                         compacted_sizes[i], &accel->blas[i]);
+
+            const VkCopyAccelerationStructureInfoKHR copy_info = {
+                .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+                .pNext = NULL,
+                .src = uncompacted[i].handle,
+                .dst = accel->blas[i].handle,
+                .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR,
+            };
+            vkCmdCopyAccelerationStructureKHR(cmd, &copy_info);
+        }
+        flush_init_cmd(render);
+
+        for (i = first; i < first + batch; i++) {
+            accel->uncompacted_bytes += sizes[i].accelerationStructureSize;
+            accel->compacted_bytes += compacted_sizes[i];
+            accel_destroy(render, &uncompacted[i]);
+        }
+    }
+
+    printf("Built %u BLAS: %llu KiB compacted from %llu KiB, %llu KiB scratch\n",
+           count, (unsigned long long)(accel->compacted_bytes >> 10),
+           (unsigned long long)(accel->uncompacted_bytes >> 10),
+           (unsigned long long)(scratch_size >> 10));
+    fflush(stdout);
+
+    vkDestroyQueryPool(render->device, query_pool, NULL);
+    destroy_buffer(render, &scratch);
+
+    free(geometries);
+    free(build_infos);
+    free(ranges);
+    free(range_ptrs);
+    free(sizes);
+    free(handles);
+    free(uncompacted);
+    free(compacted_sizes);
+}
+
+void accel_build_tlas(struct renderinfo *render, struct scene *scene) {
+    struct accelinfo *accel = &scene->accel;
+    const uint32_t count = scene->instance_count;
+    VkAccelerationStructureInstanceKHR *instances;
+    struct gpu_buffer scratch;
+    uint32_t i;
+
+    create_buffer(render,
+                  (count ? count : 1) * sizeof(VkAccelerationStructureInstanceKHR),
+                  VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &accel->instances);
+
+    instances = accel->instances.alloc.mapped;
+    for (i = 0; i < count; i++) {
+        const struct scene_instance *inst = &scene->instances[i];
+
+        memcpy(&instances[i].transform, inst->transform,
+               sizeof(instances[i].transform));
+        instances[i].instanceCustomIndex = inst->mesh;
+        instances[i].mask = 0xff;
+        instances[i].instanceShaderBindingTableRecordOffset = 0;
+        instances[i].flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+        instances[i].accelerationStructureReference =
+            accel->blas[inst->mesh].address;
+    }
+
+    const VkAccelerationStructureGeometryKHR geometry = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .pNext = NULL,
+        .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+        .geometry.instances = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+            .pNext = NULL,
+            .arrayOfPointers = VK_FALSE,
+            .data.deviceAddress = accel->instances.address,
+        },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+    };
+    VkAccelerationStructureBuildGeometryInfoKHR build_info = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .pNext = NULL,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        .geometryCount = 1,
+        .pGeometries = &geometry,
+    };
+    VkAccelerationStructureBuildSizesInfoKHR size_info = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+        .pNext = NULL,
+    };
+    vkGetAccelerationStructureBuildSizesKHR(
+        render->device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        &build_info, &count, &size_info);
+
+    accel_create(render, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+                 size_info.accelerationStructureSize, &accel->tlas);
+
+    const VkDeviceSize scratch_align =
+        render->accel_props.minAccelerationStructureScratchOffsetAlignment;
+    create_buffer(render, size_info.buildScratchSize + scratch_align,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &scratch);
+
+    build_info.dstAccelerationStructure = accel->tlas.handle;
+    build_info.scratchData.deviceAddress = ALIGN_UP(scratch.address, scratch_align);
+
+    const VkAccelerationStructureBuildRangeInfoKHR range = {
+        .primitiveCount = count,
+        .primitiveOffset = 0,
+        .firstVertex = 0,
+        .transformOffset = 0,
+    };
+    const VkAccelerationStructureBuildRangeInfoKHR *range_ptr = &range;
+
+    vkCmdBuildAccelerationStructuresKHR(get_setup_cmd(render), 1, &build_info,
+                                        &range_ptr);
+    flush_init_cmd(render);
+
+    destroy_buffer(render, &scratch);
+}
+
+void accel_cleanup(struct renderinfo *render, struct scene *scene) {
+    struct accelinfo *accel = &scene->accel;
+    uint32_t i;
+
+    accel_destroy(render, &accel->tlas);
+    destroy_buffer(render, &accel->instances);
+
+    for (i = 0; i < accel->blas_count; i++)
+        accel_destroy(render, &accel->blas[i]);
+    free(accel->blas);
+
+    memset(accel, 0, sizeof(*accel));
+}
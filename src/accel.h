@@ -0,0 +1,34 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+// Bottom level structures are built in batches that share one scratch
+// buffer. Batches are bounded by ACCEL_BATCH_BUDGET so the uncompacted
+// structures of a whole scene never need to be resident at the same time.
+#define ACCEL_BATCH_BUDGET (256ull * 1024 * 1024)
+
+struct scene;
+
+struct accel_struct {
+    VkAccelerationStructureKHR handle;
+    VkDeviceAddress address;
+    struct gpu_buffer buffer;
+};
+
+struct accelinfo {
+    struct accel_struct *blas;
+    uint32_t blas_count;
+
+    struct accel_struct tlas;
+    struct gpu_buffer instances;
+
+    VkDeviceSize uncompacted_bytes;
+    VkDeviceSize compacted_bytes;
+};
+
+void accel_build_blas(struct renderinfo *render, struct scene *scene);
+
+void accel_build_tlas(struct renderinfo *render, struct scene *scene);
+
+void accel_cleanup(struct renderinfo *render, struct scene *scene);
+
+#endif
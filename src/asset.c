@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "scenefile.h"
+#include "filemap.h"
+#include "hash.h"
+#include "objload.h"
+#include "gltf.h"
+#include "asset.h"
+
+// Bump whenever processing produces different output for the same source
+#define ASSET_PROCESS_VERSION 2
+
+static const char *asset_extension(const char *path) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    return dot && (!slash || dot > slash) ? dot + 1 : "";
+}
+
+static bool asset_is_obj(const char *path) {
+    const char *ext = asset_extension(path);
+    return strcmp(ext, "obj") == 0 || strcmp(ext, "OBJ") == 0;
+}
+
+static bool asset_is_gltf(const char *path) {
+    const char *ext = asset_extension(path);
+    return strcmp(ext, "gltf") == 0 || strcmp(ext, "glb") == 0;
+}
+
+bool asset_is_source(const char *path) {
+    return asset_is_obj(path) || asset_is_gltf(path);
+}
+
+bool asset_source_open(struct asset_source *source, const char *path) {
+    uint64_t params;
+
+    memset(source, 0, sizeof(*source));
+    source->path = path;
+    source->gltf = asset_is_gltf(path);
+    if (!asset_is_source(path)) {
+        fprintf(stderr, "%s: unsupported source format\n", path);
+        return false;
+    }
+
+    source->data = file_map(path, &source->size);
+    if (!source->data) {
+        fprintf(stderr, "Could not map scene file %s\n", path);
+        return false;
+    }
+    if (source->gltf &&
+        !gltf_open(&source->gltf_file, source->data, source->size, path)) {
+        file_unmap(source->data, source->size);
+        return false;
+    }
+
+    // Anything that changes the processed bytes for the same source goes in
+    params = hash64_combine(ASSET_PROCESS_VERSION, SCENE_FILE_VERSION);
+    params = hash64_combine(params, BVH_MAX_LEAF_TRIS);
+    params = hash64_combine(params, BVH_BIN_COUNT);
+    params = hash64_combine(params, BVH_TASK_TRIS);
+    params = hash64_combine(params, BVH_MAX_DEPTH);
+    source->hash = hash64(source->data, source->size, params);
+    if (source->gltf) {
+        source->hash = gltf_hash_buffers(&source->gltf_file, source->hash);
+        source->hash = gltf_hash_images(&source->gltf_file, source->hash);
+    }
+    return true;
+}
+
+bool asset_source_import(struct asset_source *source, struct scene *scene,
+                         struct taskinfo *tasks) {
+    if (source->gltf)
+        return gltf_import(scene, &source->gltf_file, tasks);
+    return obj_import(scene, source->data, source->size, source->path, tasks);
+}
+
+void asset_source_close(struct asset_source *source) {
+    if (source->gltf)
+        gltf_close(&source->gltf_file);
+    if (source->data)
+        file_unmap(source->data, source->size);
+    memset(source, 0, sizeof(*source));
+}
+
+void asset_free_scene(struct scene *scene) {
+    free(scene->vertices);
+    free(scene->indices);
+    free(scene->meshes);
+    free(scene->instances);
+    free(scene->materials);
+    free(scene->textures);
+    bvh_free(&scene->bvh);
+    memset(scene, 0, sizeof(*scene));
+}
+
+void asset_cache_init(struct asset_cache *cache, const char *dir,
+                      uint32_t limit_mb) {
+#ifndef _WIN32
+    const char *base = getenv("XDG_CACHE_HOME");
+    struct stat st;
+    char *p;
+    int n;
+
+    memset(cache, 0, sizeof(*cache));
+    if (limit_mb == 0)
+        limit_mb = ASSET_CACHE_DEFAULT_MB;
+    if (dir)
+        n = snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+    else if (base && *base)
+        n = snprintf(cache->dir, sizeof(cache->dir), "%s/vkrender", base);
+    else if ((base = getenv("HOME")) && *base)
+        n = snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/vkrender",
+                     base);
+    else
+        return;
+    if (n <= 0 || n >= (int)sizeof(cache->dir) - 64)
+        return;
+
+    // Create the parents of the default location as well
+    for (p = cache->dir + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(cache->dir, 0755);
+            *p = '/';
+        }
+    }
+    if (mkdir(cache->dir, 0755) != 0 &&
+        (stat(cache->dir, &st) != 0 || !S_ISDIR(st.st_mode))) {
+        fprintf(stderr, "Asset cache %s is not usable, caching is off\n",
+                cache->dir);
+        return;
+    }
+    cache->limit = (uint64_t)limit_mb << 20;
+    cache->enabled = true;
+#else
+    memset(cache, 0, sizeof(*cache));
+    (void)dir;
+    (void)limit_mb;
+#endif
+}
+
+bool asset_cache_lookup(struct asset_cache *cache, uint64_t hash,
+                        const char *ext, char *path) {
+    const int n = snprintf(path, ASSET_PATH_MAX, "%s/%016" PRIx64 ".%s",
+                           cache->dir, hash, ext);
+#ifndef _WIN32
+    // The modification time is the LRU clock, access times are often off
+    return cache->enabled && n < ASSET_PATH_MAX &&
+           utimensat(AT_FDCWD, path, NULL, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+#ifndef _WIN32
+struct asset_cache_entry {
+    char name[64];
+    uint64_t size;
+    struct timespec used;
+};
+
+static int asset_compare_used(const void *a, const void *b) {
+    const struct timespec *x = &((const struct asset_cache_entry *)a)->used;
+    const struct timespec *y = &((const struct asset_cache_entry *)b)->used;
+
+    if (x->tv_sec != y->tv_sec)
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    if (x->tv_nsec != y->tv_nsec)
+        return x->tv_nsec < y->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// Deletes the least recently used entries until the cache fits, other
+// processes that still map a deleted entry keep their pages
+static void asset_cache_evict(struct asset_cache *cache, const char *keep) {
+    struct asset_cache_entry *entries = NULL;
+    uint32_t count = 0, cap = 0, i;
+    uint64_t total = 0;
+    struct dirent *d;
+    DIR *dir;
+
+    dir = opendir(cache->dir);
+    if (!dir)
+        return;
+    while ((d = readdir(dir))) {
+        char path[ASSET_PATH_MAX];
+        struct stat st;
+
+        // Entries are <16 hex digits>.<ext>, in-flight files end in .tmp
+        if (strlen(d->d_name) >= sizeof(entries->name) ||
+            strlen(d->d_name) < 18 || d->d_name[16] != '.' ||
+            strstr(d->d_name, ".tmp"))
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", cache->dir, d->d_name) >=
+                (int)sizeof(path) ||
+            stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (count == cap) {
+            struct asset_cache_entry *grown;
+
+            cap = cap ? cap * 2 : 64;
+            grown = realloc(entries, cap * sizeof(*entries));
+            if (!grown)
+                break;
+            entries = grown;
+        }
+        strcpy(entries[count].name, d->d_name);
+        entries[count].size = st.st_size;
+        entries[count].used = st.st_mtim;
+        total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    if (total > cache->limit) {
+        qsort(entries, count, sizeof(*entries), asset_compare_used);
+        for (i = 0; i < count && total > cache->limit; i++) {
+            char path[ASSET_PATH_MAX];
+
+            if (strcmp(entries[i].name, keep) == 0 ||
+                snprintf(path, sizeof(path), "%s/%s", cache->dir,
+                         entries[i].name) >= (int)sizeof(path))
+                continue;
+            if (unlink(path) == 0)
+                total -= entries[i].size;
+        }
+    }
+    free(entries);
+}
+#endif
+
+bool asset_cache_insert(struct asset_cache *cache, uint64_t hash,
+                        const char *ext, const char *temp) {
+#ifndef _WIN32
+    char path[ASSET_PATH_MAX];
+    const char *name;
+
+    if (!cache->enabled)
+        return false;
+    asset_cache_lookup(cache, hash, ext, path);
+    if (rename(temp, path) != 0) {
+        remove(temp);
+        return false;
+    }
+    name = strrchr(path, '/') + 1;
+    asset_cache_evict(cache, name);
+    return true;
+#else
+    (void)cache;
+    (void)hash;
+    (void)ext;
+    remove(temp);
+    return false;
+#endif
+}
+
+// Writes the processed scene into the cache, failures only cost the
+// next launch its shortcut
+static void asset_cache_store(struct asset_cache *cache,
+                              const struct scene *scene, uint64_t hash) {
+    char temp[ASSET_PATH_MAX + 32];
+
+    // Unique per process so concurrent launches do not share a temp file
+    if (snprintf(temp, sizeof(temp), "%s/%016" PRIx64 ".%ld.tmp",
+                 cache->dir, hash, (long)getpid()) >= (int)sizeof(temp))
+        return;
+    if (!scene_save_file(scene, hash, temp) ||
+        !asset_cache_insert(cache, hash, "vksc", temp)) {
+        remove(temp);
+        fprintf(stderr, "Could not write to the asset cache %s\n",
+                cache->dir);
+    }
+}
+
+// Texture paths are relative to the file the scene was asked for, not to
+// its cache entry
+static bool asset_loaded(struct scene *scene, const char *path) {
+    scene->source_path = malloc(strlen(path) + 1);
+    assert(scene->source_path);
+    strcpy(scene->source_path, path);
+    return true;
+}
+
+bool asset_load_scene(struct asset_cache *cache, struct scene *scene,
+                      const char *path, struct taskinfo *tasks) {
+    struct asset_source source;
+    char entry[ASSET_PATH_MAX];
+    uint64_t hash;
+    bool ok;
+
+    if (!asset_is_source(path))
+        return scene_load_file(scene, path) && asset_loaded(scene, path);
+    if (!asset_source_open(&source, path))
+        return false;
+
+    if (asset_cache_lookup(cache, source.hash, "vksc", entry)) {
+        if (scene_file_hash(entry, &hash) && hash == source.hash &&
+            scene_load_file(scene, entry)) {
+            asset_source_close(&source);
+            printf("%s: from asset cache\n", path);
+            fflush(stdout);
+            return asset_loaded(scene, path);
+        }
+        // Truncated or foreign, rebuild it
+        remove(entry);
+    }
+
+    ok = asset_source_import(&source, scene, tasks);
+    hash = source.hash;
+    asset_source_close(&source);
+    if (!ok)
+        return false;
+    printf("Imported %s: %u vertices, %u meshes, %u instances\n", path,
+           scene->vertex_count, scene->mesh_count, scene->instance_count);
+
+    // The BVH goes into the entry whether or not this run needs it
+    if (cache->enabled) {
+        bvh_build(&scene->bvh, scene, tasks);
+        asset_cache_store(cache, scene, hash);
+    }
+    fflush(stdout);
+    return asset_loaded(scene, path);
+}
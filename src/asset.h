@@ -0,0 +1,63 @@
+#ifndef ASSET_H
+#define ASSET_H
+
+// Source scenes (.obj, .gltf, .glb) and the content-addressed cache of
+// what is derived from them. A source's hash covers its bytes, any files
+// it pulls in, and the processing parameters, so it names the result.
+
+#define ASSET_PATH_MAX 4096
+#define ASSET_CACHE_DEFAULT_MB 4096
+
+struct taskinfo;
+
+struct asset_source {
+    const char *path;
+    void *data;
+    size_t size;
+    bool gltf;
+    struct gltf_file gltf_file;
+    uint64_t hash;
+};
+
+bool asset_is_source(const char *path);
+
+// Maps the source and hashes it, errors are reported
+bool asset_source_open(struct asset_source *source, const char *path);
+
+// Imports into heap arrays, without a BVH. NULL tasks imports on the
+// calling thread.
+bool asset_source_import(struct asset_source *source, struct scene *scene,
+                         struct taskinfo *tasks);
+
+void asset_source_close(struct asset_source *source);
+
+// Frees a scene that was imported rather than loaded from a scene file
+void asset_free_scene(struct scene *scene);
+
+// Entries are named by hash and extension. Using an entry refreshes its
+// modification time, and inserting one evicts the least recently used
+// entries until the directory fits in limit bytes.
+struct asset_cache {
+    bool enabled;
+    char dir[ASSET_PATH_MAX];
+    uint64_t limit;
+};
+
+// dir NULL uses $XDG_CACHE_HOME/vkrender or ~/.cache/vkrender, limit_mb 0
+// uses ASSET_CACHE_DEFAULT_MB. A zeroed asset_cache is a disabled one.
+void asset_cache_init(struct asset_cache *cache, const char *dir,
+                      uint32_t limit_mb);
+
+// Fills in the entry's path, true when it exists
+bool asset_cache_lookup(struct asset_cache *cache, uint64_t hash,
+                        const char *ext, char *path);
+
+// Moves the finished file temp into the cache as the entry for hash
+bool asset_cache_insert(struct asset_cache *cache, uint64_t hash,
+                        const char *ext, const char *temp);
+
+// Loads a scene file directly and a source through the cache
+bool asset_load_scene(struct asset_cache *cache, struct scene *scene,
+                      const char *path, struct taskinfo *tasks);
+
+#endif
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "asyncio.h"
+
+#define ASYNC_POOL_THREADS 4
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define ASYNC_HAVE_RING
+
+// Raw system calls, liburing would be one more dependency for three calls
+struct async_ring {
+    int fd;
+    bool fixed; // buffers are registered, reads use IORING_OP_READ_FIXED
+    uint32_t to_submit;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // READV needs its iovec to stay put until the request is consumed
+    struct iovec iovecs[ASYNC_READ_MAX_BUFFERS];
+};
+
+static int async_ring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                            uint32_t flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+}
+
+static void async_ring_free(struct async_ring *ring) {
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map)
+        munmap(ring->sq_map, ring->sq_map_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    free(ring);
+}
+
+static struct async_ring *async_ring_create(struct async_reader *reader) {
+    struct io_uring_params params;
+    struct async_ring *ring;
+    uint8_t *sq, *cq;
+    uint32_t i;
+
+    ring = calloc(1, sizeof(*ring));
+    assert(ring);
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, ASYNC_READ_MAX_BUFFERS, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_map_size = params.sq_off.array +
+                        params.sq_entries * sizeof(uint32_t);
+    ring->cq_map_size = params.cq_off.cqes +
+                        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size)
+            ring->sq_map_size = ring->cq_map_size;
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        goto fail;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    sq = ring->sq_map;
+    cq = ring->cq_map;
+    ring->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+    ring->cq_head = (uint32_t *)(cq + params.cq_off.head);
+    ring->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Registration pins the buffers once. It fails over RLIMIT_MEMLOCK or
+    // for memory the kernel cannot pin, plain vectored reads work anyway.
+    for (i = 0; i < reader->buffer_count; i++) {
+        ring->iovecs[i].iov_base = reader->buffers[i];
+        ring->iovecs[i].iov_len = reader->buffer_size;
+    }
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd,
+                          IORING_REGISTER_BUFFERS, ring->iovecs,
+                          reader->buffer_count) == 0;
+    return ring;
+
+fail:
+    async_ring_free(ring);
+    return NULL;
+}
+
+static void async_ring_queue(struct async_reader *reader, uint32_t buffer) {
+    struct async_ring *ring = reader->ring;
+    const struct async_request *r = &reader->requests[buffer];
+    const uint32_t tail = *ring->sq_tail;
+    const uint32_t index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    uint8_t *dst = (uint8_t *)reader->buffers[buffer] + r->done;
+
+    // One entry per buffer at most, the queue cannot overflow
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = r->fd;
+    sqe->off = r->offset + r->done;
+    sqe->user_data = buffer;
+    if (ring->fixed) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t)(uintptr_t)dst;
+        sqe->len = r->size - r->done;
+        sqe->buf_index = buffer;
+    } else {
+        ring->iovecs[buffer].iov_base = dst;
+        ring->iovecs[buffer].iov_len = r->size - r->done;
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (uint64_t)(uintptr_t)&ring->iovecs[buffer];
+        sqe->len = 1;
+    }
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+static uint32_t async_ring_wait(struct async_reader *reader) {
+    struct async_ring *ring = reader->ring;
+
+    for (;;) {
+        const uint32_t head = *ring->cq_head;
+
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+            const uint32_t buffer = cqe->user_data;
+            struct async_request *r = &reader->requests[buffer];
+            const int res = cqe->res;
+
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            if (res == -EINTR || res == -EAGAIN) {
+                async_ring_queue(reader, buffer);
+                continue;
+            }
+            if (res <= 0) {
+                r->failed = true;
+                return buffer;
+            }
+            // Short reads happen, pick up where this one stopped
+            r->done += res;
+            if (r->done < r->size) {
+                async_ring_queue(reader, buffer);
+                continue;
+            }
+            return buffer;
+        }
+
+        const int submitted = async_ring_enter(ring->fd, ring->to_submit, 1,
+                                               IORING_ENTER_GETEVENTS);
+        if (submitted < 0) {
+            assert(errno == EINTR || errno == EAGAIN || errno == EBUSY);
+            continue;
+        }
+        ring->to_submit -= submitted;
+    }
+}
+#endif
+
+#ifndef _WIN32
+struct async_pool {
+    struct async_reader *reader;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    bool quit;
+
+    // Both queues hold buffer indices, each buffer is in one at most
+    uint32_t pending[ASYNC_READ_MAX_BUFFERS];
+    uint32_t pending_head, pending_count;
+    uint32_t complete[ASYNC_READ_MAX_BUFFERS];
+    uint32_t complete_head, complete_count;
+
+    pthread_t threads[ASYNC_POOL_THREADS];
+    uint32_t thread_count;
+};
+
+static void *async_pool_worker(void *arg) {
+    struct async_pool *pool = arg;
+
+    for (;;) {
+        struct async_request *r;
+        uint32_t buffer;
+
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->quit && pool->pending_count == 0)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->pending_count == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        buffer = pool->pending[pool->pending_head];
+        pool->pending_head = (pool->pending_head + 1) % ASYNC_READ_MAX_BUFFERS;
+        pool->pending_count--;
+        pthread_mutex_unlock(&pool->lock);
+
+        // The request belongs to this thread until it is marked complete
+        r = &pool->reader->requests[buffer];
+        while (r->done < r->size) {
+            const ssize_t n = pread(r->fd,
+                                    (uint8_t *)pool->reader->buffers[buffer] +
+                                        r->done,
+                                    r->size - r->done, r->offset + r->done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                r->failed = true;
+                break;
+            }
+            r->done += n;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->complete[(pool->complete_head + pool->complete_count) %
+                       ASYNC_READ_MAX_BUFFERS] = buffer;
+        pool->complete_count++;
+        pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static struct async_pool *async_pool_create(struct async_reader *reader) {
+    struct async_pool *pool = calloc(1, sizeof(*pool));
+    uint32_t i;
+
+    assert(pool);
+    pool->reader = reader;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 0; i < ASYNC_POOL_THREADS && i < reader->buffer_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, async_pool_worker, pool) !=
+            0)
+            break;
+    }
+    pool->thread_count = i;
+    if (pool->thread_count == 0) {
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->wake);
+        pthread_cond_destroy(&pool->done);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+static void async_pool_destroy(struct async_pool *pool) {
+    uint32_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool);
+}
+#endif
+
+bool async_reader_init(struct async_reader *reader, void *const *buffers,
+                       uint32_t buffer_count, uint32_t buffer_size,
+                       bool allow_ring) {
+    memset(reader, 0, sizeof(*reader));
+    assert(buffer_count > 0 && buffer_count <= ASYNC_READ_MAX_BUFFERS);
+    memcpy(reader->buffers, buffers, buffer_count * sizeof(void *));
+    reader->buffer_count = buffer_count;
+    reader->buffer_size = buffer_size;
+
+#ifdef ASYNC_HAVE_RING
+    if (allow_ring && (reader->ring = async_ring_create(reader)))
+        return true;
+#else
+    (void)allow_ring;
+#endif
+#ifndef _WIN32
+    reader->pool = async_pool_create(reader);
+#endif
+    return reader->pool != NULL;
+}
+
+const char *async_reader_backend(const struct async_reader *reader) {
+#ifdef ASYNC_HAVE_RING
+    if (reader->ring)
+        return reader->ring->fixed ? "io_uring, registered buffers"
+                                   : "io_uring";
+#endif
+    return "reader threads";
+}
+
+void async_reader_submit(struct async_reader *reader, uint32_t buffer, int fd,
+                         uint64_t offset, uint32_t size, uint64_t user) {
+    struct async_request *r = &reader->requests[buffer];
+
+    assert(buffer < reader->buffer_count && size <= reader->buffer_size);
+    r->fd = fd;
+    r->offset = offset;
+    r->size = size;
+    r->done = 0;
+    r->user = user;
+    r->failed = false;
+    reader->in_flight++;
+
+#ifdef ASYNC_HAVE_RING
+    if (reader->ring) {
+        async_ring_queue(reader, buffer);
+        return;
+    }
+#endif
+#ifndef _WIN32
+    struct async_pool *pool = reader->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending[(pool->pending_head + pool->pending_count) %
+                  ASYNC_READ_MAX_BUFFERS] = buffer;
+    pool->pending_count++;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+bool async_reader_wait(struct async_reader *reader, struct async_read *done) {
+    uint32_t buffer = 0;
+
+    if (reader->in_flight == 0)
+        return false;
+
+#ifdef ASYNC_HAVE_RING
+    if (reader->ring) {
+        buffer = async_ring_wait(reader);
+    } else
+#endif
+    {
+#ifndef _WIN32
+        struct async_pool *pool = reader->pool;
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->complete_count == 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        buffer = pool->complete[pool->complete_head];
+        pool->complete_head = (pool->complete_head + 1) % ASYNC_READ_MAX_BUFFERS;
+        pool->complete_count--;
+        pthread_mutex_unlock(&pool->lock);
+#endif
+    }
+
+    reader->in_flight--;
+    done->buffer = buffer;
+    done->user = reader->requests[buffer].user;
+    done->size = reader->requests[buffer].done;
+    done->ok = !reader->requests[buffer].failed;
+    return true;
+}
+
+void async_reader_cleanup(struct async_reader *reader) {
+    struct async_read done;
+
+    while (async_reader_wait(reader, &done))
+        ;
+#ifdef ASYNC_HAVE_RING
+    if (reader->ring)
+        async_ring_free(reader->ring);
+#endif
+#ifndef _WIN32
+    if (reader->pool)
+        async_pool_destroy(reader->pool);
+#endif
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,63 @@
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+// Asynchronous file reads into a fixed set of caller owned buffers. On
+// Linux the reads go through io_uring with the buffers registered, so the
+// kernel does not pin them again for every request; where no ring can be
+// set up a few reader threads issue plain preads instead. Each buffer has
+// at most one read in flight and reads complete in any order.
+
+#define ASYNC_READ_MAX_BUFFERS 32
+
+struct async_ring;
+struct async_pool;
+
+struct async_request {
+    int fd;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t done;
+    uint64_t user;
+    bool failed;
+};
+
+struct async_reader {
+    void *buffers[ASYNC_READ_MAX_BUFFERS];
+    uint32_t buffer_count;
+    uint32_t buffer_size;
+    struct async_request requests[ASYNC_READ_MAX_BUFFERS];
+    uint32_t in_flight;
+
+    struct async_ring *ring; // NULL when the thread pool is used
+    struct async_pool *pool;
+};
+
+struct async_read {
+    uint32_t buffer;
+    uint64_t user;
+    uint32_t size;
+    bool ok;
+};
+
+// allow_ring false goes straight to the reader threads. The reader must
+// not move while it is in use, the threads point back into it.
+bool async_reader_init(struct async_reader *reader, void *const *buffers,
+                       uint32_t buffer_count, uint32_t buffer_size,
+                       bool allow_ring);
+
+// Which backend init settled on, for log messages
+const char *async_reader_backend(const struct async_reader *reader);
+
+// Starts reading size bytes at offset of fd into buffer, which must not
+// have a read in flight. user comes back with the completion.
+void async_reader_submit(struct async_reader *reader, uint32_t buffer, int fd,
+                         uint64_t offset, uint32_t size, uint64_t user);
+
+// Blocks until a read is complete, false when none is in flight. A read
+// that hits the end of the file or an error completes with ok false.
+bool async_reader_wait(struct async_reader *reader, struct async_read *done);
+
+// Waits for reads still in flight
+void async_reader_cleanup(struct async_reader *reader);
+
+#endif
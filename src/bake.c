@@ -0,0 +1,382 @@
+// vkrender-bake: converts source scenes into the binary scene format with
+// everything the renderer would otherwise compute at startup done ahead of
+// time. Every input is a task on the work-stealing scheduler, and so are
+// the pieces of its import and BVH build, so one large input spreads over
+// the CPUs as well as many small ones. An output whose stored content hash
+// matches its input, the texture files it refers to and the texture
+// encoding is left alone. PPM textures of a scene are block compressed
+// into a KTX2 file next to them, with their whole mip chain.
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "task.h"
+#include "scenefile.h"
+#include "hash.h"
+#include "gltf.h"
+#include "asset.h"
+#include "bcn.h"
+#include "texfile.h"
+
+#define APP_SHORT_NAME "vkrender-bake"
+
+struct bake_job {
+    const char *input;
+    char *output;
+    bool ok;
+};
+
+struct bakeinfo {
+    struct bake_job *jobs;
+    uint32_t job_count;
+    bool force;
+    bool compress;        // false: textures are left as they are
+    enum bcn_format bcn;  // of the textures that are compressed
+    struct taskinfo tasks;
+};
+
+static const char *bake_extension(const char *path) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    return dot && (!slash || dot > slash) ? dot + 1 : "";
+}
+
+static char *bake_output_path(const char *input) {
+    const char *ext = bake_extension(input);
+    const size_t stem = *ext ? (size_t)(ext - 1 - input) : strlen(input);
+    char *output = malloc(stem + sizeof(".vksc"));
+
+    assert(output);
+    memcpy(output, input, stem);
+    memcpy(output + stem, ".vksc", sizeof(".vksc"));
+    return output;
+}
+
+static float bake_srgb_to_linear(uint8_t v) {
+    const float c = v / 255.0f;
+
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t bake_linear_to_srgb(float c) {
+    c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+    return c <= 0.0f ? 0 : c >= 1.0f ? 255 : (uint8_t)(c * 255.0f + 0.5f);
+}
+
+// Box filters src into the next level, averaging colour in linear space.
+// Odd sizes repeat their last row and column.
+static void bake_downsample(const uint8_t *src, uint32_t width,
+                            uint32_t height, bool srgb, uint8_t *dst) {
+    const uint32_t next_width = width > 1 ? width / 2 : 1;
+    const uint32_t next_height = height > 1 ? height / 2 : 1;
+    uint32_t x, y, c, i;
+
+    for (y = 0; y < next_height; y++) {
+        for (x = 0; x < next_width; x++) {
+            const uint32_t x0 = 2 * x < width ? 2 * x : width - 1;
+            const uint32_t y0 = 2 * y < height ? 2 * y : height - 1;
+            const uint32_t x1 = x0 + 1 < width ? x0 + 1 : x0;
+            const uint32_t y1 = y0 + 1 < height ? y0 + 1 : y0;
+            const uint8_t *p[4] = {
+                src + ((size_t)y0 * width + x0) * 4,
+                src + ((size_t)y0 * width + x1) * 4,
+                src + ((size_t)y1 * width + x0) * 4,
+                src + ((size_t)y1 * width + x1) * 4,
+            };
+            uint8_t *out = dst + ((size_t)y * next_width + x) * 4;
+
+            for (c = 0; c < 4; c++) {
+                float sum = 0.0f;
+
+                for (i = 0; i < 4; i++)
+                    sum += srgb && c < 3 ? bake_srgb_to_linear(p[i][c])
+                                         : p[i][c] / 255.0f;
+                out[c] = srgb && c < 3
+                             ? bake_linear_to_srgb(sum / 4.0f)
+                             : (uint8_t)(sum / 4.0f * 255.0f + 0.5f);
+            }
+        }
+    }
+}
+
+// Writes path with its .ppm replaced by .ktx2 and points the texture at it.
+// Textures in any other format are left to the renderer.
+static bool bake_texture(struct bakeinfo *bake, struct bake_job *job,
+                         struct scene_texture *texture) {
+    static const VkFormat formats[] = {
+        [BCN_BC1] = VK_FORMAT_BC1_RGB_SRGB_BLOCK,
+        [BCN_BC3] = VK_FORMAT_BC3_SRGB_BLOCK,
+        [BCN_BC5] = VK_FORMAT_BC5_UNORM_BLOCK,
+        [BCN_BC7] = VK_FORMAT_BC7_SRGB_BLOCK,
+    };
+    const bool srgb = bake->bcn != BCN_BC5;
+    const char *ext = bake_extension(texture->path);
+    const char *slash = strrchr(job->input, '/');
+    const size_t dir_length = slash ? slash - job->input + 1 : 0;
+    const size_t prefix = texture->path[0] == '/' ? 0 : dir_length;
+    const size_t stem = strlen(texture->path) - strlen(ext);
+    uint8_t *pixels[TEXFILE_MAX_LEVELS] = {NULL};
+    uint8_t *blocks[TEXFILE_MAX_LEVELS] = {NULL};
+    uint32_t width, height, w, h, level_count = 1, i;
+    char *source, *output, *temp;
+    bool ok;
+
+    if (strcmp(ext, "ppm") != 0)
+        return true;
+    if (stem + sizeof("ktx2") > SCENE_TEXTURE_PATH_MAX) {
+        fprintf(stderr, "%s: texture path too long\n", texture->path);
+        return false;
+    }
+
+    source = malloc(prefix + strlen(texture->path) + 1);
+    output = malloc(prefix + stem + sizeof("ktx2"));
+    temp = malloc(prefix + stem + sizeof("ktx2") + 16);
+    assert(source && output && temp);
+    memcpy(source, job->input, prefix);
+    strcpy(source + prefix, texture->path);
+    memcpy(output, job->input, prefix);
+    memcpy(output + prefix, texture->path, stem);
+    strcpy(output + prefix + stem, "ktx2");
+    // Scenes sharing a texture may bake it at the same time
+    sprintf(temp, "%s.%u.tmp", output, (uint32_t)(job - bake->jobs));
+
+    ok = texfile_load_ppm(source, &width, &height, &pixels[0]);
+    if (ok) {
+        w = width;
+        h = height;
+        while ((w > 1 || h > 1) && level_count < TEXFILE_MAX_LEVELS) {
+            pixels[level_count] =
+                malloc((size_t)(w > 1 ? w / 2 : 1) * (h > 1 ? h / 2 : 1) * 4);
+            assert(pixels[level_count]);
+            bake_downsample(pixels[level_count - 1], w, h, srgb,
+                            pixels[level_count]);
+            w = w > 1 ? w / 2 : 1;
+            h = h > 1 ? h / 2 : 1;
+            level_count++;
+        }
+        for (i = 0; i < level_count; i++) {
+            w = width >> i ? width >> i : 1;
+            h = height >> i ? height >> i : 1;
+            blocks[i] = malloc(bcn_level_bytes(bake->bcn, w, h));
+            assert(blocks[i]);
+            bcn_encode(bake->bcn, pixels[i], w, h, blocks[i]);
+        }
+        ok = texfile_save_ktx2(temp, formats[bake->bcn], width, height,
+                               level_count, (const uint8_t *const *)blocks) &&
+             rename(temp, output) == 0;
+        if (!ok) {
+            fprintf(stderr, "%s: could not write\n", output);
+            remove(temp);
+        } else {
+            printf("%s: %ux%u, %u levels\n", output, width, height,
+                   level_count);
+            strcpy(texture->path + stem, "ktx2");
+        }
+    }
+
+    for (i = 0; i < level_count; i++) {
+        free(pixels[i]);
+        free(blocks[i]);
+    }
+    free(source);
+    free(output);
+    free(temp);
+    return ok;
+}
+
+static bool bake_one(struct bakeinfo *bake, struct bake_job *job) {
+    struct asset_source source;
+    struct scene scene;
+    uint64_t baked_hash, content_hash;
+    char *temp;
+    uint32_t i;
+    bool ok;
+
+    if (!asset_source_open(&source, job->input))
+        return false;
+
+    // The texture encoding changes the output for the same source, 0 is
+    // uncompressed
+    content_hash = hash64_combine(source.hash,
+                                  bake->compress ? bake->bcn + 1u : 0u);
+    if (!bake->force && scene_file_hash(job->output, &baked_hash) &&
+        baked_hash == content_hash) {
+        printf("%s: up to date\n", job->output);
+        fflush(stdout);
+        asset_source_close(&source);
+        return true;
+    }
+
+    ok = asset_source_import(&source, &scene, &bake->tasks);
+    asset_source_close(&source);
+    if (!ok)
+        return false;
+
+    bvh_build(&scene.bvh, &scene, &bake->tasks);
+    for (i = 0; i < scene.texture_count && ok && bake->compress; i++)
+        ok = bake_texture(bake, job, &scene.textures[i]);
+    if (!ok) {
+        asset_free_scene(&scene);
+        return false;
+    }
+
+    // Written next to the output and renamed so a reader never sees a
+    // partial file and an interrupted bake never looks up to date
+    temp = malloc(strlen(job->output) + sizeof(".tmp"));
+    assert(temp);
+    sprintf(temp, "%s.tmp", job->output);
+    ok = scene_save_file(&scene, content_hash, temp) &&
+         rename(temp, job->output) == 0;
+    if (!ok) {
+        fprintf(stderr, "%s: could not write\n", job->output);
+        remove(temp);
+    } else {
+        printf("%s: %u vertices, %u triangles, %u meshes, %u BVH nodes\n",
+               job->output, scene.vertex_count, scene.index_count / 3,
+               scene.mesh_count, scene.bvh.node_count);
+    }
+    fflush(stdout);
+
+    free(temp);
+    asset_free_scene(&scene);
+    return ok;
+}
+
+static void bake_task(void *arg, uint32_t index) {
+    struct bakeinfo *bake = arg;
+
+    bake->jobs[index].ok = bake_one(bake, &bake->jobs[index]);
+}
+
+int main(const int argc, const char *argv[]) {
+    struct bakeinfo bake;
+    long thread_count = 0;
+    bool affinity = false;
+    const char *output = NULL;
+    int failed = 0;
+    int i, j;
+
+    memset(&bake, 0, sizeof(bake));
+    bake.compress = true;
+    bake.bcn = BCN_BC7;
+    bake.jobs = calloc(argc, sizeof(struct bake_job));
+    assert(bake.jobs);
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            bake.force = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-j") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%ld", &thread_count) == 1 && thread_count > 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "-a") == 0) {
+            affinity = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-t") == 0 && i < argc - 1) {
+            static const char *const names[] = {
+                [BCN_BC1] = "bc1",
+                [BCN_BC3] = "bc3",
+                [BCN_BC5] = "bc5",
+                [BCN_BC7] = "bc7",
+            };
+
+            i++;
+            bake.compress = strcmp(argv[i], "none") != 0;
+            for (j = 0; j < 4 && bake.compress; j++) {
+                if (strcmp(argv[i], names[j]) == 0)
+                    break;
+            }
+            if (j == 4) {
+                bake.job_count = 0;
+                break;
+            }
+            bake.bcn = (enum bcn_format)j;
+            continue;
+        }
+        if (strcmp(argv[i], "-o") == 0 && i < argc - 1) {
+            output = argv[++i];
+            continue;
+        }
+        if (argv[i][0] == '-') {
+            bake.job_count = 0;
+            break;
+        }
+        bake.jobs[bake.job_count++].input = argv[i];
+    }
+
+    if (bake.job_count == 0 || (output && bake.job_count != 1)) {
+        fprintf(stderr, "Usage:\n  %s [-f] [-j <threads>] [-a] [-t <format>] "
+                        "<scene>...\n"
+                        "  %s [-f] [-j <threads>] [-a] [-t <format>] "
+                        "-o <out.vksc> <scene>\n"
+                        "Scenes are .obj, .gltf or .glb files.\n"
+                        "Each input is baked to a .vksc next to it.\n"
+                        "-a pins each worker thread to a CPU.\n"
+                        "-t compresses PPM textures to .ktx2 files in bc1, "
+                        "bc3, bc5 or bc7 (default), none leaves them.\n",
+                APP_SHORT_NAME, APP_SHORT_NAME);
+        fflush(stderr);
+        exit(1);
+    }
+
+    for (i = 0; i < (int)bake.job_count; i++) {
+        if (output) {
+            bake.jobs[i].output = malloc(strlen(output) + 1);
+            assert(bake.jobs[i].output);
+            strcpy(bake.jobs[i].output, output);
+        } else {
+            bake.jobs[i].output = bake_output_path(bake.jobs[i].input);
+        }
+    }
+    // model.obj and model.gltf would race for model.vksc
+    for (i = 0; i < (int)bake.job_count; i++) {
+        for (j = 0; j < i; j++) {
+            if (strcmp(bake.jobs[i].output, bake.jobs[j].output) == 0) {
+                fprintf(stderr, "%s and %s both bake to %s\n",
+                        bake.jobs[j].input, bake.jobs[i].input,
+                        bake.jobs[i].output);
+                exit(1);
+            }
+        }
+    }
+
+    task_init(&bake.tasks, (uint32_t)thread_count, affinity);
+    task_parallel_for(&bake.tasks, bake.job_count, bake_task, &bake);
+    task_cleanup(&bake.tasks);
+
+    for (i = 0; i < (int)bake.job_count; i++) {
+        if (!bake.jobs[i].ok)
+            failed++;
+        free(bake.jobs[i].output);
+    }
+    free(bake.jobs);
+
+    if (failed)
+        fprintf(stderr, "%d of %u scenes failed to bake\n", failed,
+                bake.job_count);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "tracer.h"
+#include "cmdpool.h"
+#include "image_writer.h"
+#include "tiler.h"
+#include "batch.h"
+
+bool batch_load_cameras(const char *path, struct camera **cameras,
+                        uint32_t *count) {
+    struct camera *list = NULL, *grown;
+    uint32_t capacity = 0, line_number = 0;
+    char line[512];
+    FILE *file;
+
+    *cameras = NULL;
+    *count = 0;
+    file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        struct camera camera;
+        char *p = line + strspn(line, " \t");
+
+        line_number++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+            continue;
+        memset(&camera, 0, sizeof(camera));
+        if (sscanf(p, "%f %f %f %f %f %f", &camera.pos[0], &camera.pos[1],
+                   &camera.pos[2], &camera.yaw, &camera.pitch,
+                   &camera.fov) != 6 ||
+            camera.fov <= 0.0f || camera.fov >= 180.0f) {
+            fprintf(stderr, "%s:%u: expected x y z yaw pitch fov\n", path,
+                    line_number);
+            free(list);
+            fclose(file);
+            return false;
+        }
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            grown = realloc(list, capacity * sizeof(*list));
+            if (!grown) {
+                free(list);
+                fclose(file);
+                return false;
+            }
+            list = grown;
+        }
+        list[(*count)++] = camera;
+    }
+    fclose(file);
+
+    if (*count == 0) {
+        fprintf(stderr, "%s lists no cameras\n", path);
+        free(list);
+        return false;
+    }
+    *cameras = list;
+    return true;
+}
+
+static void batch_prepare_slots(struct renderinfo *render,
+                                struct batchinfo *batch,
+                                struct tracerinfo *tracer) {
+    const VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+    };
+    const VkQueryPoolCreateInfo query_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2 * BATCH_SLOTS,
+    };
+    uint32_t i;
+    VkResult err;
+
+    for (i = 0; i < BATCH_SLOTS; i++) {
+        struct batch_slot *slot = &batch->slots[i];
+
+        cmd_frame_init(render, &slot->frame);
+        err = vkCreateFence(render->device, &fence_info, NULL, &slot->fence);
+        assert(!err);
+        create_buffer(render, (VkDeviceSize)tracer->width * tracer->height * 4,
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      &slot->readback);
+        slot->busy = false;
+    }
+
+    slice_budget_init(render, &batch->budget);
+    if (render->timestamps) {
+        err = vkCreateQueryPool(render->device, &query_info, NULL,
+                                &batch->timestamps);
+        assert(!err);
+    }
+}
+
+static void batch_cleanup_slots(struct renderinfo *render,
+                                struct batchinfo *batch) {
+    uint32_t i;
+
+    for (i = 0; i < BATCH_SLOTS; i++) {
+        struct batch_slot *slot = &batch->slots[i];
+
+        cmd_frame_cleanup(render, &slot->frame);
+        vkDestroyFence(render->device, slot->fence, NULL);
+        destroy_buffer(render, &slot->readback);
+    }
+    if (batch->timestamps)
+        vkDestroyQueryPool(render->device, batch->timestamps, NULL);
+}
+
+// Writes the cell of every camera in the slot's readback to its own file
+static bool batch_write_slot(struct batchinfo *batch,
+                             const struct batch_slot *slot,
+                             uint32_t atlas_width) {
+    const uint8_t *atlas = slot->readback.alloc.mapped;
+    const size_t stride = (size_t)atlas_width * 4;
+    char path[4096];
+    uint32_t i;
+
+    for (i = 0; i < slot->count; i++) {
+        const uint8_t *pixels =
+            atlas + (size_t)(i / batch->columns) * batch->cell_height * stride +
+            (size_t)(i % batch->columns) * batch->cell_width * 4;
+        bool ok;
+
+        if (batch->sequence)
+            snprintf(path, sizeof(path), batch->pattern, slot->first + i);
+        else
+            snprintf(path, sizeof(path), "%s", batch->pattern);
+        if (batch->format == IMAGE_FORMAT_PNG)
+            ok = image_write_png(path, batch->width, batch->height, pixels,
+                                 stride);
+        else
+            ok = image_write_ppm(path, batch->width, batch->height, pixels,
+                                 stride);
+        if (!ok) {
+            fprintf(stderr, "Could not write %s\n", path);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Waits for the slot's submit, feeds its GPU time into the slice budget and
+// writes out a finished batch
+static bool batch_retire_slot(struct renderinfo *render,
+                              struct batchinfo *batch,
+                              struct tracerinfo *tracer,
+                              struct batch_slot *slot) {
+    const uint32_t query = 2 * (uint32_t)(slot - batch->slots);
+    uint64_t ticks[2];
+    VkResult err;
+
+    if (!slot->busy)
+        return true;
+    slot->busy = false;
+
+    err = vkWaitForFences(render->device, 1, &slot->fence, VK_TRUE, UINT64_MAX);
+    assert(!err);
+    err = vkResetFences(render->device, 1, &slot->fence);
+    assert(!err);
+
+    if (batch->timestamps &&
+        vkGetQueryPoolResults(render->device, batch->timestamps, query, 2,
+                              sizeof(ticks), ticks, sizeof(ticks[0]),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+        slice_budget_update(&batch->budget, slot->tiles,
+                            timestamp_delta_ms(render, ticks));
+
+    if (!slot->has_batch)
+        return true;
+    return batch_write_slot(batch, slot, tracer->width);
+}
+
+// Records the next slices of the current batch, as many as fit in the slice
+// budget, after the batch's cameras if it is just starting, and the readback
+// once its last pass is in. Returns true when the batch is complete.
+static bool batch_record_slices(struct renderinfo *render,
+                                struct tracerinfo *tracer,
+                                struct batchinfo *batch,
+                                struct batch_slot *slot) {
+    const uint32_t query = 2 * (uint32_t)(slot - batch->slots);
+    const VkCommandBuffer cmd = cmd_frame_begin(render, &slot->frame);
+    uint64_t remaining;
+    uint32_t budget;
+
+    if (batch->timestamps) {
+        vkCmdResetQueryPool(cmd, batch->timestamps, query, 2);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            batch->timestamps, query);
+    }
+
+    if (tracer->sample_count == 0 && tracer->slice_offset == 0)
+        tracer_record_batch(tracer, cmd, &batch->cameras[slot->first],
+                            slot->count, batch->cell_width,
+                            batch->cell_height, batch->columns);
+
+    // As in the tiler every pass counts as a full one
+    remaining = (uint64_t)(batch->passes - tracer->sample_count) *
+                    tracer->tile_count -
+                tracer->slice_offset;
+    budget = slice_budget_tiles(&batch->budget, remaining > UINT32_MAX
+                                                    ? UINT32_MAX
+                                                    : (uint32_t)remaining);
+    slot->tiles = tracer_record_slices(render, tracer, &slot->frame, budget,
+                                       batch->passes);
+
+    slot->has_batch = tracer->sample_count == batch->passes;
+    if (slot->has_batch) {
+        const VkMemoryBarrier copy_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                             &copy_barrier, 0, NULL, 0, NULL);
+
+        // Only the rows of the atlas the batch uses
+        const VkBufferImageCopy region = {
+            .bufferOffset = 0,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {tracer->width,
+                            (slot->count + batch->columns - 1) /
+                                batch->columns * batch->cell_height,
+                            1},
+        };
+        vkCmdCopyImageToBuffer(cmd, tracer->output.image,
+                               VK_IMAGE_LAYOUT_GENERAL, slot->readback.buf, 1,
+                               &region);
+
+        // Also keeps the next batch from tracing before the copy is done
+        const VkMemoryBarrier host_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT |
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &host_barrier, 0, NULL, 0, NULL);
+    }
+
+    if (batch->timestamps)
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            batch->timestamps, query + 1);
+
+    cmd_frame_end(&slot->frame);
+    return slot->has_batch;
+}
+
+bool batch_render(struct renderinfo *render, struct tracerinfo *tracer,
+                  const char *cameras_path, const char *pattern,
+                  uint32_t width, uint32_t height) {
+    struct batchinfo batch;
+    uint32_t max_side, next, batches, submits, i;
+    bool batch_started = false;
+    bool ok = true;
+    double start, seconds;
+    VkResult err;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.pattern = pattern;
+    batch.width = width;
+    batch.height = height;
+    if (!image_format_from_path(pattern, &batch.format) ||
+        batch.format == IMAGE_FORMAT_EXR) {
+        fprintf(stderr, "Batch output is written as PNG or PPM, not to %s\n",
+                pattern);
+        return false;
+    }
+    if (!image_check_pattern(pattern, &batch.sequence)) {
+        fprintf(stderr, "--output %s: only one %%d for the camera number\n",
+                pattern);
+        return false;
+    }
+    if (!batch_load_cameras(cameras_path, &batch.cameras, &batch.camera_count))
+        return false;
+    if (!batch.sequence && batch.camera_count > 1) {
+        fprintf(stderr, "--output %s needs a %%d for the camera number\n",
+                pattern);
+        free(batch.cameras);
+        return false;
+    }
+
+    // The atlas is bounded like one tile of a tiled render
+    max_side = tiler_pick_tile_size(render) + 2 * TILER_GUARD_BAND;
+    batch.cell_width = (width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE *
+                       TRACE_TILE_SIZE;
+    batch.cell_height = (height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE *
+                        TRACE_TILE_SIZE;
+    if (batch.cell_width > max_side || batch.cell_height > max_side) {
+        fprintf(stderr, "%ux%u does not fit in a batch, at most %ux%u\n",
+                width, height, max_side, max_side);
+        free(batch.cameras);
+        return false;
+    }
+    batch.columns = max_side / batch.cell_width;
+    batch.rows = max_side / batch.cell_height;
+    batch.per_batch = batch.columns * batch.rows;
+    if (batch.per_batch > batch.camera_count)
+        batch.per_batch = batch.camera_count;
+    if (batch.columns > batch.per_batch)
+        batch.columns = batch.per_batch;
+    batch.rows = (batch.per_batch + batch.columns - 1) / batch.columns;
+    batch.passes = render->spp_target ? render->spp_target : BATCH_DEFAULT_SPP;
+    batches = (batch.camera_count + batch.per_batch - 1) / batch.per_batch;
+
+    tracer_resize(render, tracer, batch.columns * batch.cell_width,
+                  batch.rows * batch.cell_height);
+    tracer->view_width = width;
+    tracer->view_height = height;
+    tracer_prepare_batch(render, tracer, batch.per_batch);
+    batch_prepare_slots(render, &batch, tracer);
+
+    printf("Rendering %u cameras at %ux%u, %u per batch in a %ux%u atlas "
+           "(%u passes each)\n",
+           batch.camera_count, width, height, batch.per_batch, tracer->width,
+           tracer->height, batch.passes);
+    fflush(stdout);
+
+    // Submits alternate between the slots, while the GPU works on one the
+    // other is retired and, if it finished a batch, written out
+    start = glfwGetTime();
+    next = 0;
+    for (submits = 0; next < batch.camera_count && ok; submits++) {
+        struct batch_slot *slot = &batch.slots[submits % BATCH_SLOTS];
+
+        ok = batch_retire_slot(render, &batch, tracer, slot);
+
+        if (!batch_started) {
+            tracer_reset(tracer);
+            batch_started = true;
+        }
+        slot->first = next;
+        slot->count = batch.camera_count - next < batch.per_batch
+                          ? batch.camera_count - next
+                          : batch.per_batch;
+
+        if (batch_record_slices(render, tracer, &batch, slot)) {
+            next += slot->count;
+            batch_started = false;
+            printf("\rBatch %u/%u", (next + batch.per_batch - 1) /
+                                        batch.per_batch, batches);
+            fflush(stdout);
+        }
+
+        const VkSubmitInfo submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = NULL,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &slot->frame.cmd,
+        };
+        err = vkQueueSubmit(render->queue, 1, &submit_info, slot->fence);
+        assert(!err);
+        slot->busy = true;
+    }
+    printf("\n");
+
+    for (i = 0; i < BATCH_SLOTS; i++) {
+        struct batch_slot *slot = &batch.slots[(submits + i) % BATCH_SLOTS];
+        if (!batch_retire_slot(render, &batch, tracer, slot))
+            ok = false;
+    }
+    seconds = glfwGetTime() - start;
+
+    if (ok)
+        printf("Rendered %u images in %.2f s, %.1f images/s\n",
+               batch.camera_count, seconds,
+               seconds > 0.0 ? batch.camera_count / seconds : 0.0);
+    if (batch.budget.budget_ms > 0.0f)
+        printf("%u submits, %.4f ms of GPU time per tile list entry\n",
+               submits, batch.budget.ms_per_tile);
+    fflush(stdout);
+    batch_cleanup_slots(render, &batch);
+    free(batch.cameras);
+    return ok;
+}
@@ -0,0 +1,51 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Offline renders of one scene from many cameras, for synthetic data. The
+// cameras are packed as cells of an atlas in the tracer's storage images, so
+// every pass traces all of them in one dispatch against the same scene
+// buffers. While a batch renders, the previous one is read back and written
+// out, one file per camera.
+//
+// The camera file has one camera per line, "x y z yaw pitch fov" with the
+// angles in degrees; blank lines and lines starting with # are skipped.
+
+#define BATCH_SLOTS 2
+// Samples per pixel when neither --spp nor --noise bounds the render
+#define BATCH_DEFAULT_SPP 64
+
+struct batch_slot {
+    struct cmd_frame frame;
+    VkFence fence;
+    struct gpu_buffer readback;
+    bool busy;
+    bool has_batch;          // the submit finishes a batch and reads it back
+    uint32_t tiles;          // tile list entries recorded, for the slice budget
+    uint32_t first, count;   // cameras in the readback
+};
+
+struct batchinfo {
+    const char *pattern;
+    bool sequence; // pattern has a camera number in it
+    enum image_format format;
+    struct camera *cameras;
+    uint32_t camera_count;
+    uint32_t width, height;           // of the image of one camera
+    uint32_t cell_width, cell_height; // rounded up to whole tracer tiles
+    uint32_t columns, rows;           // of the atlas
+    uint32_t per_batch;
+    uint32_t passes; // accumulation passes per batch
+    struct batch_slot slots[BATCH_SLOTS];
+    VkQueryPool timestamps; // two per slot
+    struct slice_budget budget;
+};
+
+// Returns a malloc'd array, errors are reported
+bool batch_load_cameras(const char *path, struct camera **cameras,
+                        uint32_t *count);
+
+bool batch_render(struct renderinfo *render, struct tracerinfo *tracer,
+                  const char *cameras_path, const char *pattern,
+                  uint32_t width, uint32_t height);
+
+#endif
@@ -0,0 +1,640 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "bcn.h"
+
+// BC7 subset of every pixel for each of the 64 two-subset partitions, bit i
+// set for pixel i in subset 1
+static const uint16_t bc7_partitions2[64] = {
+    0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+    0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+    0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+    0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+    0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+    0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+    0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+    0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+
+// clang-format off
+static const uint8_t bc7_partitions3[64][16] = {
+    {0,0,1,1,0,0,1,1,0,2,2,1,2,2,2,2}, {0,0,0,1,0,0,1,1,2,2,1,1,2,2,2,1},
+    {0,0,0,0,2,0,0,1,2,2,1,1,2,2,1,1}, {0,2,2,2,0,0,2,2,0,0,1,1,0,1,1,1},
+    {0,0,0,0,0,0,0,0,1,1,2,2,1,1,2,2}, {0,0,1,1,0,0,1,1,0,0,2,2,0,0,2,2},
+    {0,0,2,2,0,0,2,2,1,1,1,1,1,1,1,1}, {0,0,1,1,0,0,1,1,2,2,1,1,2,2,1,1},
+    {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2}, {0,0,0,0,1,1,1,1,1,1,1,1,2,2,2,2},
+    {0,0,0,0,1,1,1,1,2,2,2,2,2,2,2,2}, {0,0,1,2,0,0,1,2,0,0,1,2,0,0,1,2},
+    {0,1,1,2,0,1,1,2,0,1,1,2,0,1,1,2}, {0,1,2,2,0,1,2,2,0,1,2,2,0,1,2,2},
+    {0,0,1,1,0,1,1,2,1,1,2,2,1,2,2,2}, {0,0,1,1,2,0,0,1,2,2,0,0,2,2,2,0},
+    {0,0,0,1,0,0,1,1,0,1,1,2,1,1,2,2}, {0,1,1,1,0,0,1,1,2,0,0,1,2,2,0,0},
+    {0,0,0,0,1,1,2,2,1,1,2,2,1,1,2,2}, {0,0,2,2,0,0,2,2,0,0,2,2,1,1,1,1},
+    {0,1,1,1,0,1,1,1,0,2,2,2,0,2,2,2}, {0,0,0,1,0,0,0,1,2,2,2,1,2,2,2,1},
+    {0,0,0,0,0,0,1,1,0,1,2,2,0,1,2,2}, {0,0,0,0,1,1,0,0,2,2,1,0,2,2,1,0},
+    {0,1,2,2,0,1,2,2,0,0,1,1,0,0,0,0}, {0,0,1,2,0,0,1,2,1,1,2,2,2,2,2,2},
+    {0,1,1,0,1,2,2,1,1,2,2,1,0,1,1,0}, {0,0,0,0,0,1,1,0,1,2,2,1,1,2,2,1},
+    {0,0,2,2,1,1,0,2,1,1,0,2,0,0,2,2}, {0,1,1,0,0,1,1,0,2,0,0,2,2,2,2,2},
+    {0,0,1,1,0,1,2,2,0,1,2,2,0,0,1,1}, {0,0,0,0,2,0,0,0,2,2,1,1,2,2,2,1},
+    {0,0,0,0,0,0,0,2,1,1,2,2,1,2,2,2}, {0,2,2,2,0,0,2,2,0,0,1,2,0,0,1,1},
+    {0,0,1,1,0,0,1,2,0,0,2,2,0,2,2,2}, {0,1,2,0,0,1,2,0,0,1,2,0,0,1,2,0},
+    {0,0,0,0,1,1,1,1,2,2,2,2,0,0,0,0}, {0,1,2,0,1,2,0,1,2,0,1,2,0,1,2,0},
+    {0,1,2,0,2,0,1,2,1,2,0,1,0,1,2,0}, {0,0,1,1,2,2,0,0,1,1,2,2,0,0,1,1},
+    {0,0,1,1,1,1,2,2,2,2,0,0,0,0,1,1}, {0,1,0,1,0,1,0,1,2,2,2,2,2,2,2,2},
+    {0,0,0,0,0,0,0,0,2,1,2,1,2,1,2,1}, {0,0,2,2,1,1,2,2,0,0,2,2,1,1,2,2},
+    {0,0,2,2,0,0,1,1,0,0,2,2,0,0,1,1}, {0,2,2,0,1,2,2,1,0,2,2,0,1,2,2,1},
+    {0,1,0,1,2,2,2,2,2,2,2,2,0,1,0,1}, {0,0,0,0,2,1,2,1,2,1,2,1,2,1,2,1},
+    {0,1,0,1,0,1,0,1,0,1,0,1,2,2,2,2}, {0,2,2,2,0,1,1,1,0,2,2,2,0,1,1,1},
+    {0,0,0,2,1,1,1,2,0,0,0,2,1,1,1,2}, {0,0,0,0,2,1,1,2,2,1,1,2,2,1,1,2},
+    {0,2,2,2,0,1,1,1,0,1,1,1,0,2,2,2}, {0,0,0,2,1,1,1,2,1,1,1,2,0,0,0,2},
+    {0,1,1,0,0,1,1,0,0,1,1,0,2,2,2,2}, {0,0,0,0,0,0,0,0,2,1,1,2,2,1,1,2},
+    {0,1,1,0,0,1,1,0,2,2,2,2,2,2,2,2}, {0,0,2,2,0,0,1,1,0,0,1,1,0,0,2,2},
+    {0,0,2,2,1,1,2,2,1,1,2,2,0,0,2,2}, {0,0,0,0,0,0,0,0,0,0,0,0,2,1,1,2},
+    {0,0,0,2,0,0,0,1,0,0,0,2,0,0,0,1}, {0,2,2,2,1,2,2,2,0,2,2,2,1,2,2,2},
+    {0,1,0,1,2,2,2,2,2,2,2,2,2,2,2,2}, {0,1,1,1,2,0,1,1,2,2,0,1,2,2,2,0},
+};
+
+// Pixels whose index drops its top bit, after pixel 0 of subset 0
+static const uint8_t bc7_anchors2[64] = {
+    15,15,15,15,15,15,15,15, 15,15,15,15,15,15,15,15,
+    15, 2, 8, 2, 2, 8, 8,15,  2, 8, 2, 2, 8, 8, 2, 2,
+    15,15, 6, 8, 2, 8,15,15,  2, 8, 2, 2, 2,15,15, 6,
+     6, 2, 6, 8,15,15, 2, 2, 15,15,15,15,15, 2, 2,15,
+};
+
+static const uint8_t bc7_anchors3[2][64] = {
+    {
+     3, 3,15,15, 8, 3,15,15,  8, 8, 6, 6, 6, 5, 3, 3,
+     3, 3, 8,15, 3, 3, 6,10,  5, 8, 8, 6, 8, 5,15,15,
+     8,15, 3, 5, 6,10, 8,15, 15, 3,15, 5,15,15,15,15,
+     3,15, 5, 5, 5, 8, 5,10,  5,10, 8,13,15,12, 3, 3,
+    },
+    {
+    15, 8, 8, 3,15,15, 3, 8, 15,15,15,15,15,15,15, 8,
+    15, 8,15, 3,15, 8,15, 8,  3,15, 6,10,15,15,10, 8,
+    15, 3,15,10,10, 8, 9,10,  6,15, 8,15, 3, 6, 6, 8,
+    15, 3,15,15,15,15,15,15, 15,15,15,15, 3,15,15, 8,
+    },
+};
+// clang-format on
+
+static const uint8_t bc7_weights2[4] = {0, 21, 43, 64};
+static const uint8_t bc7_weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+static const uint8_t bc7_weights4[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                         34, 38, 43, 47, 51, 55, 60, 64};
+
+struct bc7_mode {
+    uint8_t subsets;
+    uint8_t partition_bits;
+    uint8_t rotation_bits;
+    uint8_t selector_bits; // index selection, mode 4
+    uint8_t color_bits;
+    uint8_t alpha_bits;    // 0: opaque
+    uint8_t endpoint_pbits; // one p-bit per endpoint
+    uint8_t shared_pbits;   // one p-bit per subset
+    uint8_t index_bits;
+    uint8_t index2_bits; // second index set, modes 4 and 5
+};
+
+static const struct bc7_mode bc7_modes[8] = {
+    {3, 4, 0, 0, 4, 0, 1, 0, 3, 0}, {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+    {3, 6, 0, 0, 5, 0, 0, 0, 2, 0}, {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+    {1, 0, 2, 1, 5, 6, 0, 0, 2, 3}, {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+    {1, 0, 0, 0, 7, 7, 1, 0, 4, 0}, {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+};
+
+uint32_t bcn_block_bytes(enum bcn_format format) {
+    return format == BCN_BC1 ? 8 : 16;
+}
+
+size_t bcn_level_bytes(enum bcn_format format, uint32_t width,
+                       uint32_t height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+           bcn_block_bytes(format);
+}
+
+// Little endian bit reader over one 16 byte block
+struct bcn_bits {
+    const uint8_t *data;
+    uint32_t pos;
+};
+
+static uint32_t bcn_read(struct bcn_bits *bits, uint32_t count) {
+    uint32_t value = 0, i;
+
+    for (i = 0; i < count; i++, bits->pos++)
+        value |= ((bits->data[bits->pos >> 3] >> (bits->pos & 7)) & 1u) << i;
+    return value;
+}
+
+static void bcn_write(uint8_t *data, uint32_t *pos, uint32_t value,
+                      uint32_t count) {
+    uint32_t i;
+
+    for (i = 0; i < count; i++, (*pos)++) {
+        if (value & (1u << i))
+            data[*pos >> 3] |= (uint8_t)(1u << (*pos & 7));
+    }
+}
+
+static uint8_t bc7_interpolate(uint32_t e0, uint32_t e1, uint32_t weight) {
+    return (uint8_t)(((64 - weight) * e0 + weight * e1 + 32) >> 6);
+}
+
+static const uint8_t *bc7_weights(uint32_t bits) {
+    return bits == 2 ? bc7_weights2 : bits == 3 ? bc7_weights3 : bc7_weights4;
+}
+
+static void bc7_decode_block(const uint8_t *block, uint8_t out[16][4]) {
+    struct bcn_bits bits = {block, 0};
+    const struct bc7_mode *mode;
+    uint8_t endpoints[3][2][4];
+    uint8_t subset_of[16];
+    uint8_t anchors[3] = {0, 0, 0};
+    uint32_t indices[16], indices2[16];
+    uint32_t m = 0, partition, rotation, selector, i, s, e, c;
+
+    while (m < 8 && bcn_read(&bits, 1) == 0)
+        m++;
+    if (m == 8) {
+        // Reserved, decodes to transparent black
+        memset(out, 0, 16 * 4);
+        return;
+    }
+    mode = &bc7_modes[m];
+    partition = bcn_read(&bits, mode->partition_bits);
+    rotation = bcn_read(&bits, mode->rotation_bits);
+    selector = bcn_read(&bits, mode->selector_bits);
+
+    for (c = 0; c < 3; c++) {
+        for (s = 0; s < mode->subsets; s++) {
+            for (e = 0; e < 2; e++)
+                endpoints[s][e][c] = (uint8_t)bcn_read(&bits, mode->color_bits);
+        }
+    }
+    for (s = 0; s < mode->subsets; s++) {
+        for (e = 0; e < 2; e++)
+            endpoints[s][e][3] =
+                mode->alpha_bits ? (uint8_t)bcn_read(&bits, mode->alpha_bits)
+                                 : 255;
+    }
+
+    // The p-bits become the low bit of every channel of their endpoints
+    if (mode->endpoint_pbits || mode->shared_pbits) {
+        uint32_t pbits[3][2];
+
+        for (s = 0; s < mode->subsets; s++) {
+            if (mode->shared_pbits) {
+                pbits[s][0] = pbits[s][1] = bcn_read(&bits, 1);
+            } else {
+                pbits[s][0] = bcn_read(&bits, 1);
+                pbits[s][1] = bcn_read(&bits, 1);
+            }
+        }
+        for (s = 0; s < mode->subsets; s++) {
+            for (e = 0; e < 2; e++) {
+                for (c = 0; c < (mode->alpha_bits ? 4u : 3u); c++)
+                    endpoints[s][e][c] =
+                        (uint8_t)((endpoints[s][e][c] << 1) | pbits[s][e]);
+            }
+        }
+    }
+
+    // Widen to 8 bits by repeating the top bits
+    for (s = 0; s < mode->subsets; s++) {
+        for (e = 0; e < 2; e++) {
+            for (c = 0; c < 4; c++) {
+                const uint32_t precision =
+                    (c < 3 ? mode->color_bits : mode->alpha_bits) +
+                    (mode->endpoint_pbits || mode->shared_pbits ? 1 : 0);
+
+                if (c == 3 && !mode->alpha_bits)
+                    continue;
+                endpoints[s][e][c] =
+                    (uint8_t)((endpoints[s][e][c] << (8 - precision)) |
+                              (endpoints[s][e][c] >> (2 * precision - 8)));
+            }
+        }
+    }
+
+    for (i = 0; i < 16; i++) {
+        subset_of[i] =
+            mode->subsets == 1 ? 0
+            : mode->subsets == 2
+                ? (uint8_t)((bc7_partitions2[partition] >> i) & 1)
+                : bc7_partitions3[partition][i];
+    }
+    if (mode->subsets == 2) {
+        anchors[1] = bc7_anchors2[partition];
+    } else if (mode->subsets == 3) {
+        anchors[1] = bc7_anchors3[0][partition];
+        anchors[2] = bc7_anchors3[1][partition];
+    }
+
+    for (i = 0; i < 16; i++) {
+        const bool anchor = i == anchors[subset_of[i]];
+
+        indices[i] = bcn_read(&bits, mode->index_bits - (anchor ? 1 : 0));
+    }
+    for (i = 0; i < 16 && mode->index2_bits; i++)
+        indices2[i] = bcn_read(&bits, mode->index2_bits - (i == 0 ? 1 : 0));
+
+    for (i = 0; i < 16; i++) {
+        const uint8_t(*ep)[4] = endpoints[subset_of[i]];
+        uint32_t color_index = indices[i], alpha_index = indices[i];
+        uint32_t color_bits = mode->index_bits, alpha_bits = mode->index_bits;
+
+        if (mode->index2_bits) {
+            // Mode 4 picks which index set goes to color, mode 5 never swaps
+            if (selector) {
+                color_index = indices2[i];
+                color_bits = mode->index2_bits;
+            } else {
+                alpha_index = indices2[i];
+                alpha_bits = mode->index2_bits;
+            }
+        }
+        for (c = 0; c < 3; c++)
+            out[i][c] = bc7_interpolate(ep[0][c], ep[1][c],
+                                        bc7_weights(color_bits)[color_index]);
+        out[i][3] = bc7_interpolate(ep[0][3], ep[1][3],
+                                    bc7_weights(alpha_bits)[alpha_index]);
+        if (rotation) {
+            const uint8_t t = out[i][3];
+
+            out[i][3] = out[i][rotation - 1];
+            out[i][rotation - 1] = t;
+        }
+    }
+}
+
+static void bc1_colors(const uint8_t *block, bool four_only,
+                       uint8_t colors[4][4]) {
+    const uint32_t c0 = block[0] | (block[1] << 8);
+    const uint32_t c1 = block[2] | (block[3] << 8);
+    uint32_t c, e;
+
+    for (e = 0; e < 2; e++) {
+        const uint32_t v = e ? c1 : c0;
+        const uint32_t r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+
+        colors[e][0] = (uint8_t)((r << 3) | (r >> 2));
+        colors[e][1] = (uint8_t)((g << 2) | (g >> 4));
+        colors[e][2] = (uint8_t)((b << 3) | (b >> 2));
+        colors[e][3] = 255;
+    }
+    for (c = 0; c < 3; c++) {
+        if (four_only || c0 > c1) {
+            colors[2][c] = (uint8_t)((2 * colors[0][c] + colors[1][c]) / 3);
+            colors[3][c] = (uint8_t)((colors[0][c] + 2 * colors[1][c]) / 3);
+        } else {
+            colors[2][c] = (uint8_t)((colors[0][c] + colors[1][c]) / 2);
+            colors[3][c] = 0;
+        }
+    }
+    colors[2][3] = 255;
+    colors[3][3] = four_only || c0 > c1 ? 255 : 0;
+}
+
+static void bc1_decode_block(const uint8_t *block, bool four_only,
+                             uint8_t out[16][4]) {
+    uint8_t colors[4][4];
+    uint32_t i;
+
+    bc1_colors(block, four_only, colors);
+    for (i = 0; i < 16; i++)
+        memcpy(out[i], colors[(block[4 + i / 4] >> (2 * (i % 4))) & 3], 4);
+}
+
+// One channel, written to every fourth byte of out
+static void bc4_decode_block(const uint8_t *block, uint8_t *out) {
+    const uint32_t a0 = block[0], a1 = block[1];
+    uint8_t values[8];
+    uint64_t bits = 0;
+    uint32_t i;
+
+    values[0] = (uint8_t)a0;
+    values[1] = (uint8_t)a1;
+    for (i = 2; i < 8; i++) {
+        if (a0 > a1)
+            values[i] = (uint8_t)(((8 - i) * a0 + (i - 1) * a1) / 7);
+        else
+            values[i] = i < 6 ? (uint8_t)(((6 - i) * a0 + (i - 1) * a1) / 5)
+                              : (i == 6 ? 0 : 255);
+    }
+    for (i = 0; i < 6; i++)
+        bits |= (uint64_t)block[2 + i] << (8 * i);
+    for (i = 0; i < 16; i++)
+        out[4 * i] = values[(bits >> (3 * i)) & 7];
+}
+
+void bcn_decode(enum bcn_format format, const uint8_t *blocks, uint32_t width,
+                uint32_t height, uint8_t *rgba8) {
+    const uint32_t block_bytes = bcn_block_bytes(format);
+    const uint32_t blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+    uint8_t out[16][4];
+    uint32_t bx, by, x, y;
+
+    for (by = 0; by < blocks_y; by++) {
+        for (bx = 0; bx < blocks_x; bx++) {
+            const uint8_t *block =
+                blocks + ((size_t)by * blocks_x + bx) * block_bytes;
+
+            switch (format) {
+            case BCN_BC1:
+                bc1_decode_block(block, false, out);
+                for (x = 0; x < 16; x++)
+                    out[x][3] = 255;
+                break;
+            case BCN_BC3:
+                bc1_decode_block(block + 8, true, out);
+                bc4_decode_block(block, &out[0][3]);
+                break;
+            case BCN_BC5:
+                bc4_decode_block(block, &out[0][0]);
+                bc4_decode_block(block + 8, &out[0][1]);
+                for (x = 0; x < 16; x++) {
+                    out[x][2] = 0;
+                    out[x][3] = 255;
+                }
+                break;
+            case BCN_BC7:
+                bc7_decode_block(block, out);
+                break;
+            }
+
+            for (y = 0; y < 4 && by * 4 + y < height; y++) {
+                for (x = 0; x < 4 && bx * 4 + x < width; x++)
+                    memcpy(rgba8 + (((size_t)by * 4 + y) * width + bx * 4 + x) *
+                                       4,
+                           out[y * 4 + x], 4);
+            }
+        }
+    }
+}
+
+// Ends of the segment along the principal axis that covers the first
+// channels of every pixel, found by power iteration on their covariance
+static void bcn_fit_line(uint8_t pixels[16][4], uint32_t channels,
+                         float lo[4], float hi[4]) {
+    float mean[4] = {0}, cov[4][4] = {{0}}, axis[4] = {1, 1, 1, 1};
+    float tmin = 1e30f, tmax = -1e30f;
+    uint32_t i, j, k, iter;
+
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < channels; j++)
+            mean[j] += pixels[i][j] / 16.0f;
+    }
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < channels; j++) {
+            for (k = 0; k < channels; k++)
+                cov[j][k] +=
+                    (pixels[i][j] - mean[j]) * (pixels[i][k] - mean[k]);
+        }
+    }
+    for (iter = 0; iter < 8; iter++) {
+        float next[4] = {0}, length = 0.0f;
+
+        for (j = 0; j < channels; j++) {
+            for (k = 0; k < channels; k++)
+                next[j] += cov[j][k] * axis[k];
+            length += next[j] * next[j];
+        }
+        if (length < 1e-12f)
+            break;
+        for (j = 0; j < channels; j++)
+            axis[j] = next[j] / sqrtf(length);
+    }
+    for (i = 0; i < 16; i++) {
+        float t = 0.0f;
+
+        for (j = 0; j < channels; j++)
+            t += (pixels[i][j] - mean[j]) * axis[j];
+        if (t < tmin)
+            tmin = t;
+        if (t > tmax)
+            tmax = t;
+    }
+    for (j = 0; j < channels; j++) {
+        lo[j] = mean[j] + axis[j] * tmin;
+        hi[j] = mean[j] + axis[j] * tmax;
+    }
+}
+
+static uint32_t bcn_clamp(float v, uint32_t max) {
+    return v <= 0.0f ? 0 : v >= (float)max ? max : (uint32_t)(v + 0.5f);
+}
+
+static uint32_t bcn_distance(const uint8_t *a, const uint8_t *b,
+                             uint32_t channels) {
+    uint32_t d = 0, c;
+
+    for (c = 0; c < channels; c++)
+        d += (uint32_t)((a[c] - b[c]) * (a[c] - b[c]));
+    return d;
+}
+
+static void bc1_encode_block(uint8_t pixels[16][4], uint8_t *block) {
+    float lo[4], hi[4];
+    uint8_t colors[4][4];
+    uint32_t c0, c1, i, best, k;
+
+    bcn_fit_line(pixels, 3, lo, hi);
+    c0 = (bcn_clamp(hi[0] * 31 / 255, 31) << 11) |
+         (bcn_clamp(hi[1] * 63 / 255, 63) << 5) | bcn_clamp(hi[2] * 31 / 255, 31);
+    c1 = (bcn_clamp(lo[0] * 31 / 255, 31) << 11) |
+         (bcn_clamp(lo[1] * 63 / 255, 63) << 5) | bcn_clamp(lo[2] * 31 / 255, 31);
+    // Four colours need c0 > c1, one colour needs no indices at all
+    if (c0 < c1) {
+        const uint32_t t = c0;
+
+        c0 = c1;
+        c1 = t;
+    }
+    memset(block, 0, 8);
+    block[0] = (uint8_t)c0;
+    block[1] = (uint8_t)(c0 >> 8);
+    block[2] = (uint8_t)c1;
+    block[3] = (uint8_t)(c1 >> 8);
+    if (c0 == c1)
+        return;
+
+    bc1_colors(block, true, colors);
+    for (i = 0; i < 16; i++) {
+        best = 0;
+        for (k = 1; k < 4; k++) {
+            if (bcn_distance(pixels[i], colors[k], 3) <
+                bcn_distance(pixels[i], colors[best], 3))
+                best = k;
+        }
+        block[4 + i / 4] |= (uint8_t)(best << (2 * (i % 4)));
+    }
+}
+
+// Channel c of every pixel into 8 bytes
+static void bc4_encode_block(uint8_t pixels[16][4], uint32_t c,
+                             uint8_t *block) {
+    uint32_t a0 = 0, a1 = 255, i, k, best;
+    uint8_t values[8];
+    uint64_t bits = 0;
+
+    for (i = 0; i < 16; i++) {
+        if (pixels[i][c] > a0)
+            a0 = pixels[i][c];
+        if (pixels[i][c] < a1)
+            a1 = pixels[i][c];
+    }
+    block[0] = (uint8_t)a0;
+    block[1] = (uint8_t)a1;
+    memset(block + 2, 0, 6);
+    if (a0 == a1)
+        return;
+
+    values[0] = (uint8_t)a0;
+    values[1] = (uint8_t)a1;
+    for (i = 2; i < 8; i++)
+        values[i] = (uint8_t)(((8 - i) * a0 + (i - 1) * a1) / 7);
+    for (i = 0; i < 16; i++) {
+        best = 0;
+        for (k = 1; k < 8; k++) {
+            if (abs(pixels[i][c] - values[k]) < abs(pixels[i][c] - values[best]))
+                best = k;
+        }
+        bits |= (uint64_t)best << (3 * i);
+    }
+    for (i = 0; i < 6; i++)
+        block[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+// Mode 6: one subset, 7 bit rgba endpoints with a p-bit each, 4 bit indices
+static void bc7_encode_block(uint8_t pixels[16][4], uint8_t *block) {
+    float lo[4], hi[4];
+    uint32_t q[2][4], p[2], indices[16], i, e, c, k, pos = 0;
+    uint8_t endpoints[2][4];
+
+    bcn_fit_line(pixels, 4, lo, hi);
+    for (e = 0; e < 2; e++) {
+        const float *target = e ? hi : lo;
+        uint32_t best_error = UINT32_MAX;
+        uint32_t pbit;
+
+        // Each endpoint keeps the p-bit that lands closer to the fit
+        for (pbit = 0; pbit < 2; pbit++) {
+            uint32_t error = 0, v[4];
+
+            for (c = 0; c < 4; c++) {
+                float d;
+
+                v[c] = bcn_clamp((target[c] - pbit) / 2.0f, 127);
+                d = (float)((v[c] << 1) | pbit) - target[c];
+                error += (uint32_t)(d * d);
+            }
+            if (error < best_error) {
+                best_error = error;
+                memcpy(q[e], v, sizeof(v));
+                p[e] = pbit;
+            }
+        }
+        for (c = 0; c < 4; c++)
+            endpoints[e][c] = (uint8_t)((q[e][c] << 1) | p[e]);
+    }
+
+    for (i = 0; i < 16; i++) {
+        uint32_t best = 0, best_error = UINT32_MAX;
+
+        for (k = 0; k < 16; k++) {
+            uint8_t color[4];
+            uint32_t error;
+
+            for (c = 0; c < 4; c++)
+                color[c] = bc7_interpolate(endpoints[0][c], endpoints[1][c],
+                                           bc7_weights4[k]);
+            error = bcn_distance(pixels[i], color, 4);
+            if (error < best_error) {
+                best_error = error;
+                best = k;
+            }
+        }
+        indices[i] = best;
+    }
+    // The anchor index has no top bit, mirror the indices if it is set
+    if (indices[0] & 8) {
+        for (c = 0; c < 4; c++) {
+            const uint32_t t = q[0][c];
+
+            q[0][c] = q[1][c];
+            q[1][c] = t;
+        }
+        k = p[0];
+        p[0] = p[1];
+        p[1] = k;
+        for (i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(block, 0, 16);
+    bcn_write(block, &pos, 1u << 6, 7);
+    for (c = 0; c < 4; c++) {
+        bcn_write(block, &pos, q[0][c], 7);
+        bcn_write(block, &pos, q[1][c], 7);
+    }
+    bcn_write(block, &pos, p[0], 1);
+    bcn_write(block, &pos, p[1], 1);
+    for (i = 0; i < 16; i++)
+        bcn_write(block, &pos, indices[i], i == 0 ? 3 : 4);
+    assert(pos == 128);
+}
+
+void bcn_encode(enum bcn_format format, const uint8_t *rgba8, uint32_t width,
+                uint32_t height, uint8_t *blocks) {
+    const uint32_t block_bytes = bcn_block_bytes(format);
+    const uint32_t blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+    uint8_t pixels[16][4];
+    uint32_t bx, by, x, y;
+
+    for (by = 0; by < blocks_y; by++) {
+        for (bx = 0; bx < blocks_x; bx++) {
+            uint8_t *block = blocks + ((size_t)by * blocks_x + bx) * block_bytes;
+
+            for (y = 0; y < 4; y++) {
+                const uint32_t sy = by * 4 + y < height ? by * 4 + y : height - 1;
+
+                for (x = 0; x < 4; x++) {
+                    const uint32_t sx =
+                        bx * 4 + x < width ? bx * 4 + x : width - 1;
+
+                    memcpy(pixels[y * 4 + x],
+                           rgba8 + ((size_t)sy * width + sx) * 4, 4);
+                }
+            }
+
+            switch (format) {
+            case BCN_BC1:
+                bc1_encode_block(pixels, block);
+                break;
+            case BCN_BC3:
+                bc4_encode_block(pixels, 3, block);
+                bc1_encode_block(pixels, block + 8);
+                break;
+            case BCN_BC5:
+                bc4_encode_block(pixels, 0, block);
+                bc4_encode_block(pixels, 1, block + 8);
+                break;
+            case BCN_BC7:
+                bc7_encode_block(pixels, block);
+                break;
+            }
+        }
+    }
+}
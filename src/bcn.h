@@ -0,0 +1,34 @@
+#ifndef BCN_H
+#define BCN_H
+
+// Block compressed pixels: BC1 (rgb), BC3 (rgba), BC5 (two channels, for
+// normal maps) and BC7 (rgba). Each 4x4 pixel block takes 8 or 16 bytes,
+// rows of blocks cover the image and the last ones hang over its edges.
+// Decoding is the fallback for devices that cannot sample a format.
+// Encoding is for the baking tool; it fits endpoints along the principal
+// axis of each block, and writes BC7 in its single-subset mode 6 only.
+
+enum bcn_format {
+    BCN_BC1,
+    BCN_BC3,
+    BCN_BC5,
+    BCN_BC7,
+};
+
+// 8 or 16
+uint32_t bcn_block_bytes(enum bcn_format format);
+
+size_t bcn_level_bytes(enum bcn_format format, uint32_t width,
+                       uint32_t height);
+
+// rgba8 holds width x height pixels. BC5 decodes to red and green with blue
+// 0 and alpha 255, BC1 to alpha 255.
+void bcn_decode(enum bcn_format format, const uint8_t *blocks, uint32_t width,
+                uint32_t height, uint8_t *rgba8);
+
+// Edge blocks repeat the last row and column. BC1 and BC5 ignore alpha,
+// BC5 only encodes red and green.
+void bcn_encode(enum bcn_format format, const uint8_t *rgba8, uint32_t width,
+                uint32_t height, uint8_t *blocks);
+
+#endif
@@ -0,0 +1,678 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <float.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "task.h"
+
+struct bvh_bin {
+    float min[3], max[3];
+    uint32_t count;
+};
+
+static void bounds_reset(float *mn, float *mx) {
+    mn[0] = mn[1] = mn[2] = FLT_MAX;
+    mx[0] = mx[1] = mx[2] = -FLT_MAX;
+}
+
+static void bounds_grow(float *mn, float *mx, const float *p) {
+    int k;
+    for (k = 0; k < 3; k++) {
+        if (p[k] < mn[k]) mn[k] = p[k];
+        if (p[k] > mx[k]) mx[k] = p[k];
+    }
+}
+
+static float bounds_area(const float *mn, const float *mx) {
+    const float dx = mx[0] - mn[0], dy = mx[1] - mn[1], dz = mx[2] - mn[2];
+    if (dx < 0.0f)
+        return 0.0f;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static void tri_bounds(const struct bvh_triangle *tri, float *mn, float *mx) {
+    float p[3];
+    int k;
+
+    bounds_reset(mn, mx);
+    bounds_grow(mn, mx, tri->v0);
+    for (k = 0; k < 3; k++) p[k] = tri->v0[k] + tri->e1[k];
+    bounds_grow(mn, mx, p);
+    for (k = 0; k < 3; k++) p[k] = tri->v0[k] + tri->e2[k];
+    bounds_grow(mn, mx, p);
+}
+
+static void tri_centroid(const struct bvh_triangle *tri, float *c) {
+    int k;
+    for (k = 0; k < 3; k++)
+        c[k] = tri->v0[k] + (tri->e1[k] + tri->e2[k]) * (1.0f / 3.0f);
+}
+
+static void transform_point(const float m[3][4], const float *p, float *out) {
+    int r;
+    for (r = 0; r < 3; r++)
+        out[r] = m[r][0] * p[0] + m[r][1] * p[1] + m[r][2] * p[2] + m[r][3];
+}
+
+static void node_update_bounds(struct bvhinfo *bvh, struct bvh_node *node) {
+    float mn[3], mx[3];
+    uint32_t i;
+
+    bounds_reset(node->min, node->max);
+    for (i = 0; i < node->count; i++) {
+        tri_bounds(&bvh->tris[node->left_first + i], mn, mx);
+        bounds_grow(node->min, node->max, mn);
+        bounds_grow(node->min, node->max, mx);
+    }
+}
+
+// Bins the centroids of triangles [first, first + count) along every axis
+// the centroid bounds have extent on
+static void bins_fill(const struct bvhinfo *bvh, uint32_t first,
+                      uint32_t count, const float *cmin, const float *cmax,
+                      struct bvh_bin bins[3][BVH_BIN_COUNT]) {
+    float c[3], mn[3], mx[3];
+    uint32_t i;
+    int a, b;
+
+    for (a = 0; a < 3; a++) {
+        for (b = 0; b < BVH_BIN_COUNT; b++) {
+            bounds_reset(bins[a][b].min, bins[a][b].max);
+            bins[a][b].count = 0;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        const struct bvh_triangle *tri = &bvh->tris[first + i];
+
+        tri_centroid(tri, c);
+        tri_bounds(tri, mn, mx);
+        for (a = 0; a < 3; a++) {
+            const float extent = cmax[a] - cmin[a];
+
+            if (extent <= 0.0f)
+                continue;
+            b = (int)((c[a] - cmin[a]) / extent * BVH_BIN_COUNT);
+            if (b >= BVH_BIN_COUNT) b = BVH_BIN_COUNT - 1;
+            bounds_grow(bins[a][b].min, bins[a][b].max, mn);
+            bounds_grow(bins[a][b].min, bins[a][b].max, mx);
+            bins[a][b].count++;
+        }
+    }
+}
+
+static void bounds_merge(float *mn, float *mx, const float *other_min,
+                         const float *other_max) {
+    int k;
+    for (k = 0; k < 3; k++) {
+        if (other_min[k] < mn[k]) mn[k] = other_min[k];
+        if (other_max[k] > mx[k]) mx[k] = other_max[k];
+    }
+}
+
+/*
+ * Binned SAH split over the triangle centroids. Returns false when no split
+ * is cheaper than keeping the node as a leaf.
+ */
+static bool bins_find_split(const struct bvh_bin bins[3][BVH_BIN_COUNT],
+                            const float *cmin, const float *cmax,
+                            float leaf_cost, int *axis, float *pos) {
+    float left_area[BVH_BIN_COUNT - 1];
+    uint32_t left_count[BVH_BIN_COUNT - 1];
+    float best_cost = leaf_cost;
+    bool found = false;
+    int a, b;
+
+    for (a = 0; a < 3; a++) {
+        const float extent = cmax[a] - cmin[a];
+        float lmin[3], lmax[3], rmin[3], rmax[3];
+        uint32_t lcount = 0, rcount = 0;
+
+        if (extent <= 0.0f)
+            continue;
+
+        bounds_reset(lmin, lmax);
+        for (b = 0; b < BVH_BIN_COUNT - 1; b++) {
+            lcount += bins[a][b].count;
+            if (bins[a][b].count) {
+                bounds_grow(lmin, lmax, bins[a][b].min);
+                bounds_grow(lmin, lmax, bins[a][b].max);
+            }
+            left_count[b] = lcount;
+            left_area[b] = bounds_area(lmin, lmax);
+        }
+
+        bounds_reset(rmin, rmax);
+        for (b = BVH_BIN_COUNT - 1; b > 0; b--) {
+            float cost;
+
+            rcount += bins[a][b].count;
+            if (bins[a][b].count) {
+                bounds_grow(rmin, rmax, bins[a][b].min);
+                bounds_grow(rmin, rmax, bins[a][b].max);
+            }
+            if (!left_count[b - 1] || !rcount)
+                continue;
+
+            cost = left_area[b - 1] * left_count[b - 1] +
+                   bounds_area(rmin, rmax) * rcount;
+            if (cost < best_cost) {
+                best_cost = cost;
+                *axis = a;
+                *pos = cmin[a] + extent * b / BVH_BIN_COUNT;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+static bool node_find_split(struct bvhinfo *bvh, const struct bvh_node *node,
+                            int *axis, float *pos) {
+    struct bvh_bin bins[3][BVH_BIN_COUNT];
+    float cmin[3], cmax[3], c[3];
+    uint32_t i;
+
+    bounds_reset(cmin, cmax);
+    for (i = 0; i < node->count; i++) {
+        tri_centroid(&bvh->tris[node->left_first + i], c);
+        bounds_grow(cmin, cmax, c);
+    }
+    bins_fill(bvh, node->left_first, node->count, cmin, cmax, bins);
+    return bins_find_split(bins, cmin, cmax,
+                           bounds_area(node->min, node->max) * node->count,
+                           axis, pos);
+}
+
+// Splits the tree below nodes[0], which is depth deep, down to the leaves
+// on the calling thread. nodes has room for the 2 * count - 1 nodes of the
+// subtree, stack for twice as many entries.
+static void bvh_build_serial(struct bvhinfo *bvh, struct bvh_node *nodes,
+                             uint32_t *node_count, uint32_t *stack,
+                             uint32_t depth) {
+    uint32_t stack_size = 0;
+    uint32_t i;
+
+    // Depth and node index pairs
+    stack[stack_size++] = depth;
+    stack[stack_size++] = 0;
+    while (stack_size) {
+        struct bvh_node *node = &nodes[stack[--stack_size]];
+        const uint32_t node_depth = stack[--stack_size];
+        uint32_t first = node->left_first, last, left;
+        float pos = 0.0f, c[3];
+        int axis = 0;
+
+        if (node->count <= BVH_MAX_LEAF_TRIS || node_depth >= BVH_MAX_DEPTH ||
+            !node_find_split(bvh, node, &axis, &pos))
+            continue;
+
+        // Partition the triangles in place around the split plane
+        last = first + node->count;
+        left = first;
+        for (i = first; i < last; i++) {
+            tri_centroid(&bvh->tris[i], c);
+            if (c[axis] < pos) {
+                struct bvh_triangle tmp = bvh->tris[i];
+                uint32_t instance = bvh->tri_instances[i];
+
+                bvh->tris[i] = bvh->tris[left];
+                bvh->tris[left] = tmp;
+                bvh->tri_instances[i] = bvh->tri_instances[left];
+                bvh->tri_instances[left] = instance;
+                left++;
+            }
+        }
+        if (left == first || left == last)
+            continue;
+
+        const uint32_t child = *node_count;
+        *node_count += 2;
+
+        nodes[child].left_first = first;
+        nodes[child].count = left - first;
+        node_update_bounds(bvh, &nodes[child]);
+        nodes[child + 1].left_first = left;
+        nodes[child + 1].count = last - left;
+        node_update_bounds(bvh, &nodes[child + 1]);
+
+        node->left_first = child;
+        node->count = 0;
+
+        stack[stack_size++] = node_depth + 1;
+        stack[stack_size++] = child;
+        stack[stack_size++] = node_depth + 1;
+        stack[stack_size++] = child + 1;
+    }
+}
+
+// Per chunk partial results of splitting a large node
+struct bvh_chunk {
+    float min[3], max[3];   // triangle or centroid bounds, then the left side
+    float rmin[3], rmax[3]; // the right side
+    struct bvh_bin bins[3][BVH_BIN_COUNT];
+    uint32_t left, right;   // counts, then where the chunk's triangles go
+};
+
+// A node small enough to be built by one task, into its own array with the
+// root first and then moved behind the large nodes
+struct bvh_subtree {
+    uint32_t node;
+    uint32_t depth;
+    struct bvh_node *nodes;
+    uint32_t node_count;
+    uint32_t base; // final index of nodes[1]
+};
+
+struct bvh_builder {
+    struct bvhinfo *bvh;
+    const struct scene *scene;
+    struct taskinfo *tasks;
+    uint32_t *instance_tris; // first triangle of every instance
+
+    // the large node being split, in chunks of BVH_CHUNK_TRIS
+    uint32_t first, count;
+    float cmin[3], cmax[3];
+    int axis;
+    float pos;
+    struct bvh_chunk *chunks;
+    struct bvh_triangle *scratch_tris;
+    uint32_t *scratch_instances;
+
+    struct bvh_subtree *subtrees;
+    uint32_t subtree_count;
+};
+
+static void bvh_chunk_range(const struct bvh_builder *builder, uint32_t index,
+                            uint32_t *first, uint32_t *last) {
+    *first = builder->first + index * BVH_CHUNK_TRIS;
+    *last = builder->first + builder->count;
+    if (*last - *first > BVH_CHUNK_TRIS)
+        *last = *first + BVH_CHUNK_TRIS;
+}
+
+// Flattens a chunk of triangles into world space and bounds them
+static void bvh_flatten_task(void *arg, uint32_t index) {
+    struct bvh_builder *builder = arg;
+    struct bvhinfo *bvh = builder->bvh;
+    const struct scene *scene = builder->scene;
+    struct bvh_chunk *chunk = &builder->chunks[index];
+    uint32_t first, last, lo = 0, hi = scene->instance_count, t;
+    float mn[3], mx[3];
+
+    bvh_chunk_range(builder, index, &first, &last);
+    // The last instance that starts at or before the chunk
+    while (hi - lo > 1) {
+        const uint32_t mid = (lo + hi) / 2;
+
+        if (builder->instance_tris[mid] <= first)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    bounds_reset(chunk->min, chunk->max);
+    for (t = first; t < last; t++) {
+        const struct scene_instance *inst;
+        const struct scene_mesh *mesh;
+        const uint32_t *idx;
+        struct bvh_triangle *tri = &bvh->tris[t];
+        float p1[3], p2[3];
+        int k;
+
+        while (builder->instance_tris[lo + 1] <= t)
+            lo++;
+        inst = &scene->instances[lo];
+        mesh = &scene->meshes[inst->mesh];
+        idx = &scene->indices[mesh->first_index +
+                              3 * (t - builder->instance_tris[lo])];
+
+        bvh->tri_instances[t] = lo;
+        tri->i0 = mesh->first_vertex + idx[0];
+        tri->i1 = mesh->first_vertex + idx[1];
+        tri->i2 = mesh->first_vertex + idx[2];
+        transform_point(inst->transform, scene->vertices[tri->i0].pos, tri->v0);
+        transform_point(inst->transform, scene->vertices[tri->i1].pos, p1);
+        transform_point(inst->transform, scene->vertices[tri->i2].pos, p2);
+        for (k = 0; k < 3; k++) {
+            tri->e1[k] = p1[k] - tri->v0[k];
+            tri->e2[k] = p2[k] - tri->v0[k];
+        }
+        tri_bounds(tri, mn, mx);
+        bounds_grow(chunk->min, chunk->max, mn);
+        bounds_grow(chunk->min, chunk->max, mx);
+    }
+}
+
+static void bvh_centroid_task(void *arg, uint32_t index) {
+    struct bvh_builder *builder = arg;
+    struct bvh_chunk *chunk = &builder->chunks[index];
+    uint32_t first, last, i;
+    float c[3];
+
+    bvh_chunk_range(builder, index, &first, &last);
+    bounds_reset(chunk->min, chunk->max);
+    for (i = first; i < last; i++) {
+        tri_centroid(&builder->bvh->tris[i], c);
+        bounds_grow(chunk->min, chunk->max, c);
+    }
+}
+
+static void bvh_bin_task(void *arg, uint32_t index) {
+    struct bvh_builder *builder = arg;
+    uint32_t first, last;
+
+    bvh_chunk_range(builder, index, &first, &last);
+    bins_fill(builder->bvh, first, last - first, builder->cmin, builder->cmax,
+              builder->chunks[index].bins);
+}
+
+static void bvh_count_task(void *arg, uint32_t index) {
+    struct bvh_builder *builder = arg;
+    struct bvh_chunk *chunk = &builder->chunks[index];
+    uint32_t first, last, i;
+    float c[3];
+
+    bvh_chunk_range(builder, index, &first, &last);
+    chunk->left = 0;
+    for (i = first; i < last; i++) {
+        tri_centroid(&builder->bvh->tris[i], c);
+        if (c[builder->axis] < builder->pos)
+            chunk->left++;
+    }
+    chunk->right = last - first - chunk->left;
+}
+
+// Stable partition into the scratch arrays, bounding both sides
+static void bvh_scatter_task(void *arg, uint32_t index) {
+    struct bvh_builder *builder = arg;
+    struct bvhinfo *bvh = builder->bvh;
+    struct bvh_chunk *chunk = &builder->chunks[index];
+    uint32_t first, last, left = chunk->left, right = chunk->right, i;
+    float c[3], mn[3], mx[3];
+
+    bvh_chunk_range(builder, index, &first, &last);
+    bounds_reset(chunk->min, chunk->max);
+    bounds_reset(chunk->rmin, chunk->rmax);
+    for (i = first; i < last; i++) {
+        const struct bvh_triangle *tri = &bvh->tris[i];
+
+        tri_centroid(tri, c);
+        tri_bounds(tri, mn, mx);
+        if (c[builder->axis] < builder->pos) {
+            builder->scratch_tris[left] = *tri;
+            builder->scratch_instances[left++] = bvh->tri_instances[i];
+            bounds_grow(chunk->min, chunk->max, mn);
+            bounds_grow(chunk->min, chunk->max, mx);
+        } else {
+            builder->scratch_tris[right] = *tri;
+            builder->scratch_instances[right++] = bvh->tri_instances[i];
+            bounds_grow(chunk->rmin, chunk->rmax, mn);
+            bounds_grow(chunk->rmin, chunk->rmax, mx);
+        }
+    }
+}
+
+static void bvh_copy_task(void *arg, uint32_t index) {
+    struct bvh_builder *builder = arg;
+    uint32_t first, last;
+
+    bvh_chunk_range(builder, index, &first, &last);
+    memcpy(&builder->bvh->tris[first], &builder->scratch_tris[first],
+           (last - first) * sizeof(struct bvh_triangle));
+    memcpy(&builder->bvh->tri_instances[first],
+           &builder->scratch_instances[first], (last - first) * sizeof(uint32_t));
+}
+
+// The same split as node_find_split with every pass over the triangles in
+// chunk tasks. Returns false when the node stays a leaf.
+static bool bvh_split_large(struct bvh_builder *builder, uint32_t index) {
+    struct bvhinfo *bvh = builder->bvh;
+    struct bvh_node *node = &bvh->nodes[index];
+    const uint32_t chunk_count =
+        (node->count + BVH_CHUNK_TRIS - 1) / BVH_CHUNK_TRIS;
+    struct bvh_bin bins[3][BVH_BIN_COUNT];
+    uint32_t left = 0, right, i, child;
+    int a, b;
+
+    builder->first = node->left_first;
+    builder->count = node->count;
+
+    task_parallel_for(builder->tasks, chunk_count, bvh_centroid_task, builder);
+    bounds_reset(builder->cmin, builder->cmax);
+    for (i = 0; i < chunk_count; i++)
+        bounds_merge(builder->cmin, builder->cmax, builder->chunks[i].min,
+                     builder->chunks[i].max);
+
+    task_parallel_for(builder->tasks, chunk_count, bvh_bin_task, builder);
+    for (a = 0; a < 3; a++) {
+        for (b = 0; b < BVH_BIN_COUNT; b++) {
+            bounds_reset(bins[a][b].min, bins[a][b].max);
+            bins[a][b].count = 0;
+            for (i = 0; i < chunk_count; i++) {
+                const struct bvh_bin *bin = &builder->chunks[i].bins[a][b];
+
+                bounds_merge(bins[a][b].min, bins[a][b].max, bin->min,
+                             bin->max);
+                bins[a][b].count += bin->count;
+            }
+        }
+    }
+    if (!bins_find_split(bins, builder->cmin, builder->cmax,
+                         bounds_area(node->min, node->max) * node->count,
+                         &builder->axis, &builder->pos))
+        return false;
+
+    task_parallel_for(builder->tasks, chunk_count, bvh_count_task, builder);
+    for (i = 0; i < chunk_count; i++)
+        left += builder->chunks[i].left;
+    if (left == 0 || left == node->count)
+        return false;
+    for (i = 0, right = builder->first + left, left = builder->first;
+         i < chunk_count; i++) {
+        struct bvh_chunk *chunk = &builder->chunks[i];
+        const uint32_t l = chunk->left, r = chunk->right;
+
+        chunk->left = left;
+        chunk->right = right;
+        left += l;
+        right += r;
+    }
+    task_parallel_for(builder->tasks, chunk_count, bvh_scatter_task, builder);
+    task_parallel_for(builder->tasks, chunk_count, bvh_copy_task, builder);
+
+    child = bvh->node_count;
+    bvh->node_count += 2;
+    bvh->nodes[child].left_first = builder->first;
+    bvh->nodes[child].count = left - builder->first;
+    bvh->nodes[child + 1].left_first = left;
+    bvh->nodes[child + 1].count = builder->first + builder->count - left;
+    bounds_reset(bvh->nodes[child].min, bvh->nodes[child].max);
+    bounds_reset(bvh->nodes[child + 1].min, bvh->nodes[child + 1].max);
+    for (i = 0; i < chunk_count; i++) {
+        const struct bvh_chunk *chunk = &builder->chunks[i];
+
+        bounds_merge(bvh->nodes[child].min, bvh->nodes[child].max, chunk->min,
+                     chunk->max);
+        bounds_merge(bvh->nodes[child + 1].min, bvh->nodes[child + 1].max,
+                     chunk->rmin, chunk->rmax);
+    }
+    node->left_first = child;
+    node->count = 0;
+    return true;
+}
+
+static void bvh_subtree_task(void *arg, uint32_t index) {
+    struct bvh_builder *builder = arg;
+    struct bvh_subtree *subtree = &builder->subtrees[index];
+    const uint32_t count = builder->bvh->nodes[subtree->node].count;
+    uint32_t *stack = malloc(4 * count * sizeof(uint32_t));
+    struct bvh_node *nodes;
+
+    subtree->nodes = malloc(2 * count * sizeof(struct bvh_node));
+    assert(subtree->nodes && stack);
+    subtree->nodes[0] = builder->bvh->nodes[subtree->node];
+    subtree->node_count = 1;
+    bvh_build_serial(builder->bvh, subtree->nodes, &subtree->node_count, stack,
+                     subtree->depth);
+    free(stack);
+
+    // Only what is used waits for the others to finish
+    nodes = realloc(subtree->nodes,
+                    subtree->node_count * sizeof(struct bvh_node));
+    if (nodes)
+        subtree->nodes = nodes;
+}
+
+static void bvh_stitch_task(void *arg, uint32_t index) {
+    struct bvh_builder *builder = arg;
+    struct bvh_subtree *subtree = &builder->subtrees[index];
+    uint32_t i;
+
+    for (i = 0; i < subtree->node_count; i++) {
+        struct bvh_node *node = i ? &builder->bvh->nodes[subtree->base + i - 1]
+                                  : &builder->bvh->nodes[subtree->node];
+
+        *node = subtree->nodes[i];
+        if (node->count == 0)
+            node->left_first += subtree->base - 1;
+    }
+    free(subtree->nodes);
+}
+
+// Leaves alone, queues a large node for splitting or makes a subtree.
+// large holds node index and depth pairs.
+static void bvh_classify(struct bvh_builder *builder, uint32_t index,
+                         uint32_t depth, uint32_t *large,
+                         uint32_t *large_count) {
+    const uint32_t count = builder->bvh->nodes[index].count;
+
+    if (count <= BVH_MAX_LEAF_TRIS || depth >= BVH_MAX_DEPTH)
+        return;
+    if (count > BVH_TASK_TRIS) {
+        large[(*large_count)++] = index;
+        large[(*large_count)++] = depth;
+    } else {
+        builder->subtrees[builder->subtree_count].node = index;
+        builder->subtrees[builder->subtree_count++].depth = depth;
+    }
+}
+
+void bvh_build(struct bvhinfo *bvh, const struct scene *scene,
+               struct taskinfo *tasks) {
+    struct bvh_builder builder;
+    uint32_t *large;
+    uint32_t large_count = 0, chunk_count;
+    uint32_t i;
+
+    memset(bvh, 0, sizeof(*bvh));
+    memset(&builder, 0, sizeof(builder));
+    builder.bvh = bvh;
+    builder.scene = scene;
+    builder.tasks = tasks;
+
+    builder.instance_tris =
+        malloc((scene->instance_count + 1) * sizeof(uint32_t));
+    assert(builder.instance_tris);
+    for (i = 0; i < scene->instance_count; i++) {
+        builder.instance_tris[i] = bvh->tri_count;
+        bvh->tri_count += scene->meshes[scene->instances[i].mesh].index_count / 3;
+    }
+    builder.instance_tris[i] = bvh->tri_count;
+
+    bvh->tris = malloc((bvh->tri_count ? bvh->tri_count : 1) *
+                       sizeof(struct bvh_triangle));
+    bvh->tri_instances = malloc((bvh->tri_count ? bvh->tri_count : 1) *
+                                sizeof(uint32_t));
+    // A binary tree over n leaves never needs more than 2n - 1 nodes
+    bvh->nodes = malloc((bvh->tri_count ? 2 * bvh->tri_count : 1) *
+                        sizeof(struct bvh_node));
+    chunk_count = (bvh->tri_count + BVH_CHUNK_TRIS - 1) / BVH_CHUNK_TRIS;
+    builder.chunks = malloc((chunk_count ? chunk_count : 1) *
+                            sizeof(struct bvh_chunk));
+    // Subtrees are disjoint and hold more than a leaf each
+    builder.subtrees = malloc((bvh->tri_count / (BVH_MAX_LEAF_TRIS + 1) + 1) *
+                              sizeof(struct bvh_subtree));
+    large = malloc((4 * (bvh->tri_count / BVH_TASK_TRIS) + 2) *
+                   sizeof(uint32_t));
+    assert(bvh->tris && bvh->tri_instances && bvh->nodes && builder.chunks &&
+           builder.subtrees && large);
+
+    // Flatten the instances into world space triangles
+    builder.first = 0;
+    builder.count = bvh->tri_count;
+    task_parallel_for(tasks, chunk_count, bvh_flatten_task, &builder);
+
+    bvh->node_count = 1;
+    bvh->nodes[0].left_first = 0;
+    bvh->nodes[0].count = bvh->tri_count;
+    bounds_reset(bvh->nodes[0].min, bvh->nodes[0].max);
+    for (i = 0; i < chunk_count; i++)
+        bounds_merge(bvh->nodes[0].min, bvh->nodes[0].max,
+                     builder.chunks[i].min, builder.chunks[i].max);
+
+    // The top of the tree one node at a time with data parallel passes,
+    // then every subtree below it as a task
+    bvh_classify(&builder, 0, 0, large, &large_count);
+    if (large_count) {
+        builder.scratch_tris =
+            malloc(bvh->tri_count * sizeof(struct bvh_triangle));
+        builder.scratch_instances = malloc(bvh->tri_count * sizeof(uint32_t));
+        assert(builder.scratch_tris && builder.scratch_instances);
+    }
+    while (large_count) {
+        const uint32_t depth = large[--large_count];
+        const uint32_t index = large[--large_count];
+
+        if (!bvh_split_large(&builder, index))
+            continue;
+        bvh_classify(&builder, bvh->nodes[index].left_first, depth + 1, large,
+                     &large_count);
+        bvh_classify(&builder, bvh->nodes[index].left_first + 1, depth + 1,
+                     large, &large_count);
+    }
+    free(builder.scratch_tris);
+    free(builder.scratch_instances);
+
+    task_parallel_for(tasks, builder.subtree_count, bvh_subtree_task,
+                      &builder);
+    for (i = 0; i < builder.subtree_count; i++) {
+        builder.subtrees[i].base = bvh->node_count;
+        bvh->node_count += builder.subtrees[i].node_count - 1;
+    }
+    task_parallel_for(tasks, builder.subtree_count, bvh_stitch_task,
+                      &builder);
+
+    free(large);
+    free(builder.subtrees);
+    free(builder.chunks);
+    free(builder.instance_tris);
+}
+
+void bvh_free(struct bvhinfo *bvh) {
+    if (!bvh->borrowed) {
+        free(bvh->nodes);
+        free(bvh->tris);
+        free(bvh->tri_instances);
+    }
+    memset(bvh, 0, sizeof(*bvh));
+}
@@ -0,0 +1,55 @@
+#ifndef BVH_H
+#define BVH_H
+
+// Compute-shader BVH used when the KHR acceleration structure path is not
+// available. Layouts match the std430 structs in shaders/trace.comp.
+
+#define BVH_MAX_LEAF_TRIS 4
+#define BVH_BIN_COUNT 12
+// Nodes with more triangles are split by all workers together, a chunk of
+// triangles per task; smaller ones become a subtree task each. Both shape
+// the result, which does not depend on the thread count.
+#define BVH_TASK_TRIS 65536
+#define BVH_CHUNK_TRIS 16384
+// Nodes this deep stay leaves however many triangles they hold, so the
+// traversal stack in shaders/trace.comp, sized by this, never overflows
+#define BVH_MAX_DEPTH 32
+
+// count == 0: inner node, children at left_first and left_first + 1
+// count > 0: leaf, triangles [left_first, left_first + count)
+struct bvh_node {
+    float min[3];
+    uint32_t left_first;
+    float max[3];
+    uint32_t count;
+};
+
+// World space triangle with precomputed edges, the vertex indices are
+// absolute so shading can fetch normals and texcoords directly
+struct bvh_triangle {
+    float v0[3];
+    uint32_t i0;
+    float e1[3];
+    uint32_t i1;
+    float e2[3];
+    uint32_t i2;
+};
+
+struct bvhinfo {
+    struct bvh_node *nodes;
+    uint32_t node_count;
+    struct bvh_triangle *tris;
+    uint32_t tri_count;
+    uint32_t *tri_instances; // instance of each triangle, for the ID AOV
+    bool borrowed; // prebuilt, nodes and tris belong to a scene file mapping
+};
+
+struct scene;
+struct taskinfo;
+
+void bvh_build(struct bvhinfo *bvh, const struct scene *scene,
+               struct taskinfo *tasks);
+
+void bvh_free(struct bvhinfo *bvh);
+
+#endif
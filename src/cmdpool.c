@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "task.h"
+#include "cmdpool.h"
+
+struct cmd_record_task {
+    struct renderinfo *render;
+    struct cmd_frame *frame;
+    void (*record)(void *arg, uint32_t index, VkCommandBuffer cmd);
+    void *arg;
+};
+
+static VkCommandPool cmd_create_pool(struct renderinfo *render) {
+    const VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = render->graphics_queue_node_index,
+    };
+    VkCommandPool pool;
+    VkResult err;
+
+    err = vkCreateCommandPool(render->device, &pool_info, NULL, &pool);
+    assert(!err);
+    return pool;
+}
+
+void cmd_frame_init(struct renderinfo *render, struct cmd_frame *frame) {
+    uint32_t i;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->tasks = render->tasks;
+    frame->thread_count = task_thread_count(render->tasks);
+    frame->threads = calloc(frame->thread_count, sizeof(struct cmd_thread));
+    assert(frame->threads);
+    for (i = 0; i < frame->thread_count; i++)
+        frame->threads[i].pool = cmd_create_pool(render);
+
+    frame->pool = cmd_create_pool(render);
+    const VkCommandBufferAllocateInfo cmd_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext = NULL,
+        .commandPool = frame->pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VkResult err;
+
+    err = vkAllocateCommandBuffers(render->device, &cmd_info, &frame->cmd);
+    assert(!err);
+}
+
+VkCommandBuffer cmd_frame_begin(struct renderinfo *render,
+                                struct cmd_frame *frame) {
+    const VkCommandBufferBeginInfo cmd_buf_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL,
+    };
+    uint32_t i;
+    VkResult err;
+
+    // Pools nobody recorded into since the last reset are left alone
+    for (i = 0; i < frame->thread_count; i++) {
+        struct cmd_thread *thread = &frame->threads[i];
+
+        if (thread->used == 0)
+            continue;
+        err = vkResetCommandPool(render->device, thread->pool, 0);
+        assert(!err);
+        thread->used = 0;
+    }
+    err = vkResetCommandPool(render->device, frame->pool, 0);
+    assert(!err);
+
+    err = vkBeginCommandBuffer(frame->cmd, &cmd_buf_info);
+    assert(!err);
+    return frame->cmd;
+}
+
+// Runs on the worker that took the pass, only that worker's pool is touched
+static void cmd_record_pass(void *arg, uint32_t index) {
+    const struct cmd_record_task *task = arg;
+    struct cmd_frame *frame = task->frame;
+    struct cmd_thread *thread =
+        &frame->threads[task_worker_index(frame->tasks)];
+    const VkCommandBufferInheritanceInfo inheritance = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = NULL,
+        .renderPass = VK_NULL_HANDLE,
+        .subpass = 0,
+        .framebuffer = VK_NULL_HANDLE,
+        .occlusionQueryEnable = VK_FALSE,
+        .queryFlags = 0,
+        .pipelineStatistics = 0,
+    };
+    const VkCommandBufferBeginInfo cmd_buf_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = &inheritance,
+    };
+    VkCommandBuffer cmd;
+    VkResult err;
+
+    if (thread->used == thread->buffer_count) {
+        const uint32_t count = thread->buffer_count ? thread->buffer_count : 4;
+        const VkCommandBufferAllocateInfo cmd_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext = NULL,
+            .commandPool = thread->pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = count,
+        };
+        VkCommandBuffer *grown =
+            realloc(thread->buffers,
+                    (thread->buffer_count + count) * sizeof(VkCommandBuffer));
+
+        assert(grown);
+        thread->buffers = grown;
+        err = vkAllocateCommandBuffers(task->render->device, &cmd_info,
+                                       &thread->buffers[thread->buffer_count]);
+        assert(!err);
+        thread->buffer_count += count;
+    }
+    cmd = thread->buffers[thread->used++];
+
+    err = vkBeginCommandBuffer(cmd, &cmd_buf_info);
+    assert(!err);
+    task->record(task->arg, index, cmd);
+    err = vkEndCommandBuffer(cmd);
+    assert(!err);
+    frame->passes[index] = cmd;
+}
+
+void cmd_frame_record(struct renderinfo *render, struct cmd_frame *frame,
+                      uint32_t pass_count,
+                      void (*record)(void *arg, uint32_t index,
+                                     VkCommandBuffer cmd),
+                      void *arg) {
+    struct cmd_record_task task = {render, frame, record, arg};
+
+    if (pass_count == 0)
+        return;
+    if (pass_count > frame->pass_capacity) {
+        free(frame->passes);
+        frame->passes = malloc(pass_count * sizeof(VkCommandBuffer));
+        assert(frame->passes);
+        frame->pass_capacity = pass_count;
+    }
+
+    task_parallel_for(frame->tasks, pass_count, cmd_record_pass, &task);
+    vkCmdExecuteCommands(frame->cmd, pass_count, frame->passes);
+}
+
+void cmd_frame_end(struct cmd_frame *frame) {
+    VkResult err;
+
+    err = vkEndCommandBuffer(frame->cmd);
+    assert(!err);
+}
+
+void cmd_frame_cleanup(struct renderinfo *render, struct cmd_frame *frame) {
+    uint32_t i;
+
+    // Destroying a pool frees the buffers allocated from it
+    for (i = 0; i < frame->thread_count; i++) {
+        vkDestroyCommandPool(render->device, frame->threads[i].pool, NULL);
+        free(frame->threads[i].buffers);
+    }
+    vkDestroyCommandPool(render->device, frame->pool, NULL);
+    free(frame->threads);
+    free(frame->passes);
+    memset(frame, 0, sizeof(*frame));
+}
@@ -0,0 +1,54 @@
+#ifndef CMDPOOL_H
+#define CMDPOOL_H
+
+// Command buffers of one submit, recorded on the task workers. A cmd_frame
+// has a command pool for every worker thread, so no two threads ever share
+// a pool, and one for the primary buffer that is submitted. Everything is
+// transient: cmd_frame_begin resets each pool with a single call instead of
+// resetting buffers one by one, so the submit recorded last must be done
+// by then. Anything that can have several submits in flight keeps a
+// cmd_frame for each.
+//
+// Between begin and end the calling thread records into the primary
+// directly and hands lists of independent passes to cmd_frame_record. Each
+// pass goes into a secondary buffer on whichever worker runs it, the
+// primary then executes them in list order. Passes run concurrently, so a
+// pass may only read host state that other passes leave alone; whatever
+// they depend on is worked out before recording.
+
+struct cmd_thread {
+    VkCommandPool pool;
+    VkCommandBuffer *buffers; // secondaries, allocated as they are needed
+    uint32_t buffer_count;
+    uint32_t used; // since the last reset
+};
+
+struct cmd_frame {
+    struct taskinfo *tasks;
+    VkCommandPool pool; // of the primary
+    VkCommandBuffer cmd; // primary
+    uint32_t thread_count;
+    struct cmd_thread *threads;
+    VkCommandBuffer *passes; // secondaries of the passes being recorded
+    uint32_t pass_capacity;
+};
+
+void cmd_frame_init(struct renderinfo *render, struct cmd_frame *frame);
+
+// Resets the pools and begins the primary, which is returned
+VkCommandBuffer cmd_frame_begin(struct renderinfo *render,
+                                struct cmd_frame *frame);
+
+// Records pass_count passes in parallel, record is called for every index
+// with a begun secondary buffer, and appends them to the primary
+void cmd_frame_record(struct renderinfo *render, struct cmd_frame *frame,
+                      uint32_t pass_count,
+                      void (*record)(void *arg, uint32_t index,
+                                     VkCommandBuffer cmd),
+                      void *arg);
+
+void cmd_frame_end(struct cmd_frame *frame);
+
+void cmd_frame_cleanup(struct renderinfo *render, struct cmd_frame *frame);
+
+#endif
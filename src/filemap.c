@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "filemap.h"
+
+void *file_map(const char *path, size_t *size) {
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    void *data;
+    long length;
+
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = length > 0 ? malloc(length) : NULL;
+    if (data && fread(data, 1, length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = length;
+    return data;
+#else
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    // Most users walk the file once front to back, start reading ahead
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    madvise(map, st.st_size, MADV_WILLNEED);
+    *size = st.st_size;
+    return map;
+#endif
+}
+
+void file_unmap(void *map, size_t size) {
+#ifdef _WIN32
+    free(map);
+#else
+    munmap(map, size);
+#endif
+}
@@ -0,0 +1,11 @@
+#ifndef FILEMAP_H
+#define FILEMAP_H
+
+// Read-only view of a whole file. The mapping is private and writable, so
+// callers may patch it in place; pages are copied only when that happens.
+
+void *file_map(const char *path, size_t *size);
+
+void file_unmap(void *map, size_t size);
+
+#endif
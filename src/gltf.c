@@ -0,0 +1,1195 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "filemap.h"
+#include "hash.h"
+#include "task.h"
+#include "gltf.h"
+
+#define GLB_MAGIC 0x46546c67 // "glTF"
+#define GLB_CHUNK_JSON 0x4e4f534a
+#define GLB_CHUNK_BIN 0x004e4942
+
+#define GLTF_MODE_TRIANGLES 4
+#define GLTF_BYTE 5120
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_SHORT 5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+
+#define JSON_MAX_DEPTH 64
+
+enum json_type {
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_PRIMITIVE,
+};
+
+// Tokens are stored in document order, an object's children alternate
+// between keys and values
+struct json_token {
+    uint32_t type;
+    uint32_t start, end; // string tokens exclude the quotes
+    uint32_t size;       // direct children
+    uint32_t next;       // first token after this one's subtree
+    uint32_t items;      // arrays: where their elements start in items
+};
+
+struct gltf_buffer {
+    const uint8_t *data;
+    size_t size;
+    void *map;  // external file, unmapped on close
+    void *heap; // decoded data: URI, freed on close
+};
+
+// A resolved accessor, element i starts at data + i * stride
+struct gltf_view {
+    const uint8_t *data;
+    uint32_t count;
+    uint32_t stride;
+    uint32_t components;
+    uint32_t component_type;
+    bool normalized;
+};
+
+struct gltf_primitive {
+    uint32_t mesh; // glTF mesh
+    uint32_t material;
+    struct gltf_view position, normal, texcoord, index;
+    bool has_normal, has_texcoord, has_index;
+};
+
+struct json_parser {
+    const char *text;
+    size_t pos, size;
+    struct json_token *tokens;
+    uint32_t count, cap;
+};
+
+static void json_skip_space(struct json_parser *json) {
+    while (json->pos < json->size &&
+           (json->text[json->pos] == ' ' || json->text[json->pos] == '\t' ||
+            json->text[json->pos] == '\r' || json->text[json->pos] == '\n'))
+        json->pos++;
+}
+
+static int64_t json_add(struct json_parser *json, uint32_t type) {
+    if (json->count == json->cap) {
+        const uint32_t cap = json->cap ? json->cap * 2 : 256;
+        struct json_token *tokens = realloc(json->tokens, cap * sizeof(*tokens));
+
+        if (!tokens)
+            return -1;
+        json->tokens = tokens;
+        json->cap = cap;
+    }
+    memset(&json->tokens[json->count], 0, sizeof(struct json_token));
+    json->tokens[json->count].type = type;
+    json->tokens[json->count].start = (uint32_t)json->pos;
+    return json->count++;
+}
+
+static bool json_value(struct json_parser *json, int depth) {
+    int64_t t;
+    char c;
+
+    json_skip_space(json);
+    if (json->pos >= json->size || depth > JSON_MAX_DEPTH)
+        return false;
+    c = json->text[json->pos];
+
+    if (c == '{' || c == '[') {
+        const bool object = c == '{';
+        const char close = object ? '}' : ']';
+
+        t = json_add(json, object ? JSON_OBJECT : JSON_ARRAY);
+        if (t < 0)
+            return false;
+        json->pos++;
+        json_skip_space(json);
+        if (json->pos < json->size && json->text[json->pos] == close) {
+            json->pos++;
+        } else {
+            for (;;) {
+                if (object) {
+                    json_skip_space(json);
+                    if (json->pos >= json->size || json->text[json->pos] != '"' ||
+                        !json_value(json, depth + 1))
+                        return false;
+                    json_skip_space(json);
+                    if (json->pos >= json->size || json->text[json->pos] != ':')
+                        return false;
+                    json->pos++;
+                    json->tokens[t].size++;
+                }
+                if (!json_value(json, depth + 1))
+                    return false;
+                json->tokens[t].size++;
+
+                json_skip_space(json);
+                if (json->pos >= json->size)
+                    return false;
+                c = json->text[json->pos++];
+                if (c == close)
+                    break;
+                if (c != ',')
+                    return false;
+            }
+        }
+        json->tokens[t].end = (uint32_t)json->pos;
+    } else if (c == '"') {
+        json->pos++;
+        t = json_add(json, JSON_STRING);
+        if (t < 0)
+            return false;
+        while (json->pos < json->size && json->text[json->pos] != '"')
+            json->pos += json->text[json->pos] == '\\' ? 2 : 1;
+        if (json->pos >= json->size)
+            return false;
+        json->tokens[t].end = (uint32_t)json->pos++;
+    } else {
+        t = json_add(json, JSON_PRIMITIVE);
+        if (t < 0)
+            return false;
+        while (json->pos < json->size &&
+               !strchr(",]} \t\r\n", json->text[json->pos]))
+            json->pos++;
+        json->tokens[t].end = (uint32_t)json->pos;
+        if (json->tokens[t].end == json->tokens[t].start)
+            return false;
+    }
+
+    json->tokens[t].next = json->count;
+    return true;
+}
+
+static bool json_equals(const struct gltf_file *file, int64_t t,
+                        const char *str) {
+    const struct json_token *token;
+
+    if (t < 0)
+        return false;
+    token = &file->tokens[t];
+    return token->type == JSON_STRING &&
+           strlen(str) == token->end - token->start &&
+           memcmp(file->json + token->start, str, token->end - token->start) == 0;
+}
+
+// Value of key in object t, -1 when t is not an object or has no such key
+static int64_t json_get(const struct gltf_file *file, int64_t t,
+                        const char *key) {
+    uint32_t child;
+
+    if (t < 0 || file->tokens[t].type != JSON_OBJECT)
+        return -1;
+    for (child = t + 1; child < file->tokens[t].next;
+         child = file->tokens[child + 1].next) {
+        if (json_equals(file, child, key))
+            return child + 1;
+    }
+    return -1;
+}
+
+static uint32_t json_count(const struct gltf_file *file, int64_t t) {
+    return t >= 0 && file->tokens[t].type == JSON_ARRAY ? file->tokens[t].size
+                                                        : 0;
+}
+
+// Element i of array t, -1 when out of range
+static int64_t json_at(const struct gltf_file *file, int64_t t, uint32_t i) {
+    if (i >= json_count(file, t))
+        return -1;
+    return file->items[file->tokens[t].items + i];
+}
+
+// Lists every array's elements so json_at does not have to walk siblings,
+// large scenes index arrays of a hundred thousand nodes
+static bool json_index_arrays(struct gltf_file *file) {
+    uint32_t count = 0;
+    uint32_t t, child, i;
+
+    for (t = 0; t < file->token_count; t++) {
+        if (file->tokens[t].type == JSON_ARRAY) {
+            file->tokens[t].items = count;
+            count += file->tokens[t].size;
+        }
+    }
+    file->items = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!file->items)
+        return false;
+    for (t = 0; t < file->token_count; t++) {
+        if (file->tokens[t].type != JSON_ARRAY)
+            continue;
+        for (i = 0, child = t + 1; i < file->tokens[t].size; i++) {
+            file->items[file->tokens[t].items + i] = child;
+            child = file->tokens[child].next;
+        }
+    }
+    return true;
+}
+
+static double json_number(const struct gltf_file *file, int64_t t,
+                          double fallback) {
+    char buf[64];
+    size_t length;
+
+    if (t < 0 || file->tokens[t].type != JSON_PRIMITIVE)
+        return fallback;
+    length = file->tokens[t].end - file->tokens[t].start;
+    if (length >= sizeof(buf))
+        return fallback;
+    memcpy(buf, file->json + file->tokens[t].start, length);
+    buf[length] = '\0';
+    return strtod(buf, NULL);
+}
+
+static bool json_bool(const struct gltf_file *file, int64_t t) {
+    return t >= 0 && file->tokens[t].type == JSON_PRIMITIVE &&
+           file->json[file->tokens[t].start] == 't';
+}
+
+// Index properties, -1 when absent or not a valid index
+static int64_t json_index(const struct gltf_file *file, int64_t t) {
+    const double value = json_number(file, t, -1.0);
+    return value >= 0.0 && value <= UINT32_MAX ? (int64_t)value : -1;
+}
+
+static double json_get_number(const struct gltf_file *file, int64_t t,
+                              const char *key, double fallback) {
+    return json_number(file, json_get(file, t, key), fallback);
+}
+
+static int64_t json_get_index(const struct gltf_file *file, int64_t t,
+                              const char *key) {
+    return json_index(file, json_get(file, t, key));
+}
+
+static void json_floats(const struct gltf_file *file, int64_t t, float *out,
+                        uint32_t count) {
+    uint32_t i;
+
+    if (json_count(file, t) != count)
+        return;
+    for (i = 0; i < count; i++)
+        out[i] = (float)json_number(file, json_at(file, t, i), out[i]);
+}
+
+static int64_t gltf_element(const struct gltf_file *file, const char *array,
+                            int64_t index) {
+    return index < 0 ? -1 : json_at(file, json_get(file, 0, array), index);
+}
+
+static int base64_value(char c) {
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '+')
+        return 62;
+    if (c == '/')
+        return 63;
+    return -1;
+}
+
+static bool gltf_decode_base64(struct gltf_buffer *buffer, const char *text,
+                               size_t length) {
+    uint8_t *out = malloc(length / 4 * 3 + 3);
+    uint32_t bits = 0;
+    int have = 0;
+    size_t i, size = 0;
+
+    if (!out)
+        return false;
+    for (i = 0; i < length && text[i] != '='; i++) {
+        const int v = base64_value(text[i]);
+
+        if (v < 0) {
+            free(out);
+            return false;
+        }
+        bits = bits << 6 | (uint32_t)v;
+        have += 6;
+        if (have >= 8) {
+            have -= 8;
+            out[size++] = (uint8_t)(bits >> have);
+        }
+    }
+    buffer->heap = out;
+    buffer->data = out;
+    buffer->size = size;
+    return true;
+}
+
+// URIs may be percent encoded, out needs room for length + 1 bytes
+static size_t gltf_decode_uri(char *out, const char *uri, size_t length) {
+    size_t i, n = 0;
+
+    for (i = 0; i < length; i++) {
+        unsigned int c;
+
+        if (uri[i] == '%' && i + 2 < length &&
+            sscanf(uri + i + 1, "%2x", &c) == 1) {
+            out[n++] = (char)c;
+            i += 2;
+        } else {
+            out[n++] = uri[i];
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// Buffer URIs are relative to the glTF file
+static bool gltf_map_uri(struct gltf_buffer *buffer, const char *base,
+                         const char *uri, size_t length) {
+    const char *slash = strrchr(base, '/');
+    const size_t dir = slash ? (size_t)(slash + 1 - base) : 0;
+    char *path = malloc(dir + length + 1);
+
+    if (!path)
+        return false;
+    memcpy(path, base, dir);
+    gltf_decode_uri(path + dir, uri, length);
+
+    buffer->map = file_map(path, &buffer->size);
+    buffer->data = buffer->map;
+    if (!buffer->map)
+        fprintf(stderr, "Could not map glTF buffer %s\n", path);
+    free(path);
+    return buffer->map != NULL;
+}
+
+bool gltf_open(struct gltf_file *file, const void *data, size_t size,
+               const char *path) {
+    const uint8_t *bytes = data;
+    struct json_parser json;
+    const uint8_t *bin = NULL;
+    size_t bin_size = 0;
+    int64_t buffers;
+    uint32_t i;
+
+    memset(file, 0, sizeof(*file));
+    file->path = path;
+    file->json = data;
+    file->json_size = size;
+
+    if (size >= 12 && *(const uint32_t *)bytes == GLB_MAGIC) {
+        const uint32_t *header = data;
+        uint32_t chunk_size;
+
+        // header: magic, version, length, then JSON and optional BIN chunks
+        if (header[1] != 2 || header[2] > size || header[2] < 20 ||
+            header[4] != GLB_CHUNK_JSON || header[3] > header[2] - 20) {
+            fprintf(stderr, "%s: not a glTF 2.0 binary\n", path);
+            return false;
+        }
+        file->json = (const char *)bytes + 20;
+        file->json_size = header[3];
+        size = header[2];
+
+        i = 20 + ((header[3] + 3) & ~3u);
+        if (i + 8 <= size) {
+            memcpy(&chunk_size, bytes + i, sizeof(chunk_size));
+            if (*(const uint32_t *)(bytes + i + 4) == GLB_CHUNK_BIN &&
+                chunk_size <= size - i - 8) {
+                bin = bytes + i + 8;
+                bin_size = chunk_size;
+            }
+        }
+    }
+
+    memset(&json, 0, sizeof(json));
+    json.text = file->json;
+    json.size = file->json_size;
+    if (json.size > UINT32_MAX || !json_value(&json, 0) ||
+        json.tokens[0].type != JSON_OBJECT) {
+        fprintf(stderr, "%s: malformed glTF JSON\n", path);
+        free(json.tokens);
+        return false;
+    }
+    file->tokens = json.tokens;
+    file->token_count = json.count;
+    if (!json_index_arrays(file))
+        goto fail;
+
+    if (!json_equals(file, json_get(file, json_get(file, 0, "asset"), "version"),
+                     "2.0")) {
+        fprintf(stderr, "%s: only glTF 2.0 is supported\n", path);
+        goto fail;
+    }
+
+    buffers = json_get(file, 0, "buffers");
+    file->buffer_count = json_count(file, buffers);
+    file->buffers = calloc(file->buffer_count ? file->buffer_count : 1,
+                           sizeof(struct gltf_buffer));
+    if (!file->buffers)
+        goto fail;
+    for (i = 0; i < file->buffer_count; i++) {
+        const int64_t buffer = json_at(file, buffers, i);
+        const int64_t uri = json_get(file, buffer, "uri");
+        const double length = json_get_number(file, buffer, "byteLength", -1.0);
+        struct gltf_buffer *out = &file->buffers[i];
+
+        if (uri < 0) {
+            // Only the first buffer of a .glb may leave out its URI
+            if (i != 0 || !bin) {
+                fprintf(stderr, "%s: buffer %u has no data\n", path, i);
+                goto fail;
+            }
+            out->data = bin;
+            out->size = bin_size;
+        } else {
+            const char *text = file->json + file->tokens[uri].start;
+            const char *text_end = file->json + file->tokens[uri].end;
+            const char *comma = memchr(text, ',', text_end - text);
+
+            if (text_end - text > 5 && memcmp(text, "data:", 5) == 0) {
+                if (!comma || comma - text < 7 ||
+                    memcmp(comma - 7, ";base64", 7) != 0 ||
+                    !gltf_decode_base64(out, comma + 1, text_end - comma - 1)) {
+                    fprintf(stderr, "%s: buffer %u has a bad data URI\n", path,
+                            i);
+                    goto fail;
+                }
+            } else if (!gltf_map_uri(out, path, text, text_end - text)) {
+                goto fail;
+            }
+        }
+        if (length < 0.0 || length > out->size) {
+            fprintf(stderr, "%s: buffer %u is shorter than its byteLength\n",
+                    path, i);
+            goto fail;
+        }
+        out->size = (size_t)length;
+    }
+    return true;
+
+fail:
+    gltf_close(file);
+    return false;
+}
+
+uint64_t gltf_hash_buffers(const struct gltf_file *file, uint64_t hash) {
+    uint32_t i;
+
+    for (i = 0; i < file->buffer_count; i++) {
+        if (file->buffers[i].map)
+            hash = hash64(file->buffers[i].data, file->buffers[i].size, hash);
+    }
+    return hash;
+}
+
+uint64_t gltf_hash_images(const struct gltf_file *file, uint64_t hash) {
+    const int64_t images = json_get(file, 0, "images");
+    const uint32_t count = json_count(file, images);
+    const char *slash = strrchr(file->path, '/');
+    const size_t dir = slash ? (size_t)(slash + 1 - file->path) : 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        const int64_t uri = json_get(file, json_at(file, images, i), "uri");
+        const char *text;
+        size_t length, prefix, size;
+        char *path;
+        void *map;
+
+        if (uri < 0 || file->tokens[uri].type != JSON_STRING)
+            continue;
+        text = file->json + file->tokens[uri].start;
+        length = file->tokens[uri].end - file->tokens[uri].start;
+        if (length > 5 && memcmp(text, "data:", 5) == 0)
+            continue;
+
+        // Resolved the way the renderer and the baker look textures up
+        prefix = text[0] == '/' ? 0 : dir;
+        path = malloc(prefix + length + 1);
+        assert(path);
+        memcpy(path, file->path, prefix);
+        gltf_decode_uri(path + prefix, text, length);
+
+        // A missing image hashes differently from any contents, so one
+        // that appears later changes the hash as well
+        map = file_map(path, &size);
+        if (map) {
+            hash = hash64(map, size, hash);
+            file_unmap(map, size);
+        } else {
+            hash = hash64_combine(hash, UINT64_MAX);
+        }
+        free(path);
+    }
+    return hash;
+}
+
+void gltf_close(struct gltf_file *file) {
+    uint32_t i;
+
+    for (i = 0; i < file->buffer_count; i++) {
+        if (file->buffers[i].map)
+            file_unmap(file->buffers[i].map, file->buffers[i].size);
+        free(file->buffers[i].heap);
+    }
+    free(file->buffers);
+    free(file->tokens);
+    free(file->items);
+    memset(file, 0, sizeof(*file));
+}
+
+static uint32_t gltf_index_count(const struct gltf_primitive *prim) {
+    const uint32_t count =
+        prim->has_index ? prim->index.count : prim->position.count;
+    return count / 3 * 3;
+}
+
+static uint32_t gltf_component_size(uint32_t type) {
+    switch (type) {
+    case GLTF_BYTE:
+    case GLTF_UNSIGNED_BYTE:
+        return 1;
+    case GLTF_SHORT:
+    case GLTF_UNSIGNED_SHORT:
+        return 2;
+    case GLTF_UNSIGNED_INT:
+    case GLTF_FLOAT:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static uint32_t gltf_type_components(const struct gltf_file *file, int64_t t) {
+    static const struct {
+        const char *name;
+        uint32_t components;
+    } types[] = {{"SCALAR", 1}, {"VEC2", 2}, {"VEC3", 3}, {"VEC4", 4},
+                 {"MAT2", 4},   {"MAT3", 9}, {"MAT4", 16}};
+    uint32_t i;
+
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (json_equals(file, t, types[i].name))
+            return types[i].components;
+    }
+    return 0;
+}
+
+// Sparse accessors and accessors without a buffer view are not supported
+static bool gltf_accessor(const struct gltf_file *file, int64_t index,
+                          struct gltf_view *view) {
+    const int64_t accessor = gltf_element(file, "accessors", index);
+    const int64_t buffer_view = gltf_element(
+        file, "bufferViews", json_get_index(file, accessor, "bufferView"));
+    const struct gltf_buffer *buffer;
+    uint64_t view_offset, view_length, offset, element;
+    int64_t buffer_index;
+
+    if (accessor < 0 || buffer_view < 0 ||
+        json_get(file, accessor, "sparse") >= 0)
+        return false;
+
+    memset(view, 0, sizeof(*view));
+    view->count = (uint32_t)json_get_index(file, accessor, "count");
+    view->component_type =
+        (uint32_t)json_get_index(file, accessor, "componentType");
+    view->components =
+        gltf_type_components(file, json_get(file, accessor, "type"));
+    view->normalized = json_bool(file, json_get(file, accessor, "normalized"));
+    element = (uint64_t)gltf_component_size(view->component_type) *
+              view->components;
+    if (element == 0 || json_get_index(file, accessor, "count") < 1)
+        return false;
+
+    buffer_index = json_get_index(file, buffer_view, "buffer");
+    if (buffer_index < 0 || buffer_index >= file->buffer_count)
+        return false;
+    buffer = &file->buffers[buffer_index];
+    view_offset = (uint64_t)json_get_number(file, buffer_view, "byteOffset", 0.0);
+    view_length = (uint64_t)json_get_number(file, buffer_view, "byteLength", 0.0);
+    offset = (uint64_t)json_get_number(file, accessor, "byteOffset", 0.0);
+    view->stride =
+        (uint32_t)json_get_number(file, buffer_view, "byteStride", 0.0);
+    if (view->stride == 0)
+        view->stride = (uint32_t)element;
+
+    if (view_offset > buffer->size || view_length > buffer->size - view_offset ||
+        offset + (uint64_t)view->stride * (view->count - 1) + element >
+            view_length)
+        return false;
+    view->data = buffer->data + view_offset + offset;
+    return true;
+}
+
+static float gltf_read_float(const struct gltf_view *view, uint32_t i,
+                             uint32_t c) {
+    const uint8_t *p = view->data + (size_t)i * view->stride +
+                       c * gltf_component_size(view->component_type);
+    float f;
+    uint16_t u16;
+    int16_t s16;
+    uint32_t u32;
+
+    switch (view->component_type) {
+    case GLTF_FLOAT:
+        memcpy(&f, p, sizeof(f));
+        return f;
+    case GLTF_UNSIGNED_BYTE:
+        return view->normalized ? p[0] / 255.0f : p[0];
+    case GLTF_BYTE:
+        return view->normalized ? fmaxf((int8_t)p[0] / 127.0f, -1.0f)
+                                : (int8_t)p[0];
+    case GLTF_UNSIGNED_SHORT:
+        memcpy(&u16, p, sizeof(u16));
+        return view->normalized ? u16 / 65535.0f : u16;
+    case GLTF_SHORT:
+        memcpy(&s16, p, sizeof(s16));
+        return view->normalized ? fmaxf(s16 / 32767.0f, -1.0f) : s16;
+    default:
+        memcpy(&u32, p, sizeof(u32));
+        return (float)u32;
+    }
+}
+
+static uint32_t gltf_read_index(const struct gltf_view *view, uint32_t i) {
+    const uint8_t *p = view->data + (size_t)i * view->stride;
+    uint16_t u16;
+    uint32_t u32;
+
+    switch (view->component_type) {
+    case GLTF_UNSIGNED_BYTE:
+        return p[0];
+    case GLTF_UNSIGNED_SHORT:
+        memcpy(&u16, p, sizeof(u16));
+        return u16;
+    default:
+        memcpy(&u32, p, sizeof(u32));
+        return u32;
+    }
+}
+
+// True when the attributes are interleaved exactly like scene_vertex, so a
+// primitive's vertices can be copied as one block
+static bool gltf_matches_vertex(const struct gltf_primitive *prim) {
+    const struct gltf_view *p = &prim->position;
+
+    return prim->has_normal && prim->has_texcoord &&
+           p->component_type == GLTF_FLOAT &&
+           prim->normal.component_type == GLTF_FLOAT &&
+           prim->texcoord.component_type == GLTF_FLOAT &&
+           prim->texcoord.components == 2 &&
+           p->stride == sizeof(struct scene_vertex) &&
+           prim->normal.stride == sizeof(struct scene_vertex) &&
+           prim->texcoord.stride == sizeof(struct scene_vertex) &&
+           prim->normal.data == p->data + offsetof(struct scene_vertex, normal) &&
+           prim->texcoord.data == p->data + offsetof(struct scene_vertex, uv);
+}
+
+static bool gltf_check_view(const struct gltf_view *view, uint32_t count,
+                            uint32_t min_components) {
+    return view->count == count && view->components >= min_components &&
+           view->components <= 4;
+}
+
+static bool gltf_collect_primitive(const struct gltf_file *file, int64_t prim,
+                                   uint32_t mesh, struct gltf_primitive *out) {
+    const int64_t attributes = json_get(file, prim, "attributes");
+    const int64_t mode = json_get(file, prim, "mode");
+    const int64_t material = json_get_index(file, prim, "material");
+    const int64_t indices = json_get(file, prim, "indices");
+    const uint32_t material_count =
+        json_count(file, json_get(file, 0, "materials"));
+    uint32_t count;
+
+    memset(out, 0, sizeof(*out));
+    out->mesh = mesh;
+    // Primitives without a material use the default one after the file's
+    out->material = material >= 0 && material < material_count
+                        ? (uint32_t)material
+                        : material_count;
+
+    if (mode >= 0 && json_index(file, mode) != GLTF_MODE_TRIANGLES)
+        return false;
+    if (!gltf_accessor(file, json_get_index(file, attributes, "POSITION"),
+                       &out->position) ||
+        out->position.component_type != GLTF_FLOAT ||
+        out->position.components != 3)
+        return false;
+    count = out->position.count;
+
+    out->has_normal =
+        gltf_accessor(file, json_get_index(file, attributes, "NORMAL"),
+                      &out->normal) &&
+        gltf_check_view(&out->normal, count, 3);
+    out->has_texcoord =
+        gltf_accessor(file, json_get_index(file, attributes, "TEXCOORD_0"),
+                      &out->texcoord) &&
+        gltf_check_view(&out->texcoord, count, 2);
+    if (indices >= 0) {
+        if (!gltf_accessor(file, json_index(file, indices), &out->index) ||
+            out->index.components != 1 ||
+            (out->index.component_type != GLTF_UNSIGNED_BYTE &&
+             out->index.component_type != GLTF_UNSIGNED_SHORT &&
+             out->index.component_type != GLTF_UNSIGNED_INT))
+            return false;
+        out->has_index = true;
+    }
+    return (out->has_index ? out->index.count : count) >= 3;
+}
+
+static void gltf_fill_primitive(struct scene *scene,
+                                const struct gltf_primitive *prim,
+                                struct scene_mesh *mesh) {
+    struct scene_vertex *vertices = scene->vertices + mesh->first_vertex;
+    uint32_t *indices = scene->indices + mesh->first_index;
+    uint32_t i, c;
+
+    if (gltf_matches_vertex(prim)) {
+        memcpy(vertices, prim->position.data,
+               (size_t)mesh->vertex_count * sizeof(struct scene_vertex));
+    } else {
+        for (i = 0; i < mesh->vertex_count; i++) {
+            struct scene_vertex *v = &vertices[i];
+
+            for (c = 0; c < 3; c++) {
+                v->pos[c] = gltf_read_float(&prim->position, i, c);
+                v->normal[c] = prim->has_normal
+                                   ? gltf_read_float(&prim->normal, i, c)
+                                   : 0.0f;
+            }
+            for (c = 0; c < 2; c++)
+                v->uv[c] = prim->has_texcoord
+                               ? gltf_read_float(&prim->texcoord, i, c)
+                               : 0.0f;
+        }
+    }
+
+    if (!prim->has_index) {
+        for (i = 0; i < mesh->index_count; i++)
+            indices[i] = i;
+    } else if (prim->index.component_type == GLTF_UNSIGNED_INT &&
+               prim->index.stride == sizeof(uint32_t)) {
+        memcpy(indices, prim->index.data,
+               (size_t)mesh->index_count * sizeof(uint32_t));
+    } else {
+        for (i = 0; i < mesh->index_count; i++)
+            indices[i] = gltf_read_index(&prim->index, i);
+    }
+
+    // The GPU trusts indices, a bad one degenerates to the first vertex
+    for (i = 0; i < mesh->index_count; i++) {
+        if (indices[i] >= mesh->vertex_count)
+            indices[i] = 0;
+    }
+
+    if (prim->has_normal)
+        return;
+
+    // Area weighted face normals for primitives that come without
+    for (i = 0; i + 2 < mesh->index_count; i += 3) {
+        const uint32_t *t = &indices[i];
+        float e1[3], e2[3], n[3];
+
+        for (c = 0; c < 3; c++) {
+            e1[c] = vertices[t[1]].pos[c] - vertices[t[0]].pos[c];
+            e2[c] = vertices[t[2]].pos[c] - vertices[t[0]].pos[c];
+        }
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        for (c = 0; c < 3; c++) {
+            vertices[t[c]].normal[0] += n[0];
+            vertices[t[c]].normal[1] += n[1];
+            vertices[t[c]].normal[2] += n[2];
+        }
+    }
+    for (i = 0; i < mesh->vertex_count; i++) {
+        float *n = vertices[i].normal;
+        const float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        if (len > 0.0f) {
+            n[0] /= len;
+            n[1] /= len;
+            n[2] /= len;
+        } else {
+            n[2] = 1.0f;
+        }
+    }
+}
+
+static void gltf_materials(struct scene *scene, const struct gltf_file *file,
+                           uint32_t *texture_remap) {
+    const int64_t materials = json_get(file, 0, "materials");
+    const uint32_t texture_count =
+        json_count(file, json_get(file, 0, "textures"));
+    uint32_t i;
+
+    // The last material is the default for primitives without one
+    scene->material_count = json_count(file, materials) + 1;
+    scene->materials =
+        calloc(scene->material_count, sizeof(struct scene_material));
+    assert(scene->materials);
+
+    for (i = 0; i < scene->material_count; i++) {
+        const int64_t material = json_at(file, materials, i);
+        const int64_t pbr = json_get(file, material, "pbrMetallicRoughness");
+        const int64_t texture = json_get_index(
+            file, json_get(file, pbr, "baseColorTexture"), "index");
+        struct scene_material *out = &scene->materials[i];
+
+        out->base_color[0] = out->base_color[1] = out->base_color[2] = 1.0f;
+        out->base_color[3] = 1.0f;
+        out->metallic = (float)json_get_number(file, pbr, "metallicFactor", 1.0);
+        out->roughness =
+            (float)json_get_number(file, pbr, "roughnessFactor", 1.0);
+        json_floats(file, json_get(file, pbr, "baseColorFactor"),
+                    out->base_color, 4);
+        json_floats(file, json_get(file, material, "emissiveFactor"),
+                    out->emission, 3);
+        out->base_color_texture =
+            texture >= 0 && texture < texture_count ? texture_remap[texture]
+                                                    : SCENE_NO_TEXTURE;
+    }
+}
+
+// Only images stored as files can be referenced, embedded ones are skipped
+static void gltf_textures(struct scene *scene, const struct gltf_file *file,
+                          uint32_t *texture_remap) {
+    const int64_t textures = json_get(file, 0, "textures");
+    const uint32_t count = json_count(file, textures);
+    uint32_t i;
+
+    scene->textures = calloc(count ? count : 1, sizeof(struct scene_texture));
+    assert(scene->textures);
+
+    for (i = 0; i < count; i++) {
+        const int64_t source =
+            json_get_index(file, json_at(file, textures, i), "source");
+        const int64_t image = gltf_element(file, "images", source);
+        const int64_t uri = json_get(file, image, "uri");
+        const char *text;
+        size_t length;
+
+        texture_remap[i] = SCENE_NO_TEXTURE;
+        if (uri < 0 || file->tokens[uri].type != JSON_STRING)
+            continue;
+        text = file->json + file->tokens[uri].start;
+        length = file->tokens[uri].end - file->tokens[uri].start;
+        if (length >= SCENE_TEXTURE_PATH_MAX ||
+            (length > 5 && memcmp(text, "data:", 5) == 0))
+            continue;
+
+        texture_remap[i] = scene->texture_count;
+        gltf_decode_uri(scene->textures[scene->texture_count].path, text,
+                        length);
+        scene->texture_count++;
+    }
+}
+
+// Column-major 4x4, out = a * b
+static void gltf_mat4_mul(float *out, const float *a, const float *b) {
+    float m[16];
+    int r, c, k;
+
+    for (c = 0; c < 4; c++) {
+        for (r = 0; r < 4; r++) {
+            m[c * 4 + r] = 0.0f;
+            for (k = 0; k < 4; k++)
+                m[c * 4 + r] += a[k * 4 + r] * b[c * 4 + k];
+        }
+    }
+    memcpy(out, m, sizeof(m));
+}
+
+static void gltf_node_matrix(const struct gltf_file *file, int64_t node,
+                             float *m) {
+    float t[3] = {0.0f, 0.0f, 0.0f};
+    float q[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    float s[3] = {1.0f, 1.0f, 1.0f};
+    const int64_t matrix = json_get(file, node, "matrix");
+
+    if (json_count(file, matrix) == 16) {
+        memset(m, 0, 16 * sizeof(float));
+        m[0] = m[5] = m[10] = m[15] = 1.0f;
+        json_floats(file, matrix, m, 16);
+        return;
+    }
+    json_floats(file, json_get(file, node, "translation"), t, 3);
+    json_floats(file, json_get(file, node, "rotation"), q, 4);
+    json_floats(file, json_get(file, node, "scale"), s, 3);
+
+    // T * R * S
+    m[0] = (1.0f - 2.0f * (q[1] * q[1] + q[2] * q[2])) * s[0];
+    m[1] = (2.0f * (q[0] * q[1] + q[2] * q[3])) * s[0];
+    m[2] = (2.0f * (q[0] * q[2] - q[1] * q[3])) * s[0];
+    m[3] = 0.0f;
+    m[4] = (2.0f * (q[0] * q[1] - q[2] * q[3])) * s[1];
+    m[5] = (1.0f - 2.0f * (q[0] * q[0] + q[2] * q[2])) * s[1];
+    m[6] = (2.0f * (q[1] * q[2] + q[0] * q[3])) * s[1];
+    m[7] = 0.0f;
+    m[8] = (2.0f * (q[0] * q[2] + q[1] * q[3])) * s[2];
+    m[9] = (2.0f * (q[1] * q[2] - q[0] * q[3])) * s[2];
+    m[10] = (1.0f - 2.0f * (q[0] * q[0] + q[1] * q[1])) * s[2];
+    m[11] = 0.0f;
+    m[12] = t[0];
+    m[13] = t[1];
+    m[14] = t[2];
+    m[15] = 1.0f;
+}
+
+struct gltf_instancer {
+    const struct gltf_file *file;
+    struct scene *scene;
+    const uint32_t *mesh_first; // first scene mesh of each glTF mesh
+    const uint32_t *mesh_count;
+    uint32_t instance_cap;
+    uint32_t visits; // bounds the walk when the hierarchy has cycles
+};
+
+static bool gltf_instance_node(struct gltf_instancer *inst, int64_t index,
+                               const float *parent) {
+    const struct gltf_file *file = inst->file;
+    const int64_t node = gltf_element(file, "nodes", index);
+    const int64_t children = json_get(file, node, "children");
+    const int64_t mesh = json_get_index(file, node, "mesh");
+    struct scene *scene = inst->scene;
+    float local[16], world[16];
+    uint32_t i;
+
+    if (node < 0 || inst->visits++ > json_count(file, json_get(file, 0, "nodes")))
+        return false;
+
+    gltf_node_matrix(file, node, local);
+    gltf_mat4_mul(world, parent, local);
+
+    if (mesh >= 0 && mesh < json_count(file, json_get(file, 0, "meshes"))) {
+        for (i = 0; i < inst->mesh_count[mesh]; i++) {
+            struct scene_instance *out;
+            int r, c;
+
+            if (scene->instance_count == inst->instance_cap) {
+                const uint32_t cap =
+                    inst->instance_cap ? inst->instance_cap * 2 : 64;
+                struct scene_instance *grown =
+                    realloc(scene->instances, cap * sizeof(*grown));
+
+                if (!grown)
+                    return false;
+                scene->instances = grown;
+                inst->instance_cap = cap;
+            }
+            out = &scene->instances[scene->instance_count++];
+            memset(out, 0, sizeof(*out));
+            for (r = 0; r < 3; r++)
+                for (c = 0; c < 4; c++)
+                    out->transform[r][c] = world[c * 4 + r];
+            out->mesh = inst->mesh_first[mesh] + i;
+        }
+    }
+
+    for (i = 0; i < json_count(file, children); i++) {
+        const int64_t child = json_index(file, json_at(file, children, i));
+
+        if (!gltf_instance_node(inst, child, world))
+            return false;
+    }
+    return true;
+}
+
+static bool gltf_instances(struct scene *scene, const struct gltf_file *file,
+                           const uint32_t *mesh_first,
+                           const uint32_t *mesh_count) {
+    static const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0,
+                                       0, 0, 1, 0, 0, 0, 0, 1};
+    const int64_t scenes = json_get(file, 0, "scenes");
+    int64_t roots = -1;
+    struct gltf_instancer inst = {
+        .file = file,
+        .scene = scene,
+        .mesh_first = mesh_first,
+        .mesh_count = mesh_count,
+    };
+    uint32_t i;
+
+    if (json_count(file, scenes)) {
+        int64_t index = json_get_index(file, 0, "scene");
+        if (index < 0)
+            index = 0;
+        roots = json_get(file, json_at(file, scenes, index), "nodes");
+    }
+    for (i = 0; i < json_count(file, roots); i++) {
+        if (!gltf_instance_node(&inst, json_index(file, json_at(file, roots, i)),
+                                identity))
+            return false;
+    }
+
+    // Files without a scene still show their meshes
+    if (scene->instance_count == 0) {
+        scene->instances =
+            calloc(scene->mesh_count, sizeof(struct scene_instance));
+        if (!scene->instances)
+            return false;
+        for (i = 0; i < scene->mesh_count; i++) {
+            scene->instances[i].transform[0][0] = 1.0f;
+            scene->instances[i].transform[1][1] = 1.0f;
+            scene->instances[i].transform[2][2] = 1.0f;
+            scene->instances[i].mesh = i;
+        }
+        scene->instance_count = scene->mesh_count;
+    }
+    return true;
+}
+
+struct gltf_fill {
+    struct scene *scene;
+    const struct gltf_primitive *prims;
+};
+
+static void gltf_fill_task(void *arg, uint32_t index) {
+    const struct gltf_fill *fill = arg;
+
+    gltf_fill_primitive(fill->scene, &fill->prims[index],
+                        &fill->scene->meshes[index]);
+}
+
+bool gltf_import(struct scene *scene, const struct gltf_file *file,
+                 struct taskinfo *tasks) {
+    const int64_t meshes = json_get(file, 0, "meshes");
+    const uint32_t gltf_mesh_count = json_count(file, meshes);
+    const uint32_t texture_count =
+        json_count(file, json_get(file, 0, "textures"));
+    struct gltf_primitive *prims = NULL;
+    uint32_t *mesh_first = NULL, *mesh_count = NULL, *texture_remap = NULL;
+    struct gltf_fill fill;
+    uint64_t vertices = 0, indices = 0;
+    uint32_t prim_count = 0, prim_cap = 0, skipped = 0;
+    uint32_t m, p;
+
+    memset(scene, 0, sizeof(*scene));
+    mesh_first = calloc(gltf_mesh_count + 1, sizeof(uint32_t));
+    mesh_count = calloc(gltf_mesh_count + 1, sizeof(uint32_t));
+    texture_remap = calloc(texture_count + 1, sizeof(uint32_t));
+    if (!mesh_first || !mesh_count || !texture_remap)
+        goto fail;
+
+    // Collect the primitives first so the arrays get their exact size
+    for (m = 0; m < gltf_mesh_count; m++) {
+        const int64_t primitives =
+            json_get(file, json_at(file, meshes, m), "primitives");
+
+        mesh_first[m] = prim_count;
+        for (p = 0; p < json_count(file, primitives); p++) {
+            struct gltf_primitive *prim;
+
+            if (prim_count == prim_cap) {
+                const uint32_t cap = prim_cap ? prim_cap * 2 : 64;
+                struct gltf_primitive *grown =
+                    realloc(prims, cap * sizeof(*grown));
+
+                if (!grown)
+                    goto fail;
+                prims = grown;
+                prim_cap = cap;
+            }
+            prim = &prims[prim_count];
+            if (!gltf_collect_primitive(file, json_at(file, primitives, p), m,
+                                        prim)) {
+                skipped++;
+                continue;
+            }
+            vertices += prim->position.count;
+            indices += gltf_index_count(prim);
+            prim_count++;
+            mesh_count[m]++;
+        }
+    }
+    if (skipped) {
+        fprintf(stderr, "%s: skipped %u primitives that are not indexable "
+                        "triangles\n", file->path, skipped);
+    }
+    if (prim_count == 0) {
+        fprintf(stderr, "%s: no triangle meshes\n", file->path);
+        goto fail;
+    }
+    if (vertices > UINT32_MAX || indices > UINT32_MAX) {
+        fprintf(stderr, "%s: too many vertices\n", file->path);
+        goto fail;
+    }
+
+    scene->vertex_count = (uint32_t)vertices;
+    scene->index_count = (uint32_t)indices;
+    scene->mesh_count = prim_count;
+    scene->vertices = calloc(vertices, sizeof(struct scene_vertex));
+    scene->indices = malloc(indices * sizeof(uint32_t));
+    scene->meshes = calloc(prim_count, sizeof(struct scene_mesh));
+    if (!scene->vertices || !scene->indices || !scene->meshes)
+        goto fail;
+
+    vertices = indices = 0;
+    for (p = 0; p < prim_count; p++) {
+        struct scene_mesh *mesh = &scene->meshes[p];
+        const struct gltf_primitive *prim = &prims[p];
+
+        mesh->first_vertex = (uint32_t)vertices;
+        mesh->vertex_count = prim->position.count;
+        mesh->first_index = (uint32_t)indices;
+        mesh->index_count = gltf_index_count(prim);
+        mesh->material = prim->material;
+        vertices += mesh->vertex_count;
+        indices += mesh->index_count;
+    }
+    // Every primitive has its own ranges of the arrays
+    fill.scene = scene;
+    fill.prims = prims;
+    task_parallel_for(tasks, prim_count, gltf_fill_task, &fill);
+
+    gltf_textures(scene, file, texture_remap);
+    gltf_materials(scene, file, texture_remap);
+    if (!gltf_instances(scene, file, mesh_first, mesh_count)) {
+        fprintf(stderr, "%s: bad node hierarchy\n", file->path);
+        goto fail;
+    }
+
+    free(prims);
+    free(mesh_first);
+    free(mesh_count);
+    free(texture_remap);
+    return true;
+
+fail:
+    free(prims);
+    free(mesh_first);
+    free(mesh_count);
+    free(texture_remap);
+    free(scene->vertices);
+    free(scene->indices);
+    free(scene->meshes);
+    free(scene->instances);
+    free(scene->materials);
+    free(scene->textures);
+    memset(scene, 0, sizeof(*scene));
+    return false;
+}
@@ -0,0 +1,44 @@
+#ifndef GLTF_H
+#define GLTF_H
+
+// glTF 2.0 import, both .gltf with external or data: URI buffers and .glb.
+// Every triangle primitive becomes a mesh and every node that uses a mesh
+// one instance per primitive with the node's world transform. Materials
+// keep their metallic-roughness factors; images are recorded by URI in the
+// texture table, embedded ones are not.
+
+struct json_token;
+struct gltf_buffer;
+struct taskinfo;
+
+struct gltf_file {
+    const char *path;
+    const char *json;
+    size_t json_size;
+    struct json_token *tokens;
+    uint32_t token_count;
+    uint32_t *items;
+    struct gltf_buffer *buffers;
+    uint32_t buffer_count;
+};
+
+// Parses the JSON and maps the buffers, data is the file and has to stay
+// valid until gltf_close
+bool gltf_open(struct gltf_file *file, const void *data, size_t size,
+               const char *path);
+
+// Feeds the buffers that live outside the file itself into hash
+uint64_t gltf_hash_buffers(const struct gltf_file *file, uint64_t hash);
+
+// Feeds the contents of the image files the textures refer to into hash,
+// embedded images are covered by the file itself
+uint64_t gltf_hash_images(const struct gltf_file *file, uint64_t hash);
+
+// Primitives are decoded as tasks, NULL tasks decodes them on the calling
+// thread
+bool gltf_import(struct scene *scene, const struct gltf_file *file,
+                 struct taskinfo *tasks);
+
+void gltf_close(struct gltf_file *file);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "hash.h"
+
+#define PRIME1 0x9e3779b185ebca87ull
+#define PRIME2 0xc2b2ae3d27d4eb4full
+#define PRIME3 0x165667b19e3779f9ull
+#define PRIME4 0x85ebca77c2b2ae63ull
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    return rotl64(acc, 31) * PRIME1;
+}
+
+static inline uint64_t hash_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+
+        do {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = (h ^ hash_round(0, v1)) * PRIME1 + PRIME4;
+        h = (h ^ hash_round(0, v2)) * PRIME1 + PRIME4;
+        h = (h ^ hash_round(0, v3)) * PRIME1 + PRIME4;
+        h = (h ^ hash_round(0, v4)) * PRIME1 + PRIME4;
+    } else {
+        h = seed + PRIME4;
+    }
+
+    h += size;
+    for (; end - p >= 8; p += 8)
+        h = rotl64(h ^ hash_round(0, read64(p)), 27) * PRIME1 + PRIME4;
+    for (; p < end; p++)
+        h = rotl64(h ^ (*p * PRIME4), 11) * PRIME1;
+
+    return hash_avalanche(h);
+}
+
+uint64_t hash64_combine(uint64_t hash, uint64_t value) {
+    return hash_avalanche(rotl64(hash ^ hash_round(0, value), 27) * PRIME1 +
+                          PRIME4);
+}
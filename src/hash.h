@@ -0,0 +1,13 @@
+#ifndef HASH_H
+#define HASH_H
+
+// Fast non-cryptographic 64-bit hash for content addressing. Four
+// independent lanes over 32 byte stripes keep it at memory bandwidth for
+// large inputs. Not compatible with any published hash.
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed);
+
+// Feeds a value into an existing hash, for processing parameters
+uint64_t hash64_combine(uint64_t hash, uint64_t value);
+
+#endif
@@ -0,0 +1,418 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define fseeko _fseeki64
+#define off_t __int64
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "image_writer.h"
+
+bool image_writer_open(struct image_writer *writer, const char *path,
+                       uint32_t width, uint32_t height) {
+    int header;
+
+    memset(writer, 0, sizeof(*writer));
+    writer->file = fopen(path, "wb");
+    if (!writer->file)
+        return false;
+    writer->width = width;
+    writer->height = height;
+
+    header = fprintf(writer->file, "P6\n%u %u\n255\n", width, height);
+    if (header < 0) {
+        fclose(writer->file);
+        writer->file = NULL;
+        return false;
+    }
+    writer->data_offset = header;
+    return true;
+}
+
+bool image_writer_write_region(struct image_writer *writer, uint32_t x,
+                               uint32_t y, uint32_t width, uint32_t height,
+                               const uint8_t *rgba8, size_t stride) {
+    uint32_t row, i;
+
+    assert(x + width <= writer->width && y + height <= writer->height);
+
+    if (width > writer->row_cap) {
+        free(writer->row);
+        writer->row = malloc(width * 3);
+        writer->row_cap = width;
+    }
+
+    for (row = 0; row < height; row++) {
+        const uint8_t *src = rgba8 + row * stride;
+        const off_t offset =
+            writer->data_offset +
+            ((off_t)(y + row) * writer->width + x) * 3;
+
+        for (i = 0; i < width; i++) {
+            writer->row[i * 3 + 0] = src[i * 4 + 0];
+            writer->row[i * 3 + 1] = src[i * 4 + 1];
+            writer->row[i * 3 + 2] = src[i * 4 + 2];
+        }
+        // Seeking past the end leaves a hole that a later region fills in
+        if (fseeko(writer->file, offset, SEEK_SET) != 0 ||
+            fwrite(writer->row, 3, width, writer->file) != width)
+            return false;
+    }
+    return true;
+}
+
+bool image_writer_close(struct image_writer *writer) {
+    bool ok = true;
+
+    if (writer->file)
+        ok = fclose(writer->file) == 0;
+    free(writer->row);
+    memset(writer, 0, sizeof(*writer));
+    return ok;
+}
+
+bool image_format_from_path(const char *path, enum image_format *format) {
+    const char *dot = strrchr(path, '.');
+
+    if (!dot || strchr(dot, '/'))
+        return false;
+    if (strcmp(dot, ".ppm") == 0)
+        *format = IMAGE_FORMAT_PPM;
+    else if (strcmp(dot, ".png") == 0)
+        *format = IMAGE_FORMAT_PNG;
+    else if (strcmp(dot, ".exr") == 0)
+        *format = IMAGE_FORMAT_EXR;
+    else
+        return false;
+    return true;
+}
+
+// Accepts at most one %d or %u with flags and width, and %% escapes, so
+// the pattern can be handed to snprintf with the frame number
+bool image_check_pattern(const char *pattern, bool *sequence) {
+    const char *p;
+
+    *sequence = false;
+    for (p = pattern; *p; p++) {
+        if (*p != '%')
+            continue;
+        if (p[1] == '%') {
+            p++;
+            continue;
+        }
+        for (p++; *p == '0' || *p == '-' || *p == '+' || *p == ' '; p++)
+            ;
+        while (*p >= '0' && *p <= '9')
+            p++;
+        if ((*p != 'd' && *p != 'u') || *sequence)
+            return false;
+        *sequence = true;
+    }
+    return true;
+}
+
+bool image_write_ppm(const char *path, uint32_t width, uint32_t height,
+                     const uint8_t *rgba8, size_t stride) {
+    struct image_writer writer;
+    bool ok;
+
+    if (!image_writer_open(&writer, path, width, height))
+        return false;
+    ok = image_writer_write_region(&writer, 0, 0, width, height, rgba8, stride);
+    return image_writer_close(&writer) && ok;
+}
+
+static void image_put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static bool image_write_png_chunk(FILE *file, const uint32_t *crc_table,
+                                  const char *type, const uint8_t *data,
+                                  uint32_t size) {
+    uint8_t head[8], tail[4];
+    uint32_t crc = 0xffffffffu, i;
+
+    image_put_be32(head, size);
+    memcpy(head + 4, type, 4);
+    for (i = 4; i < 8; i++)
+        crc = crc_table[(crc ^ head[i]) & 0xff] ^ (crc >> 8);
+    for (i = 0; i < size; i++)
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    image_put_be32(tail, crc ^ 0xffffffffu);
+    return fwrite(head, 1, 8, file) == 8 &&
+           (size == 0 || fwrite(data, 1, size, file) == size) &&
+           fwrite(tail, 1, 4, file) == 4;
+}
+
+// The image data is stored, not compressed: frames are written while the
+// renderer runs and deflate would cost more than the disk it saves
+bool image_write_png(const char *path, uint32_t width, uint32_t height,
+                     const uint8_t *rgba8, size_t stride) {
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G',
+                                         '\r', '\n', 0x1a, '\n'};
+    const uint64_t row_size = 1 + (uint64_t)width * 3;
+    const uint64_t raw_size = row_size * height;
+    const uint64_t block_count = (raw_size + 65534) / 65535;
+    const uint64_t zlib_size = 2 + block_count * 5 + raw_size + 4;
+    uint32_t crc_table[256], a = 1, b = 0, i, x, y;
+    uint8_t header[13], *zlib, *out;
+    uint64_t done;
+    FILE *file;
+    bool ok;
+
+    if (zlib_size > 0x7fffffff)
+        return false;
+    for (i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (x = 0; x < 8; x++)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+
+    zlib = malloc(zlib_size);
+    if (!zlib)
+        return false;
+    out = zlib;
+    *out++ = 0x78;
+    *out++ = 0x01;
+    // Rows are streamed through the stored blocks, every 65535 bytes of
+    // filtered data get a block header of their own
+    done = 0;
+    for (y = 0; y < height; y++) {
+        const uint8_t *src = rgba8 + y * stride;
+
+        for (x = 0; x < row_size; x++) {
+            uint8_t v;
+
+            if (done % 65535 == 0) {
+                const uint32_t len = raw_size - done < 65535
+                                         ? (uint32_t)(raw_size - done)
+                                         : 65535;
+                *out++ = raw_size - done <= 65535 ? 1 : 0;
+                *out++ = len;
+                *out++ = len >> 8;
+                *out++ = ~len;
+                *out++ = ~len >> 8;
+            }
+            // Filter type 0 in front of each row, then rgb
+            v = x == 0 ? 0 : src[(x - 1) / 3 * 4 + (x - 1) % 3];
+            *out++ = v;
+            a = (a + v) % 65521;
+            b = (b + a) % 65521;
+            done++;
+        }
+    }
+    image_put_be32(out, b << 16 | a);
+
+    image_put_be32(header, width);
+    image_put_be32(header + 4, height);
+    header[8] = 8;  // bits per channel
+    header[9] = 2;  // rgb
+    header[10] = 0; // deflate
+    header[11] = 0; // adaptive filtering
+    header[12] = 0; // not interlaced
+
+    file = fopen(path, "wb");
+    if (!file) {
+        free(zlib);
+        return false;
+    }
+    ok = fwrite(signature, 1, 8, file) == 8 &&
+         image_write_png_chunk(file, crc_table, "IHDR", header, 13) &&
+         image_write_png_chunk(file, crc_table, "IDAT", zlib, zlib_size) &&
+         image_write_png_chunk(file, crc_table, "IEND", NULL, 0);
+    ok = fclose(file) == 0 && ok;
+    free(zlib);
+    return ok;
+}
+
+// Rounds to nearest even, overflow becomes infinity
+static uint16_t image_float_to_half(float f) {
+    uint32_t x, mant, h, rem, half;
+    uint16_t sign;
+    int e;
+
+    memcpy(&x, &f, sizeof(x));
+    sign = (x >> 16) & 0x8000;
+    mant = x & 0x7fffff;
+    if (((x >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+    e = (int)((x >> 23) & 0xff) - 127 + 15;
+    if (e >= 0x1f)
+        return sign | 0x7c00;
+    if (e <= 0) {
+        const uint32_t shift = 14 - e;
+
+        if (e < -10)
+            return sign;
+        mant |= 0x800000;
+        h = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        half = 1u << (shift - 1);
+    } else {
+        h = (uint32_t)e << 10 | mant >> 13;
+        rem = mant & 0x1fff;
+        half = 0x1000;
+    }
+    // A carry out of the mantissa correctly bumps the exponent
+    if (rem > half || (rem == half && (h & 1)))
+        h++;
+    return sign | h;
+}
+
+static uint8_t *image_exr_attribute(uint8_t *p, const char *name,
+                                    const char *type, const void *value,
+                                    uint32_t size) {
+    memcpy(p, name, strlen(name) + 1);
+    p += strlen(name) + 1;
+    memcpy(p, type, strlen(type) + 1);
+    p += strlen(type) + 1;
+    memcpy(p, &size, 4);
+    memcpy(p + 4, value, size);
+    return p + 4 + size;
+}
+
+// EXR pixel type of each channel type: 0 uint, 1 half, 2 float
+static const int32_t image_exr_types[] = {
+    [IMAGE_CHANNEL_HALF] = 1,
+    [IMAGE_CHANNEL_FLOAT_AS_HALF] = 1,
+    [IMAGE_CHANNEL_FLOAT] = 2,
+    [IMAGE_CHANNEL_UINT] = 0,
+};
+
+// Scanline file without compression, one line per block
+bool image_write_exr(const char *path, uint32_t width, uint32_t height,
+                     const struct image_channel *channels,
+                     uint32_t channel_count) {
+    static const uint8_t magic[8] = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+    const int32_t window[4] = {0, 0, (int32_t)width - 1, (int32_t)height - 1};
+    const float aspect = 1.0f, center[2] = {0.0f, 0.0f}, screen = 1.0f;
+    const uint8_t none = 0;
+    uint32_t order[32], chlist_size = 1, block_size = 8, i, j, x, y;
+    uint8_t *header, *p, *chlist, *block;
+    uint64_t offset;
+    FILE *file;
+    bool ok;
+
+    assert(channel_count > 0 && channel_count <= 32);
+
+    // Channels are stored sorted by name
+    for (i = 0; i < channel_count; i++) {
+        for (j = i; j > 0 &&
+                    strcmp(channels[order[j - 1]].name, channels[i].name) > 0;
+             j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    for (i = 0; i < channel_count; i++) {
+        chlist_size += strlen(channels[i].name) + 1 + 16;
+        block_size += width * (image_exr_types[channels[i].type] == 1 ? 2 : 4);
+    }
+
+    chlist = malloc(chlist_size);
+    header = malloc(chlist_size + 512);
+    block = malloc(block_size);
+    if (!chlist || !header || !block) {
+        free(chlist);
+        free(header);
+        free(block);
+        return false;
+    }
+
+    p = chlist;
+    for (i = 0; i < channel_count; i++) {
+        const int32_t sampling = 1;
+        const char *name = channels[order[i]].name;
+
+        memcpy(p, name, strlen(name) + 1);
+        p += strlen(name) + 1;
+        memcpy(p, &image_exr_types[channels[order[i]].type], 4);
+        memset(p + 4, 0, 4); // pLinear and reserved
+        memcpy(p + 8, &sampling, 4);
+        memcpy(p + 12, &sampling, 4);
+        p += 16;
+    }
+    *p = 0;
+
+    p = header;
+    memcpy(p, magic, sizeof(magic));
+    p += sizeof(magic);
+    p = image_exr_attribute(p, "channels", "chlist", chlist, chlist_size);
+    p = image_exr_attribute(p, "compression", "compression", &none, 1);
+    p = image_exr_attribute(p, "dataWindow", "box2i", window, 16);
+    p = image_exr_attribute(p, "displayWindow", "box2i", window, 16);
+    p = image_exr_attribute(p, "lineOrder", "lineOrder", &none, 1);
+    p = image_exr_attribute(p, "pixelAspectRatio", "float", &aspect, 4);
+    p = image_exr_attribute(p, "screenWindowCenter", "v2f", center, 8);
+    p = image_exr_attribute(p, "screenWindowWidth", "float", &screen, 4);
+    *p++ = 0;
+
+    file = fopen(path, "wb");
+    ok = file && fwrite(header, 1, p - header, file) == (size_t)(p - header);
+
+    // Offset table, the blocks follow it back to back
+    offset = (p - header) + (uint64_t)height * 8;
+    for (y = 0; y < height && ok; y++, offset += block_size)
+        ok = fwrite(&offset, 8, 1, file) == 1;
+
+    for (y = 0; y < height && ok; y++) {
+        const int32_t line = y, size = block_size - 8;
+        uint8_t *dst = block + 8;
+
+        memcpy(block, &line, 4);
+        memcpy(block + 4, &size, 4);
+        for (i = 0; i < channel_count; i++) {
+            const struct image_channel *c = &channels[order[i]];
+            const uint8_t *src =
+                (const uint8_t *)c->data + (size_t)y * c->row_stride;
+
+            for (x = 0; x < width; x++, src += c->pixel_stride) {
+                float f;
+                uint16_t h;
+
+                switch (c->type) {
+                case IMAGE_CHANNEL_HALF:
+                    memcpy(dst, src, 2);
+                    dst += 2;
+                    break;
+                case IMAGE_CHANNEL_FLOAT_AS_HALF:
+                    memcpy(&f, src, 4);
+                    h = image_float_to_half(f);
+                    memcpy(dst, &h, 2);
+                    dst += 2;
+                    break;
+                case IMAGE_CHANNEL_FLOAT:
+                case IMAGE_CHANNEL_UINT:
+                    memcpy(dst, src, 4);
+                    dst += 4;
+                    break;
+                }
+            }
+        }
+        ok = fwrite(block, 1, block_size, file) == block_size;
+    }
+    if (file)
+        ok = fclose(file) == 0 && ok;
+
+    free(chlist);
+    free(header);
+    free(block);
+    return ok;
+}
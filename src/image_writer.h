@@ -0,0 +1,69 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+// Streaming image file writer. Regions arrive in any order and go straight
+// to their place in the file, so an image never has to fit in memory.
+// Binary PPM is used because every pixel has a fixed file offset.
+
+struct image_writer {
+    FILE *file;
+    uint32_t width, height;
+    long data_offset; // size of the header
+    uint8_t *row;     // one converted region row
+    uint32_t row_cap;
+};
+
+bool image_writer_open(struct image_writer *writer, const char *path,
+                       uint32_t width, uint32_t height);
+
+// rgba8 points at the region's first pixel, rows are stride bytes apart
+bool image_writer_write_region(struct image_writer *writer, uint32_t x,
+                               uint32_t y, uint32_t width, uint32_t height,
+                               const uint8_t *rgba8, size_t stride);
+
+bool image_writer_close(struct image_writer *writer);
+
+// Whole images, for outputs that fit in memory. PNG and PPM take the rgb of
+// rgba8 pixels; EXR takes any number of named channels, each read from its
+// own place in memory.
+
+enum image_format {
+    IMAGE_FORMAT_PPM,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_EXR,
+};
+
+// From the extension of path, false for anything else
+bool image_format_from_path(const char *path, enum image_format *format);
+
+// Output paths are printf patterns with at most one %d or %u for the frame
+// number, sequence says whether there is one
+bool image_check_pattern(const char *pattern, bool *sequence);
+
+bool image_write_ppm(const char *path, uint32_t width, uint32_t height,
+                     const uint8_t *rgba8, size_t stride);
+
+bool image_write_png(const char *path, uint32_t width, uint32_t height,
+                     const uint8_t *rgba8, size_t stride);
+
+enum image_channel_type {
+    IMAGE_CHANNEL_HALF,          // half floats, stored as they are
+    IMAGE_CHANNEL_FLOAT_AS_HALF, // floats, stored as half floats
+    IMAGE_CHANNEL_FLOAT,         // floats
+    IMAGE_CHANNEL_UINT,          // uint32_t
+};
+
+// Samples are pixel_stride bytes apart in a row, rows are row_stride bytes
+// apart. Layers use dotted names, "normal.X".
+struct image_channel {
+    const char *name;
+    enum image_channel_type type;
+    const void *data; // first sample
+    size_t pixel_stride, row_stride;
+};
+
+bool image_write_exr(const char *path, uint32_t width, uint32_t height,
+                     const struct image_channel *channels,
+                     uint32_t channel_count);
+
+#endif
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <signal.h>
+#include <math.h>
+#include <pthread.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -15,28 +17,301 @@
 #include <GLFW/glfw3.h>
 
 #include "window.h"
+#include "memalloc.h"
 #include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "tracer.h"
+#include "task.h"
+#include "cmdpool.h"
+#include "scenefile.h"
+#include "gltf.h"
+#include "asset.h"
+#include "image_writer.h"
+#include "tiler.h"
+#include "recorder.h"
+#include "batch.h"
+#include "server.h"
 
 #define APP_SHORT_NAME "vkrender"
 #define APP_LONG_NAME "Vulkan Render"
 
+#define CAMERA_SPEED 2.0f      // units per second
+#define CAMERA_TURN_SPEED 60.0f // degrees per second
 
 
+static void resize(struct windowinfo *window, struct renderinfo *render,
+                   struct tracerinfo *tracer) {
+    vkDeviceWaitIdle(render->device);
+    prepare_swapchain(window, render);
+    tracer_resize(render, tracer, window->width, window->height);
+}
+
+// The passes of an interactive frame, in the order they execute
+enum frame_pass {
+    FRAME_PASS_TRACE,
+    FRAME_PASS_PRESENT,
+    FRAME_PASS_RECORD, // only when frames are saved
+    FRAME_PASS_COUNT,
+};
+
+struct frame_passes {
+    struct renderinfo *render;
+    const struct tracerinfo *tracer;
+    const struct recorderinfo *recorder;
+    VkImage target;
+};
+
+static void record_pass(void *arg, uint32_t index, VkCommandBuffer cmd) {
+    const struct frame_passes *passes = arg;
+
+    switch (index) {
+    case FRAME_PASS_TRACE:
+        tracer_record_trace(passes->render, passes->tracer, cmd);
+        break;
+    case FRAME_PASS_PRESENT:
+        tracer_record_present(passes->tracer, cmd, passes->target);
+        break;
+    case FRAME_PASS_RECORD:
+        recorder_record(passes->recorder, passes->tracer, cmd);
+        break;
+    }
+}
+
+static void draw(struct windowinfo *window, struct renderinfo *render,
+                 struct tracerinfo *tracer, struct recorderinfo *recorder,
+                 struct cmd_frame *frame) {
+    VkResult err;
+
+    // Get the index of the next available swapchain image:
+    err = vkAcquireNextImageKHR(render->device, render->swapchain, UINT64_MAX,
+                                render->image_acquired, VK_NULL_HANDLE,
+                                &render->current_buffer);
+    if (err == VK_ERROR_OUT_OF_DATE_KHR) {
+        // swapchain is out of date (e.g. the window was resized) and
+        // must be recreated:
+        window->resized = true;
+        return;
+    } else if (err == VK_SUBOPTIMAL_KHR) {
+        // swapchain is not as optimal as it could be, but the platform's
+        // presentation engine will still present the image correctly.
+    } else {
+        assert(!err);
+    }
+
+    // Everything the passes share is settled here, they only record
+    const struct frame_passes passes = {
+        render, tracer, recorder,
+        render->swapchain_images[render->current_buffer]};
+    tracer_plan_frame(render, tracer);
+    if (recorder)
+        recorder_prepare(render, recorder, tracer);
+
+    // The last frame's fence was waited for, its pools can be reset
+    cmd_frame_begin(render, frame);
+    cmd_frame_record(render, frame,
+                     recorder ? FRAME_PASS_COUNT : FRAME_PASS_RECORD,
+                     record_pass, (void *)&passes);
+    cmd_frame_end(frame);
+
+    VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo submit_info = {.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                .pNext = NULL,
+                                .waitSemaphoreCount = 1,
+                                .pWaitSemaphores = &render->image_acquired,
+                                .pWaitDstStageMask = &pipe_stage_flags,
+                                .commandBufferCount = 1,
+                                .pCommandBuffers = &frame->cmd,
+                                .signalSemaphoreCount = 1,
+                                .pSignalSemaphores = &render->draw_complete};
+
+    err = vkResetFences(render->device, 1, &render->draw_fence);
+    assert(!err);
+    err = vkQueueSubmit(render->queue, 1, &submit_info, render->draw_fence);
+    assert(!err);
+
+    VkPresentInfoKHR present = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .pNext = NULL,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &render->draw_complete,
+        .swapchainCount = 1,
+        .pSwapchains = &render->swapchain,
+        .pImageIndices = &render->current_buffer,
+    };
+
+    err = vkQueuePresentKHR(render->queue, &present);
+    if (err == VK_ERROR_OUT_OF_DATE_KHR) {
+        window->resized = true;
+    } else if (err == VK_SUBOPTIMAL_KHR) {
+        // nothing to do, the image was still presented
+    } else {
+        assert(!err);
+    }
+
+    err = vkWaitForFences(render->device, 1, &render->draw_fence, VK_TRUE,
+                          UINT64_MAX);
+    assert(!err);
+
+    tracer_frame_done(render, tracer);
+    if (recorder)
+        recorder_frame_done(recorder);
+}
+
+/* Returns true when the camera moved and the accumulation has to restart. */
+static bool update_camera(struct windowinfo *window, struct camera *camera,
+                          float dt) {
+    const float yaw = camera->yaw * (float)M_PI / 180.0f;
+    float move[3] = {0.0f, 0.0f, 0.0f};
+    bool moved = false;
+
+    if (glfwGetKey(window->window, GLFW_KEY_W) == GLFW_PRESS) move[2] += 1.0f;
+    if (glfwGetKey(window->window, GLFW_KEY_S) == GLFW_PRESS) move[2] -= 1.0f;
+    if (glfwGetKey(window->window, GLFW_KEY_D) == GLFW_PRESS) move[0] += 1.0f;
+    if (glfwGetKey(window->window, GLFW_KEY_A) == GLFW_PRESS) move[0] -= 1.0f;
+    if (glfwGetKey(window->window, GLFW_KEY_E) == GLFW_PRESS) move[1] += 1.0f;
+    if (glfwGetKey(window->window, GLFW_KEY_Q) == GLFW_PRESS) move[1] -= 1.0f;
+
+    if (move[0] != 0.0f || move[1] != 0.0f || move[2] != 0.0f) {
+        camera->pos[0] += (move[2] * sinf(yaw) + move[0] * cosf(yaw)) * CAMERA_SPEED * dt;
+        camera->pos[1] += move[1] * CAMERA_SPEED * dt;
+        camera->pos[2] += (move[2] * cosf(yaw) - move[0] * sinf(yaw)) * CAMERA_SPEED * dt;
+        moved = true;
+    }
+
+    if (glfwGetKey(window->window, GLFW_KEY_LEFT) == GLFW_PRESS) {
+        camera->yaw -= CAMERA_TURN_SPEED * dt;
+        moved = true;
+    }
+    if (glfwGetKey(window->window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
+        camera->yaw += CAMERA_TURN_SPEED * dt;
+        moved = true;
+    }
+    if (glfwGetKey(window->window, GLFW_KEY_UP) == GLFW_PRESS &&
+        camera->pitch < 89.0f) {
+        camera->pitch += CAMERA_TURN_SPEED * dt;
+        moved = true;
+    }
+    if (glfwGetKey(window->window, GLFW_KEY_DOWN) == GLFW_PRESS &&
+        camera->pitch > -89.0f) {
+        camera->pitch -= CAMERA_TURN_SPEED * dt;
+        moved = true;
+    }
+
+    return moved;
+}
+
+static void run(struct windowinfo *window, struct renderinfo *render,
+                struct tracerinfo *tracer, struct recorderinfo *recorder,
+                struct cmd_frame *frame) {
+    double last = glfwGetTime();
+
+    while (!glfwWindowShouldClose(window->window)) {
+        // A converged image does not change until the user does something,
+        // so stop spinning and only present again on input or damage
+        if (tracer->converged && !window->damaged && !window->resized)
+            glfwWaitEvents();
+        else
+            glfwPollEvents();
+
+        const double now = glfwGetTime();
+        const float dt = now - last < 0.1 ? (float)(now - last) : 0.1f;
+        last = now;
+
+        if (update_camera(window, &tracer->camera, dt))
+            tracer_reset(tracer);
+        if (window->resized)
+            resize(window, render, tracer);
+        tracer->show_heatmap = window->show_heatmap;
+        if (window->width == 0 || window->height == 0)
+            continue;
+
+        draw(window, render, tracer, recorder, frame);
+        window->damaged = false;
+
+        render->curFrame++;
+        if (render->frameCount != INT32_MAX && render->curFrame == render->frameCount)
+            glfwSetWindowShouldClose(window->window, GLFW_TRUE);
+    }
+}
+
 int main(const int argc, const char *argv[]) {
     struct windowinfo window;
     struct renderinfo render;
-   
+    struct scene scene;
+    struct tracerinfo tracer;
+    struct asset_cache cache;
+    struct recorderinfo recorder;
+    struct taskinfo tasks;
+    struct cmd_frame frame;
+    int exit_code = 0;
 
     init_render(&window,&render,APP_SHORT_NAME,argc,argv);
+    task_init(&tasks,render.task_threads,render.task_affinity);
+    render.tasks = &tasks;
     create_window(&window,APP_LONG_NAME);
+    init_device(&window,&render);
+
+    if (render.serve_path) {
+        // Scenes come and go with the jobs, the window is never presented to
+        glfwHideWindow(window.window);
+        if (!server_run(&render,render.serve_path))
+            exit_code = 1;
+        vkDeviceWaitIdle(render.device);
+        cleanup_render(&window,&render);
+        task_cleanup(&tasks);
+        return exit_code;
+    }
 
+    if (!render.scene_path)
+        scene_init_builtin(&scene);
+    else {
+        if (render.no_cache)
+            memset(&cache,0,sizeof(cache));
+        else
+            asset_cache_init(&cache,render.cache_dir,render.cache_mb);
+        if (!asset_load_scene(&cache,&scene,render.scene_path,render.tasks))
+            exit(1);
+    }
+    scene_upload(&render,&scene);
 
-    //demo_init_vk_swapchain(&demo);
+    if (render.cameras_path) {
+        // Offline render of many views, the window is never presented to
+        glfwHideWindow(window.window);
+        tracer_prepare(&render,&tracer,&scene,TRACE_TILE_SIZE,TRACE_TILE_SIZE);
+        if (!batch_render(&render,&tracer,render.cameras_path,
+                          render.output_path,render.batch_width,
+                          render.batch_height))
+            exit_code = 1;
+    } else if (render.output_width) {
+        // Offline render, the window is never presented to
+        glfwHideWindow(window.window);
+        tracer_prepare(&render,&tracer,&scene,TRACE_TILE_SIZE,TRACE_TILE_SIZE);
+        if (!tiler_render(&render,&tracer,render.output_path,
+                          render.output_width,render.output_height))
+            exit_code = 1;
+    } else {
+        if (render.output_path && !recorder_init(&recorder,render.output_path))
+            exit(1);
+        prepare_swapchain(&window,&render);
+        tracer_prepare(&render,&tracer,&scene,window.width,window.height);
+        cmd_frame_init(&render,&frame);
 
-    //demo_prepare(&demo);
-    //demo_run(&demo);
+        run(&window,&render,&tracer,render.output_path ? &recorder : NULL,
+            &frame);
+        cmd_frame_cleanup(&render,&frame);
+        if (render.output_path && !recorder_finish(&render,&recorder))
+            exit_code = 1;
+    }
 
-    //demo_cleanup(&demo);
+    vkDeviceWaitIdle(render.device);
+    tracer_cleanup(&render,&tracer);
+    scene_cleanup(&render,&scene);
+    cleanup_render(&window,&render);
+    task_cleanup(&tasks);
 
     //return validation_error;
+    return exit_code;
 }
\ No newline at end of file
@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+
+#define ALIGN_UP(v, a) (((v) + (a) - 1) & ~((VkDeviceSize)(a) - 1))
+
+#define ERR_EXIT(err_msg, err_class)                                           \
+    do {                                                                       \
+        printf(err_msg);                                                       \
+        fflush(stdout);                                                        \
+        exit(1);                                                               \
+    } while (0)
+
+void memalloc_init(struct renderinfo *render) {
+    memset(&render->allocator, 0, sizeof(render->allocator));
+
+    // Acceleration structure builds need device addresses of their inputs,
+    // scratch and storage, so every block is allocated address-capable
+    if (render->use_accel_struct)
+        render->allocator.alloc_flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+}
+
+static void block_insert_range(struct mem_block *block, uint32_t at,
+                               VkDeviceSize offset, VkDeviceSize size) {
+    if (block->free_count == block->free_cap) {
+        block->free_cap = block->free_cap ? block->free_cap * 2 : 16;
+        block->free_ranges = realloc(block->free_ranges,
+                                     block->free_cap * sizeof(struct mem_range));
+        assert(block->free_ranges);
+    }
+    memmove(&block->free_ranges[at + 1], &block->free_ranges[at],
+            (block->free_count - at) * sizeof(struct mem_range));
+    block->free_ranges[at].offset = offset;
+    block->free_ranges[at].size = size;
+    block->free_count++;
+}
+
+static void block_remove_range(struct mem_block *block, uint32_t at) {
+    memmove(&block->free_ranges[at], &block->free_ranges[at + 1],
+            (block->free_count - at - 1) * sizeof(struct mem_range));
+    block->free_count--;
+}
+
+/* First fit: carve an aligned range of 'size' bytes out of the free list. */
+static bool block_try_alloc(struct mem_block *block, VkDeviceSize size,
+                            VkDeviceSize alignment, VkDeviceSize *offset) {
+    uint32_t i;
+
+    for (i = 0; i < block->free_count; i++) {
+        const struct mem_range r = block->free_ranges[i];
+        const VkDeviceSize aligned = ALIGN_UP(r.offset, alignment);
+
+        if (aligned + size > r.offset + r.size)
+            continue;
+
+        block_remove_range(block, i);
+        if (aligned + size < r.offset + r.size) {
+            block_insert_range(block, i, aligned + size,
+                               r.offset + r.size - (aligned + size));
+        }
+        if (aligned > r.offset) {
+            block_insert_range(block, i, r.offset, aligned - r.offset);
+        }
+
+        *offset = aligned;
+        return true;
+    }
+
+    return false;
+}
+
+static bool memalloc_new_block(struct renderinfo *render, uint32_t type_index,
+                               bool optimal, VkDeviceSize size,
+                               uint32_t *block_index) {
+    struct mem_allocator *allocator = &render->allocator;
+    struct mem_block *block = NULL;
+    VkResult err;
+    uint32_t i;
+
+    // Reuse the slot of a block that was released
+    for (i = 0; i < allocator->block_count; i++) {
+        if (allocator->blocks[i].mem == VK_NULL_HANDLE) {
+            block = &allocator->blocks[i];
+            break;
+        }
+    }
+    if (!block) {
+        allocator->blocks = realloc(allocator->blocks,
+                                    (allocator->block_count + 1) *
+                                        sizeof(struct mem_block));
+        assert(allocator->blocks);
+        block = &allocator->blocks[allocator->block_count++];
+        memset(block, 0, sizeof(*block));
+    }
+
+    const VkMemoryAllocateFlagsInfo flags_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .pNext = NULL,
+        .flags = allocator->alloc_flags,
+        .deviceMask = 0,
+    };
+    const VkMemoryAllocateInfo mem_alloc = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = allocator->alloc_flags ? &flags_info : NULL,
+        .allocationSize = size,
+        .memoryTypeIndex = type_index,
+    };
+
+    err = vkAllocateMemory(render->device, &mem_alloc, NULL, &block->mem);
+    if (err == VK_ERROR_OUT_OF_DEVICE_MEMORY ||
+        err == VK_ERROR_OUT_OF_HOST_MEMORY) {
+        block->mem = VK_NULL_HANDLE;
+        return false;
+    }
+    assert(!err);
+
+    block->size = size;
+    block->type_index = type_index;
+    block->optimal = optimal;
+    block->mapped = NULL;
+    block->free_count = 0;
+    block->live_count = 0;
+    block_insert_range(block, 0, 0, size);
+
+    if (render->memory_properties.memoryTypes[type_index].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        // Host visible blocks stay mapped for their whole lifetime
+        err = vkMapMemory(render->device, block->mem, 0, VK_WHOLE_SIZE, 0,
+                          &block->mapped);
+        assert(!err);
+    }
+
+    allocator->allocated_bytes += size;
+    *block_index = (uint32_t)(block - allocator->blocks);
+    return true;
+}
+
+bool memalloc_alloc(struct renderinfo *render,
+                    const VkMemoryRequirements *mem_reqs,
+                    VkMemoryPropertyFlags required_props, bool optimal,
+                    struct mem_allocation *alloc) {
+    struct mem_allocator *allocator = &render->allocator;
+    const VkDeviceSize alignment = mem_reqs->alignment;
+    VkDeviceSize offset = 0;
+    uint32_t type_index;
+    uint32_t i;
+
+    if (!memory_type_from_properties(render, mem_reqs->memoryTypeBits,
+                                     required_props, &type_index))
+        return false;
+
+    for (i = 0; i < allocator->block_count; i++) {
+        struct mem_block *block = &allocator->blocks[i];
+        if (block->mem == VK_NULL_HANDLE || block->type_index != type_index ||
+            block->optimal != optimal)
+            continue;
+        if (block_try_alloc(block, mem_reqs->size, alignment, &offset))
+            break;
+    }
+
+    if (i == allocator->block_count) {
+        VkDeviceSize block_size = ALIGN_UP(mem_reqs->size, alignment);
+        if (block_size < MEMALLOC_BLOCK_SIZE)
+            block_size = MEMALLOC_BLOCK_SIZE;
+
+        if (!memalloc_new_block(render, type_index, optimal, block_size, &i))
+            return false;
+        if (!block_try_alloc(&allocator->blocks[i], mem_reqs->size, alignment,
+                             &offset))
+            return false;
+    }
+
+    struct mem_block *block = &allocator->blocks[i];
+    block->live_count++;
+    allocator->used_bytes += mem_reqs->size;
+
+    alloc->mem = block->mem;
+    alloc->offset = offset;
+    alloc->size = mem_reqs->size;
+    alloc->mapped = block->mapped ? (char *)block->mapped + offset : NULL;
+    alloc->block = i;
+    return true;
+}
+
+void memalloc_free(struct renderinfo *render, struct mem_allocation *alloc) {
+    struct mem_allocator *allocator = &render->allocator;
+    struct mem_block *block;
+    uint32_t at;
+
+    if (alloc->mem == VK_NULL_HANDLE)
+        return;
+    if (alloc->block == MEMALLOC_DEDICATED) {
+        vkFreeMemory(render->device, alloc->mem, NULL);
+        memset(alloc, 0, sizeof(*alloc));
+        return;
+    }
+
+    assert(alloc->block < allocator->block_count);
+    block = &allocator->blocks[alloc->block];
+    assert(block->mem == alloc->mem);
+
+    allocator->used_bytes -= alloc->size;
+
+    if (--block->live_count == 0) {
+        // Give empty blocks back to the driver right away, large scenes
+        // need that memory for the next batch of builds
+        vkFreeMemory(render->device, block->mem, NULL);
+        allocator->allocated_bytes -= block->size;
+        block->mem = VK_NULL_HANDLE;
+        block->mapped = NULL;
+        block->free_count = 0;
+        memset(alloc, 0, sizeof(*alloc));
+        return;
+    }
+
+    // Insert sorted and coalesce with the neighbours
+    for (at = 0; at < block->free_count; at++) {
+        if (block->free_ranges[at].offset > alloc->offset)
+            break;
+    }
+    block_insert_range(block, at, alloc->offset, alloc->size);
+
+    if (at + 1 < block->free_count &&
+        block->free_ranges[at].offset + block->free_ranges[at].size ==
+            block->free_ranges[at + 1].offset) {
+        block->free_ranges[at].size += block->free_ranges[at + 1].size;
+        block_remove_range(block, at + 1);
+    }
+    if (at > 0 &&
+        block->free_ranges[at - 1].offset + block->free_ranges[at - 1].size ==
+            block->free_ranges[at].offset) {
+        block->free_ranges[at - 1].size += block->free_ranges[at].size;
+        block_remove_range(block, at);
+    }
+
+    memset(alloc, 0, sizeof(*alloc));
+}
+
+void memalloc_cleanup(struct renderinfo *render) {
+    struct mem_allocator *allocator = &render->allocator;
+    uint32_t i;
+
+    for (i = 0; i < allocator->block_count; i++) {
+        if (allocator->blocks[i].mem != VK_NULL_HANDLE)
+            vkFreeMemory(render->device, allocator->blocks[i].mem, NULL);
+        free(allocator->blocks[i].free_ranges);
+    }
+    free(allocator->blocks);
+    memset(allocator, 0, sizeof(*allocator));
+}
+
+void create_buffer(struct renderinfo *render, VkDeviceSize size,
+                   VkBufferUsageFlags usage, VkMemoryPropertyFlags required_props,
+                   struct gpu_buffer *buffer) {
+    const VkBufferCreateInfo buf_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = NULL,
+        .size = size,
+        .usage = usage,
+        .flags = 0,
+    };
+    VkMemoryRequirements mem_reqs;
+    VkResult err;
+
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->size = size;
+
+    err = vkCreateBuffer(render->device, &buf_info, NULL, &buffer->buf);
+    assert(!err);
+
+    vkGetBufferMemoryRequirements(render->device, buffer->buf, &mem_reqs);
+
+    if (!memalloc_alloc(render, &mem_reqs, required_props, false,
+                        &buffer->alloc)) {
+        ERR_EXIT("Out of device memory while allocating a buffer\n",
+                 "Memory Allocation Failure");
+    }
+
+    err = vkBindBufferMemory(render->device, buffer->buf, buffer->alloc.mem,
+                             buffer->alloc.offset);
+    assert(!err);
+
+    if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+        const VkBufferDeviceAddressInfo address_info = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+            .pNext = NULL,
+            .buffer = buffer->buf,
+        };
+        buffer->address = vkGetBufferDeviceAddress(render->device, &address_info);
+    }
+}
+
+bool import_host_buffer(struct renderinfo *render, const void *range,
+                        size_t range_size, const void *data, VkDeviceSize size,
+                        VkBufferUsageFlags usage, struct gpu_buffer *buffer) {
+    const VkExternalMemoryHandleTypeFlagBits handle_type =
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    const uintptr_t align = (uintptr_t)render->host_pointer_alignment;
+    const uintptr_t start = (uintptr_t)data & ~(align - 1);
+    const uintptr_t end = ((uintptr_t)data + size + align - 1) & ~(align - 1);
+    // Integrated GPUs may not call system memory device local, but it is
+    const bool unified =
+        render->gpu_props.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
+        render->gpu_props.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+    VkMemoryHostPointerPropertiesEXT host_props = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+        .pNext = NULL,
+    };
+    VkMemoryRequirements mem_reqs;
+    VkDeviceMemory mem;
+    VkResult err;
+    uint32_t type_index, bits;
+
+    if (!render->import_host_memory || size == 0 ||
+        start < (uintptr_t)range || end > (uintptr_t)range + range_size)
+        return false;
+    if (vkGetMemoryHostPointerPropertiesEXT(render->device, handle_type,
+                                            (void *)start,
+                                            &host_props) != VK_SUCCESS)
+        return false;
+
+    const VkExternalMemoryBufferCreateInfo external_info = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+        .pNext = NULL,
+        .handleTypes = handle_type,
+    };
+    const VkBufferCreateInfo buf_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = &external_info,
+        .size = size,
+        .usage = usage,
+        .flags = 0,
+    };
+    memset(buffer, 0, sizeof(*buffer));
+    err = vkCreateBuffer(render->device, &buf_info, NULL, &buffer->buf);
+    assert(!err);
+    vkGetBufferMemoryRequirements(render->device, buffer->buf, &mem_reqs);
+
+    // The buffer starts where data does, somewhere in the first page
+    bits = host_props.memoryTypeBits & mem_reqs.memoryTypeBits;
+    for (type_index = 0; type_index < 32; type_index++) {
+        if ((bits & (1u << type_index)) &&
+            (unified || (render->memory_properties.memoryTypes[type_index]
+                             .propertyFlags &
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)))
+            break;
+    }
+    if (type_index == 32 || ((uintptr_t)data - start) % mem_reqs.alignment) {
+        vkDestroyBuffer(render->device, buffer->buf, NULL);
+        memset(buffer, 0, sizeof(*buffer));
+        return false;
+    }
+
+    const VkMemoryAllocateFlagsInfo flags_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .pNext = NULL,
+        .flags = render->allocator.alloc_flags,
+        .deviceMask = 0,
+    };
+    const VkImportMemoryHostPointerInfoEXT import_info = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+        .pNext = render->allocator.alloc_flags ? &flags_info : NULL,
+        .handleType = handle_type,
+        .pHostPointer = (void *)start,
+    };
+    const VkMemoryAllocateInfo mem_alloc = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = &import_info,
+        .allocationSize = end - start,
+        .memoryTypeIndex = type_index,
+    };
+    // Drivers that pin pages may refuse file mappings
+    if (vkAllocateMemory(render->device, &mem_alloc, NULL, &mem) !=
+        VK_SUCCESS) {
+        vkDestroyBuffer(render->device, buffer->buf, NULL);
+        memset(buffer, 0, sizeof(*buffer));
+        return false;
+    }
+
+    buffer->size = size;
+    buffer->alloc.mem = mem;
+    buffer->alloc.offset = (uintptr_t)data - start;
+    buffer->alloc.size = end - start;
+    buffer->alloc.mapped = NULL;
+    buffer->alloc.block = MEMALLOC_DEDICATED;
+    err = vkBindBufferMemory(render->device, buffer->buf, mem,
+                             buffer->alloc.offset);
+    assert(!err);
+
+    if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+        const VkBufferDeviceAddressInfo address_info = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+            .pNext = NULL,
+            .buffer = buffer->buf,
+        };
+        buffer->address = vkGetBufferDeviceAddress(render->device, &address_info);
+    }
+    return true;
+}
+
+void destroy_buffer(struct renderinfo *render, struct gpu_buffer *buffer) {
+    if (buffer->buf == VK_NULL_HANDLE)
+        return;
+
+    vkDestroyBuffer(render->device, buffer->buf, NULL);
+    memalloc_free(render, &buffer->alloc);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void create_image(struct renderinfo *render, VkFormat format, uint32_t width,
+                  uint32_t height, VkImageUsageFlags usage,
+                  struct gpu_image *image) {
+    create_image_mips(render, format, width, height, 1, usage, image);
+}
+
+void create_image_mips(struct renderinfo *render, VkFormat format,
+                       uint32_t width, uint32_t height, uint32_t mip_levels,
+                       VkImageUsageFlags usage, struct gpu_image *image) {
+    const VkImageCreateInfo image_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext = NULL,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = {width, height, 1},
+        .mipLevels = mip_levels,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .flags = 0,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    VkImageViewCreateInfo view = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = NULL,
+        .image = VK_NULL_HANDLE,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .components =
+            {
+             VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G,
+             VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A,
+            },
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mip_levels, 0, 1},
+        .flags = 0,
+    };
+    VkMemoryRequirements mem_reqs;
+    VkResult err;
+
+    memset(image, 0, sizeof(*image));
+    image->format = format;
+    image->width = width;
+    image->height = height;
+    image->mip_levels = mip_levels;
+
+    err = vkCreateImage(render->device, &image_create_info, NULL, &image->image);
+    assert(!err);
+
+    vkGetImageMemoryRequirements(render->device, image->image, &mem_reqs);
+
+    if (!memalloc_alloc(render, &mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        true, &image->alloc)) {
+        ERR_EXIT("Out of device memory while allocating an image\n",
+                 "Memory Allocation Failure");
+    }
+
+    err = vkBindImageMemory(render->device, image->image, image->alloc.mem,
+                            image->alloc.offset);
+    assert(!err);
+
+    view.image = image->image;
+    err = vkCreateImageView(render->device, &view, NULL, &image->view);
+    assert(!err);
+}
+
+void destroy_image(struct renderinfo *render, struct gpu_image *image) {
+    if (image->image == VK_NULL_HANDLE)
+        return;
+
+    vkDestroyImageView(render->device, image->view, NULL);
+    vkDestroyImage(render->device, image->image, NULL);
+    memalloc_free(render, &image->alloc);
+    memset(image, 0, sizeof(*image));
+}
+
+void uniform_ring_init(struct renderinfo *render, struct uniform_ring *ring,
+                       VkDeviceSize frame_size, uint32_t frame_count) {
+    const VkPhysicalDeviceLimits *limits = &render->gpu_props.limits;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->alignment = limits->minUniformBufferOffsetAlignment;
+    if (ring->alignment < limits->minStorageBufferOffsetAlignment)
+        ring->alignment = limits->minStorageBufferOffsetAlignment;
+    if (ring->alignment == 0)
+        ring->alignment = 1;
+    ring->frame_size = ALIGN_UP(frame_size, ring->alignment);
+    ring->frame_count = frame_count;
+    // Starts on the last region so that the first submit gets region 0
+    ring->frame = frame_count - 1;
+    ring->head = ring->frame_size;
+
+    create_buffer(render, ring->frame_size * frame_count,
+                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &ring->buffer);
+    assert(ring->buffer.alloc.mapped);
+}
+
+void uniform_ring_next(struct uniform_ring *ring) {
+    ring->frame = (ring->frame + 1) % ring->frame_count;
+    ring->head = 0;
+}
+
+bool uniform_ring_push(struct uniform_ring *ring, const void *data,
+                       VkDeviceSize size, uint32_t *offset) {
+    const VkDeviceSize start =
+        (VkDeviceSize)ring->frame * ring->frame_size + ring->head;
+
+    if (ring->head + size > ring->frame_size)
+        return false;
+    memcpy((char *)ring->buffer.alloc.mapped + start, data, size);
+    ring->head = ALIGN_UP(ring->head + size, ring->alignment);
+    *offset = (uint32_t)start;
+    return true;
+}
+
+void uniform_ring_cleanup(struct renderinfo *render,
+                          struct uniform_ring *ring) {
+    destroy_buffer(render, &ring->buffer);
+    memset(ring, 0, sizeof(*ring));
+}
@@ -0,0 +1,138 @@
+#ifndef MEMALLOC_H
+#define MEMALLOC_H
+
+// Device memory sub-allocator. Buffers and images are placed into large
+// VkDeviceMemory blocks instead of getting one allocation each, which keeps
+// us far away from maxMemoryAllocationCount and lets tightly sized objects
+// (compacted acceleration structures, per-mesh buffers) pack together.
+
+#define MEMALLOC_BLOCK_SIZE (64ull * 1024 * 1024)
+// block of allocations that have their memory to themselves
+#define MEMALLOC_DEDICATED UINT32_MAX
+
+struct renderinfo;
+
+struct mem_range {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+struct mem_block {
+    VkDeviceMemory mem;
+    VkDeviceSize size;
+    uint32_t type_index;
+    bool optimal; // holds optimal tiling images and nothing else
+    void *mapped;
+
+    // free ranges, sorted by offset
+    struct mem_range *free_ranges;
+    uint32_t free_count;
+    uint32_t free_cap;
+
+    uint32_t live_count;
+};
+
+struct mem_allocator {
+    struct mem_block *blocks;
+    uint32_t block_count;
+
+    VkMemoryAllocateFlags alloc_flags;
+
+    VkDeviceSize allocated_bytes;
+    VkDeviceSize used_bytes;
+};
+
+struct mem_allocation {
+    VkDeviceMemory mem;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void *mapped;
+    uint32_t block;
+};
+
+struct gpu_buffer {
+    VkBuffer buf;
+    VkDeviceSize size;
+    VkDeviceAddress address;
+    struct mem_allocation alloc;
+};
+
+struct gpu_image {
+    VkImage image;
+    VkImageView view;
+    VkFormat format;
+    uint32_t width, height;
+    uint32_t mip_levels; // all of them are in view
+    struct mem_allocation alloc;
+};
+
+void memalloc_init(struct renderinfo *render);
+
+// optimal: the memory is for an optimal tiling image. Those get blocks of
+// their own, so linear and optimal resources are never neighbours and no
+// sub-allocation needs bufferImageGranularity.
+bool memalloc_alloc(struct renderinfo *render,
+                    const VkMemoryRequirements *mem_reqs,
+                    VkMemoryPropertyFlags required_props, bool optimal,
+                    struct mem_allocation *alloc);
+
+void memalloc_free(struct renderinfo *render, struct mem_allocation *alloc);
+
+void memalloc_cleanup(struct renderinfo *render);
+
+void create_buffer(struct renderinfo *render, VkDeviceSize size,
+                   VkBufferUsageFlags usage, VkMemoryPropertyFlags required_props,
+                   struct gpu_buffer *buffer);
+
+// Creates a buffer on host memory at data imported with
+// VK_EXT_external_memory_host, for devices that read host memory as their
+// own: integrated GPUs and software renderers. The import covers data
+// widened to render->host_pointer_alignment, which has to stay within the
+// size bytes at range. False when the device cannot import it or would
+// read it across the bus, the caller uploads the data then. The memory
+// must stay mapped until the buffer is destroyed.
+bool import_host_buffer(struct renderinfo *render, const void *range,
+                        size_t range_size, const void *data, VkDeviceSize size,
+                        VkBufferUsageFlags usage, struct gpu_buffer *buffer);
+
+void destroy_buffer(struct renderinfo *render, struct gpu_buffer *buffer);
+
+void create_image(struct renderinfo *render, VkFormat format, uint32_t width,
+                  uint32_t height, VkImageUsageFlags usage,
+                  struct gpu_image *image);
+
+// Full chain: mip_levels of floor(log2(max(width, height))) + 1
+void create_image_mips(struct renderinfo *render, VkFormat format,
+                       uint32_t width, uint32_t height, uint32_t mip_levels,
+                       VkImageUsageFlags usage, struct gpu_image *image);
+
+void destroy_image(struct renderinfo *render, struct gpu_image *image);
+
+// Linear allocator for constants that change with every submit. The buffer
+// stays mapped and is split into frame_count regions; each submit fills the
+// next one, so a region is only written again frame_count submits later.
+// One descriptor covers the buffer and everything in it is bound with a
+// dynamic offset, nothing is created or updated per submit.
+struct uniform_ring {
+    struct gpu_buffer buffer;
+    VkDeviceSize alignment; // of dynamic offsets
+    VkDeviceSize frame_size;
+    uint32_t frame_count;
+    uint32_t frame;    // region being filled
+    VkDeviceSize head; // next free byte in it
+};
+
+void uniform_ring_init(struct renderinfo *render, struct uniform_ring *ring,
+                       VkDeviceSize frame_size, uint32_t frame_count);
+
+// Moves on to the next region, at most frame_count submits that use the
+// ring may be in flight
+void uniform_ring_next(struct uniform_ring *ring);
+
+// Copies data into the current region, false when it is full
+bool uniform_ring_push(struct uniform_ring *ring, const void *data,
+                       VkDeviceSize size, uint32_t *offset);
+
+void uniform_ring_cleanup(struct renderinfo *render, struct uniform_ring *ring);
+
+#endif
@@ -0,0 +1,880 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "task.h"
+#include "objload.h"
+
+#define OBJ_MATERIAL_NAME_MAX 64
+#define OBJ_CHUNKS_PER_THREAD 4 // more chunks than threads evens out the load
+#define OBJ_CHUNK_MIN (1 << 20)
+#define OBJ_MAP_MIN_CAP 1024
+#define OBJ_MAP_CLAIMED UINT32_MAX
+
+// One triangle corner, 0-based indices into the attribute arrays, -1: absent
+struct obj_corner {
+    int32_t v, vt, vn;
+};
+
+// An o, g or usemtl line, the mesh ends before the chunk's corner-th corner
+struct obj_break {
+    uint32_t corner;
+    uint32_t name_length;
+    const char *name; // usemtl material name, NULL for o and g
+};
+
+// Corners of a chunk from corner on belong to mesh
+struct obj_span {
+    uint32_t corner;
+    uint32_t mesh;
+};
+
+// A range of whole lines, parsed by one thread. The counts come from a
+// first pass over all chunks, the bases are their prefix sums so every
+// chunk can write its attributes straight into the shared arrays.
+struct obj_chunk {
+    const char *begin, *end;
+    uint32_t line_count, first_line;
+    uint32_t position_count, position_base;
+    uint32_t texcoord_count, texcoord_base;
+    uint32_t normal_count, normal_base;
+
+    struct obj_corner *corners;
+    uint32_t corner_count, corner_cap, corner_base;
+    struct obj_break *breaks;
+    uint32_t break_count, break_cap;
+    struct obj_span *spans;
+    uint32_t span_count, span_cap;
+
+    uint32_t vertex_count, vertex_base; // vertices this chunk saw first
+    uint32_t error_line;                // chunk relative, 0: no error
+};
+
+// Vertex dedup map shared by all threads. A slot is claimed by swapping
+// mesh from 0 to OBJ_MAP_CLAIMED, filled in, and published by storing the
+// real mesh + 1. first keeps the lowest corner using the key, which makes
+// the vertex order the order of first use, the same as a serial parse.
+struct obj_map_entry {
+    int32_t v, vt, vn;
+    uint32_t mesh;
+    uint32_t first;
+    uint32_t vertex;
+};
+
+struct obj_state {
+    const char *name;
+    struct scene *scene;
+
+    float *positions, *texcoords, *normals;
+    uint32_t position_count, texcoord_count, normal_count;
+
+    struct obj_chunk *chunks;
+    uint32_t chunk_count;
+
+    struct obj_map_entry *map;
+    uint32_t map_mask;
+    uint8_t *needs_normal; // per scene vertex, normal comes from its faces
+
+    uint32_t mesh_cap, material_cap;
+    char (*material_names)[OBJ_MATERIAL_NAME_MAX];
+
+    struct taskinfo *tasks;
+    uint32_t thread_count;
+    void (*task)(struct obj_state *state, uint32_t index);
+};
+
+// Running attribute counts while a chunk is parsed, global so face indices
+// resolve the same way they would in a serial parse
+struct obj_parser {
+    struct obj_state *state;
+    struct obj_chunk *chunk;
+    uint32_t position_count, texcoord_count, normal_count;
+};
+
+static bool obj_grow(void **array, uint32_t *cap, uint64_t need, size_t elem) {
+    uint64_t new_cap;
+    void *grown;
+
+    if (need <= *cap)
+        return true;
+    if (need > UINT32_MAX)
+        return false;
+    new_cap = *cap ? *cap : 64;
+    while (new_cap < need)
+        new_cap *= 2;
+    if (new_cap > UINT32_MAX)
+        new_cap = UINT32_MAX;
+    grown = realloc(*array, new_cap * elem);
+    if (!grown)
+        return false;
+    *array = grown;
+    *cap = (uint32_t)new_cap;
+    return true;
+}
+
+static inline bool obj_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline void obj_skip_space(const char **p, const char *end) {
+    while (*p < end && obj_is_space(**p))
+        (*p)++;
+}
+
+// Parses a decimal float without needing a terminated string, accurate to
+// the last digit or so for the values geometry files contain
+static bool obj_parse_float(const char **p, const char *end, float *out) {
+    static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                   1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                   1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *s = *p;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool negative = false, any = false;
+    double value;
+
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+    for (; s < end && *s >= '0' && *s <= '9'; s++, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+            if (mantissa)
+                digits++;
+        } else {
+            exponent++;
+        }
+    }
+    if (s < end && *s == '.') {
+        for (s++; s < end && *s >= '0' && *s <= '9'; s++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+                if (mantissa)
+                    digits++;
+                exponent--;
+            }
+        }
+    }
+    if (!any)
+        return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        bool exp_negative = false;
+        int e = 0;
+
+        s++;
+        if (s < end && (*s == '-' || *s == '+'))
+            exp_negative = *s++ == '-';
+        if (s >= end || *s < '0' || *s > '9')
+            return false;
+        for (; s < end && *s >= '0' && *s <= '9'; s++)
+            if (e < 1000)
+                e = e * 10 + (*s - '0');
+        exponent += exp_negative ? -e : e;
+    }
+
+    value = (double)mantissa;
+    while (exponent > 22) {
+        value *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22) {
+        value /= 1e22;
+        exponent += 22;
+    }
+    value = exponent >= 0 ? value * pow10[exponent] : value / pow10[-exponent];
+
+    *out = (float)(negative ? -value : value);
+    *p = s;
+    return true;
+}
+
+static bool obj_parse_int(const char **p, const char *end, int64_t *out) {
+    const char *s = *p;
+    bool negative = false;
+    int64_t value = 0;
+
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+    if (s >= end || *s < '0' || *s > '9')
+        return false;
+    for (; s < end && *s >= '0' && *s <= '9'; s++)
+        if (value < INT32_MAX)
+            value = value * 10 + (*s - '0');
+    *out = negative ? -value : value;
+    *p = s;
+    return true;
+}
+
+static bool obj_parse_floats(const char **p, const char *end, float *out,
+                             int count, int required) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        obj_skip_space(p, end);
+        if (!obj_parse_float(p, end, &out[i])) {
+            if (i < required)
+                return false;
+            out[i] = 0.0f;
+        }
+    }
+    return true;
+}
+
+// OBJ indices are 1-based, negative ones count back from the last element
+static bool obj_resolve(int64_t index, uint32_t count, int32_t *out) {
+    if (index > 0 && index <= count)
+        *out = (int32_t)(index - 1);
+    else if (index < 0 && -index <= count)
+        *out = (int32_t)(count + index);
+    else
+        return false;
+    return true;
+}
+
+static uint32_t obj_material(struct obj_state *state, const char *name,
+                             size_t length) {
+    struct scene *scene = state->scene;
+    uint32_t i;
+
+    if (length >= OBJ_MATERIAL_NAME_MAX)
+        length = OBJ_MATERIAL_NAME_MAX - 1;
+    for (i = 0; i < scene->material_count; i++) {
+        if (strncmp(state->material_names[i], name, length) == 0 &&
+            state->material_names[i][length] == '\0')
+            return i;
+    }
+
+    if (!obj_grow((void **)&scene->materials, &state->material_cap,
+                  scene->material_count + 1, sizeof(struct scene_material)))
+        return UINT32_MAX;
+    // material_names shares material_cap, grow it to the same size
+    state->material_names =
+        realloc(state->material_names,
+                (size_t)state->material_cap * OBJ_MATERIAL_NAME_MAX);
+    if (!state->material_names)
+        return UINT32_MAX;
+
+    i = scene->material_count++;
+    memset(&scene->materials[i], 0, sizeof(scene->materials[i]));
+    scene->materials[i].base_color[0] = 0.8f;
+    scene->materials[i].base_color[1] = 0.8f;
+    scene->materials[i].base_color[2] = 0.8f;
+    scene->materials[i].base_color[3] = 1.0f;
+    scene->materials[i].roughness = 1.0f;
+    scene->materials[i].base_color_texture = SCENE_NO_TEXTURE;
+    memcpy(state->material_names[i], name, length);
+    state->material_names[i][length] = '\0';
+    return i;
+}
+
+static void obj_run_task(void *arg, uint32_t index) {
+    struct obj_state *state = arg;
+
+    state->task(state, index);
+}
+
+// Runs task for 0..count-1 on the task system and waits for all
+static void obj_parallel(struct obj_state *state, uint32_t count,
+                         void (*task)(struct obj_state *state, uint32_t index)) {
+    state->task = task;
+    task_parallel_for(state->tasks, count, obj_run_task, state);
+}
+
+static const char *obj_keyword(const char **p, const char *end,
+                               size_t *length) {
+    const char *keyword;
+
+    obj_skip_space(p, end);
+    keyword = *p;
+    while (*p < end && !obj_is_space(**p))
+        (*p)++;
+    *length = *p - keyword;
+    return keyword;
+}
+
+static void obj_count_chunk(struct obj_state *state, uint32_t index) {
+    struct obj_chunk *chunk = &state->chunks[index];
+    const char *p = chunk->begin;
+
+    while (p < chunk->end) {
+        const char *line_end = memchr(p, '\n', chunk->end - p);
+        const char *keyword;
+        size_t length;
+
+        if (!line_end)
+            line_end = chunk->end;
+        chunk->line_count++;
+
+        keyword = obj_keyword(&p, line_end, &length);
+        if (length == 1 && keyword[0] == 'v')
+            chunk->position_count++;
+        else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't')
+            chunk->texcoord_count++;
+        else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n')
+            chunk->normal_count++;
+        p = line_end + 1;
+    }
+}
+
+static bool obj_emit_corner(struct obj_chunk *chunk,
+                            const struct obj_corner *corner) {
+    if (!obj_grow((void **)&chunk->corners, &chunk->corner_cap,
+                  (uint64_t)chunk->corner_count + 1, sizeof(struct obj_corner)))
+        return false;
+    chunk->corners[chunk->corner_count++] = *corner;
+    return true;
+}
+
+static bool obj_face(struct obj_parser *parser, const char *p,
+                     const char *end) {
+    struct obj_corner first, previous;
+    uint32_t count = 0;
+
+    for (;;) {
+        struct obj_corner corner = {-1, -1, -1};
+        int64_t index;
+
+        obj_skip_space(&p, end);
+        if (p >= end)
+            break;
+
+        if (!obj_parse_int(&p, end, &index) ||
+            !obj_resolve(index, parser->position_count, &corner.v))
+            return false;
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p != '/' &&
+                (!obj_parse_int(&p, end, &index) ||
+                 !obj_resolve(index, parser->texcoord_count, &corner.vt)))
+                return false;
+            if (p < end && *p == '/') {
+                p++;
+                if (!obj_parse_int(&p, end, &index) ||
+                    !obj_resolve(index, parser->normal_count, &corner.vn))
+                    return false;
+            }
+        }
+        if (p < end && !obj_is_space(*p))
+            return false;
+
+        // Fan around the first corner
+        if (count == 0)
+            first = corner;
+        else if (count >= 2 && (!obj_emit_corner(parser->chunk, &first) ||
+                                !obj_emit_corner(parser->chunk, &previous) ||
+                                !obj_emit_corner(parser->chunk, &corner)))
+            return false;
+        previous = corner;
+        count++;
+    }
+    return count >= 3;
+}
+
+static bool obj_break(struct obj_chunk *chunk, const char *name,
+                      size_t length) {
+    struct obj_break *b;
+
+    if (!obj_grow((void **)&chunk->breaks, &chunk->break_cap,
+                  (uint64_t)chunk->break_count + 1, sizeof(struct obj_break)))
+        return false;
+    b = &chunk->breaks[chunk->break_count++];
+    b->corner = chunk->corner_count;
+    b->name = name;
+    b->name_length = (uint32_t)length;
+    return true;
+}
+
+static bool obj_line(struct obj_parser *parser, const char *p,
+                     const char *end) {
+    struct obj_state *state = parser->state;
+    const char *keyword;
+    size_t length;
+
+    keyword = obj_keyword(&p, end, &length);
+    if (length == 0 || keyword[0] == '#')
+        return true;
+
+    // The counting pass saw the same keywords, the slots are there
+    if (length == 1 && keyword[0] == 'v')
+        return obj_parse_floats(
+            &p, end, &state->positions[(size_t)parser->position_count++ * 3],
+            3, 3);
+    if (length == 2 && keyword[0] == 'v' && keyword[1] == 't')
+        return obj_parse_floats(
+            &p, end, &state->texcoords[(size_t)parser->texcoord_count++ * 2],
+            2, 1);
+    if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n')
+        return obj_parse_floats(
+            &p, end, &state->normals[(size_t)parser->normal_count++ * 3], 3,
+            3);
+    if (length == 1 && keyword[0] == 'f')
+        return obj_face(parser, p, end);
+    if (length == 1 && (keyword[0] == 'o' || keyword[0] == 'g'))
+        return obj_break(parser->chunk, NULL, 0);
+    if (length == 6 && memcmp(keyword, "usemtl", 6) == 0) {
+        obj_skip_space(&p, end);
+        while (end > p && obj_is_space(end[-1]))
+            end--;
+        return obj_break(parser->chunk, p, end - p);
+    }
+
+    // s, mtllib, l, p and friends carry nothing the renderer uses
+    return true;
+}
+
+static void obj_parse_chunk(struct obj_state *state, uint32_t index) {
+    struct obj_chunk *chunk = &state->chunks[index];
+    struct obj_parser parser = {
+        .state = state,
+        .chunk = chunk,
+        .position_count = chunk->position_base,
+        .texcoord_count = chunk->texcoord_base,
+        .normal_count = chunk->normal_base,
+    };
+    const char *p = chunk->begin;
+    uint32_t line = 0;
+
+    while (p < chunk->end) {
+        const char *line_end = memchr(p, '\n', chunk->end - p);
+        if (!line_end)
+            line_end = chunk->end;
+
+        line++;
+        if (!obj_line(&parser, p, line_end)) {
+            chunk->error_line = line;
+            return;
+        }
+        p = line_end + 1;
+    }
+}
+
+// Turns the o, g and usemtl breaks of all chunks into meshes, in file
+// order. Meshes without faces are dropped, as is their break.
+static bool obj_build_meshes(struct obj_state *state) {
+    struct scene *scene = state->scene;
+    uint32_t material = 0;
+    bool mesh_open = false;
+    uint32_t c, b, i;
+
+    for (c = 0; c < state->chunk_count; c++) {
+        struct obj_chunk *chunk = &state->chunks[c];
+        uint32_t corner = 0;
+
+        for (b = 0; b <= chunk->break_count; b++) {
+            const struct obj_break *brk =
+                b < chunk->break_count ? &chunk->breaks[b] : NULL;
+            const uint32_t next = brk ? brk->corner : chunk->corner_count;
+
+            if (next > corner) {
+                if (!mesh_open) {
+                    struct scene_mesh *mesh;
+
+                    if (!obj_grow((void **)&scene->meshes, &state->mesh_cap,
+                                  scene->mesh_count + 1,
+                                  sizeof(struct scene_mesh)))
+                        return false;
+                    mesh = &scene->meshes[scene->mesh_count++];
+                    memset(mesh, 0, sizeof(*mesh));
+                    mesh->first_index = chunk->corner_base + corner;
+                    mesh->material = material;
+                    mesh_open = true;
+                }
+                if (!obj_grow((void **)&chunk->spans, &chunk->span_cap,
+                              chunk->span_count + 1, sizeof(struct obj_span)))
+                    return false;
+                chunk->spans[chunk->span_count].corner = corner;
+                chunk->spans[chunk->span_count].mesh = scene->mesh_count - 1;
+                chunk->span_count++;
+                corner = next;
+            }
+            if (brk) {
+                mesh_open = false;
+                if (brk->name) {
+                    material = obj_material(state, brk->name, brk->name_length);
+                    if (material == UINT32_MAX)
+                        return false;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < scene->mesh_count; i++) {
+        const uint32_t next = i + 1 < scene->mesh_count
+                                  ? scene->meshes[i + 1].first_index
+                                  : scene->index_count;
+        scene->meshes[i].index_count = next - scene->meshes[i].first_index;
+    }
+    return true;
+}
+
+static inline uint32_t obj_key_hash(uint32_t mesh,
+                                    const struct obj_corner *key) {
+    uint32_t h = (uint32_t)key->v * 0x9e3779b1u;
+    h ^= (uint32_t)key->vt * 0x85ebca77u;
+    h ^= (uint32_t)key->vn * 0xc2b2ae3du;
+    h ^= mesh * 0x27d4eb2fu;
+    return h ^ (h >> 15);
+}
+
+// Returns the slot of the key, inserting it when it is new
+static uint32_t obj_map_insert(struct obj_state *state, uint32_t mesh,
+                               const struct obj_corner *key, uint32_t corner) {
+    const uint32_t tag = mesh + 1; // vertices are only shared within a mesh
+    uint32_t slot = obj_key_hash(mesh, key) & state->map_mask;
+
+    for (;; slot = (slot + 1) & state->map_mask) {
+        struct obj_map_entry *entry = &state->map[slot];
+        uint32_t m = __atomic_load_n(&entry->mesh, __ATOMIC_ACQUIRE);
+        uint32_t first;
+
+        if (m == 0) {
+            if (__atomic_compare_exchange_n(&entry->mesh, &m, OBJ_MAP_CLAIMED,
+                                            false, __ATOMIC_ACQUIRE,
+                                            __ATOMIC_ACQUIRE)) {
+                entry->v = key->v;
+                entry->vt = key->vt;
+                entry->vn = key->vn;
+                entry->first = corner;
+                __atomic_store_n(&entry->mesh, tag, __ATOMIC_RELEASE);
+                return slot;
+            }
+        }
+        // Another thread is filling the slot in, only takes a few stores
+        while (m == OBJ_MAP_CLAIMED)
+            m = __atomic_load_n(&entry->mesh, __ATOMIC_ACQUIRE);
+
+        if (m != tag || entry->v != key->v || entry->vt != key->vt ||
+            entry->vn != key->vn)
+            continue;
+        first = __atomic_load_n(&entry->first, __ATOMIC_RELAXED);
+        while (corner < first &&
+               !__atomic_compare_exchange_n(&entry->first, &first, corner, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+        return slot;
+    }
+}
+
+static inline uint32_t obj_span_mesh(const struct obj_chunk *chunk,
+                                     uint32_t *span, uint32_t corner) {
+    while (*span + 1 < chunk->span_count &&
+           chunk->spans[*span + 1].corner <= corner)
+        (*span)++;
+    return chunk->spans[*span].mesh;
+}
+
+// The slot of every corner is kept in its index until vertices are numbered
+static void obj_dedup_chunk(struct obj_state *state, uint32_t index) {
+    const struct obj_chunk *chunk = &state->chunks[index];
+    uint32_t *indices = state->scene->indices + chunk->corner_base;
+    uint32_t span = 0;
+    uint32_t i;
+
+    for (i = 0; i < chunk->corner_count; i++)
+        indices[i] = obj_map_insert(state, obj_span_mesh(chunk, &span, i),
+                                    &chunk->corners[i], chunk->corner_base + i);
+}
+
+static void obj_count_vertices(struct obj_state *state, uint32_t index) {
+    struct obj_chunk *chunk = &state->chunks[index];
+    const uint32_t *slots = state->scene->indices + chunk->corner_base;
+    uint32_t i;
+
+    for (i = 0; i < chunk->corner_count; i++)
+        if (state->map[slots[i]].first == chunk->corner_base + i)
+            chunk->vertex_count++;
+}
+
+static void obj_emit_vertices(struct obj_state *state, uint32_t index) {
+    const struct obj_chunk *chunk = &state->chunks[index];
+    const uint32_t *slots = state->scene->indices + chunk->corner_base;
+    uint32_t vertex = chunk->vertex_base;
+    uint32_t i;
+
+    for (i = 0; i < chunk->corner_count; i++) {
+        const struct obj_corner *key = &chunk->corners[i];
+        struct scene_vertex *out;
+
+        if (state->map[slots[i]].first != chunk->corner_base + i)
+            continue;
+        state->map[slots[i]].vertex = vertex;
+
+        out = &state->scene->vertices[vertex];
+        memcpy(out->pos, &state->positions[(size_t)key->v * 3],
+               sizeof(out->pos));
+        if (key->vn >= 0)
+            memcpy(out->normal, &state->normals[(size_t)key->vn * 3],
+                   sizeof(out->normal));
+        else
+            memset(out->normal, 0, sizeof(out->normal));
+        if (key->vt >= 0) {
+            out->uv[0] = state->texcoords[(size_t)key->vt * 2];
+            out->uv[1] = state->texcoords[(size_t)key->vt * 2 + 1];
+        } else {
+            out->uv[0] = out->uv[1] = 0.0f;
+        }
+        state->needs_normal[vertex] = key->vn < 0;
+        vertex++;
+    }
+}
+
+static void obj_emit_indices(struct obj_state *state, uint32_t index) {
+    const struct obj_chunk *chunk = &state->chunks[index];
+    const struct scene_mesh *meshes = state->scene->meshes;
+    uint32_t *indices = state->scene->indices + chunk->corner_base;
+    uint32_t span = 0;
+    uint32_t i;
+
+    for (i = 0; i < chunk->corner_count; i++)
+        indices[i] = state->map[indices[i]].vertex -
+                     meshes[obj_span_mesh(chunk, &span, i)].first_vertex;
+}
+
+// Area weighted face normals for the vertices that have none. Meshes own
+// their vertices, so they can be done in parallel without atomics.
+static void obj_mesh_normals(struct obj_state *state, uint32_t index) {
+    struct scene *scene = state->scene;
+    const struct scene_mesh *mesh = &scene->meshes[index];
+    const uint8_t *needs = state->needs_normal + mesh->first_vertex;
+    struct scene_vertex *vertices = scene->vertices + mesh->first_vertex;
+    const uint32_t *indices = scene->indices + mesh->first_index;
+    uint32_t t, i;
+
+    for (t = 0; t + 2 < mesh->index_count; t += 3) {
+        const uint32_t *corner = &indices[t];
+        float e1[3], e2[3], n[3];
+
+        if (!needs[corner[0]] && !needs[corner[1]] && !needs[corner[2]])
+            continue;
+        for (i = 0; i < 3; i++) {
+            e1[i] = vertices[corner[1]].pos[i] - vertices[corner[0]].pos[i];
+            e2[i] = vertices[corner[2]].pos[i] - vertices[corner[0]].pos[i];
+        }
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        for (i = 0; i < 3; i++) {
+            if (needs[corner[i]]) {
+                vertices[corner[i]].normal[0] += n[0];
+                vertices[corner[i]].normal[1] += n[1];
+                vertices[corner[i]].normal[2] += n[2];
+            }
+        }
+    }
+
+    for (i = 0; i < mesh->vertex_count; i++) {
+        float *n = vertices[i].normal;
+        float len;
+
+        if (!needs[i])
+            continue;
+        len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len > 0.0f) {
+            n[0] /= len;
+            n[1] /= len;
+            n[2] /= len;
+        } else {
+            n[2] = 1.0f;
+        }
+    }
+}
+
+static bool obj_split(struct obj_state *state, const char *data, size_t size) {
+    uint64_t count = size / OBJ_CHUNK_MIN;
+    const char *p = data;
+    const char *end = data + size;
+    uint32_t i;
+
+    if (count > (uint64_t)state->thread_count * OBJ_CHUNKS_PER_THREAD)
+        count = (uint64_t)state->thread_count * OBJ_CHUNKS_PER_THREAD;
+    if (count == 0)
+        count = 1;
+
+    state->chunks = calloc(count, sizeof(struct obj_chunk));
+    if (!state->chunks)
+        return false;
+
+    // Cut at the first line end after each even split point
+    for (i = 0; i < count && p < end; i++) {
+        const char *cut = i + 1 == count ? end : data + size / count * (i + 1);
+
+        if (cut < p)
+            cut = p;
+        if (cut < end) {
+            const char *line_end = memchr(cut, '\n', end - cut);
+            cut = line_end ? line_end + 1 : end;
+        }
+        state->chunks[i].begin = p;
+        state->chunks[i].end = cut;
+        p = cut;
+    }
+    state->chunk_count = i;
+    return true;
+}
+
+static void obj_free_state(struct obj_state *state) {
+    uint32_t i;
+
+    for (i = 0; i < state->chunk_count; i++) {
+        free(state->chunks[i].corners);
+        free(state->chunks[i].breaks);
+        free(state->chunks[i].spans);
+    }
+    free(state->chunks);
+    free(state->positions);
+    free(state->texcoords);
+    free(state->normals);
+    free(state->map);
+    free(state->needs_normal);
+    free(state->material_names);
+}
+
+bool obj_import(struct scene *scene, const char *data, size_t size,
+                const char *name, struct taskinfo *tasks) {
+    struct obj_state state;
+    uint64_t positions = 0, texcoords = 0, normals = 0, corners = 0;
+    uint64_t map_cap;
+    uint32_t lines = 0, vertices = 0;
+    uint32_t i;
+
+    memset(scene, 0, sizeof(*scene));
+    memset(&state, 0, sizeof(state));
+    state.name = name;
+    state.scene = scene;
+    state.tasks = tasks;
+    state.thread_count = task_thread_count(tasks);
+
+    // Faces before any usemtl use a default material
+    if (obj_material(&state, "", 0) == UINT32_MAX ||
+        !obj_split(&state, data, size))
+        goto fail;
+
+    // Count attributes per chunk, then give each chunk its slice of the
+    // shared arrays
+    obj_parallel(&state, state.chunk_count, obj_count_chunk);
+    for (i = 0; i < state.chunk_count; i++) {
+        struct obj_chunk *chunk = &state.chunks[i];
+
+        chunk->first_line = lines;
+        chunk->position_base = (uint32_t)positions;
+        chunk->texcoord_base = (uint32_t)texcoords;
+        chunk->normal_base = (uint32_t)normals;
+        lines += chunk->line_count;
+        positions += chunk->position_count;
+        texcoords += chunk->texcoord_count;
+        normals += chunk->normal_count;
+    }
+    if (positions > INT32_MAX || texcoords > INT32_MAX || normals > INT32_MAX) {
+        fprintf(stderr, "%s: too many vertices\n", name);
+        goto fail;
+    }
+    state.position_count = (uint32_t)positions;
+    state.texcoord_count = (uint32_t)texcoords;
+    state.normal_count = (uint32_t)normals;
+    state.positions = malloc((positions ? positions : 1) * 3 * sizeof(float));
+    state.texcoords = malloc((texcoords ? texcoords : 1) * 2 * sizeof(float));
+    state.normals = malloc((normals ? normals : 1) * 3 * sizeof(float));
+    if (!state.positions || !state.texcoords || !state.normals)
+        goto fail;
+
+    obj_parallel(&state, state.chunk_count, obj_parse_chunk);
+    for (i = 0; i < state.chunk_count; i++) {
+        struct obj_chunk *chunk = &state.chunks[i];
+
+        if (chunk->error_line) {
+            fprintf(stderr, "%s:%u: malformed or unsupported line\n", name,
+                    chunk->first_line + chunk->error_line);
+            goto fail;
+        }
+        chunk->corner_base = (uint32_t)corners;
+        corners += chunk->corner_count;
+    }
+    if (corners == 0) {
+        fprintf(stderr, "%s: no faces\n", name);
+        goto fail;
+    }
+    map_cap = OBJ_MAP_MIN_CAP;
+    while (map_cap < corners + corners / 4)
+        map_cap *= 2;
+    if (corners > UINT32_MAX || map_cap > (uint64_t)UINT32_MAX + 1) {
+        fprintf(stderr, "%s: too many faces\n", name);
+        goto fail;
+    }
+    scene->index_count = (uint32_t)corners;
+    scene->indices = malloc(corners * sizeof(uint32_t));
+    state.map = calloc(map_cap, sizeof(struct obj_map_entry));
+    state.map_mask = (uint32_t)(map_cap - 1);
+    if (!scene->indices || !state.map || !obj_build_meshes(&state))
+        goto fail;
+
+    // Dedup, then number the vertices in order of their first corner
+    obj_parallel(&state, state.chunk_count, obj_dedup_chunk);
+    obj_parallel(&state, state.chunk_count, obj_count_vertices);
+    for (i = 0; i < state.chunk_count; i++) {
+        state.chunks[i].vertex_base = vertices;
+        vertices += state.chunks[i].vertex_count;
+    }
+    scene->vertex_count = vertices;
+    scene->vertices = malloc((size_t)vertices * sizeof(struct scene_vertex));
+    state.needs_normal = malloc(vertices);
+    if (!scene->vertices || !state.needs_normal)
+        goto fail;
+    obj_parallel(&state, state.chunk_count, obj_emit_vertices);
+
+    // A mesh's first corner always introduces a vertex
+    for (i = 0; i < scene->mesh_count; i++)
+        scene->meshes[i].first_vertex =
+            state.map[scene->indices[scene->meshes[i].first_index]].vertex;
+    for (i = 0; i < scene->mesh_count; i++) {
+        const uint32_t next = i + 1 < scene->mesh_count
+                                  ? scene->meshes[i + 1].first_vertex
+                                  : scene->vertex_count;
+        scene->meshes[i].vertex_count = next - scene->meshes[i].first_vertex;
+    }
+    obj_parallel(&state, state.chunk_count, obj_emit_indices);
+    obj_parallel(&state, scene->mesh_count, obj_mesh_normals);
+
+    scene->instance_count = scene->mesh_count;
+    scene->instances = calloc(scene->instance_count, sizeof(struct scene_instance));
+    if (!scene->instances)
+        goto fail;
+    for (i = 0; i < scene->instance_count; i++) {
+        scene->instances[i].transform[0][0] = 1.0f;
+        scene->instances[i].transform[1][1] = 1.0f;
+        scene->instances[i].transform[2][2] = 1.0f;
+        scene->instances[i].mesh = i;
+    }
+
+    obj_free_state(&state);
+    return true;
+
+fail:
+    obj_free_state(&state);
+    free(scene->vertices);
+    free(scene->indices);
+    free(scene->meshes);
+    free(scene->materials);
+    free(scene->instances);
+    memset(scene, 0, sizeof(*scene));
+    return false;
+}
@@ -0,0 +1,19 @@
+#ifndef OBJLOAD_H
+#define OBJLOAD_H
+
+// Wavefront OBJ import into the scene arrays. Polygons are fanned into
+// triangles, every o, g or usemtl starts a new mesh with one instance, and
+// vertices are deduplicated per mesh on their position/texcoord/normal
+// triple. Vertices without a normal get the average of their faces'.
+// Material names become default materials, mtllib is not read.
+//
+// The file is cut into chunks on line boundaries that are parsed and
+// deduplicated as tasks, NULL tasks runs them on the calling thread. The
+// result does not depend on the thread count.
+
+struct taskinfo;
+
+bool obj_import(struct scene *scene, const char *data, size_t size,
+                const char *name, struct taskinfo *tasks);
+
+#endif
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "tracer.h"
+#include "image_writer.h"
+#include "recorder.h"
+
+// How each AOV image is read back and which EXR layer it becomes
+static const struct recorder_aov {
+    uint32_t pixel_size;
+    enum image_channel_type type;
+    uint32_t channel_count;
+    const char *names[3];
+} recorder_aovs[TRACE_AOV_COUNT] = {
+    [TRACE_AOV_DEPTH] = {4, IMAGE_CHANNEL_FLOAT, 1, {"depth.Z"}},
+    [TRACE_AOV_NORMAL] = {8, IMAGE_CHANNEL_HALF, 3,
+                          {"normal.X", "normal.Y", "normal.Z"}},
+    [TRACE_AOV_ALBEDO] = {8, IMAGE_CHANNEL_HALF, 3,
+                          {"albedo.R", "albedo.G", "albedo.B"}},
+    [TRACE_AOV_INSTANCE] = {4, IMAGE_CHANNEL_UINT, 1, {"id"}},
+    [TRACE_AOV_MOTION] = {8, IMAGE_CHANNEL_HALF, 2, {"motion.X", "motion.Y"}},
+};
+
+// The AOVs follow the beauty in the readback buffer, each one starting on
+// a 16 byte boundary so the copies stay aligned to their texel size
+static VkDeviceSize recorder_aov_offset(uint32_t width, uint32_t height,
+                                        uint32_t aovs, uint32_t aov) {
+    VkDeviceSize offset = (VkDeviceSize)width * height * 16;
+    uint32_t i;
+
+    for (i = 0; i < aov; i++) {
+        if (aovs & TRACE_AOV_BIT(i))
+            offset += ((VkDeviceSize)width * height * recorder_aovs[i].pixel_size +
+                       15) & ~(VkDeviceSize)15;
+    }
+    return offset;
+}
+
+static bool recorder_write_exr(const char *path,
+                               const struct recorder_slot *slot) {
+    static const char *const beauty[3] = {"R", "G", "B"};
+    const uint8_t *pixels = slot->readback.alloc.mapped;
+    struct image_channel channels[3 + 3 * TRACE_AOV_COUNT];
+    uint32_t count = 0, i, j;
+
+    for (i = 0; i < 3; i++) {
+        channels[count].name = beauty[i];
+        channels[count].type = IMAGE_CHANNEL_FLOAT_AS_HALF;
+        channels[count].data = pixels + i * sizeof(float);
+        channels[count].pixel_stride = 16;
+        channels[count].row_stride = (size_t)slot->width * 16;
+        count++;
+    }
+    for (i = 0; i < TRACE_AOV_COUNT; i++) {
+        const struct recorder_aov *aov = &recorder_aovs[i];
+        const VkDeviceSize offset =
+            recorder_aov_offset(slot->width, slot->height, slot->aovs, i);
+
+        if (!(slot->aovs & TRACE_AOV_BIT(i)))
+            continue;
+        for (j = 0; j < aov->channel_count; j++) {
+            channels[count].name = aov->names[j];
+            channels[count].type = aov->type;
+            channels[count].data =
+                pixels + offset + j * (aov->type == IMAGE_CHANNEL_HALF ? 2 : 4);
+            channels[count].pixel_stride = aov->pixel_size;
+            channels[count].row_stride = (size_t)slot->width * aov->pixel_size;
+            count++;
+        }
+    }
+    return image_write_exr(path, slot->width, slot->height, channels, count);
+}
+
+static bool recorder_write_slot(struct recorderinfo *recorder,
+                                const struct recorder_slot *slot) {
+    char path[4096], temp[4096 + 8];
+    const void *pixels = slot->readback.alloc.mapped;
+    bool ok;
+
+    if (recorder->sequence)
+        snprintf(path, sizeof(path), recorder->pattern, slot->frame);
+    else
+        snprintf(path, sizeof(path), "%s", recorder->pattern);
+    // A viewer watching the file never sees half a frame
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    switch (recorder->format) {
+    case IMAGE_FORMAT_PNG:
+        ok = image_write_png(temp, slot->width, slot->height, pixels,
+                             (size_t)slot->width * 4);
+        break;
+    case IMAGE_FORMAT_EXR:
+        ok = recorder_write_exr(temp, slot);
+        break;
+    default:
+        ok = image_write_ppm(temp, slot->width, slot->height, pixels,
+                             (size_t)slot->width * 4);
+        break;
+    }
+    if (ok && rename(temp, path) == 0)
+        return true;
+    remove(temp);
+    fprintf(stderr, "Could not write %s\n", path);
+    return false;
+}
+
+static void *recorder_writer(void *arg) {
+    struct recorderinfo *recorder = arg;
+
+    for (;;) {
+        uint32_t index;
+        bool ok;
+
+        pthread_mutex_lock(&recorder->lock);
+        while (!recorder->quit && recorder->queue_count == 0)
+            pthread_cond_wait(&recorder->wake, &recorder->lock);
+        if (recorder->queue_count == 0) {
+            pthread_mutex_unlock(&recorder->lock);
+            return NULL;
+        }
+        index = recorder->queue[recorder->queue_head];
+        pthread_mutex_unlock(&recorder->lock);
+
+        // The slot stays queued, and so untouched by the render loop, until
+        // it is written
+        ok = recorder_write_slot(recorder, &recorder->slots[index]);
+
+        pthread_mutex_lock(&recorder->lock);
+        recorder->queue_head = (recorder->queue_head + 1) % RECORDER_SLOTS;
+        recorder->queue_count--;
+        recorder->slots[index].queued = false;
+        if (ok)
+            recorder->written++;
+        else
+            recorder->failed = true;
+        pthread_cond_signal(&recorder->done);
+        pthread_mutex_unlock(&recorder->lock);
+    }
+}
+
+bool recorder_init(struct recorderinfo *recorder, const char *pattern) {
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->pattern = pattern;
+    if (!image_format_from_path(pattern, &recorder->format)) {
+        fprintf(stderr, "--output %s: use a .ppm, .png or .exr file\n",
+                pattern);
+        return false;
+    }
+    if (!image_check_pattern(pattern, &recorder->sequence)) {
+        fprintf(stderr, "--output %s: only one %%d for the frame number\n",
+                pattern);
+        return false;
+    }
+
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_cond_init(&recorder->wake, NULL);
+    pthread_cond_init(&recorder->done, NULL);
+    if (pthread_create(&recorder->thread, NULL, recorder_writer, recorder) !=
+        0) {
+        fprintf(stderr, "Could not start the frame writer thread\n");
+        return false;
+    }
+    return true;
+}
+
+void recorder_prepare(struct renderinfo *render, struct recorderinfo *recorder,
+                      const struct tracerinfo *tracer) {
+    struct recorder_slot *slot = &recorder->slots[recorder->next_slot];
+    const bool linear = recorder->format == IMAGE_FORMAT_EXR;
+    const uint32_t aovs = linear ? tracer->aovs : 0;
+    const VkDeviceSize size =
+        linear ? recorder_aov_offset(tracer->width, tracer->height, aovs,
+                                     TRACE_AOV_COUNT)
+               : (VkDeviceSize)tracer->width * tracer->height * 4;
+
+    // Only a writer that falls RECORDER_SLOTS frames behind stalls the loop
+    pthread_mutex_lock(&recorder->lock);
+    if (slot->queued) {
+        const double start = glfwGetTime();
+
+        while (slot->queued)
+            pthread_cond_wait(&recorder->done, &recorder->lock);
+        recorder->stall_seconds += glfwGetTime() - start;
+    }
+    pthread_mutex_unlock(&recorder->lock);
+
+    // The window may have grown since the slot was last used
+    if (slot->readback.size < size) {
+        if (slot->readback.buf)
+            destroy_buffer(render, &slot->readback);
+        create_buffer(render, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      &slot->readback);
+    }
+
+    slot->frame = recorder->frame++;
+    slot->width = tracer->width;
+    slot->height = tracer->height;
+    slot->aovs = aovs;
+    slot->recorded = true;
+}
+
+void recorder_record(const struct recorderinfo *recorder,
+                     const struct tracerinfo *tracer, VkCommandBuffer cmd) {
+    const struct recorder_slot *slot = &recorder->slots[recorder->next_slot];
+    const bool linear = recorder->format == IMAGE_FORMAT_EXR;
+    uint32_t i;
+
+    const VkMemoryBarrier copy_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &copy_barrier, 0,
+                         NULL, 0, NULL);
+
+    // The storage images stay in the general layout between passes
+    VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {slot->width, slot->height, 1},
+    };
+    vkCmdCopyImageToBuffer(cmd,
+                           linear               ? tracer->accum.image
+                           : tracer->show_heatmap ? tracer->heatmap.image
+                                                  : tracer->output.image,
+                           VK_IMAGE_LAYOUT_GENERAL, slot->readback.buf, 1,
+                           &region);
+    for (i = 0; i < TRACE_AOV_COUNT; i++) {
+        if (!(slot->aovs & TRACE_AOV_BIT(i)))
+            continue;
+        region.bufferOffset =
+            recorder_aov_offset(slot->width, slot->height, slot->aovs, i);
+        vkCmdCopyImageToBuffer(cmd, tracer->aov_images[i].image,
+                               VK_IMAGE_LAYOUT_GENERAL, slot->readback.buf, 1,
+                               &region);
+    }
+
+    // Also keeps the next pass from writing the image before it is copied
+    const VkMemoryBarrier host_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &host_barrier, 0, NULL, 0, NULL);
+}
+
+void recorder_frame_done(struct recorderinfo *recorder) {
+    struct recorder_slot *slot = &recorder->slots[recorder->next_slot];
+
+    if (!slot->recorded)
+        return;
+    slot->recorded = false;
+
+    pthread_mutex_lock(&recorder->lock);
+    slot->queued = true;
+    recorder->queue[(recorder->queue_head + recorder->queue_count) %
+                    RECORDER_SLOTS] = recorder->next_slot;
+    recorder->queue_count++;
+    pthread_cond_signal(&recorder->wake);
+    pthread_mutex_unlock(&recorder->lock);
+
+    recorder->next_slot = (recorder->next_slot + 1) % RECORDER_SLOTS;
+}
+
+bool recorder_finish(struct renderinfo *render, struct recorderinfo *recorder) {
+    uint32_t i;
+
+    pthread_mutex_lock(&recorder->lock);
+    recorder->quit = true;
+    pthread_cond_signal(&recorder->wake);
+    pthread_mutex_unlock(&recorder->lock);
+    pthread_join(recorder->thread, NULL);
+
+    for (i = 0; i < RECORDER_SLOTS; i++) {
+        if (recorder->slots[i].readback.buf)
+            destroy_buffer(render, &recorder->slots[i].readback);
+    }
+    pthread_mutex_destroy(&recorder->lock);
+    pthread_cond_destroy(&recorder->wake);
+    pthread_cond_destroy(&recorder->done);
+
+    printf("Wrote %u frames to %s, %.2f s waiting for the writer\n",
+           recorder->written, recorder->pattern, recorder->stall_seconds);
+    fflush(stdout);
+    return !recorder->failed;
+}
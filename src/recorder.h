@@ -0,0 +1,65 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+// Saves the frames the interactive loop renders. Each frame copies the
+// displayed image (the linear accumulation for EXR, followed by the AOVs
+// the tracer writes, which become layers of the file) into the next slot of
+// a ring of host-visible readback buffers. Once the frame's fence has
+// signaled the slot goes to a writer thread that encodes and writes it,
+// so the loop only waits when every slot is still queued for writing.
+//
+// The output path is a printf pattern with one integer conversion, e.g.
+// frame_%04d.png, or a plain name that always holds the latest frame.
+
+#define RECORDER_SLOTS 4
+
+struct recorder_slot {
+    struct gpu_buffer readback;
+    uint32_t frame;
+    uint32_t width, height;
+    uint32_t aovs; // read back after the beauty, EXR only
+    bool recorded; // the copy is in the frame being rendered
+    bool queued;   // with the writer thread, under the lock
+};
+
+struct recorderinfo {
+    const char *pattern;
+    bool sequence; // pattern has a frame number in it
+    enum image_format format;
+    struct recorder_slot slots[RECORDER_SLOTS];
+    uint32_t next_slot;
+    uint32_t frame;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    uint32_t queue[RECORDER_SLOTS]; // retired slots in frame order
+    uint32_t queue_head, queue_count;
+    bool quit;
+    bool failed;
+
+    uint32_t written;
+    double stall_seconds; // the render loop waited on the writer
+};
+
+// Checks the pattern and starts the writer thread, errors are reported
+bool recorder_init(struct recorderinfo *recorder, const char *pattern);
+
+// Claims the slot of the frame about to be recorded, waiting for the writer
+// if it still has it, and makes room in its readback buffer
+void recorder_prepare(struct renderinfo *render, struct recorderinfo *recorder,
+                      const struct tracerinfo *tracer);
+
+// Records the readback of the frame the tracer draws into the prepared slot,
+// may run on any thread while the tracer's own passes are recorded
+void recorder_record(const struct recorderinfo *recorder,
+                     const struct tracerinfo *tracer, VkCommandBuffer cmd);
+
+// After the frame's fence, hands the slot to the writer thread
+void recorder_frame_done(struct recorderinfo *recorder);
+
+// Writes what is queued and stops the thread, false if a write failed
+bool recorder_finish(struct renderinfo *render, struct recorderinfo *recorder);
+
+#endif
@@ -15,7 +15,14 @@
 #include <GLFW/glfw3.h>
 
 #include "window.h"
+#include "memalloc.h"
 #include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "tracer.h"
+#include "image_writer.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
@@ -249,7 +256,7 @@ void init_vulkan(struct windowinfo *window, struct renderinfo *render, char *APP
         .applicationVersion = 0,
         .pEngineName = APP_SHORT_NAME,
         .engineVersion = 0,
-        .apiVersion = VK_API_VERSION_1_0,
+        .apiVersion = VK_API_VERSION_1_2,
     };
     VkInstanceCreateInfo inst_info = {
         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
@@ -311,6 +318,7 @@ void init_vulkan(struct windowinfo *window, struct renderinfo *render, char *APP
     /* Look for device extensions */
     uint32_t device_extension_count = 0;
     VkBool32 swapchainExtFound = 0;
+    uint32_t accelExtCount = 0;
     render->enabled_extension_count = 0;
 
     err = vkEnumerateDeviceExtensionProperties(render->gpu, NULL,
@@ -331,12 +339,30 @@ void init_vulkan(struct windowinfo *window, struct renderinfo *render, char *APP
                 render->extension_names[render->enabled_extension_count++] =
                     VK_KHR_SWAPCHAIN_EXTENSION_NAME;
             }
+            // Only counted here, init_device enables them once the features
+            // have been checked
+            if (!strcmp(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+                        device_extensions[i].extensionName) ||
+                !strcmp(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+                        device_extensions[i].extensionName) ||
+                !strcmp(VK_KHR_RAY_QUERY_EXTENSION_NAME,
+                        device_extensions[i].extensionName)) {
+                accelExtCount++;
+            }
+            if (!strcmp(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME,
+                        device_extensions[i].extensionName))
+                render->host_image_copy_found = true;
+            if (!strcmp(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME,
+                        device_extensions[i].extensionName))
+                render->external_memory_host_found = true;
             assert(render->enabled_extension_count < 64);
         }
 
         free(device_extensions);
     }
 
+    render->accel_ext_found = accelExtCount == 3;
+
     if (!swapchainExtFound) {
         ERR_EXIT("vkEnumerateDeviceExtensionProperties failed to find "
                  "the " VK_KHR_SWAPCHAIN_EXTENSION_NAME
@@ -391,11 +417,39 @@ void init_vulkan(struct windowinfo *window, struct renderinfo *render, char *APP
 }
 
 
+// Comma separated AOV names, e.g. depth,normal
+static bool parse_aovs(const char *list, uint32_t *aovs) {
+    const char *p = list;
+    uint32_t i;
+
+    *aovs = 0;
+    while (*p) {
+        const size_t len = strcspn(p, ",");
+
+        for (i = 0; i < TRACE_AOV_COUNT; i++) {
+            if (strlen(trace_aov_names[i]) == len &&
+                strncmp(p, trace_aov_names[i], len) == 0)
+                break;
+        }
+        if (i == TRACE_AOV_COUNT)
+            return false;
+        *aovs |= TRACE_AOV_BIT(i);
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    return *aovs != 0;
+}
+
 void init_render(struct windowinfo *window, struct renderinfo *render, char *APP_SHORT_NAME, const int argc, const char *argv[])
 {
+    enum image_format format;
     int i;
     memset(window, 0, sizeof(*window));
+    memset(render, 0, sizeof(*render));
     render->frameCount = INT32_MAX;
+    render->max_bounces = 4;
+    render->slice_budget_ms = 20.0f;
 
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--use_staging") == 0) {
@@ -410,6 +464,118 @@ void init_render(struct windowinfo *window, struct renderinfo *render, char *APP
             render->validate = true;
             continue;
         }
+        if (strcmp(argv[i], "--no_accel") == 0) {
+            render->no_accel = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--adaptive") == 0) {
+            render->adaptive = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--spp") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%u", &render->spp_target) == 1) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--noise") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%f", &render->noise_threshold) == 1 &&
+            render->noise_threshold >= 0.0f) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--bounces") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%u", &render->max_bounces) == 1) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--slice_ms") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%f", &render->slice_budget_ms) == 1 &&
+            render->slice_budget_ms >= 0.0f) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--scene") == 0 && i < argc - 1) {
+            render->scene_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--cache") == 0 && i < argc - 1) {
+            render->cache_dir = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--cache_mb") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%u", &render->cache_mb) == 1) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--no_cache") == 0) {
+            render->no_cache = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--texture_mb") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%u", &render->texture_mb) == 1) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--quantize") == 0) {
+            render->quantize = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%u", &render->task_threads) == 1 &&
+            render->task_threads > 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--affinity") == 0) {
+            render->task_affinity = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--no_io_uring") == 0) {
+            render->no_io_uring = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--tiled") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%ux%u", &render->output_width,
+                   &render->output_height) == 2 &&
+            render->output_width > 0 && render->output_height > 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--cameras") == 0 && i < argc - 1) {
+            render->cameras_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--batch") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%ux%u", &render->batch_width,
+                   &render->batch_height) == 2 &&
+            render->batch_width > 0 && render->batch_height > 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--serve") == 0 && i < argc - 1) {
+            render->serve_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--serve_scenes") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%u", &render->serve_scenes) == 1 &&
+            render->serve_scenes > 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--aov") == 0 && i < argc - 1 &&
+            parse_aovs(argv[i + 1], &render->aovs)) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--output") == 0 && i < argc - 1) {
+            render->output_path = argv[i + 1];
+            i++;
+            continue;
+        }
         if (strcmp(argv[i], "--c") == 0 && render->frameCount == INT32_MAX &&
             i < argc - 1 && sscanf(argv[i + 1], "%d", &render->frameCount) == 1 &&
             render->frameCount >= 0) {
@@ -418,12 +584,66 @@ void init_render(struct windowinfo *window, struct renderinfo *render, char *APP
         }
 
         fprintf(stderr, "Usage:\n  %s [--use_staging] [--validate] [--break] "
-                        "[--c <framecount>]\n",
+                        "[--no_accel] [--c <framecount>] [--scene <file>]\n"
+                        "  [--spp <sample target>] [--noise <threshold>] "
+                        "[--bounces <n>] [--adaptive] [--slice_ms <ms>]\n"
+                        "  [--cache <dir>] [--cache_mb <size>] [--no_cache] "
+                        "[--no_io_uring]\n"
+                        "  [--threads <n>] [--affinity] [--texture_mb <size>] "
+                        "[--quantize]\n"
+                        "  [--tiled <width>x<height> --output <file.ppm>]\n"
+                        "  [--output <frame_%%04d.ppm|png|exr>]\n"
+                        "  [--aov <depth,normal,albedo,id,motion> "
+                        "--output <file.exr>]\n"
+                        "  [--cameras <file> --batch <width>x<height> "
+                        "--output <cam_%%04d.ppm|png>]\n"
+                        "  [--serve <socket> [--serve_scenes <n>]]\n",
                 APP_SHORT_NAME);
         fflush(stderr);
         exit(1);
     }
 
+    if (render->output_width && !render->output_path) {
+        fprintf(stderr, "--tiled needs an --output file\n");
+        fflush(stderr);
+        exit(1);
+    }
+    if ((render->cameras_path != NULL) != (render->batch_width != 0) ||
+        (render->cameras_path &&
+         (!render->output_path || render->output_width || render->aovs))) {
+        fprintf(stderr, "--cameras and --batch go together, with an --output "
+                        "pattern and without --tiled or --aov\n");
+        fflush(stderr);
+        exit(1);
+    }
+    // Jobs bring their own outputs, scenes and cameras
+    if (render->serve_path &&
+        (render->output_path || render->cameras_path || render->aovs)) {
+        fprintf(stderr, "--serve takes no --output, --tiled, --cameras or "
+                        "--aov\n");
+        fflush(stderr);
+        exit(1);
+    }
+    // Pages are streamed in as the interactive loop asks for them
+    if (render->texture_mb &&
+        (render->output_path || render->serve_path)) {
+        fprintf(stderr, "--texture_mb only streams textures interactively, "
+                        "without --output or --serve\n");
+        fflush(stderr);
+        exit(1);
+    }
+    // Only EXR has room for the extra layers
+    if (render->aovs &&
+        (!render->output_path || render->output_width ||
+         !image_format_from_path(render->output_path, &format) ||
+         format != IMAGE_FORMAT_EXR)) {
+        fprintf(stderr, "--aov needs an .exr --output and no --tiled\n");
+        fflush(stderr);
+        exit(1);
+    }
+    if (render->adaptive && render->noise_threshold == 0.0f)
+        render->noise_threshold = 0.01f;
+
     init_connection(window);
     init_vulkan(window, render, APP_SHORT_NAME);
 
@@ -431,4 +651,577 @@ void init_render(struct windowinfo *window, struct renderinfo *render, char *APP
     window->height = 500;
     //demo->depthStencil = 1.0;
     //demo->depthIncrement = -0.01f;
-}
\ No newline at end of file
+}
+
+bool memory_type_from_properties(struct renderinfo *render, uint32_t typeBits,
+                                 VkFlags requirements_mask,
+                                 uint32_t *typeIndex) {
+    uint32_t i;
+    // Search memtypes to find first index with those properties
+    for (i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+        if ((typeBits & 1) == 1) {
+            // Type is available, does it match user properties?
+            if ((render->memory_properties.memoryTypes[i].propertyFlags &
+                 requirements_mask) == requirements_mask) {
+                *typeIndex = i;
+                return true;
+            }
+        }
+        typeBits >>= 1;
+    }
+    // No memory types matched, return failure
+    return false;
+}
+
+VkCommandBuffer get_setup_cmd(struct renderinfo *render) {
+    VkResult err;
+
+    if (render->setup_cmd == VK_NULL_HANDLE) {
+        const VkCommandBufferAllocateInfo cmd = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext = NULL,
+            .commandPool = render->cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+
+        err = vkAllocateCommandBuffers(render->device, &cmd, &render->setup_cmd);
+        assert(!err);
+
+        VkCommandBufferBeginInfo cmd_buf_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .pNext = NULL,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            .pInheritanceInfo = NULL,
+        };
+        err = vkBeginCommandBuffer(render->setup_cmd, &cmd_buf_info);
+        assert(!err);
+    }
+
+    return render->setup_cmd;
+}
+
+void flush_init_cmd(struct renderinfo *render) {
+    VkResult err;
+
+    if (render->setup_cmd == VK_NULL_HANDLE)
+        return;
+
+    err = vkEndCommandBuffer(render->setup_cmd);
+    assert(!err);
+
+    const VkCommandBuffer cmd_bufs[] = {render->setup_cmd};
+    VkFence nullFence = {VK_NULL_HANDLE};
+    VkSubmitInfo submit_info = {.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                .pNext = NULL,
+                                .waitSemaphoreCount = 0,
+                                .pWaitSemaphores = NULL,
+                                .pWaitDstStageMask = NULL,
+                                .commandBufferCount = 1,
+                                .pCommandBuffers = cmd_bufs,
+                                .signalSemaphoreCount = 0,
+                                .pSignalSemaphores = NULL};
+
+    err = vkQueueSubmit(render->queue, 1, &submit_info, nullFence);
+    assert(!err);
+
+    err = vkQueueWaitIdle(render->queue);
+    assert(!err);
+
+    vkFreeCommandBuffers(render->device, render->cmd_pool, 1, cmd_bufs);
+    render->setup_cmd = VK_NULL_HANDLE;
+}
+
+void init_device(struct windowinfo *window, struct renderinfo *render) {
+    VkResult err;
+    uint32_t i;
+
+    // Create a WSI surface for the window:
+    err = glfwCreateWindowSurface(render->inst, window->window, NULL,
+                                  &window->surface);
+    assert(!err);
+
+    // Iterate over each queue to learn whether it supports presenting:
+    VkBool32 *supportsPresent =
+        (VkBool32 *)malloc(render->queue_count * sizeof(VkBool32));
+    for (i = 0; i < render->queue_count; i++) {
+        vkGetPhysicalDeviceSurfaceSupportKHR(render->gpu, i, window->surface,
+                                             &supportsPresent[i]);
+    }
+
+    // The tracer dispatches compute work on the same queue it presents from,
+    // so look for one family that can do graphics, compute and present
+    uint32_t queueNodeIndex = UINT32_MAX;
+    for (i = 0; i < render->queue_count; i++) {
+        const VkQueueFlags flags = render->queue_props[i].queueFlags;
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && (flags & VK_QUEUE_COMPUTE_BIT) &&
+            supportsPresent[i] == VK_TRUE) {
+            queueNodeIndex = i;
+            break;
+        }
+    }
+    free(supportsPresent);
+
+    if (queueNodeIndex == UINT32_MAX) {
+        ERR_EXIT("Could not find a common graphics, compute and present queue\n",
+                 "Device Initialization Failure");
+    }
+    render->graphics_queue_node_index = queueNodeIndex;
+
+    // Slicing adapts to measured GPU time, without timestamps it stays off
+    render->timestamps =
+        render->queue_props[queueNodeIndex].timestampValidBits > 0 &&
+        render->gpu_props.limits.timestampPeriod > 0.0f;
+    render->timestamp_period = render->gpu_props.limits.timestampPeriod;
+    if (!render->timestamps)
+        render->slice_budget_ms = 0.0f;
+
+    VkPhysicalDeviceRayQueryFeaturesKHR ray_query_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR,
+        .pNext = NULL,
+    };
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR accel_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+        .pNext = &ray_query_features,
+    };
+    VkPhysicalDeviceVulkan12Features features12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = NULL,
+    };
+    VkPhysicalDeviceHostImageCopyFeaturesEXT host_copy_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT,
+        .pNext = &features12,
+    };
+    VkPhysicalDeviceFeatures2 features2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &features12,
+    };
+
+    if (render->accel_ext_found && !render->no_accel)
+        features12.pNext = &accel_features;
+    // Its dependencies are core from 1.3 on
+    if (render->host_image_copy_found &&
+        render->gpu_props.apiVersion >= VK_API_VERSION_1_3)
+        features2.pNext = &host_copy_features;
+
+    if (render->gpu_props.apiVersion >= VK_API_VERSION_1_2)
+        vkGetPhysicalDeviceFeatures2(render->gpu, &features2);
+
+    render->use_accel_struct = render->accel_ext_found && !render->no_accel &&
+                               features12.bufferDeviceAddress &&
+                               accel_features.accelerationStructure &&
+                               ray_query_features.rayQuery;
+
+    // Quantized positions are built into acceleration structures as they
+    // are stored, which not every device supports
+    if (render->quantize && render->use_accel_struct) {
+        VkFormatProperties props;
+
+        vkGetPhysicalDeviceFormatProperties(
+            render->gpu, VK_FORMAT_R16G16B16A16_SNORM, &props);
+        if (!(props.bufferFeatures &
+              VK_FORMAT_FEATURE_ACCELERATION_STRUCTURE_VERTEX_BUFFER_BIT_KHR)) {
+            printf("No acceleration structures of 16-bit positions, "
+                   "not quantizing\n");
+            fflush(stdout);
+            render->quantize = false;
+        }
+    }
+
+    // Scene textures live in one partially bound array that grows while it
+    // is bound, see texture.h
+    if (!features12.runtimeDescriptorArray ||
+        !features12.descriptorBindingPartiallyBound ||
+        !features12.descriptorBindingSampledImageUpdateAfterBind ||
+        !features12.shaderSampledImageArrayNonUniformIndexing) {
+        ERR_EXIT("Descriptor indexing is required for the texture table\n",
+                 "Device Initialization Failure");
+    }
+    VkPhysicalDeviceVulkan12Properties props12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+        .pNext = NULL,
+    };
+    VkPhysicalDeviceProperties2 indexing_props2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &props12,
+    };
+    vkGetPhysicalDeviceProperties2(render->gpu, &indexing_props2);
+    render->max_bindless_images =
+        props12.maxPerStageDescriptorUpdateAfterBindSampledImages <
+                props12.maxDescriptorSetUpdateAfterBindSampledImages
+            ? props12.maxPerStageDescriptorUpdateAfterBindSampledImages
+            : props12.maxDescriptorSetUpdateAfterBindSampledImages;
+    render->update_unused_while_pending =
+        features12.descriptorBindingUpdateUnusedWhilePending;
+
+    // Textures are written in the layout they are sampled in, so host image
+    // copy is only of use when it may copy into that one
+    bool use_host_image_copy = false;
+    if (host_copy_features.hostImageCopy && !render->use_staging_buffer) {
+        VkPhysicalDeviceHostImageCopyPropertiesEXT host_copy_props = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT,
+            .pNext = NULL,
+        };
+        VkPhysicalDeviceProperties2 host_copy_props2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &host_copy_props,
+        };
+
+        vkGetPhysicalDeviceProperties2(render->gpu, &host_copy_props2);
+        host_copy_props.pCopyDstLayouts =
+            malloc((host_copy_props.copyDstLayoutCount + 1) *
+                   sizeof(VkImageLayout));
+        assert(host_copy_props.pCopyDstLayouts);
+        host_copy_props.copySrcLayoutCount = 0;
+        vkGetPhysicalDeviceProperties2(render->gpu, &host_copy_props2);
+        for (i = 0; i < host_copy_props.copyDstLayoutCount; i++) {
+            if (host_copy_props.pCopyDstLayouts[i] ==
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+                use_host_image_copy = true;
+        }
+        free(host_copy_props.pCopyDstLayouts);
+    }
+
+    // Only enable what we are going to use
+    VkPhysicalDeviceVulkan12Features enabled12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = NULL,
+    };
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR enabled_accel = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+        .pNext = NULL,
+    };
+    VkPhysicalDeviceRayQueryFeaturesKHR enabled_ray_query = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR,
+        .pNext = NULL,
+    };
+    // Its only dependency, VK_KHR_external_memory, is core from 1.1 on
+    render->import_host_memory =
+        render->external_memory_host_found && !render->use_staging_buffer &&
+        render->gpu_props.apiVersion >= VK_API_VERSION_1_1;
+    if (render->import_host_memory) {
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_memory_props = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+            .pNext = NULL,
+        };
+        VkPhysicalDeviceProperties2 host_memory_props2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &host_memory_props,
+        };
+
+        vkGetPhysicalDeviceProperties2(render->gpu, &host_memory_props2);
+        render->host_pointer_alignment =
+            host_memory_props.minImportedHostPointerAlignment;
+        render->extension_names[render->enabled_extension_count++] =
+            VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+        assert(render->enabled_extension_count < 64);
+    }
+
+    VkPhysicalDeviceHostImageCopyFeaturesEXT enabled_host_copy = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT,
+        .pNext = NULL,
+    };
+    const void *device_pnext = NULL;
+
+    if (render->gpu_props.apiVersion >= VK_API_VERSION_1_2)
+        device_pnext = &enabled12;
+    if (use_host_image_copy) {
+        enabled_host_copy.hostImageCopy = VK_TRUE;
+        enabled_host_copy.pNext = (void *)device_pnext;
+        device_pnext = &enabled_host_copy;
+        render->extension_names[render->enabled_extension_count++] =
+            VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME;
+        assert(render->enabled_extension_count < 64);
+    }
+
+    enabled12.runtimeDescriptorArray = VK_TRUE;
+    enabled12.descriptorBindingPartiallyBound = VK_TRUE;
+    enabled12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    enabled12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    enabled12.descriptorBindingUpdateUnusedWhilePending =
+        render->update_unused_while_pending;
+
+    if (render->use_accel_struct) {
+        enabled12.bufferDeviceAddress = VK_TRUE;
+        enabled12.pNext = &enabled_accel;
+        enabled_accel.accelerationStructure = VK_TRUE;
+        enabled_accel.pNext = &enabled_ray_query;
+        enabled_ray_query.rayQuery = VK_TRUE;
+
+        render->extension_names[render->enabled_extension_count++] =
+            VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME;
+        render->extension_names[render->enabled_extension_count++] =
+            VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME;
+        render->extension_names[render->enabled_extension_count++] =
+            VK_KHR_RAY_QUERY_EXTENSION_NAME;
+        assert(render->enabled_extension_count < 64);
+
+        render->accel_props.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+        VkPhysicalDeviceProperties2 props2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &render->accel_props,
+        };
+        vkGetPhysicalDeviceProperties2(render->gpu, &props2);
+    }
+
+    float queue_priorities[1] = {0.0};
+    const VkDeviceQueueCreateInfo queue = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .pNext = NULL,
+        .queueFamilyIndex = render->graphics_queue_node_index,
+        .queueCount = 1,
+        .pQueuePriorities = queue_priorities};
+
+    VkPhysicalDeviceFeatures features;
+    memset(&features, 0, sizeof(features));
+    if (render->gpu_features.shaderClipDistance) {
+        features.shaderClipDistance = VK_TRUE;
+    }
+
+    VkDeviceCreateInfo device = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = device_pnext,
+        .queueCreateInfoCount = 1,
+        .pQueueCreateInfos = &queue,
+        .enabledLayerCount = 0,
+        .ppEnabledLayerNames = NULL,
+        .enabledExtensionCount = render->enabled_extension_count,
+        .ppEnabledExtensionNames = (const char *const *)render->extension_names,
+        .pEnabledFeatures = &features,
+    };
+
+    err = vkCreateDevice(render->gpu, &device, NULL, &render->device);
+    assert(!err);
+
+    vkGetDeviceQueue(render->device, render->graphics_queue_node_index, 0,
+                     &render->queue);
+
+    // Get Memory information and properties
+    vkGetPhysicalDeviceMemoryProperties(render->gpu, &render->memory_properties);
+
+    // A BAR window of 256 MB is what every device had before resizable
+    // BAR, staging through it would crowd out everything else mapped there
+    render->upload_path = use_host_image_copy ? UPLOAD_HOST_IMAGE_COPY
+                                              : UPLOAD_STAGING;
+    for (i = 0; i < render->memory_properties.memoryTypeCount &&
+                !use_host_image_copy && !render->use_staging_buffer;
+         i++) {
+        const VkMemoryType *type = &render->memory_properties.memoryTypes[i];
+        const VkMemoryPropertyFlags bar = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+        if ((type->propertyFlags & bar) == bar &&
+            render->memory_properties.memoryHeaps[type->heapIndex].size >
+                256ull * 1024 * 1024)
+            render->upload_path = UPLOAD_REBAR;
+    }
+
+    const VkCommandPoolCreateInfo cmd_pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .queueFamilyIndex = render->graphics_queue_node_index,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    };
+    err = vkCreateCommandPool(render->device, &cmd_pool_info, NULL,
+                              &render->cmd_pool);
+    assert(!err);
+
+    const VkSemaphoreCreateInfo semaphoreCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+    };
+    err = vkCreateSemaphore(render->device, &semaphoreCreateInfo, NULL,
+                            &render->image_acquired);
+    assert(!err);
+    err = vkCreateSemaphore(render->device, &semaphoreCreateInfo, NULL,
+                            &render->draw_complete);
+    assert(!err);
+
+    const VkFenceCreateInfo fenceCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    };
+    err = vkCreateFence(render->device, &fenceCreateInfo, NULL,
+                        &render->draw_fence);
+    assert(!err);
+
+    // Get the list of VkFormat's that are supported:
+    uint32_t formatCount;
+    err = vkGetPhysicalDeviceSurfaceFormatsKHR(render->gpu, window->surface,
+                                               &formatCount, NULL);
+    assert(!err);
+    VkSurfaceFormatKHR *surfFormats =
+        (VkSurfaceFormatKHR *)malloc(formatCount * sizeof(VkSurfaceFormatKHR));
+    err = vkGetPhysicalDeviceSurfaceFormatsKHR(render->gpu, window->surface,
+                                               &formatCount, surfFormats);
+    assert(!err);
+    // If the format list includes just one entry of VK_FORMAT_UNDEFINED,
+    // the surface has no preferred format.  Otherwise, at least one
+    // supported format will be returned.
+    assert(formatCount >= 1);
+    if (formatCount == 1 && surfFormats[0].format == VK_FORMAT_UNDEFINED) {
+        render->format = VK_FORMAT_B8G8R8A8_UNORM;
+        render->color_space = surfFormats[0].colorSpace;
+    } else {
+        // The tracer output is already gamma encoded, so prefer a UNORM
+        // format the blit will not encode a second time
+        render->format = surfFormats[0].format;
+        render->color_space = surfFormats[0].colorSpace;
+        for (i = 0; i < formatCount; i++) {
+            if (surfFormats[i].format == VK_FORMAT_B8G8R8A8_UNORM ||
+                surfFormats[i].format == VK_FORMAT_R8G8B8A8_UNORM) {
+                render->format = surfFormats[i].format;
+                render->color_space = surfFormats[i].colorSpace;
+                break;
+            }
+        }
+    }
+    free(surfFormats);
+
+    memalloc_init(render);
+
+    render->curFrame = 0;
+}
+
+void prepare_swapchain(struct windowinfo *window, struct renderinfo *render) {
+    VkResult err;
+    VkSwapchainKHR oldSwapchain = render->swapchain;
+
+    // Check the surface capabilities and formats
+    VkSurfaceCapabilitiesKHR surfCapabilities;
+    err = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+        render->gpu, window->surface, &surfCapabilities);
+    assert(!err);
+
+    VkExtent2D swapchainExtent;
+    // width and height are either both 0xFFFFFFFF, or both not 0xFFFFFFFF.
+    if (surfCapabilities.currentExtent.width == 0xFFFFFFFF) {
+        // If the surface size is undefined, the size is set to the size
+        // of the images requested, which must fit within the minimum and
+        // maximum values.
+        swapchainExtent.width = window->width;
+        swapchainExtent.height = window->height;
+
+        if (swapchainExtent.width < surfCapabilities.minImageExtent.width) {
+            swapchainExtent.width = surfCapabilities.minImageExtent.width;
+        } else if (swapchainExtent.width > surfCapabilities.maxImageExtent.width) {
+            swapchainExtent.width = surfCapabilities.maxImageExtent.width;
+        }
+
+        if (swapchainExtent.height < surfCapabilities.minImageExtent.height) {
+            swapchainExtent.height = surfCapabilities.minImageExtent.height;
+        } else if (swapchainExtent.height > surfCapabilities.maxImageExtent.height) {
+            swapchainExtent.height = surfCapabilities.maxImageExtent.height;
+        }
+    } else {
+        // If the surface size is defined, the swap chain size must match
+        swapchainExtent = surfCapabilities.currentExtent;
+    }
+    window->width = swapchainExtent.width;
+    window->height = swapchainExtent.height;
+
+    if (!(surfCapabilities.supportedUsageFlags &
+          VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+        ERR_EXIT("The surface does not support blitting into swapchain images\n",
+                 "Swapchain Initialization Failure");
+    }
+
+    uint32_t desiredNumOfSwapchainImages = surfCapabilities.minImageCount;
+    if ((surfCapabilities.maxImageCount > 0) &&
+        (desiredNumOfSwapchainImages > surfCapabilities.maxImageCount)) {
+        desiredNumOfSwapchainImages = surfCapabilities.maxImageCount;
+    }
+
+    VkSurfaceTransformFlagsKHR preTransform;
+    if (surfCapabilities.supportedTransforms &
+        VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR) {
+        preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    } else {
+        preTransform = surfCapabilities.currentTransform;
+    }
+
+    const VkSwapchainCreateInfoKHR swapchain = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .pNext = NULL,
+        .surface = window->surface,
+        .minImageCount = desiredNumOfSwapchainImages,
+        .imageFormat = render->format,
+        .imageColorSpace = render->color_space,
+        .imageExtent =
+            {
+             .width = swapchainExtent.width, .height = swapchainExtent.height,
+            },
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .preTransform = preTransform,
+        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+        .imageArrayLayers = 1,
+        .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = NULL,
+        .presentMode = VK_PRESENT_MODE_FIFO_KHR,
+        .oldSwapchain = oldSwapchain,
+        .clipped = true,
+    };
+
+    err = vkCreateSwapchainKHR(render->device, &swapchain, NULL,
+                               &render->swapchain);
+    assert(!err);
+
+    // If we just re-created an existing swapchain, we should destroy the old
+    // swapchain at this point.
+    if (oldSwapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(render->device, oldSwapchain, NULL);
+    }
+
+    err = vkGetSwapchainImagesKHR(render->device, render->swapchain,
+                                  &render->swapchainImageCount, NULL);
+    assert(!err);
+
+    free(render->swapchain_images);
+    render->swapchain_images =
+        (VkImage *)malloc(render->swapchainImageCount * sizeof(VkImage));
+    assert(render->swapchain_images);
+    err = vkGetSwapchainImagesKHR(render->device, render->swapchain,
+                                  &render->swapchainImageCount,
+                                  render->swapchain_images);
+    assert(!err);
+
+    render->current_buffer = 0;
+    window->resized = false;
+}
+
+void cleanup_render(struct windowinfo *window, struct renderinfo *render) {
+    if (render->setup_cmd) {
+        vkFreeCommandBuffers(render->device, render->cmd_pool, 1,
+                             &render->setup_cmd);
+    }
+    vkDestroyCommandPool(render->device, render->cmd_pool, NULL);
+
+    vkDestroySemaphore(render->device, render->image_acquired, NULL);
+    vkDestroySemaphore(render->device, render->draw_complete, NULL);
+    vkDestroyFence(render->device, render->draw_fence, NULL);
+
+    vkDestroySwapchainKHR(render->device, render->swapchain, NULL);
+    free(render->swapchain_images);
+
+    memalloc_cleanup(render);
+
+    vkDestroyDevice(render->device, NULL);
+    if (render->validate) {
+        vkDestroyDebugReportCallbackEXT(render->inst, render->msg_callback, NULL);
+    }
+    vkDestroySurfaceKHR(render->inst, window->surface, NULL);
+    vkDestroyInstance(render->inst, NULL);
+
+    free(render->queue_props);
+
+    glfwDestroyWindow(window->window);
+    glfwTerminate();
+}
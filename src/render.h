@@ -1,6 +1,15 @@
 #ifndef RENDER_H
 #define RENDER_H
 
+// How texture data reaches device memory, cheapest first. Host image copy
+// writes the image straight from the mapped file, the others stage it in a
+// ring the copy engine reads, in device-local memory when the whole of it
+// is host visible (resizable BAR, or unified memory).
+enum upload_path {
+    UPLOAD_HOST_IMAGE_COPY,
+    UPLOAD_REBAR,
+    UPLOAD_STAGING,
+};
 
 struct renderinfo {
    
@@ -9,7 +18,8 @@ struct renderinfo {
 
     bool validate;
     bool use_break;
-    bool use_staging_buffer;
+    bool use_staging_buffer; // upload through the staging ring regardless
+    bool no_accel;
 
 
     VkInstance inst;
@@ -18,6 +28,7 @@ struct renderinfo {
     VkQueue queue;
     VkPhysicalDeviceProperties gpu_props;
     VkPhysicalDeviceFeatures gpu_features;
+    VkPhysicalDeviceMemoryProperties memory_properties;
     VkQueueFamilyProperties *queue_props;
     uint32_t graphics_queue_node_index;
 
@@ -30,6 +41,88 @@ struct renderinfo {
 
     uint32_t current_buffer;
     uint32_t queue_count;
+
+    VkCommandPool cmd_pool; // setup and uploads, frames use a cmd_frame
+    VkCommandBuffer setup_cmd; // Command Buffer for initialization commands
+
+    VkFormat format;
+    VkColorSpaceKHR color_space;
+
+    uint32_t swapchainImageCount;
+    VkSwapchainKHR swapchain;
+    VkImage *swapchain_images;
+
+    VkSemaphore image_acquired;
+    VkSemaphore draw_complete;
+    VkFence draw_fence;
+
+    // progressive accumulation, 0 disables the respective stop criterion
+    uint32_t spp_target;
+    float noise_threshold;
+    uint32_t max_bounces;
+    // sample per tile until its own error estimate reaches noise_threshold
+    bool adaptive;
+
+    // GPU time a single submit may take before its work is split up,
+    // 0 disables slicing
+    float slice_budget_ms;
+    bool timestamps; // the queue supports timestamp queries
+    float timestamp_period; // ns per timestamp tick
+
+    const char *scene_path; // NULL: built-in scene
+
+    // CPU side preparation runs on tasks, task_threads 0: one per CPU
+    uint32_t task_threads;
+    bool task_affinity; // pin each worker thread to a CPU
+    struct taskinfo *tasks;
+
+    // where processed source scenes are kept, NULL: default location
+    const char *cache_dir;
+    uint32_t cache_mb; // size limit, 0: default
+    bool no_cache;
+    bool no_io_uring; // stream scene files with reader threads instead
+
+    // device memory for pages of large KTX2 textures, 0: upload them whole
+    uint32_t texture_mb;
+
+    // 16-bit vertex attributes and indices on the device, see scene.h
+    bool quantize;
+
+    // offline render of an output_width x output_height image in tiles
+    const char *output_path;
+    uint32_t output_width, output_height;
+    uint32_t aovs; // TRACE_AOV_BIT mask of extra outputs, EXR only
+
+    // offline render of a batch_width x batch_height image for every
+    // camera listed in cameras_path
+    const char *cameras_path;
+    uint32_t batch_width, batch_height;
+
+    // render jobs sent to a Unix socket, keeping up to serve_scenes scenes
+    // uploaded (0: default)
+    const char *serve_path;
+    uint32_t serve_scenes;
+
+    struct mem_allocator allocator;
+
+    // KHR acceleration structure path, only used when the device exposes
+    // VK_KHR_acceleration_structure and VK_KHR_ray_query
+    bool accel_ext_found;
+    bool use_accel_struct;
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR accel_props;
+
+    // descriptor indexing, which the texture table needs
+    uint32_t max_bindless_images; // in one update-after-bind set
+    bool update_unused_while_pending;
+
+    bool host_image_copy_found; // VK_EXT_host_image_copy is exposed
+    enum upload_path upload_path;
+
+    // scene sections are imported from their mapping where that saves a
+    // copy, see import_host_buffer
+    bool external_memory_host_found;
+    bool import_host_memory;
+    VkDeviceSize host_pointer_alignment; // minImportedHostPointerAlignment
     
     
     
@@ -57,5 +150,19 @@ void init_vulkan(struct windowinfo *window, struct renderinfo *render, char *APP
 
 void init_render(struct windowinfo *window, struct renderinfo *render, char *APP_SHORT_NAME, const int argc, const char *argv[]);
 
+void init_device(struct windowinfo *window, struct renderinfo *render);
+
+bool memory_type_from_properties(struct renderinfo *render, uint32_t typeBits,
+                                 VkFlags requirements_mask,
+                                 uint32_t *typeIndex);
+
+void prepare_swapchain(struct windowinfo *window, struct renderinfo *render);
+
+VkCommandBuffer get_setup_cmd(struct renderinfo *render);
+
+void flush_init_cmd(struct renderinfo *render);
+
+void cleanup_render(struct windowinfo *window, struct renderinfo *render);
+
 
-#endif
\ No newline at end of file
+#endif
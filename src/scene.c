@@ -0,0 +1,746 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "filemap.h"
+#include "scenefile.h"
+#include "asyncio.h"
+#include "task.h"
+
+// Uploads go through a ring of staging slots, so filling one slot (a read
+// from the scene file or a memcpy) overlaps the copies out of the others
+// and loading takes about as long as the slower of disk and PCIe
+#define SCENE_UPLOAD_SLOTS 4
+#define SCENE_UPLOAD_CHUNK (8ull * 1024 * 1024)
+
+struct scene_upload_slot {
+    VkCommandBuffer cmd;
+    VkFence fence;
+    bool reading; // a file read into the slot is in flight
+    bool copying; // its copy is submitted and the fence not yet seen
+    uint64_t submitted; // copy order, the oldest is waited for first
+};
+
+struct scene_uploader {
+    struct gpu_buffer staging;
+    VkDeviceSize slot_size;
+    struct scene_upload_slot slots[SCENE_UPLOAD_SLOTS];
+    uint64_t copy_count;
+
+    // Sections of a scene file are read from the file rather than paged in
+    // through its mapping, fd is -1 when there is nothing to stream
+    int fd;
+    struct async_reader reader;
+    uint64_t streamed;
+    uint64_t imported; // bytes the device reads out of the mapping itself
+};
+
+void scene_init_builtin(struct scene *scene) {
+    // clang-format off
+    const struct scene_vertex vb[3] = {
+        /*      position                normal                 texcoord */
+        { { -1.0f, -1.0f,  0.25f }, { 0.0f, 0.0f, -1.0f }, { 0.0f, 0.0f } },
+        { {  1.0f, -1.0f,  0.25f }, { 0.0f, 0.0f, -1.0f }, { 1.0f, 0.0f } },
+        { {  0.0f,  1.0f,  1.0f  }, { 0.0f, 0.0f, -1.0f }, { 0.5f, 1.0f } },
+    };
+    const uint32_t ib[3] = { 0, 1, 2 };
+    // clang-format on
+
+    memset(scene, 0, sizeof(*scene));
+
+    scene->vertex_count = 3;
+    scene->vertices = malloc(sizeof(vb));
+    assert(scene->vertices);
+    memcpy(scene->vertices, vb, sizeof(vb));
+
+    scene->index_count = 3;
+    scene->indices = malloc(sizeof(ib));
+    assert(scene->indices);
+    memcpy(scene->indices, ib, sizeof(ib));
+
+    scene->mesh_count = 1;
+    scene->meshes = calloc(1, sizeof(struct scene_mesh));
+    assert(scene->meshes);
+    scene->meshes[0].vertex_count = 3;
+    scene->meshes[0].index_count = 3;
+
+    scene->instance_count = 1;
+    scene->instances = calloc(1, sizeof(struct scene_instance));
+    assert(scene->instances);
+    scene->instances[0].transform[0][0] = 1.0f;
+    scene->instances[0].transform[1][1] = 1.0f;
+    scene->instances[0].transform[2][2] = 1.0f;
+    scene->instances[0].mesh = 0;
+}
+
+static void scene_uploader_init(struct renderinfo *render,
+                                struct scene_uploader *up,
+                                const struct scene *scene) {
+    void *buffers[SCENE_UPLOAD_SLOTS];
+    VkResult err;
+    uint32_t i;
+
+    memset(up, 0, sizeof(*up));
+    up->fd = -1;
+    up->slot_size = SCENE_UPLOAD_CHUNK;
+    create_buffer(render, up->slot_size * SCENE_UPLOAD_SLOTS,
+                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &up->staging);
+
+    const VkCommandBufferAllocateInfo cmd_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext = NULL,
+        .commandPool = render->cmd_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    const VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+    };
+    for (i = 0; i < SCENE_UPLOAD_SLOTS; i++) {
+        err = vkAllocateCommandBuffers(render->device, &cmd_info,
+                                       &up->slots[i].cmd);
+        assert(!err);
+        err = vkCreateFence(render->device, &fence_info, NULL,
+                            &up->slots[i].fence);
+        assert(!err);
+        buffers[i] = (uint8_t *)up->staging.alloc.mapped + i * up->slot_size;
+    }
+
+#ifndef _WIN32
+    // On Windows the "mapping" is already a heap copy of the whole file
+    if (scene->file_path) {
+        up->fd = open(scene->file_path, O_RDONLY);
+        if (up->fd >= 0 &&
+            !async_reader_init(&up->reader, buffers, SCENE_UPLOAD_SLOTS,
+                               up->slot_size, !render->no_io_uring)) {
+            close(up->fd);
+            up->fd = -1;
+        }
+    }
+#endif
+}
+
+static void scene_uploader_cleanup(struct renderinfo *render,
+                                   struct scene_uploader *up) {
+    VkResult err;
+    uint32_t i;
+
+#ifndef _WIN32
+    if (up->fd >= 0) {
+        async_reader_cleanup(&up->reader);
+        close(up->fd);
+    }
+#endif
+    for (i = 0; i < SCENE_UPLOAD_SLOTS; i++) {
+        if (up->slots[i].copying) {
+            err = vkWaitForFences(render->device, 1, &up->slots[i].fence,
+                                  VK_TRUE, UINT64_MAX);
+            assert(!err);
+        }
+        vkDestroyFence(render->device, up->slots[i].fence, NULL);
+        vkFreeCommandBuffers(render->device, render->cmd_pool, 1,
+                             &up->slots[i].cmd);
+    }
+    destroy_buffer(render, &up->staging);
+}
+
+// Finds a slot that can be filled. With file reads in flight it does not
+// wait on the GPU, a completed read is the better use of the time.
+static uint32_t scene_upload_slot(struct renderinfo *render,
+                                  struct scene_uploader *up,
+                                  bool reads_pending) {
+    uint32_t i, oldest = UINT32_MAX;
+    VkResult err;
+
+    for (i = 0; i < SCENE_UPLOAD_SLOTS; i++) {
+        struct scene_upload_slot *slot = &up->slots[i];
+
+        if (slot->reading)
+            continue;
+        if (!slot->copying)
+            return i;
+        if (vkGetFenceStatus(render->device, slot->fence) == VK_SUCCESS) {
+            slot->copying = false;
+            return i;
+        }
+        if (oldest == UINT32_MAX || slot->submitted < up->slots[oldest].submitted)
+            oldest = i;
+    }
+    if (reads_pending || oldest == UINT32_MAX)
+        return UINT32_MAX;
+
+    err = vkWaitForFences(render->device, 1, &up->slots[oldest].fence, VK_TRUE,
+                          UINT64_MAX);
+    assert(!err);
+    up->slots[oldest].copying = false;
+    return oldest;
+}
+
+static void scene_upload_copy(struct renderinfo *render,
+                              struct scene_uploader *up, uint32_t index,
+                              VkDeviceSize dst_offset, VkDeviceSize size,
+                              struct gpu_buffer *buffer) {
+    struct scene_upload_slot *slot = &up->slots[index];
+    VkResult err;
+
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL,
+    };
+    err = vkBeginCommandBuffer(slot->cmd, &begin_info);
+    assert(!err);
+
+    const VkBufferCopy copy_region = {
+        .srcOffset = index * up->slot_size,
+        .dstOffset = dst_offset,
+        .size = size,
+    };
+    vkCmdCopyBuffer(slot->cmd, up->staging.buf, buffer->buf, 1, &copy_region);
+    err = vkEndCommandBuffer(slot->cmd);
+    assert(!err);
+
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = NULL,
+        .waitSemaphoreCount = 0,
+        .pWaitSemaphores = NULL,
+        .pWaitDstStageMask = NULL,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &slot->cmd,
+        .signalSemaphoreCount = 0,
+        .pSignalSemaphores = NULL,
+    };
+    err = vkResetFences(render->device, 1, &slot->fence);
+    assert(!err);
+    err = vkQueueSubmit(render->queue, 1, &submit_info, slot->fence);
+    assert(!err);
+    slot->copying = true;
+    slot->submitted = up->copy_count++;
+}
+
+static void scene_upload_buffer(struct renderinfo *render,
+                                struct scene_uploader *up,
+                                const struct scene *scene, const void *data,
+                                VkDeviceSize size, VkBufferUsageFlags usage,
+                                struct gpu_buffer *buffer) {
+    const uint8_t *map = scene->file_map;
+    const bool stream = up->fd >= 0 && (const uint8_t *)data >= map &&
+                        (const uint8_t *)data + size <= map + scene->file_size;
+    const uint64_t file_offset = stream ? (const uint8_t *)data - map : 0;
+#ifdef _WIN32
+    const size_t mapped = scene->file_size;
+#else
+    // The mapping goes on to the end of the page, which imports may cover
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t mapped = (scene->file_size + page - 1) / page * page;
+#endif
+    VkDeviceSize offset = 0, chunk;
+    uint32_t i;
+
+    // Unified memory reads the section where it is mapped, nothing to copy
+    if (map && import_host_buffer(render, map, mapped, data, size, usage,
+                                  buffer)) {
+        up->imported += size;
+        return;
+    }
+
+    create_buffer(render, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer);
+
+    while (offset < size || (stream && up->reader.in_flight)) {
+        // Keep every free slot busy, with file reads or with memcpys
+        while (offset < size) {
+            i = scene_upload_slot(render, up, stream && up->reader.in_flight);
+            if (i == UINT32_MAX)
+                break;
+            chunk = size - offset < up->slot_size ? size - offset
+                                                  : up->slot_size;
+            if (stream) {
+                async_reader_submit(&up->reader, i, up->fd, file_offset + offset,
+                                    chunk, offset);
+                up->slots[i].reading = true;
+            } else {
+                memcpy((uint8_t *)up->staging.alloc.mapped + i * up->slot_size,
+                       (const uint8_t *)data + offset, chunk);
+                scene_upload_copy(render, up, i, offset, chunk, buffer);
+            }
+            offset += chunk;
+        }
+
+        struct async_read done;
+        if (stream && async_reader_wait(&up->reader, &done)) {
+            uint8_t *dst = (uint8_t *)up->staging.alloc.mapped +
+                           done.buffer * up->slot_size;
+
+            chunk = size - done.user < up->slot_size ? size - done.user
+                                                     : up->slot_size;
+            // The mapping has the same bytes, take them from there instead
+            if (!done.ok)
+                memcpy(dst, (const uint8_t *)data + done.user, chunk);
+            up->slots[done.buffer].reading = false;
+            up->streamed += chunk;
+            scene_upload_copy(render, up, done.buffer, done.user, chunk,
+                              buffer);
+        }
+    }
+}
+
+// Same red/green checker the raster demo textured with, in cells of 8x8
+// pixels so that filtering only blurs their edges
+static uint32_t scene_add_checker(struct renderinfo *render,
+                                  struct texture_table *table) {
+    uint8_t pixels[16][16][4];
+    uint32_t x, y;
+
+    for (y = 0; y < 16; y++) {
+        for (x = 0; x < 16; x++) {
+            const bool red = ((x / 8) ^ (y / 8)) & 1;
+
+            pixels[y][x][0] = red ? 230 : 89;
+            pixels[y][x][1] = red ? 89 : 230;
+            pixels[y][x][2] = 89;
+            pixels[y][x][3] = 255;
+        }
+    }
+    return texture_table_add(render, table, VK_FORMAT_R8G8B8A8_SRGB, 16, 16,
+                             &pixels[0][0][0]);
+}
+
+// Fills the texture table, a texture that does not load is left white.
+// Returns the table element of every scene texture.
+static uint32_t *scene_load_textures(struct renderinfo *render,
+                                     struct scene *scene) {
+    const char *slash =
+        scene->source_path ? strrchr(scene->source_path, '/') : NULL;
+    const size_t dir_length = slash ? slash - scene->source_path + 1 : 0;
+    uint32_t *elements;
+    uint32_t i;
+
+    elements = malloc((scene->texture_count ? scene->texture_count : 1) *
+                      sizeof(uint32_t));
+    assert(elements);
+    for (i = 0; i < scene->texture_count; i++) {
+        const char *name = scene->textures[i].path;
+        const size_t prefix = name[0] == '/' ? 0 : dir_length;
+        char *path = malloc(prefix + strlen(name) + 1);
+
+        assert(path);
+        if (prefix)
+            memcpy(path, scene->source_path, prefix);
+        strcpy(path + prefix, name);
+        elements[i] = texture_table_load(render, &scene->texture_table, path);
+        free(path);
+    }
+    if (scene->texture_count)
+        printf("Loaded %u textures\n", scene->texture_table.count);
+    return elements;
+}
+
+// Uploads the materials pointing at table elements, and for the compute
+// BVH, which only knows the instance it hit, the material of every instance
+static void scene_upload_materials(struct renderinfo *render,
+                                   struct scene_uploader *up,
+                                   struct scene *scene,
+                                   const uint32_t *elements) {
+    struct scene_material *materials;
+    uint32_t count = scene->material_count, i;
+
+    if (count == 0) {
+        // Untextured scenes without materials keep their old checker look
+        count = 1;
+        materials = calloc(1, sizeof(struct scene_material));
+        assert(materials);
+        materials[0].base_color[0] = 1.0f;
+        materials[0].base_color[1] = 1.0f;
+        materials[0].base_color[2] = 1.0f;
+        materials[0].base_color[3] = 1.0f;
+        materials[0].roughness = 1.0f;
+        materials[0].base_color_texture =
+            scene_add_checker(render, &scene->texture_table);
+    } else {
+        materials = malloc(count * sizeof(struct scene_material));
+        assert(materials);
+        memcpy(materials, scene->materials, count * sizeof(*materials));
+        for (i = 0; i < count; i++) {
+            const uint32_t texture = materials[i].base_color_texture;
+
+            materials[i].base_color_texture = texture < scene->texture_count
+                                                  ? elements[texture]
+                                                  : SCENE_NO_TEXTURE;
+        }
+    }
+    scene_upload_buffer(render, up, scene, materials,
+                        count * sizeof(struct scene_material),
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        &scene->material_buf);
+    free(materials);
+
+    if (!render->use_accel_struct) {
+        uint32_t *instance_materials = malloc(
+            (scene->instance_count ? scene->instance_count : 1) *
+            sizeof(uint32_t));
+
+        assert(instance_materials);
+        instance_materials[0] = 0;
+        for (i = 0; i < scene->instance_count; i++) {
+            const uint32_t material =
+                scene->meshes[scene->instances[i].mesh].material;
+
+            instance_materials[i] = material < count ? material : 0;
+        }
+        scene_upload_buffer(render, up, scene, instance_materials,
+                            (scene->instance_count ? scene->instance_count
+                                                   : 1) *
+                                sizeof(uint32_t),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                            &scene->instance_material_buf);
+        free(instance_materials);
+    }
+}
+
+// Rounds to nearest even, like image_float_to_half in image_writer.c
+static uint16_t scene_float_to_half(float f) {
+    uint32_t x, mant, h, rem, half;
+    uint16_t sign;
+    int e;
+
+    memcpy(&x, &f, sizeof(x));
+    sign = (x >> 16) & 0x8000;
+    mant = x & 0x7fffff;
+    if (((x >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+    e = (int)((x >> 23) & 0xff) - 127 + 15;
+    if (e >= 0x1f)
+        return sign | 0x7c00;
+    if (e <= 0) {
+        const uint32_t shift = 14 - e;
+
+        if (e < -10)
+            return sign;
+        mant |= 0x800000;
+        h = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        half = 1u << (shift - 1);
+    } else {
+        h = (uint32_t)e << 10 | mant >> 13;
+        rem = mant & 0x1fff;
+        half = 0x1000;
+    }
+    if (rem > half || (rem == half && (h & 1)))
+        h++;
+    return sign | h;
+}
+
+static int16_t scene_snorm16(float v) {
+    v = v < -1.0f ? -1.0f : v > 1.0f ? 1.0f : v;
+    return (int16_t)lrintf(v * 32767.0f);
+}
+
+// Maps the unit sphere onto the octahedron and unfolds its lower half
+// onto the corners of the square, decoded by oct_decode in trace.comp
+static void scene_oct_encode(const float n[3], int16_t out[2]) {
+    const float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    float x = l1 > 0.0f ? n[0] / l1 : 0.0f;
+    float y = l1 > 0.0f ? n[1] / l1 : 0.0f;
+
+    if (n[2] < 0.0f) {
+        const float ox = x;
+
+        x = (1.0f - fabsf(y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+        y = (1.0f - fabsf(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+    }
+    out[0] = scene_snorm16(x);
+    out[1] = scene_snorm16(y);
+}
+
+struct scene_quantizer {
+    const struct scene *scene;
+    struct scene_gpu_mesh *meshes; // index ranges already laid out
+    struct scene_qvertex *vertices;
+    uint16_t *indices;
+};
+
+static void scene_quantize_task(void *arg, uint32_t index) {
+    const struct scene_quantizer *q = arg;
+    const struct scene_mesh *mesh = &q->scene->meshes[index];
+    struct scene_gpu_mesh *gpu = &q->meshes[index];
+    const struct scene_vertex *src = q->scene->vertices + mesh->first_vertex;
+    struct scene_qvertex *dst = q->vertices + mesh->first_vertex;
+    const uint32_t *indices = q->scene->indices + mesh->first_index;
+    float lo[3] = {0.0f, 0.0f, 0.0f}, hi[3] = {0.0f, 0.0f, 0.0f};
+    uint32_t i, c;
+
+    for (i = 0; i < mesh->vertex_count; i++) {
+        for (c = 0; c < 3; c++) {
+            const float p = src[i].pos[c];
+
+            if (i == 0 || p < lo[c])
+                lo[c] = p;
+            if (i == 0 || p > hi[c])
+                hi[c] = p;
+        }
+    }
+    for (c = 0; c < 3; c++) {
+        gpu->center[c] = 0.5f * (lo[c] + hi[c]);
+        gpu->extent[c] = 0.5f * (hi[c] - lo[c]);
+    }
+
+    for (i = 0; i < mesh->vertex_count; i++) {
+        for (c = 0; c < 3; c++) {
+            dst[i].pos[c] =
+                gpu->extent[c] > 0.0f
+                    ? scene_snorm16((src[i].pos[c] - gpu->center[c]) /
+                                    gpu->extent[c])
+                    : 0;
+        }
+        dst[i].pos[3] = 0;
+        scene_oct_encode(src[i].normal, dst[i].normal);
+        dst[i].uv[0] = scene_float_to_half(src[i].uv[0]);
+        dst[i].uv[1] = scene_float_to_half(src[i].uv[1]);
+    }
+
+    if (gpu->flags & SCENE_MESH_INDEX16) {
+        for (i = 0; i < mesh->index_count; i++)
+            q->indices[gpu->first_index + i] = (uint16_t)indices[i];
+    } else {
+        memcpy(&q->indices[gpu->first_index], indices,
+               (size_t)mesh->index_count * sizeof(uint32_t));
+    }
+}
+
+// Uploads the vertices, indices and meshes, quantized with
+// render->quantize. Indices of meshes with up to 65536 vertices shrink to
+// 16 bits, the others stay 32-bit.
+static void scene_upload_geometry(struct renderinfo *render,
+                                  struct scene_uploader *up,
+                                  struct scene *scene,
+                                  VkBufferUsageFlags usage) {
+    const uint64_t float_bytes =
+        (uint64_t)scene->vertex_count * sizeof(struct scene_vertex) +
+        (uint64_t)scene->index_count * sizeof(uint32_t);
+    struct scene_quantizer q;
+    uint64_t halves = 0;
+    uint32_t i;
+
+    scene->gpu_meshes =
+        calloc(scene->mesh_count ? scene->mesh_count : 1,
+               sizeof(struct scene_gpu_mesh));
+    assert(scene->gpu_meshes);
+    scene->quantized = render->quantize;
+    for (i = 0; i < scene->mesh_count; i++) {
+        const struct scene_mesh *mesh = &scene->meshes[i];
+        struct scene_gpu_mesh *gpu = &scene->gpu_meshes[i];
+
+        gpu->first_vertex = mesh->first_vertex;
+        gpu->vertex_count = mesh->vertex_count;
+        gpu->index_count = mesh->index_count;
+        // Clamped like the instance materials, a scene without materials
+        // gets only the default one
+        gpu->material =
+            mesh->material < scene->material_count ? mesh->material : 0;
+        gpu->extent[0] = gpu->extent[1] = gpu->extent[2] = 1.0f;
+        if (!scene->quantized) {
+            gpu->first_index = 2 * mesh->first_index;
+            continue;
+        }
+        // Indices are relative to first_vertex
+        if (mesh->vertex_count <= 65536) {
+            gpu->flags = SCENE_MESH_INDEX16;
+            gpu->first_index = (uint32_t)halves;
+            halves += mesh->index_count;
+        } else {
+            halves = (halves + 1) & ~1ull;
+            gpu->first_index = (uint32_t)halves;
+            halves += 2ull * mesh->index_count;
+        }
+    }
+
+    if (!scene->quantized) {
+        scene_upload_buffer(render, up, scene, scene->vertices,
+                            scene->vertex_count * sizeof(struct scene_vertex),
+                            usage | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                            &scene->vertex_buf);
+        scene_upload_buffer(render, up, scene, scene->indices,
+                            scene->index_count * sizeof(uint32_t),
+                            usage | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                            &scene->index_buf);
+    } else {
+        // The shader reads the indices as whole words
+        const VkDeviceSize index_size = ((halves + 1) & ~1ull) * 2;
+        const VkDeviceSize vertex_size =
+            (VkDeviceSize)scene->vertex_count * sizeof(struct scene_qvertex);
+
+        q.scene = scene;
+        q.meshes = scene->gpu_meshes;
+        q.vertices = calloc(scene->vertex_count ? scene->vertex_count : 1,
+                            sizeof(struct scene_qvertex));
+        q.indices = calloc(index_size ? index_size : 4, 1);
+        assert(q.vertices && q.indices);
+        task_parallel_for(render->tasks, scene->mesh_count,
+                          scene_quantize_task, &q);
+
+        scene_upload_buffer(render, up, scene, q.vertices, vertex_size,
+                            usage | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                            &scene->vertex_buf);
+        scene_upload_buffer(render, up, scene, q.indices,
+                            index_size ? index_size : 4,
+                            usage | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                            &scene->index_buf);
+        free(q.vertices);
+        free(q.indices);
+        printf("Quantized geometry from %.1f MB to %.1f MB\n",
+               float_bytes / 1048576.0,
+               (vertex_size + index_size) / 1048576.0);
+        fflush(stdout);
+    }
+
+    scene_upload_buffer(render, up, scene, scene->gpu_meshes,
+                        (scene->mesh_count ? scene->mesh_count : 1) *
+                            sizeof(struct scene_gpu_mesh),
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &scene->mesh_buf);
+
+    // Builds dequantize the positions through a transform per geometry
+    if (scene->quantized && render->use_accel_struct) {
+        VkTransformMatrixKHR *transforms =
+            calloc(scene->mesh_count ? scene->mesh_count : 1,
+                   sizeof(VkTransformMatrixKHR));
+
+        assert(transforms);
+        for (i = 0; i < scene->mesh_count; i++) {
+            const struct scene_gpu_mesh *gpu = &scene->gpu_meshes[i];
+            uint32_t r;
+
+            for (r = 0; r < 3; r++) {
+                transforms[i].matrix[r][r] = gpu->extent[r];
+                transforms[i].matrix[r][3] = gpu->center[r];
+            }
+        }
+        scene_upload_buffer(render, up, scene, transforms,
+                            (scene->mesh_count ? scene->mesh_count : 1) *
+                                sizeof(VkTransformMatrixKHR),
+                            usage, &scene->mesh_transform_buf);
+        free(transforms);
+    }
+}
+
+void scene_upload(struct renderinfo *render, struct scene *scene) {
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    struct scene_uploader up;
+    uint32_t *texture_elements;
+
+    if (render->use_accel_struct) {
+        usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                 VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+    }
+
+    // Copies are submitted behind whatever setup work is still recorded
+    flush_init_cmd(render);
+    texture_table_init(render, &scene->texture_table);
+    texture_elements = scene_load_textures(render, scene);
+    scene_uploader_init(render, &up, scene);
+
+    scene_upload_geometry(render, &up, scene, usage);
+    scene_upload_materials(render, &up, scene, texture_elements);
+    free(texture_elements);
+    texture_table_finish(render, &scene->texture_table);
+
+    if (!render->use_accel_struct) {
+        if (scene->bvh.node_count == 0)
+            bvh_build(&scene->bvh, scene, render->tasks);
+        scene_upload_buffer(render, &up, scene, scene->bvh.nodes,
+                            scene->bvh.node_count * sizeof(struct bvh_node),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                            &scene->bvh_node_buf);
+        scene_upload_buffer(render, &up, scene, scene->bvh.tris,
+                            (scene->bvh.tri_count ? scene->bvh.tri_count : 1) *
+                                sizeof(struct bvh_triangle),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                            &scene->bvh_tri_buf);
+        scene_upload_buffer(render, &up, scene, scene->bvh.tri_instances,
+                            (scene->bvh.tri_count ? scene->bvh.tri_count : 1) *
+                                sizeof(uint32_t),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                            &scene->bvh_instance_buf);
+    }
+
+    // The acceleration structure builds read the buffers uploaded above
+    if (up.streamed) {
+        printf("Streamed %.1f MB of %s (%s)\n", up.streamed / 1048576.0,
+               scene->file_path, async_reader_backend(&up.reader));
+        fflush(stdout);
+    }
+    if (up.imported) {
+        printf("Imported %.1f MB of %s as device memory\n",
+               up.imported / 1048576.0, scene->file_path);
+        fflush(stdout);
+    }
+    scene_uploader_cleanup(render, &up);
+
+    if (render->use_accel_struct) {
+        accel_build_blas(render, scene);
+        accel_build_tlas(render, scene);
+    }
+}
+
+void scene_cleanup(struct renderinfo *render, struct scene *scene) {
+    if (render->use_accel_struct)
+        accel_cleanup(render, scene);
+
+    destroy_buffer(render, &scene->bvh_node_buf);
+    destroy_buffer(render, &scene->bvh_tri_buf);
+    destroy_buffer(render, &scene->bvh_instance_buf);
+    destroy_buffer(render, &scene->instance_material_buf);
+    bvh_free(&scene->bvh);
+
+    destroy_buffer(render, &scene->vertex_buf);
+    destroy_buffer(render, &scene->index_buf);
+    destroy_buffer(render, &scene->mesh_buf);
+    destroy_buffer(render, &scene->mesh_transform_buf);
+    free(scene->gpu_meshes);
+    destroy_buffer(render, &scene->material_buf);
+    texture_table_cleanup(render, &scene->texture_table);
+
+    free(scene->file_path);
+    free(scene->source_path);
+    if (scene->file_map) {
+        file_unmap(scene->file_map, scene->file_size);
+    } else {
+        free(scene->vertices);
+        free(scene->indices);
+        free(scene->meshes);
+        free(scene->instances);
+        free(scene->materials);
+        free(scene->textures);
+    }
+    memset(scene, 0, sizeof(*scene));
+}
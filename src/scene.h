@@ -0,0 +1,120 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+struct scene_vertex {
+    float pos[3];
+    float normal[3];
+    float uv[2];
+};
+
+// Index ranges are relative to first_vertex so each mesh can be used as
+// acceleration structure geometry on its own
+struct scene_mesh {
+    uint32_t first_vertex;
+    uint32_t vertex_count;
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t material;
+};
+
+// With render->quantize the device holds vertices in half the space:
+// positions as snorm relative to the bounds of their mesh, the normal
+// octahedron mapped to two snorms, texture coordinates as halves. The 4th
+// position component is 0, acceleration structure builds read it as
+// R16G16B16A16_SNORM.
+struct scene_qvertex {
+    int16_t pos[4];
+    int16_t normal[2];
+    uint16_t uv[2];
+};
+
+#define SCENE_MESH_INDEX16 1u // its indices are 16-bit
+
+// Must match Mesh in shaders/trace.comp (std430). Indices of 32-bit meshes
+// start at a multiple of 4 bytes in the index buffer.
+struct scene_gpu_mesh {
+    uint32_t first_vertex;
+    uint32_t vertex_count;
+    uint32_t first_index; // in 16-bit units of the index buffer
+    uint32_t index_count;
+    uint32_t material;
+    uint32_t flags;
+    uint32_t pad[2];
+    float center[4]; // quantized positions are center + extent * snorm,
+    float extent[4]; // 0 and 1 for float ones
+};
+
+#define SCENE_NO_TEXTURE UINT32_MAX
+
+struct scene_material {
+    float base_color[4];
+    float emission[3];
+    float roughness;
+    float metallic;
+    uint32_t base_color_texture; // index into textures or SCENE_NO_TEXTURE
+    uint32_t pad[2];
+};
+
+#define SCENE_TEXTURE_PATH_MAX 256
+
+// Textures are referenced by path relative to the scene file
+struct scene_texture {
+    char path[SCENE_TEXTURE_PATH_MAX];
+};
+
+struct scene_instance {
+    float transform[3][4];
+    uint32_t mesh;
+};
+
+struct scene {
+    struct scene_vertex *vertices;
+    uint32_t vertex_count;
+    uint32_t *indices;
+    uint32_t index_count;
+    struct scene_mesh *meshes;
+    uint32_t mesh_count;
+    struct scene_instance *instances;
+    uint32_t instance_count;
+    struct scene_material *materials;
+    uint32_t material_count;
+    struct scene_texture *textures;
+    uint32_t texture_count;
+
+    // When loaded from a scene file the arrays above (and a prebuilt BVH)
+    // point straight into its mapping instead of owning heap memory
+    void *file_map;
+    size_t file_size;
+    char *file_path; // uploads stream the large sections from here
+    char *source_path; // textures are looked up next to it, NULL: built-in
+
+    struct gpu_buffer vertex_buf;
+    struct gpu_buffer index_buf;
+    struct gpu_buffer mesh_buf;
+    struct scene_gpu_mesh *gpu_meshes; // what mesh_buf holds
+    bool quantized;
+    // per mesh, scales quantized positions in acceleration structure builds
+    struct gpu_buffer mesh_transform_buf;
+
+    // materials with their textures as elements of the texture table
+    struct gpu_buffer material_buf;
+    struct texture_table texture_table;
+
+    // KHR path
+    struct accelinfo accel;
+
+    // compute BVH path
+    struct bvhinfo bvh;
+    struct gpu_buffer bvh_node_buf;
+    struct gpu_buffer bvh_tri_buf;
+    struct gpu_buffer bvh_instance_buf;
+    struct gpu_buffer instance_material_buf;
+};
+
+void scene_init_builtin(struct scene *scene);
+
+void scene_upload(struct renderinfo *render, struct scene *scene);
+
+void scene_cleanup(struct renderinfo *render, struct scene *scene);
+
+#endif
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "filemap.h"
+#include "scenefile.h"
+
+static const uint32_t section_strides[SCENE_SECTION_COUNT] = {
+    [SCENE_SECTION_VERTICES] = sizeof(struct scene_vertex),
+    [SCENE_SECTION_INDICES] = sizeof(uint32_t),
+    [SCENE_SECTION_MESHES] = sizeof(struct scene_mesh),
+    [SCENE_SECTION_INSTANCES] = sizeof(struct scene_instance),
+    [SCENE_SECTION_MATERIALS] = sizeof(struct scene_material),
+    [SCENE_SECTION_TEXTURES] = sizeof(struct scene_texture),
+    [SCENE_SECTION_BVH_NODES] = sizeof(struct bvh_node),
+    [SCENE_SECTION_BVH_TRIANGLES] = sizeof(struct bvh_triangle),
+    [SCENE_SECTION_BVH_INSTANCES] = sizeof(uint32_t),
+};
+
+// Everything the GPU or the texture loader indexes with is checked, a bad
+// reference in a truncated or hostile file would read out of bounds there.
+// The indices are one pass over the section, the rest is small.
+static bool scene_file_check(const struct scene *scene, const char *path) {
+    uint32_t i, j;
+
+    for (i = 0; i < scene->mesh_count; i++) {
+        const struct scene_mesh *mesh = &scene->meshes[i];
+
+        if ((uint64_t)mesh->first_vertex + mesh->vertex_count >
+                scene->vertex_count ||
+            (uint64_t)mesh->first_index + mesh->index_count >
+                scene->index_count ||
+            (scene->material_count && mesh->material >= scene->material_count)) {
+            fprintf(stderr, "%s: mesh %u is out of range\n", path, i);
+            return false;
+        }
+        for (j = 0; j < mesh->index_count; j++) {
+            if (scene->indices[mesh->first_index + j] >= mesh->vertex_count) {
+                fprintf(stderr, "%s: mesh %u has an index out of range\n",
+                        path, i);
+                return false;
+            }
+        }
+    }
+    for (i = 0; i < scene->instance_count; i++) {
+        if (scene->instances[i].mesh >= scene->mesh_count) {
+            fprintf(stderr, "%s: instance %u is out of range\n", path, i);
+            return false;
+        }
+    }
+    for (i = 0; i < scene->material_count; i++) {
+        const uint32_t texture = scene->materials[i].base_color_texture;
+
+        if (texture != SCENE_NO_TEXTURE && texture >= scene->texture_count) {
+            fprintf(stderr, "%s: material %u is out of range\n", path, i);
+            return false;
+        }
+    }
+    for (i = 0; i < scene->texture_count; i++) {
+        if (!memchr(scene->textures[i].path, '\0', SCENE_TEXTURE_PATH_MAX)) {
+            fprintf(stderr, "%s: texture %u has no path\n", path, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Children always come after their parent in both builders, which also
+// rules out cycles. A tree deeper than the traversal stack, from a build
+// before BVH_MAX_DEPTH, is dropped and built again at upload.
+static bool scene_file_check_bvh(struct scene *scene, const char *path) {
+    struct bvhinfo *bvh = &scene->bvh;
+    uint32_t *depths;
+    uint32_t i, max_depth = 0;
+
+    for (i = 0; i < bvh->tri_count; i++) {
+        const struct bvh_triangle *tri = &bvh->tris[i];
+
+        if (tri->i0 >= scene->vertex_count || tri->i1 >= scene->vertex_count ||
+            tri->i2 >= scene->vertex_count ||
+            bvh->tri_instances[i] >= scene->instance_count) {
+            fprintf(stderr, "%s: BVH triangle %u is out of range\n", path, i);
+            return false;
+        }
+    }
+
+    depths = calloc(bvh->node_count, sizeof(uint32_t));
+    assert(depths);
+    for (i = 0; i < bvh->node_count; i++) {
+        const struct bvh_node *node = &bvh->nodes[i];
+
+        if (node->count
+                ? (uint64_t)node->left_first + node->count > bvh->tri_count
+                : node->left_first <= i ||
+                      (uint64_t)node->left_first + 1 >= bvh->node_count) {
+            fprintf(stderr, "%s: BVH node %u is out of range\n", path, i);
+            free(depths);
+            return false;
+        }
+        if (node->count) {
+            if (depths[i] > max_depth)
+                max_depth = depths[i];
+            continue;
+        }
+        if (depths[node->left_first] < depths[i] + 1)
+            depths[node->left_first] = depths[i] + 1;
+        if (depths[node->left_first + 1] < depths[i] + 1)
+            depths[node->left_first + 1] = depths[i] + 1;
+    }
+    free(depths);
+
+    if (max_depth > BVH_MAX_DEPTH) {
+        fprintf(stderr, "%s: prebuilt BVH is %u deep, rebuilding it\n", path,
+                max_depth);
+        memset(bvh, 0, sizeof(*bvh));
+    }
+    return true;
+}
+
+bool scene_load_file(struct scene *scene, const char *path) {
+    const struct scene_file_header *header;
+    const struct scene_file_section *sections;
+    uint8_t *map;
+    size_t size;
+    uint32_t i;
+
+    memset(scene, 0, sizeof(*scene));
+
+    map = file_map(path, &size);
+    if (!map) {
+        fprintf(stderr, "Could not map scene file %s\n", path);
+        return false;
+    }
+    scene->file_map = map;
+    scene->file_size = size;
+
+    header = (const struct scene_file_header *)map;
+    if (size < sizeof(*header) || header->magic != SCENE_FILE_MAGIC) {
+        fprintf(stderr, "%s is not a scene file\n", path);
+        goto fail;
+    }
+    if (header->version != SCENE_FILE_VERSION ||
+        header->section_count != SCENE_SECTION_COUNT) {
+        fprintf(stderr, "%s has scene format version %u, expected %u\n", path,
+                header->version, SCENE_FILE_VERSION);
+        goto fail;
+    }
+
+    // The section table first, the references inside the sections once
+    // they are in place
+    sections = header->sections;
+    for (i = 0; i < SCENE_SECTION_COUNT; i++) {
+        const struct scene_file_section *s = &sections[i];
+
+        if (s->size == 0)
+            continue;
+        if (s->stride != section_strides[i] ||
+            s->size != (uint64_t)s->count * s->stride ||
+            s->offset % SCENE_FILE_ALIGN != 0 || s->offset > size ||
+            s->size > size - s->offset) {
+            fprintf(stderr, "%s: section %u is corrupt\n", path, i);
+            goto fail;
+        }
+    }
+
+#define SECTION(index, type, field, count_field)                               \
+    do {                                                                       \
+        scene->field = (type *)(map + sections[index].offset);                 \
+        scene->count_field = sections[index].count;                            \
+    } while (0)
+
+    SECTION(SCENE_SECTION_VERTICES, struct scene_vertex, vertices, vertex_count);
+    SECTION(SCENE_SECTION_INDICES, uint32_t, indices, index_count);
+    SECTION(SCENE_SECTION_MESHES, struct scene_mesh, meshes, mesh_count);
+    SECTION(SCENE_SECTION_INSTANCES, struct scene_instance, instances,
+            instance_count);
+    SECTION(SCENE_SECTION_MATERIALS, struct scene_material, materials,
+            material_count);
+    SECTION(SCENE_SECTION_TEXTURES, struct scene_texture, textures,
+            texture_count);
+    SECTION(SCENE_SECTION_BVH_NODES, struct bvh_node, bvh.nodes, bvh.node_count);
+    SECTION(SCENE_SECTION_BVH_TRIANGLES, struct bvh_triangle, bvh.tris,
+            bvh.tri_count);
+    scene->bvh.tri_instances =
+        (uint32_t *)(map + sections[SCENE_SECTION_BVH_INSTANCES].offset);
+
+#undef SECTION
+
+    if (scene->vertex_count == 0 || scene->mesh_count == 0 ||
+        scene->instance_count == 0) {
+        fprintf(stderr, "%s: scene is empty\n", path);
+        goto fail;
+    }
+
+    if (!scene_file_check(scene, path))
+        goto fail;
+    scene->bvh.borrowed = true;
+    if (scene->bvh.node_count == 0 || scene->bvh.tri_count == 0 ||
+        sections[SCENE_SECTION_BVH_INSTANCES].count != scene->bvh.tri_count)
+        memset(&scene->bvh, 0, sizeof(scene->bvh));
+    else if (!scene_file_check_bvh(scene, path))
+        goto fail;
+
+    scene->file_path = malloc(strlen(path) + 1);
+    assert(scene->file_path);
+    strcpy(scene->file_path, path);
+
+    printf("Mapped %s: %u vertices, %u meshes, %u instances%s\n", path,
+           scene->vertex_count, scene->mesh_count, scene->instance_count,
+           scene->bvh.node_count ? ", prebuilt BVH" : "");
+    fflush(stdout);
+    return true;
+
+fail:
+    file_unmap(map, size);
+    memset(scene, 0, sizeof(*scene));
+    return false;
+}
+
+static bool scene_write_padding(FILE *file, uint64_t *offset) {
+    static const uint8_t zeros[SCENE_FILE_ALIGN];
+    const uint64_t pad = (SCENE_FILE_ALIGN - *offset % SCENE_FILE_ALIGN) %
+                         SCENE_FILE_ALIGN;
+
+    *offset += pad;
+    return fwrite(zeros, 1, pad, file) == pad;
+}
+
+bool scene_save_file(const struct scene *scene, uint64_t content_hash,
+                     const char *path) {
+    const void *data[SCENE_SECTION_COUNT] = {
+        [SCENE_SECTION_VERTICES] = scene->vertices,
+        [SCENE_SECTION_INDICES] = scene->indices,
+        [SCENE_SECTION_MESHES] = scene->meshes,
+        [SCENE_SECTION_INSTANCES] = scene->instances,
+        [SCENE_SECTION_MATERIALS] = scene->materials,
+        [SCENE_SECTION_TEXTURES] = scene->textures,
+        [SCENE_SECTION_BVH_NODES] = scene->bvh.nodes,
+        [SCENE_SECTION_BVH_TRIANGLES] = scene->bvh.tris,
+        [SCENE_SECTION_BVH_INSTANCES] = scene->bvh.tri_instances,
+    };
+    const uint32_t counts[SCENE_SECTION_COUNT] = {
+        [SCENE_SECTION_VERTICES] = scene->vertex_count,
+        [SCENE_SECTION_INDICES] = scene->index_count,
+        [SCENE_SECTION_MESHES] = scene->mesh_count,
+        [SCENE_SECTION_INSTANCES] = scene->instance_count,
+        [SCENE_SECTION_MATERIALS] = scene->material_count,
+        [SCENE_SECTION_TEXTURES] = scene->texture_count,
+        [SCENE_SECTION_BVH_NODES] = scene->bvh.node_count,
+        [SCENE_SECTION_BVH_TRIANGLES] = scene->bvh.tri_count,
+        [SCENE_SECTION_BVH_INSTANCES] = scene->bvh.tri_count,
+    };
+    struct scene_file_header header;
+    uint64_t offset;
+    FILE *file;
+    bool ok;
+    uint32_t i;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SCENE_FILE_MAGIC;
+    header.version = SCENE_FILE_VERSION;
+    header.section_count = SCENE_SECTION_COUNT;
+    header.content_hash = content_hash;
+
+    offset = sizeof(header);
+    for (i = 0; i < SCENE_SECTION_COUNT; i++) {
+        struct scene_file_section *s = &header.sections[i];
+
+        s->stride = section_strides[i];
+        s->count = data[i] ? counts[i] : 0;
+        s->size = (uint64_t)s->count * s->stride;
+        if (s->size == 0)
+            continue;
+        offset += (SCENE_FILE_ALIGN - offset % SCENE_FILE_ALIGN) % SCENE_FILE_ALIGN;
+        s->offset = offset;
+        offset += s->size;
+    }
+
+    file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    offset = sizeof(header);
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (i = 0; i < SCENE_SECTION_COUNT && ok; i++) {
+        const struct scene_file_section *s = &header.sections[i];
+
+        if (s->size == 0)
+            continue;
+        ok = scene_write_padding(file, &offset) &&
+             fwrite(data[i], 1, s->size, file) == s->size;
+        offset += s->size;
+    }
+
+    if (fclose(file) != 0)
+        ok = false;
+    return ok;
+}
+
+bool scene_file_hash(const char *path, uint64_t *content_hash) {
+    struct scene_file_header header;
+    FILE *file = fopen(path, "rb");
+    bool ok;
+
+    if (!file)
+        return false;
+    ok = fread(&header, sizeof(header), 1, file) == 1 &&
+         header.magic == SCENE_FILE_MAGIC &&
+         header.version == SCENE_FILE_VERSION;
+    fclose(file);
+    if (ok)
+        *content_hash = header.content_hash;
+    return ok;
+}
@@ -0,0 +1,52 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+// Binary scene container. Every section is a plain array in the layout the
+// renderer uses at runtime and starts on a page boundary, so a loaded file
+// is only mapped: the scene arrays point into the mapping and uploads read
+// the sections from the file straight into staging memory without parsing.
+//
+// All values are little endian. Sections that are absent have size 0.
+
+#define SCENE_FILE_MAGIC 0x43534b56u // "VKSC"
+#define SCENE_FILE_VERSION 2
+#define SCENE_FILE_ALIGN 4096
+
+enum scene_section {
+    SCENE_SECTION_VERTICES,
+    SCENE_SECTION_INDICES,
+    SCENE_SECTION_MESHES,
+    SCENE_SECTION_INSTANCES,
+    SCENE_SECTION_MATERIALS,
+    SCENE_SECTION_TEXTURES,
+    SCENE_SECTION_BVH_NODES,     // optional, prebuilt compute BVH
+    SCENE_SECTION_BVH_TRIANGLES,
+    SCENE_SECTION_BVH_INSTANCES, // per BVH triangle, present with the BVH
+    SCENE_SECTION_COUNT,
+};
+
+struct scene_file_section {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t count;
+    uint32_t stride; // sizeof the element, checked against this build
+};
+
+struct scene_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t section_count;
+    uint32_t flags;
+    uint64_t content_hash; // of the source data, for incremental rebuilds
+    struct scene_file_section sections[SCENE_SECTION_COUNT];
+};
+
+bool scene_load_file(struct scene *scene, const char *path);
+
+bool scene_save_file(const struct scene *scene, uint64_t content_hash,
+                     const char *path);
+
+// Reads only the header, false when path is not a current scene file
+bool scene_file_hash(const char *path, uint64_t *content_hash);
+
+#endif
@@ -0,0 +1,693 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "tracer.h"
+#include "cmdpool.h"
+#include "scenefile.h"
+#include "gltf.h"
+#include "asset.h"
+#include "image_writer.h"
+#include "tiler.h"
+#include "server.h"
+
+static void server_reply(int client, const char *format, ...) {
+    char line[SERVER_LINE_MAX];
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    if (len > (int)sizeof(line) - 2)
+        len = sizeof(line) - 2;
+    line[len++] = '\n';
+    // A client that went away only loses its replies
+    send(client, line, len, MSG_NOSIGNAL);
+}
+
+static void server_free_job(struct renderinfo *render, struct server_job *job) {
+    if (job->snapshot.buf)
+        destroy_buffer(render, &job->snapshot);
+    if (job->client >= 0)
+        close(job->client);
+    free(job->scene_path);
+    free(job->output);
+    free(job);
+}
+
+static char *server_strdup(const char *s) {
+    char *copy = malloc(strlen(s) + 1);
+
+    if (copy)
+        strcpy(copy, s);
+    return copy;
+}
+
+// Fills in a job from its line, on failure error says why
+static bool server_parse_job(struct serverinfo *server, char *line,
+                             struct server_job *job, const char **error) {
+    char *word, *save = NULL;
+
+    job->camera.pos[2] = -3.0f;
+    job->camera.fov = 60.0f;
+    job->width = SERVER_DEFAULT_SIZE;
+    job->height = SERVER_DEFAULT_SIZE;
+    job->passes = SERVER_DEFAULT_SPP;
+
+    for (word = strtok_r(line, " \t\r\n", &save); word;
+         word = strtok_r(NULL, " \t\r\n", &save)) {
+        char *value = strchr(word, '=');
+        struct camera *c = &job->camera;
+        char end;
+
+        if (!value) {
+            *error = "expected key=value";
+            return false;
+        }
+        *value++ = 0;
+        if (strcmp(word, "scene") == 0) {
+            free(job->scene_path);
+            job->scene_path = server_strdup(value);
+        } else if (strcmp(word, "output") == 0) {
+            free(job->output);
+            job->output = server_strdup(value);
+        } else if (strcmp(word, "spp") == 0) {
+            if (sscanf(value, "%u%c", &job->passes, &end) != 1 ||
+                job->passes == 0) {
+                *error = "bad spp";
+                return false;
+            }
+        } else if (strcmp(word, "size") == 0) {
+            if (sscanf(value, "%ux%u%c", &job->width, &job->height, &end) !=
+                    2 ||
+                job->width == 0 || job->height == 0 ||
+                job->width > server->max_size ||
+                job->height > server->max_size) {
+                *error = "bad size";
+                return false;
+            }
+        } else if (strcmp(word, "camera") == 0) {
+            if (sscanf(value, "%f,%f,%f,%f,%f,%f%c", &c->pos[0], &c->pos[1],
+                       &c->pos[2], &c->yaw, &c->pitch, &c->fov, &end) != 6 ||
+                c->fov <= 0.0f || c->fov >= 180.0f) {
+                *error = "bad camera, expected x,y,z,yaw,pitch,fov";
+                return false;
+            }
+        } else if (strcmp(word, "priority") == 0) {
+            if (sscanf(value, "%d%c", &job->priority, &end) != 1) {
+                *error = "bad priority";
+                return false;
+            }
+        } else {
+            *error = "unknown key";
+            return false;
+        }
+    }
+
+    if (!job->output ||
+        !image_format_from_path(job->output, &job->format)) {
+        *error = "output must be a .ppm, .png or .exr file";
+        return false;
+    }
+    return true;
+}
+
+// Keeps the queue ordered by priority, then by id so that a preempted job
+// goes back ahead of the later ones of its priority
+static void server_enqueue(struct serverinfo *server, struct server_job *job) {
+    struct server_job **p = &server->queue;
+
+    while (*p && ((*p)->priority > job->priority ||
+                  ((*p)->priority == job->priority && (*p)->id < job->id)))
+        p = &(*p)->next;
+    job->next = *p;
+    *p = job;
+}
+
+// Reads the client's line and queues its job. Returns false once a client
+// asked the server to shut down.
+static bool server_accept(struct serverinfo *server, int client) {
+    const struct timeval timeout = {5, 0};
+    char line[SERVER_LINE_MAX];
+    struct server_job *job;
+    const char *error = NULL;
+    size_t len = 0;
+    ssize_t got;
+
+    // A client that never finishes its line must not hold up the others
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (len < sizeof(line) - 1 && !memchr(line, '\n', len)) {
+        got = recv(client, line + len, sizeof(line) - 1 - len, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        len += got;
+    }
+    line[len] = 0;
+
+    if (strncmp(line, "shutdown", 8) == 0) {
+        pthread_mutex_lock(&server->lock);
+        server->quit = true;
+        pthread_cond_signal(&server->wake);
+        pthread_mutex_unlock(&server->lock);
+        server_reply(client, "ok");
+        close(client);
+        return false;
+    }
+
+    job = calloc(1, sizeof(*job));
+    if (!job) {
+        server_reply(client, "error out of memory");
+        close(client);
+        return true;
+    }
+    job->client = client;
+    if (!memchr(line, '\n', len))
+        error = "expected one line";
+    else if (!server_parse_job(server, line, job, &error))
+        job->client = -1;
+    if (error) {
+        server_reply(client, "error %s", error);
+        close(client);
+        job->client = -1;
+        server_free_job(NULL, job);
+        return true;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    job->id = server->next_id++;
+    server_reply(client, "queued %u", job->id);
+    server_enqueue(server, job);
+    pthread_cond_signal(&server->wake);
+    pthread_mutex_unlock(&server->lock);
+    return true;
+}
+
+static void *server_listen(void *arg) {
+    struct serverinfo *server = arg;
+
+    for (;;) {
+        const int client = accept(server->listen_fd, NULL, NULL);
+
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // The socket was shut down
+            return NULL;
+        }
+        if (!server_accept(server, client))
+            return NULL;
+    }
+}
+
+static bool server_open_socket(struct serverinfo *server) {
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen(server->socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", server->socket_path);
+        return false;
+    }
+    // A socket left over from an earlier server is replaced, anything else
+    // at the path is not
+    if (stat(server->socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(server->socket_path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, server->socket_path);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listen_fd < 0 ||
+        bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, 16) != 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", server->socket_path,
+                strerror(errno));
+        if (server->listen_fd >= 0)
+            close(server->listen_fd);
+        return false;
+    }
+    return true;
+}
+
+// Returns the resident scene for path, loading it in place of the least
+// recently used one if needed. NULL if it does not load.
+static struct server_scene *server_get_scene(struct renderinfo *render,
+                                             struct serverinfo *server,
+                                             const struct server_job *job) {
+    struct server_scene *entry = NULL;
+    struct scene scene;
+    uint32_t i;
+
+    for (i = 0; i < server->scene_count; i++) {
+        struct server_scene *s = &server->scenes[i];
+
+        if (s->resident &&
+            (s->path && job->scene_path ? strcmp(s->path, job->scene_path) == 0
+                                        : s->path == job->scene_path)) {
+            s->last_used = ++server->use_clock;
+            return s;
+        }
+        if (!entry || !s->resident ||
+            (entry->resident && s->last_used < entry->last_used))
+            entry = s;
+    }
+
+    // A scene that does not load leaves the resident ones alone
+    if (!job->scene_path)
+        scene_init_builtin(&scene);
+    else if (!asset_load_scene(&server->cache, &scene, job->scene_path,
+                               render->tasks))
+        return NULL;
+
+    if (entry->resident) {
+        printf("Evicting %s\n", entry->path ? entry->path : "built-in scene");
+        tracer_cleanup(render, &entry->tracer);
+        scene_cleanup(render, &entry->scene);
+        free(entry->path);
+        memset(entry, 0, sizeof(*entry));
+    }
+
+    entry->scene = scene;
+    scene_upload(render, &entry->scene);
+    tracer_prepare(render, &entry->tracer, &entry->scene, job->width,
+                   job->height);
+    entry->path = job->scene_path ? server_strdup(job->scene_path) : NULL;
+    entry->resident = true;
+    entry->last_used = ++server->use_clock;
+    return entry;
+}
+
+static void server_submit(struct renderinfo *render,
+                          struct serverinfo *server) {
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = NULL,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &server->frame.cmd,
+    };
+    VkResult err;
+
+    cmd_frame_end(&server->frame);
+    err = vkQueueSubmit(render->queue, 1, &submit_info, server->fence);
+    assert(!err);
+    err = vkWaitForFences(render->device, 1, &server->fence, VK_TRUE,
+                          UINT64_MAX);
+    assert(!err);
+    err = vkResetFences(render->device, 1, &server->fence);
+    assert(!err);
+}
+
+// Every submit is waited for, so one frame of command pools is enough
+static VkCommandBuffer server_begin(struct renderinfo *render,
+                                    struct serverinfo *server) {
+    return cmd_frame_begin(render, &server->frame);
+}
+
+// Copies the accumulation of a job between the tracer and its snapshot
+static void server_snapshot(struct renderinfo *render,
+                            struct serverinfo *server,
+                            struct tracerinfo *tracer, struct server_job *job,
+                            bool save) {
+    const VkDeviceSize pixels = (VkDeviceSize)tracer->width * tracer->height;
+    const VkDeviceSize state_size = tracer->tile_count * 2 * sizeof(uint32_t);
+    const VkDeviceSize list_size =
+        4 * sizeof(uint32_t) + tracer->tile_count * sizeof(uint32_t);
+    const VkDeviceSize offsets[4] = {0, pixels * 16, pixels * 20,
+                                     pixels * 20 + state_size};
+    const VkImage images[2] = {tracer->accum.image, tracer->variance.image};
+    const VkBuffer buffers[2] = {tracer->tile_state.buf, tracer->tile_list.buf};
+    const VkDeviceSize sizes[2] = {state_size, list_size};
+    VkCommandBuffer cmd;
+    uint32_t i;
+
+    if (save)
+        create_buffer(render, offsets[3] + list_size,
+                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &job->snapshot);
+
+    cmd = server_begin(render, server);
+    const VkMemoryBarrier before = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT |
+                         VK_ACCESS_TRANSFER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &before, 0,
+                         NULL, 0, NULL);
+
+    for (i = 0; i < 2; i++) {
+        const VkBufferImageCopy region = {
+            .bufferOffset = offsets[i],
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {tracer->width, tracer->height, 1},
+        };
+        if (save)
+            vkCmdCopyImageToBuffer(cmd, images[i],
+                                   VK_IMAGE_LAYOUT_GENERAL, job->snapshot.buf,
+                                   1, &region);
+        else
+            vkCmdCopyBufferToImage(cmd, job->snapshot.buf, images[i],
+                                   VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+    }
+    for (i = 0; i < 2; i++) {
+        const VkBufferCopy region = {
+            .srcOffset = save ? 0 : offsets[2 + i],
+            .dstOffset = save ? offsets[2 + i] : 0,
+            .size = sizes[i],
+        };
+        vkCmdCopyBuffer(cmd, save ? buffers[i] : job->snapshot.buf,
+                        save ? job->snapshot.buf : buffers[i], 1, &region);
+    }
+
+    const VkMemoryBarrier after = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                         VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         0, 1, &after, 0, NULL, 0, NULL);
+    server_submit(render, server);
+
+    if (!save)
+        destroy_buffer(render, &job->snapshot);
+}
+
+// Records and runs one slice of the job's passes, as many tile list entries
+// as the tracer's slice budget allows
+static void server_run_slice(struct renderinfo *render,
+                             struct serverinfo *server,
+                             struct tracerinfo *tracer,
+                             const struct server_job *job) {
+    const VkCommandBuffer cmd = server_begin(render, server);
+    uint64_t remaining, ticks[2];
+    uint32_t budget, tiles;
+
+    if (tracer->timestamps) {
+        vkCmdResetQueryPool(cmd, tracer->timestamps, 0, 2);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            tracer->timestamps, 0);
+    }
+
+    // As in the tiler every pass counts as a full one
+    remaining = (uint64_t)(job->passes - tracer->sample_count) *
+                    tracer->tile_count -
+                tracer->slice_offset;
+    budget = slice_budget_tiles(&tracer->budget, remaining > UINT32_MAX
+                                                     ? UINT32_MAX
+                                                     : (uint32_t)remaining);
+    tiles = tracer_record_slices(render, tracer, &server->frame, budget,
+                                 job->passes);
+
+    if (tracer->timestamps)
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            tracer->timestamps, 1);
+    server_submit(render, server);
+
+    if (tracer->timestamps &&
+        vkGetQueryPoolResults(render->device, tracer->timestamps, 0, 2,
+                              sizeof(ticks), ticks, sizeof(ticks[0]),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+        slice_budget_update(&tracer->budget, tiles,
+                            timestamp_delta_ms(render, ticks));
+}
+
+// Reads the finished image back and writes the job's output file
+static bool server_write_output(struct renderinfo *render,
+                                struct serverinfo *server,
+                                struct tracerinfo *tracer,
+                                const struct server_job *job) {
+    static const char *const names[3] = {"R", "G", "B"};
+    const bool linear = job->format == IMAGE_FORMAT_EXR;
+    const uint32_t pixel_size = linear ? 16 : 4;
+    struct gpu_buffer readback;
+    struct image_channel channels[3];
+    VkCommandBuffer cmd;
+    bool ok;
+    uint32_t i;
+
+    create_buffer(render,
+                  (VkDeviceSize)tracer->width * tracer->height * pixel_size,
+                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &readback);
+
+    cmd = server_begin(render, server);
+    const VkMemoryBarrier copy_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &copy_barrier,
+                         0, NULL, 0, NULL);
+    const VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {tracer->width, tracer->height, 1},
+    };
+    vkCmdCopyImageToBuffer(cmd,
+                           linear ? tracer->accum.image : tracer->output.image,
+                           VK_IMAGE_LAYOUT_GENERAL, readback.buf, 1, &region);
+    const VkMemoryBarrier host_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier, 0,
+                         NULL, 0, NULL);
+    server_submit(render, server);
+
+    switch (job->format) {
+    case IMAGE_FORMAT_PNG:
+        ok = image_write_png(job->output, tracer->width, tracer->height,
+                             readback.alloc.mapped, (size_t)tracer->width * 4);
+        break;
+    case IMAGE_FORMAT_EXR:
+        for (i = 0; i < 3; i++) {
+            channels[i].name = names[i];
+            channels[i].type = IMAGE_CHANNEL_FLOAT_AS_HALF;
+            channels[i].data = (const uint8_t *)readback.alloc.mapped +
+                               i * sizeof(float);
+            channels[i].pixel_stride = 16;
+            channels[i].row_stride = (size_t)tracer->width * 16;
+        }
+        ok = image_write_exr(job->output, tracer->width, tracer->height,
+                             channels, 3);
+        break;
+    default:
+        ok = image_write_ppm(job->output, tracer->width, tracer->height,
+                             readback.alloc.mapped, (size_t)tracer->width * 4);
+        break;
+    }
+    destroy_buffer(render, &readback);
+    return ok;
+}
+
+// A waiting job of higher priority takes over between slices
+static bool server_preempted(struct serverinfo *server,
+                             const struct server_job *job) {
+    bool preempt;
+
+    pthread_mutex_lock(&server->lock);
+    preempt = server->queue && server->queue->priority > job->priority;
+    pthread_mutex_unlock(&server->lock);
+    return preempt;
+}
+
+// Runs the job until it is done or preempted. Returns false when it went
+// back into the queue.
+static bool server_run_job(struct renderinfo *render,
+                           struct serverinfo *server, struct server_job *job) {
+    struct server_scene *entry;
+    struct tracerinfo *tracer;
+    double start = glfwGetTime();
+
+    entry = server_get_scene(render, server, job);
+    if (!entry) {
+        server_reply(job->client, "failed %u could not load %s", job->id,
+                     job->scene_path);
+        return true;
+    }
+    tracer = &entry->tracer;
+    if (tracer->width != job->width || tracer->height != job->height)
+        tracer_resize(render, tracer, job->width, job->height);
+    tracer->camera = job->camera;
+
+    tracer_reset(tracer);
+    if (job->suspended) {
+        server_snapshot(render, server, tracer, job, false);
+        tracer->sample_count = job->sample_count;
+        tracer->slice_offset = job->slice_offset;
+        tracer->pass_tiles = tracer->tile_count;
+        job->suspended = false;
+    }
+    server_reply(job->client, "running %u", job->id);
+
+    while (tracer->sample_count < job->passes) {
+        server_run_slice(render, server, tracer, job);
+
+        if (tracer->sample_count < job->passes &&
+            server_preempted(server, job)) {
+            server_snapshot(render, server, tracer, job, true);
+            job->sample_count = tracer->sample_count;
+            job->slice_offset = tracer->slice_offset;
+            job->suspended = true;
+            job->seconds += glfwGetTime() - start;
+            server_reply(job->client, "preempted %u after %u of %u passes",
+                         job->id, job->sample_count, job->passes);
+            printf("Job %u preempted\n", job->id);
+            fflush(stdout);
+            return false;
+        }
+    }
+
+    job->seconds += glfwGetTime() - start;
+    if (server_write_output(render, server, tracer, job)) {
+        server_reply(job->client, "done %u %.3f", job->id, job->seconds);
+        printf("Job %u: %s, %ux%u, %u passes in %.3f s\n", job->id,
+               job->output, job->width, job->height, job->passes,
+               job->seconds);
+    } else {
+        server_reply(job->client, "failed %u could not write %s", job->id,
+                     job->output);
+    }
+    fflush(stdout);
+    return true;
+}
+
+bool server_run(struct renderinfo *render, const char *socket_path) {
+    struct serverinfo server;
+    struct server_job *job;
+    uint32_t i;
+    VkResult err;
+
+    memset(&server, 0, sizeof(server));
+    server.socket_path = socket_path;
+    server.scene_count =
+        render->serve_scenes ? render->serve_scenes : SERVER_DEFAULT_SCENES;
+    if (server.scene_count > SERVER_MAX_SCENES)
+        server.scene_count = SERVER_MAX_SCENES;
+    // Bounded like one tile of a tiled render
+    server.max_size = tiler_pick_tile_size(render) + 2 * TILER_GUARD_BAND;
+    if (render->no_cache)
+        memset(&server.cache, 0, sizeof(server.cache));
+    else
+        asset_cache_init(&server.cache, render->cache_dir, render->cache_mb);
+
+    if (!server_open_socket(&server))
+        return false;
+
+    const VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+    };
+    cmd_frame_init(render, &server.frame);
+    err = vkCreateFence(render->device, &fence_info, NULL, &server.fence);
+    assert(!err);
+
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.wake, NULL);
+    if (pthread_create(&server.thread, NULL, server_listen, &server) != 0) {
+        fprintf(stderr, "Could not start the listener thread\n");
+        exit(1);
+    }
+    printf("Serving render jobs on %s, up to %u resident scenes\n",
+           socket_path, server.scene_count);
+    fflush(stdout);
+
+    for (;;) {
+        pthread_mutex_lock(&server.lock);
+        while (!server.quit && !server.queue)
+            pthread_cond_wait(&server.wake, &server.lock);
+        if (server.quit) {
+            pthread_mutex_unlock(&server.lock);
+            break;
+        }
+        job = server.queue;
+        server.queue = job->next;
+        pthread_mutex_unlock(&server.lock);
+
+        if (server_run_job(render, &server, job)) {
+            server_free_job(render, job);
+        } else {
+            pthread_mutex_lock(&server.lock);
+            server_enqueue(&server, job);
+            pthread_mutex_unlock(&server.lock);
+        }
+    }
+
+    shutdown(server.listen_fd, SHUT_RDWR);
+    pthread_join(server.thread, NULL);
+    close(server.listen_fd);
+    unlink(socket_path);
+
+    vkDeviceWaitIdle(render->device);
+    while ((job = server.queue)) {
+        server.queue = job->next;
+        server_reply(job->client, "failed %u server shut down", job->id);
+        server_free_job(render, job);
+    }
+    for (i = 0; i < server.scene_count; i++) {
+        struct server_scene *entry = &server.scenes[i];
+
+        if (!entry->resident)
+            continue;
+        tracer_cleanup(render, &entry->tracer);
+        scene_cleanup(render, &entry->scene);
+        free(entry->path);
+    }
+    cmd_frame_cleanup(render, &server.frame);
+    vkDestroyFence(render->device, server.fence, NULL);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.wake);
+    printf("Server stopped\n");
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Long-running render server. Jobs arrive on a Unix domain socket, one per
+// connection as a line of key=value words:
+//
+//   output=<file.ppm|png|exr> [scene=<file>] [spp=<n>] [size=<w>x<h>]
+//   [camera=<x>,<y>,<z>,<yaw>,<pitch>,<fov>] [priority=<n>]
+//
+// The server answers "queued <id>" or "error <reason>", then reports
+// "running", "preempted" and finally "done <id> <seconds>" or
+// "failed <id> <reason>" on the same connection. A "shutdown" line stops the
+// server once the running job is done, the queued ones fail.
+//
+// Jobs run highest priority first, in arrival order within a priority. Each
+// submit is one slice of the job's passes; a job is preempted between
+// slices when one of higher priority is waiting, its accumulation is copied
+// aside and put back when it resumes. Scenes stay uploaded, each with its
+// own tracer and pipelines, in a least recently used set.
+
+#define SERVER_MAX_SCENES 16
+#define SERVER_DEFAULT_SCENES 4
+#define SERVER_DEFAULT_SPP 64
+#define SERVER_DEFAULT_SIZE 512
+#define SERVER_LINE_MAX 4096
+
+struct server_job {
+    uint32_t id;
+    int32_t priority;
+    int client; // the job's connection, replies go there
+    char *scene_path; // NULL: built-in scene
+    struct camera camera;
+    uint32_t width, height;
+    uint32_t passes;
+    char *output;
+    enum image_format format;
+    double seconds; // spent running so far
+
+    // progress of a preempted job
+    bool suspended;
+    uint32_t sample_count, slice_offset;
+    struct gpu_buffer snapshot; // accumulation, variance and tile state
+
+    struct server_job *next;
+};
+
+struct server_scene {
+    bool resident;
+    char *path; // NULL: built-in scene
+    struct scene scene;
+    struct tracerinfo tracer;
+    uint64_t last_used;
+};
+
+struct serverinfo {
+    const char *socket_path;
+    int listen_fd;
+    uint32_t max_size; // largest image side a tracer can hold
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct server_job *queue; // by priority, then id
+    uint32_t next_id;
+    bool quit;
+
+    struct server_scene scenes[SERVER_MAX_SCENES];
+    uint32_t scene_count; // resident scenes allowed
+    uint64_t use_clock;
+    struct asset_cache cache;
+
+    struct cmd_frame frame;
+    VkFence fence;
+};
+
+// Serves until a client sends shutdown, false if the socket could not be
+// set up
+bool server_run(struct renderinfo *render, const char *socket_path);
+
+#endif
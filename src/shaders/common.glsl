@@ -0,0 +1,57 @@
+// Declarations shared by every pass that runs with the tracer's pipeline
+// layout. Keep in sync with struct trace_constants / struct trace_stats.
+
+#define TILE_SIZE 8
+
+// Constants of one slice of a pass, sub-allocated from the tracer's
+// uniform ring each submit and bound with a dynamic offset
+layout(std140, binding = 17) uniform Constants {
+    vec4 cam_pos;     // w = tan(fov / 2)
+    vec4 cam_right;
+    vec4 cam_up;
+    vec4 cam_forward;
+    // camera the last accumulation started with, for motion vectors
+    vec4 prev_cam_pos;
+    vec4 prev_cam_right;
+    vec4 prev_cam_up;
+    vec4 prev_cam_forward;
+    uint width;
+    uint height;
+    uint sample_index; // passes since the last reset, 0 restarts
+    uint max_bounces;
+    uint tiles_x;
+    uint tile_count;
+    uint spp_target;   // 0: unlimited
+    uint adaptive;
+    float noise_threshold;
+    float heatmap_max;
+    // The storage images may only cover a window of the final image when
+    // it is rendered in tiles
+    ivec2 origin;      // of the storage images in the final image
+    uvec2 extent;      // of the final image
+    uint tile_offset;  // first tile list entry of a sliced pass
+} slice;
+
+// Fixed point (x2^24) sum of the per-pixel relative variance of the mean,
+// read back by the host to decide when the image has converged. It is 64
+// bits wide in two words, 64-bit atomics are optional.
+layout(std430, binding = 5) buffer Stats {
+    uint noise_sum_lo;
+    uint noise_sum_hi;
+    uint noise_pixels;
+    uint active_tiles;
+};
+
+// Indirect dispatch arguments followed by the compacted list of tiles that
+// still need samples
+layout(std430, binding = 10) buffer TileList {
+    uvec4 tile_args;
+    uint tile_ids[];
+};
+
+struct TileState {
+    float error;   // relative standard error of the tile's mean
+    uint samples;  // fewest samples of any pixel in the tile
+};
+
+layout(std430, binding = 11) buffer Tiles { TileState tiles[]; };
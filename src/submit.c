@@ -0,0 +1,81 @@
+// vkrender-submit: sends one job to a render server started with --serve and
+// prints its replies until the server is done with it. The arguments after
+// the socket are the job's key=value words, or shutdown.
+//
+//   vkrender-submit /tmp/vkrender.sock output=view.png spp=256 priority=1
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SUBMIT_LINE_MAX 4096
+
+int main(const int argc, const char *argv[]) {
+    struct sockaddr_un addr;
+    char line[SUBMIT_LINE_MAX], reply[SUBMIT_LINE_MAX];
+    size_t len = 0, reply_len = 0;
+    bool ok = false;
+    ssize_t got;
+    int fd, i;
+
+    if (argc < 3 || strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Usage:\n  %s <socket> output=<file> [scene=<file>] "
+                        "[spp=<n>] [size=<w>x<h>]\n"
+                        "  [camera=<x>,<y>,<z>,<yaw>,<pitch>,<fov>] "
+                        "[priority=<n>]\n"
+                        "  %s <socket> shutdown\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+    for (i = 2; i < argc; i++) {
+        const size_t word = strlen(argv[i]);
+
+        if (len + word + 2 > sizeof(line)) {
+            fprintf(stderr, "Job is too long\n");
+            return 1;
+        }
+        memcpy(line + len, argv[i], word);
+        len += word;
+        line[len++] = i < argc - 1 ? ' ' : '\n';
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, argv[1]);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (send(fd, line, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        perror("send");
+        close(fd);
+        return 1;
+    }
+
+    // Replies are lines, the last one says how the job ended
+    while ((got = recv(fd, reply + reply_len, sizeof(reply) - 1 - reply_len,
+                       0)) > 0) {
+        char *start = reply, *end;
+
+        reply_len += got;
+        reply[reply_len] = 0;
+        while ((end = strchr(start, '\n'))) {
+            *end = 0;
+            printf("%s\n", start);
+            ok = strncmp(start, "done", 4) == 0 ||
+                 strncmp(start, "ok", 2) == 0;
+            start = end + 1;
+        }
+        reply_len -= start - reply;
+        memmove(reply, start, reply_len);
+        if (reply_len == sizeof(reply) - 1)
+            reply_len = 0;
+    }
+    fflush(stdout);
+    close(fd);
+    return ok ? 0 : 1;
+}
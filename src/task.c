@@ -0,0 +1,312 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "task.h"
+
+static __thread struct task_worker *task_current;
+
+// Slots are read by thieves while the owner may be refilling them, a thief
+// that loses the race on top throws its copy away
+static void task_store(struct task *slot, const struct task *task) {
+    __atomic_store_n(&slot->func, task->func, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->arg, task->arg, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->index, task->index, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->counter, task->counter, __ATOMIC_RELAXED);
+}
+
+static void task_load(struct task *slot, struct task *task) {
+    task->func = __atomic_load_n(&slot->func, __ATOMIC_RELAXED);
+    task->arg = __atomic_load_n(&slot->arg, __ATOMIC_RELAXED);
+    task->index = __atomic_load_n(&slot->index, __ATOMIC_RELAXED);
+    task->counter = __atomic_load_n(&slot->counter, __ATOMIC_RELAXED);
+}
+
+// Owner only
+static bool task_push(struct task_deque *deque, const struct task *task) {
+    const int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    const int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    if (bottom - top >= TASK_DEQUE_SIZE)
+        return false;
+    task_store(&deque->slots[bottom & (TASK_DEQUE_SIZE - 1)], task);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+// Owner only, takes the newest task
+static bool task_pop(struct task_deque *deque, struct task *task) {
+    const int64_t bottom =
+        __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    int64_t top;
+    bool taken = true;
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    task_load(&deque->slots[bottom & (TASK_DEQUE_SIZE - 1)], task);
+    if (top == bottom) {
+        // The last task, a thief may be after it too
+        taken = __atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED);
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return taken;
+}
+
+// Any thread, takes the oldest task
+static bool task_steal(struct task_deque *deque, struct task *task) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    int64_t bottom;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom)
+        return false;
+    task_load(&deque->slots[top & (TASK_DEQUE_SIZE - 1)], task);
+    return __atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void task_run(const struct task *task) {
+    task->func(task->arg, task->index);
+    __atomic_sub_fetch(&task->counter->pending, 1, __ATOMIC_RELEASE);
+}
+
+static struct task_worker *task_self(struct taskinfo *tasks) {
+    return tasks && task_current && task_current->tasks == tasks
+               ? task_current
+               : NULL;
+}
+
+// Own deque first, then one pass over the others from a random victim
+static bool task_find(struct taskinfo *tasks, struct task_worker *self,
+                      struct task *task) {
+    uint32_t start, i;
+
+    if (self && task_pop(&self->deque, task))
+        return true;
+    if (self) {
+        self->rng ^= self->rng << 13;
+        self->rng ^= self->rng >> 17;
+        self->rng ^= self->rng << 5;
+        start = self->rng;
+    } else {
+        start = 0;
+    }
+    for (i = 0; i < tasks->thread_count; i++) {
+        struct task_worker *victim =
+            &tasks->workers[(start + i) % tasks->thread_count];
+
+        if (victim != self && task_steal(&victim->deque, task))
+            return true;
+    }
+    return false;
+}
+
+static bool task_has_work(struct taskinfo *tasks) {
+    uint32_t i;
+
+    for (i = 0; i < tasks->thread_count; i++) {
+        struct task_deque *deque = &tasks->workers[i].deque;
+
+        if (__atomic_load_n(&deque->top, __ATOMIC_SEQ_CST) <
+            __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST))
+            return true;
+    }
+    return false;
+}
+
+static void *task_worker_main(void *arg) {
+    struct task_worker *self = arg;
+    struct taskinfo *tasks = self->tasks;
+    struct task task;
+    uint32_t idle = 0;
+
+    task_current = self;
+    for (;;) {
+        if (task_find(tasks, self, &task)) {
+            task_run(&task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < TASK_SPIN_ROUNDS) {
+            sched_yield();
+            continue;
+        }
+
+        // A spawn after the check sees sleeping and signals
+        pthread_mutex_lock(&tasks->lock);
+        __atomic_add_fetch(&tasks->sleeping, 1, __ATOMIC_SEQ_CST);
+        while (!tasks->quit && !task_has_work(tasks))
+            pthread_cond_wait(&tasks->wake, &tasks->lock);
+        __atomic_sub_fetch(&tasks->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (tasks->quit) {
+            pthread_mutex_unlock(&tasks->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&tasks->lock);
+        idle = 0;
+    }
+}
+
+static void task_pin(pthread_t thread, const cpu_set_t *allowed,
+                     uint32_t index) {
+    const int count = CPU_COUNT(allowed);
+    cpu_set_t set;
+    int cpu, seen = -1;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, allowed) && ++seen == (int)(index % count))
+            break;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+        fprintf(stderr, "Could not pin worker %u to CPU %d\n", index, cpu);
+}
+
+void task_init(struct taskinfo *tasks, uint32_t thread_count, bool affinity) {
+    cpu_set_t allowed;
+    uint32_t i;
+
+    memset(tasks, 0, sizeof(*tasks));
+    if (thread_count == 0)
+        thread_count = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count == 0)
+        thread_count = 1;
+    if (thread_count > TASK_MAX_THREADS)
+        thread_count = TASK_MAX_THREADS;
+    if (affinity && (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 ||
+                     CPU_COUNT(&allowed) == 0)) {
+        fprintf(stderr, "Could not read the CPU affinity, workers are not "
+                        "pinned\n");
+        affinity = false;
+    }
+
+    tasks->workers = calloc(thread_count, sizeof(struct task_worker));
+    assert(tasks->workers);
+    pthread_mutex_init(&tasks->lock, NULL);
+    pthread_cond_init(&tasks->wake, NULL);
+    for (i = 0; i < thread_count; i++) {
+        tasks->workers[i].tasks = tasks;
+        tasks->workers[i].index = i;
+        tasks->workers[i].rng = 0x9e3779b9u * (i + 1);
+    }
+
+    tasks->thread_count = thread_count;
+    tasks->workers[0].thread = pthread_self();
+    tasks->workers[0].running = true;
+    task_current = &tasks->workers[0];
+    if (affinity)
+        task_pin(tasks->workers[0].thread, &allowed, 0);
+    // A worker that does not start leaves an empty deque behind, that only
+    // costs parallelism
+    for (i = 1; i < thread_count; i++) {
+        if (pthread_create(&tasks->workers[i].thread, NULL, task_worker_main,
+                           &tasks->workers[i]) != 0) {
+            fprintf(stderr, "Could not start worker thread %u\n", i);
+            continue;
+        }
+        tasks->workers[i].running = true;
+        if (affinity)
+            task_pin(tasks->workers[i].thread, &allowed, i);
+    }
+}
+
+uint32_t task_thread_count(const struct taskinfo *tasks) {
+    return tasks ? tasks->thread_count : 1;
+}
+
+uint32_t task_worker_index(struct taskinfo *tasks) {
+    struct task_worker *self = task_self(tasks);
+
+    assert(!tasks || self);
+    return self ? self->index : 0;
+}
+
+void task_spawn(struct taskinfo *tasks, struct task_counter *counter,
+                void (*func)(void *arg, uint32_t index), void *arg,
+                uint32_t index) {
+    struct task_worker *self = task_self(tasks);
+    const struct task task = {func, arg, index, counter};
+
+    __atomic_add_fetch(&counter->pending, 1, __ATOMIC_RELAXED);
+    if (!self || !task_push(&self->deque, &task)) {
+        task_run(&task);
+        return;
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&tasks->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&tasks->lock);
+        pthread_cond_signal(&tasks->wake);
+        pthread_mutex_unlock(&tasks->lock);
+    }
+}
+
+void task_wait(struct taskinfo *tasks, struct task_counter *counter) {
+    struct task_worker *self = task_self(tasks);
+    struct task task;
+
+    while (__atomic_load_n(&counter->pending, __ATOMIC_ACQUIRE)) {
+        // Whatever is left runs on other threads
+        if (!tasks || !task_find(tasks, self, &task)) {
+            sched_yield();
+            continue;
+        }
+        task_run(&task);
+    }
+}
+
+void task_parallel_for(struct taskinfo *tasks, uint32_t count,
+                       void (*func)(void *arg, uint32_t index), void *arg) {
+    struct task_counter counter = {0};
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+        task_spawn(tasks, &counter, func, arg, i);
+    task_wait(tasks, &counter);
+}
+
+void task_cleanup(struct taskinfo *tasks) {
+    uint32_t i;
+
+    pthread_mutex_lock(&tasks->lock);
+    tasks->quit = true;
+    pthread_cond_broadcast(&tasks->wake);
+    pthread_mutex_unlock(&tasks->lock);
+    for (i = 1; i < tasks->thread_count; i++) {
+        if (tasks->workers[i].running)
+            pthread_join(tasks->workers[i].thread, NULL);
+    }
+
+    if (task_current && task_current->tasks == tasks)
+        task_current = NULL;
+    pthread_mutex_destroy(&tasks->lock);
+    pthread_cond_destroy(&tasks->wake);
+    free(tasks->workers);
+    memset(tasks, 0, sizeof(*tasks));
+}
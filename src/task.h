@@ -0,0 +1,82 @@
+#ifndef TASK_H
+#define TASK_H
+
+// Work-stealing scheduler for the CPU side of loading and preparing a
+// scene: imports, BVH builds and pipeline creation. Every worker owns a
+// Chase-Lev deque; it pushes and pops tasks at the bottom of its own and
+// steals from the top of the others'. The thread that called task_init is
+// worker 0, it runs tasks only while it waits on a counter. The other
+// workers sleep while no deque has work.
+//
+// A counter holds the number of unfinished tasks spawned against it, and
+// task_wait runs queued tasks until it reaches zero, so a task can spawn
+// children and wait on them without tying up its thread. A thread that is
+// not a worker, or a full deque, runs the spawned task right away. A NULL
+// taskinfo runs everything on the calling thread.
+
+#define TASK_MAX_THREADS 256
+#define TASK_DEQUE_SIZE 1024 // per worker, a power of two
+#define TASK_SPIN_ROUNDS 64  // failed steals before a worker goes to sleep
+
+struct task_counter {
+    uint32_t pending;
+};
+
+struct task {
+    void (*func)(void *arg, uint32_t index);
+    void *arg;
+    uint32_t index;
+    struct task_counter *counter;
+};
+
+// top and bottom on their own cache lines, thieves only write top
+struct task_deque {
+    int64_t top;
+    char pad0[56];
+    int64_t bottom;
+    char pad1[56];
+    struct task slots[TASK_DEQUE_SIZE];
+};
+
+struct task_worker {
+    struct taskinfo *tasks;
+    uint32_t index;
+    uint32_t rng; // picks the victims of steals
+    pthread_t thread;
+    bool running;
+    struct task_deque deque;
+};
+
+struct taskinfo {
+    uint32_t thread_count; // workers including the creating thread
+    struct task_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint32_t sleeping;
+    bool quit;
+};
+
+// thread_count 0 uses one thread per CPU. affinity pins worker i to the
+// i-th CPU the process may run on.
+void task_init(struct taskinfo *tasks, uint32_t thread_count, bool affinity);
+
+// 1 for a NULL taskinfo
+uint32_t task_thread_count(const struct taskinfo *tasks);
+
+// Index of the calling worker below task_thread_count, 0 for a NULL
+// taskinfo. Lets tasks pick per-thread resources; only workers may call it.
+uint32_t task_worker_index(struct taskinfo *tasks);
+
+void task_spawn(struct taskinfo *tasks, struct task_counter *counter,
+                void (*func)(void *arg, uint32_t index), void *arg,
+                uint32_t index);
+
+void task_wait(struct taskinfo *tasks, struct task_counter *counter);
+
+// Runs func for every index in 0..count-1 as its own task and waits
+void task_parallel_for(struct taskinfo *tasks, uint32_t count,
+                       void (*func)(void *arg, uint32_t index), void *arg);
+
+void task_cleanup(struct taskinfo *tasks);
+
+#endif
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "filemap.h"
+#include "texfile.h"
+
+static const uint8_t ktx2_identifier[12] = {0xab, 0x4b, 0x54, 0x58, 0x20, 0x32,
+                                            0x30, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a};
+
+struct ktx2_header {
+    uint8_t identifier[12];
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression;
+    uint32_t dfd_offset, dfd_length;
+    uint32_t kvd_offset, kvd_length;
+    uint64_t sgd_offset, sgd_length;
+};
+
+struct ktx2_level {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t uncompressed_length;
+};
+
+// Data format descriptor colour models and channels, from the Khronos data
+// format specification
+#define KTX2_MODEL_RGBSDA 1
+#define KTX2_MODEL_BC1A 128
+#define KTX2_MODEL_BC3 130
+#define KTX2_MODEL_BC5 132
+#define KTX2_MODEL_BC7 134
+#define KTX2_CHANNEL_ALPHA 15
+#define KTX2_CHANNEL_LINEAR 0x10 // qualifier, alpha of sRGB formats
+
+struct ktx2_format {
+    VkFormat format;
+    uint8_t block;      // texels along each side of a block
+    uint8_t bytes;      // per block
+    uint8_t model;
+    bool srgb;
+    uint8_t samples;
+    uint8_t channels[4];
+};
+
+static const struct ktx2_format ktx2_formats[] = {
+    {VK_FORMAT_BC1_RGB_UNORM_BLOCK, 4, 8, KTX2_MODEL_BC1A, false, 1, {0}},
+    {VK_FORMAT_BC1_RGB_SRGB_BLOCK, 4, 8, KTX2_MODEL_BC1A, true, 1, {0}},
+    {VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 4, 8, KTX2_MODEL_BC1A, false, 1, {1}},
+    {VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 4, 8, KTX2_MODEL_BC1A, true, 1, {1}},
+    {VK_FORMAT_BC3_UNORM_BLOCK, 4, 16, KTX2_MODEL_BC3, false, 2,
+     {KTX2_CHANNEL_ALPHA, 0}},
+    {VK_FORMAT_BC3_SRGB_BLOCK, 4, 16, KTX2_MODEL_BC3, true, 2,
+     {KTX2_CHANNEL_ALPHA, 0}},
+    {VK_FORMAT_BC5_UNORM_BLOCK, 4, 16, KTX2_MODEL_BC5, false, 2, {0, 1}},
+    {VK_FORMAT_BC7_UNORM_BLOCK, 4, 16, KTX2_MODEL_BC7, false, 1, {0}},
+    {VK_FORMAT_BC7_SRGB_BLOCK, 4, 16, KTX2_MODEL_BC7, true, 1, {0}},
+    {VK_FORMAT_R8G8B8A8_UNORM, 1, 4, KTX2_MODEL_RGBSDA, false, 4,
+     {0, 1, 2, KTX2_CHANNEL_ALPHA}},
+    {VK_FORMAT_R8G8B8A8_SRGB, 1, 4, KTX2_MODEL_RGBSDA, true, 4,
+     {0, 1, 2, KTX2_CHANNEL_ALPHA}},
+};
+
+static const struct ktx2_format *ktx2_find_format(VkFormat format) {
+    uint32_t i;
+
+    for (i = 0; i < sizeof(ktx2_formats) / sizeof(ktx2_formats[0]); i++) {
+        if (ktx2_formats[i].format == format)
+            return &ktx2_formats[i];
+    }
+    return NULL;
+}
+
+bool texfile_block_size(VkFormat format, uint32_t *block, uint32_t *bytes) {
+    const struct ktx2_format *f = ktx2_find_format(format);
+
+    if (!f)
+        return false;
+    *block = f->block;
+    *bytes = f->bytes;
+    return true;
+}
+
+size_t texfile_level_size(VkFormat format, uint32_t width, uint32_t height) {
+    uint32_t block, bytes;
+
+    if (!texfile_block_size(format, &block, &bytes))
+        return 0;
+    return (size_t)((width + block - 1) / block) *
+           ((height + block - 1) / block) * bytes;
+}
+
+// Next header field of a PPM, skipping whitespace and comments
+static bool texfile_ppm_field(FILE *file, uint32_t *value) {
+    int c = fgetc(file);
+
+    while (c == '#' || isspace(c)) {
+        if (c == '#') {
+            while (c != '\n' && c != EOF)
+                c = fgetc(file);
+        }
+        c = fgetc(file);
+    }
+    if (!isdigit(c))
+        return false;
+    *value = 0;
+    while (isdigit(c)) {
+        if (*value > 100000)
+            return false;
+        *value = *value * 10 + (uint32_t)(c - '0');
+        c = fgetc(file);
+    }
+    // A single whitespace character ends the header
+    return isspace(c);
+}
+
+bool texfile_load_ppm(const char *path, uint32_t *width, uint32_t *height,
+                      uint8_t **rgba8) {
+    FILE *file = fopen(path, "rb");
+    uint32_t maxval;
+    uint8_t *pixels;
+    size_t i;
+    char magic[2];
+
+    if (!file) {
+        printf("%s: cannot open texture\n", path);
+        return false;
+    }
+    if (fread(magic, 1, 2, file) != 2 || magic[0] != 'P' || magic[1] != '6' ||
+        !texfile_ppm_field(file, width) || !texfile_ppm_field(file, height) ||
+        !texfile_ppm_field(file, &maxval) || *width == 0 || *height == 0 ||
+        maxval == 0 || maxval > 255) {
+        printf("%s: only 8-bit binary PPM textures are read\n", path);
+        fclose(file);
+        return false;
+    }
+
+    // Read as rgb into the end of the buffer, then spread out in place
+    pixels = malloc((size_t)*width * *height * 4);
+    assert(pixels);
+    const size_t count = (size_t)*width * *height;
+    uint8_t *rgb = pixels + count;
+    if (fread(rgb, 3, count, file) != count) {
+        printf("%s: truncated texture\n", path);
+        free(pixels);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    for (i = 0; i < count; i++) {
+        const uint8_t r = rgb[3 * i], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+
+        pixels[4 * i + 0] = (uint8_t)(r * 255u / maxval);
+        pixels[4 * i + 1] = (uint8_t)(g * 255u / maxval);
+        pixels[4 * i + 2] = (uint8_t)(b * 255u / maxval);
+        pixels[4 * i + 3] = 255;
+    }
+    *rgba8 = pixels;
+    return true;
+}
+
+bool texfile_open_ktx2(const char *path, struct texfile_ktx2 *ktx) {
+    const struct ktx2_header *header;
+    const struct ktx2_level *index;
+    uint32_t width, height, i;
+
+    memset(ktx, 0, sizeof(*ktx));
+    ktx->map = file_map(path, &ktx->map_size);
+    if (!ktx->map) {
+        printf("%s: cannot open texture\n", path);
+        return false;
+    }
+    header = ktx->map;
+    if (ktx->map_size < sizeof(*header) ||
+        memcmp(header->identifier, ktx2_identifier, sizeof(ktx2_identifier)) !=
+            0) {
+        printf("%s: not a KTX2 file\n", path);
+        goto fail;
+    }
+    if (!ktx2_find_format(header->vk_format) || header->supercompression != 0 ||
+        header->pixel_width == 0 || header->pixel_height == 0 ||
+        header->pixel_depth != 0 || header->layer_count != 0 ||
+        header->face_count != 1 || header->level_count > TEXFILE_MAX_LEVELS) {
+        printf("%s: only uncompressed 2D BCn and rgba8 KTX2 textures are read\n",
+               path);
+        goto fail;
+    }
+
+    ktx->format = header->vk_format;
+    ktx->width = header->pixel_width;
+    ktx->height = header->pixel_height;
+    // 0 asks the reader to generate the chain, only level 0 is stored
+    ktx->level_count = header->level_count ? header->level_count : 1;
+    if (ktx->map_size < sizeof(*header) + ktx->level_count * sizeof(*index)) {
+        printf("%s: truncated texture\n", path);
+        goto fail;
+    }
+
+    index = (const struct ktx2_level *)(header + 1);
+    width = ktx->width;
+    height = ktx->height;
+    for (i = 0; i < ktx->level_count; i++) {
+        const size_t size = texfile_level_size(ktx->format, width, height);
+
+        if (index[i].offset > ktx->map_size ||
+            index[i].length > ktx->map_size - index[i].offset ||
+            index[i].length < size) {
+            printf("%s: truncated texture\n", path);
+            goto fail;
+        }
+        ktx->levels[i] = (const uint8_t *)ktx->map + index[i].offset;
+        ktx->level_sizes[i] = size;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return true;
+
+fail:
+    file_unmap(ktx->map, ktx->map_size);
+    memset(ktx, 0, sizeof(*ktx));
+    return false;
+}
+
+void texfile_close_ktx2(struct texfile_ktx2 *ktx) {
+    if (ktx->map)
+        file_unmap(ktx->map, ktx->map_size);
+    memset(ktx, 0, sizeof(*ktx));
+}
+
+// The basic descriptor block, with one sample per channel. Returns its
+// size in words.
+static uint32_t ktx2_write_dfd(const struct ktx2_format *f, uint32_t *dfd) {
+    const uint32_t block_size = 24 + 16 * f->samples;
+    const uint32_t bits = f->bytes * 8 / f->samples;
+    uint32_t i;
+
+    dfd[0] = 4 + block_size;
+    dfd[1] = 0; // Khronos vendor, basic descriptor type
+    dfd[2] = 2 | (block_size << 16);
+    dfd[3] = f->model | (1u << 8) | ((f->srgb ? 2u : 1u) << 16); // BT.709
+    dfd[4] = f->block > 1 ? (f->block - 1) | ((f->block - 1u) << 8) : 0;
+    dfd[5] = f->bytes;
+    dfd[6] = 0;
+    for (i = 0; i < f->samples; i++) {
+        uint32_t *sample = &dfd[7 + 4 * i];
+        uint32_t channel = f->channels[i];
+
+        if (f->srgb && channel == KTX2_CHANNEL_ALPHA &&
+            f->model == KTX2_MODEL_RGBSDA)
+            channel |= KTX2_CHANNEL_LINEAR;
+        sample[0] = (i * bits) | ((bits - 1) << 16) | (channel << 24);
+        sample[1] = 0;
+        sample[2] = 0;
+        sample[3] = f->model == KTX2_MODEL_RGBSDA ? 255 : UINT32_MAX;
+    }
+    return dfd[0] / 4;
+}
+
+bool texfile_save_ktx2(const char *path, VkFormat format, uint32_t width,
+                       uint32_t height, uint32_t level_count,
+                       const uint8_t *const *levels) {
+    static const uint8_t zeros[16];
+    const struct ktx2_format *f = ktx2_find_format(format);
+    const uint32_t align = f && f->bytes > 4 ? f->bytes : 4;
+    struct ktx2_header header;
+    struct ktx2_level index[TEXFILE_MAX_LEVELS];
+    uint32_t dfd[7 + 4 * 4];
+    uint32_t dfd_words, i;
+    uint64_t offset;
+    FILE *file;
+    bool ok;
+
+    if (!f || level_count == 0 || level_count > TEXFILE_MAX_LEVELS)
+        return false;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.identifier, ktx2_identifier, sizeof(ktx2_identifier));
+    header.vk_format = format;
+    header.type_size = 1;
+    header.pixel_width = width;
+    header.pixel_height = height;
+    header.face_count = 1;
+    header.level_count = level_count;
+    dfd_words = ktx2_write_dfd(f, dfd);
+    header.dfd_offset = sizeof(header) + level_count * sizeof(index[0]);
+    header.dfd_length = dfd_words * 4;
+
+    // Smallest level first, so that a reader streaming the file in has
+    // something to show early
+    memset(index, 0, sizeof(index));
+    offset = header.dfd_offset + header.dfd_length;
+    for (i = level_count; i-- > 0;) {
+        const uint32_t w = width >> i ? width >> i : 1;
+        const uint32_t h = height >> i ? height >> i : 1;
+
+        offset += (align - offset % align) % align;
+        index[i].offset = offset;
+        index[i].length = texfile_level_size(format, w, h);
+        index[i].uncompressed_length = index[i].length;
+        offset += index[i].length;
+    }
+
+    file = fopen(path, "wb");
+    if (!file)
+        return false;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(index, sizeof(index[0]), level_count, file) == level_count &&
+         fwrite(dfd, 4, dfd_words, file) == dfd_words;
+    offset = header.dfd_offset + header.dfd_length;
+    for (i = level_count; i-- > 0 && ok;) {
+        const size_t pad = index[i].offset - offset;
+
+        ok = fwrite(zeros, 1, pad, file) == pad &&
+             fwrite(levels[i], 1, index[i].length, file) == index[i].length;
+        offset = index[i].offset + index[i].length;
+    }
+    if (fclose(file) != 0)
+        ok = false;
+    return ok;
+}
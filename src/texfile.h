@@ -0,0 +1,43 @@
+#ifndef TEXFILE_H
+#define TEXFILE_H
+
+// Texture files, read by the renderer and written by the baker: 8-bit
+// binary PPM for source images and KTX2 for images with their whole mip
+// chain in the format they are sampled in, block compressed or rgba8.
+
+#define TEXFILE_MAX_LEVELS 16
+
+// A KTX2 file mapped into memory, levels point into the mapping
+struct texfile_ktx2 {
+    void *map;
+    size_t map_size;
+    VkFormat format;
+    uint32_t width, height;
+    uint32_t level_count;
+    const uint8_t *levels[TEXFILE_MAX_LEVELS]; // level 0 is the largest
+    size_t level_sizes[TEXFILE_MAX_LEVELS];
+};
+
+// Reads a binary PPM (P6) into rgba8 pixels, which the caller frees. Errors
+// are reported.
+bool texfile_load_ppm(const char *path, uint32_t *width, uint32_t *height,
+                      uint8_t **rgba8);
+
+// Only single 2D images without supercompression, in one of the BC1, BC3,
+// BC5, BC7 or R8G8B8A8 formats. Errors are reported.
+bool texfile_open_ktx2(const char *path, struct texfile_ktx2 *ktx);
+
+void texfile_close_ktx2(struct texfile_ktx2 *ktx);
+
+// Texels along each side of a block, 1 for rgba8, and its bytes
+bool texfile_block_size(VkFormat format, uint32_t *block, uint32_t *bytes);
+
+// Bytes of a width x height level of format, 0 for formats KTX2 files are
+// not read in
+size_t texfile_level_size(VkFormat format, uint32_t width, uint32_t height);
+
+bool texfile_save_ktx2(const char *path, VkFormat format, uint32_t width,
+                       uint32_t height, uint32_t level_count,
+                       const uint8_t *const *levels);
+
+#endif
@@ -0,0 +1,746 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "task.h"
+#include "texfile.h"
+#include "texstream.h"
+
+// entry_slots of pages that are not resident, or on their way
+#define TEXSTREAM_NO_SLOT UINT32_MAX
+#define TEXSTREAM_LOADING (UINT32_MAX - 1)
+// slot_entries of free slots, slot_used of mip tails, which stay
+#define TEXSTREAM_NO_ENTRY UINT32_MAX
+#define TEXSTREAM_PINNED UINT32_MAX
+
+struct texstream_texture {
+    struct texfile_ktx2 ktx; // mapped for as long as the scene is loaded
+    uint32_t pool;
+    uint32_t tail_level;
+    uint32_t first_entry;
+    uint32_t level_entries[TEXFILE_MAX_LEVELS]; // from first_entry
+};
+
+// Atlas of the pages of every streamed texture of one format
+struct texstream_pool {
+    VkFormat format;
+    uint32_t block, block_bytes;
+    VkDeviceSize slot_bytes;
+    uint64_t demand; // bytes of level 0 of its textures
+    uint32_t tails;
+
+    uint32_t element; // of the atlas in the texture table
+    const struct gpu_image *atlas;
+    uint32_t columns, slot_count;
+    uint32_t *slot_entries; // page table entry held by every slot
+    uint32_t *slot_used;    // frame the tracer last asked for it
+    uint32_t hand;          // next slot to consider for eviction
+    uint32_t resident;
+};
+
+static uint32_t texstream_pages(uint32_t size) {
+    return (size + TEXSTREAM_PAGE - 1) / TEXSTREAM_PAGE;
+}
+
+static uint32_t texstream_level_size(uint32_t size, uint32_t level) {
+    return size >> level ? size >> level : 1;
+}
+
+void texture_stream_init(struct renderinfo *render,
+                         struct texture_stream *stream) {
+    memset(stream, 0, sizeof(*stream));
+    stream->budget = (VkDeviceSize)render->texture_mb * 1024 * 1024;
+}
+
+uint32_t texture_stream_add(struct texture_stream *stream,
+                            struct texfile_ktx2 *ktx) {
+    struct texstream_texture *texture;
+    struct texstream_pool *pool;
+    uint32_t tail = 0, entries = 0, level, i;
+
+    if (stream->budget == 0)
+        return SCENE_NO_TEXTURE;
+    // Worth it when level 0 takes more than a page and the file has the
+    // levels down to one that does not
+    while (tail < ktx->level_count &&
+           (texstream_level_size(ktx->width, tail) > TEXSTREAM_PAGE ||
+            texstream_level_size(ktx->height, tail) > TEXSTREAM_PAGE))
+        tail++;
+    if (tail == 0 || tail == ktx->level_count)
+        return SCENE_NO_TEXTURE;
+
+    for (i = 0; i < stream->pool_count; i++) {
+        if (stream->pools[i].format == ktx->format)
+            break;
+    }
+    if (i == stream->pool_count) {
+        stream->pools = realloc(stream->pools,
+                                (stream->pool_count + 1) * sizeof(*pool));
+        assert(stream->pools);
+        pool = &stream->pools[stream->pool_count++];
+        memset(pool, 0, sizeof(*pool));
+        pool->format = ktx->format;
+        texfile_block_size(ktx->format, &pool->block, &pool->block_bytes);
+        pool->slot_bytes = texfile_level_size(ktx->format, TEXSTREAM_SLOT,
+                                              TEXSTREAM_SLOT);
+        if (pool->slot_bytes > stream->slot_bytes)
+            stream->slot_bytes = pool->slot_bytes;
+    }
+    pool = &stream->pools[i];
+    pool->demand += ktx->level_sizes[0];
+    pool->tails++;
+
+    if (stream->texture_count == stream->texture_capacity) {
+        stream->texture_capacity =
+            stream->texture_capacity ? stream->texture_capacity * 2 : 16;
+        stream->textures = realloc(stream->textures,
+                                   stream->texture_capacity * sizeof(*texture));
+        assert(stream->textures);
+    }
+    texture = &stream->textures[stream->texture_count];
+    texture->ktx = *ktx;
+    texture->pool = i;
+    texture->tail_level = tail;
+    texture->first_entry = stream->entry_count;
+    for (level = 0; level <= tail; level++) {
+        texture->level_entries[level] = entries;
+        entries += texstream_pages(texstream_level_size(ktx->width, level)) *
+                   texstream_pages(texstream_level_size(ktx->height, level));
+    }
+    stream->entry_count += entries;
+    memset(ktx, 0, sizeof(*ktx));
+    return TEXSTREAM_VIRTUAL_BIT | stream->texture_count++;
+}
+
+// Copies the blocks of a page and its border out of the mapped level,
+// wrapping around its edges as the sampler's repeat mode does
+static void texstream_gather_task(void *arg, uint32_t index) {
+    struct texture_stream *stream = arg;
+    const struct texstream_load *load = &stream->loads[index];
+    const struct texstream_texture *texture = &stream->textures[load->texture];
+    const struct texstream_pool *pool = &stream->pools[texture->pool];
+    const int64_t blocks_x =
+        (texstream_level_size(texture->ktx.width, load->level) + pool->block -
+         1) / pool->block;
+    const int64_t blocks_y =
+        (texstream_level_size(texture->ktx.height, load->level) + pool->block -
+         1) / pool->block;
+    const uint32_t slot_blocks = TEXSTREAM_SLOT / pool->block;
+    const int64_t origin_x = (int64_t)load->x * (TEXSTREAM_PAGE / pool->block) -
+                             TEXSTREAM_BORDER / pool->block;
+    const int64_t origin_y = (int64_t)load->y * (TEXSTREAM_PAGE / pool->block) -
+                             TEXSTREAM_BORDER / pool->block;
+    const uint8_t *src = texture->ktx.levels[load->level];
+    uint8_t *dst = (uint8_t *)stream->staging.alloc.mapped + load->offset;
+    uint32_t x, y;
+
+    for (y = 0; y < slot_blocks; y++) {
+        const int64_t sy = ((origin_y + y) % blocks_y + blocks_y) % blocks_y;
+
+        for (x = 0; x < slot_blocks; x++) {
+            const int64_t sx = ((origin_x + x) % blocks_x + blocks_x) % blocks_x;
+
+            memcpy(dst, src + (sy * blocks_x + sx) * pool->block_bytes,
+                   pool->block_bytes);
+            dst += pool->block_bytes;
+        }
+    }
+}
+
+// Records the copies of the gathered pages into their slots and the page
+// table entries of loads and evictions, and waits for them
+static void texstream_upload(struct renderinfo *render,
+                             struct texture_stream *stream) {
+    const VkCommandBuffer cmd = get_setup_cmd(render);
+    const VkDeviceSize values_offset = TEXSTREAM_LOADS_MAX * stream->slot_bytes;
+    uint32_t *values =
+        (uint32_t *)((uint8_t *)stream->staging.alloc.mapped + values_offset);
+    VkBufferCopy entry_copies[2 * TEXSTREAM_LOADS_MAX];
+    VkBufferImageCopy regions[TEXSTREAM_LOADS_MAX];
+    VkImageMemoryBarrier barrier;
+    uint32_t copy_count = 0, region_count, p, i;
+
+    for (i = 0; i < stream->eviction_count; i++) {
+        values[copy_count] = 0;
+        entry_copies[copy_count] = (VkBufferCopy){
+            values_offset + copy_count * 4,
+            (VkDeviceSize)stream->evictions[i].entry * 4, 4};
+        copy_count++;
+    }
+    for (i = 0; i < stream->load_count; i++) {
+        values[copy_count] = stream->loads[i].slot + 1;
+        entry_copies[copy_count] = (VkBufferCopy){
+            values_offset + copy_count * 4,
+            (VkDeviceSize)stream->loads[i].entry * 4, 4};
+        copy_count++;
+    }
+
+    memset(&barrier, 0, sizeof(barrier));
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange =
+        (VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    for (p = 0; p < stream->pool_count; p++) {
+        const struct texstream_pool *pool = &stream->pools[p];
+
+        region_count = 0;
+        for (i = 0; i < stream->load_count; i++) {
+            const struct texstream_load *load = &stream->loads[i];
+
+            if (stream->textures[load->texture].pool != p)
+                continue;
+            regions[region_count++] = (VkBufferImageCopy){
+                .bufferOffset = load->offset,
+                .bufferRowLength = TEXSTREAM_SLOT,
+                .bufferImageHeight = TEXSTREAM_SLOT,
+                .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                .imageOffset = {(int32_t)(load->slot % pool->columns *
+                                          TEXSTREAM_SLOT),
+                                (int32_t)(load->slot / pool->columns *
+                                          TEXSTREAM_SLOT),
+                                0},
+                .imageExtent = {TEXSTREAM_SLOT, TEXSTREAM_SLOT, 1},
+            };
+        }
+        if (region_count == 0)
+            continue;
+
+        // Slots that are not copied to stay as they are, and are sampled
+        // all along
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.image = pool->atlas->image;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0,
+                             NULL, 1, &barrier);
+        vkCmdCopyBufferToImage(cmd, stream->staging.buf, pool->atlas->image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               region_count, regions);
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+                             0, NULL, 1, &barrier);
+    }
+
+    if (copy_count > 0) {
+        const VkBufferMemoryBarrier table_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = stream->page_table.buf,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        };
+
+        vkCmdCopyBuffer(cmd, stream->staging.buf, stream->page_table.buf,
+                        copy_count, entry_copies);
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+                             1, &table_barrier, 0, NULL);
+    }
+    flush_init_cmd(render);
+
+    for (i = 0; i < stream->load_count; i++) {
+        const struct texstream_load *load = &stream->loads[i];
+
+        stream->entry_slots[load->entry] = load->slot;
+        stream->bytes += stream->pools[stream->textures[load->texture].pool]
+                             .slot_bytes;
+    }
+    stream->load_count = 0;
+    stream->eviction_count = 0;
+}
+
+// The first free slot, or else the next one the clock hand finds that no
+// frame asked for since the one before last. Evicting its page is queued
+// with the loads. TEXSTREAM_NO_ENTRY when every slot is in use.
+static uint32_t texstream_alloc_slot(struct texture_stream *stream,
+                                     struct texstream_pool *pool) {
+    uint32_t n, slot, entry;
+
+    for (n = 0; n < pool->slot_count; n++) {
+        slot = pool->hand;
+        pool->hand = (pool->hand + 1) % pool->slot_count;
+        entry = pool->slot_entries[slot];
+        if (entry == TEXSTREAM_NO_ENTRY)
+            return slot;
+        if (pool->slot_used[slot] == TEXSTREAM_PINNED ||
+            pool->slot_used[slot] + 1 >= stream->frame ||
+            stream->entry_slots[entry] == TEXSTREAM_LOADING)
+            continue;
+
+        stream->entry_slots[entry] = TEXSTREAM_NO_SLOT;
+        stream->evictions[stream->eviction_count++].entry = entry;
+        pool->slot_entries[slot] = TEXSTREAM_NO_ENTRY;
+        pool->resident--;
+        return slot;
+    }
+    return TEXSTREAM_NO_ENTRY;
+}
+
+// Texture of a page table entry, by binary search over their first entries
+static uint32_t texstream_find_texture(const struct texture_stream *stream,
+                                       uint32_t entry) {
+    uint32_t lo = 0, hi = stream->texture_count - 1;
+
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi + 1) / 2;
+
+        if (stream->textures[mid].first_entry <= entry)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// Queues the gather of a page into the next staging slot. False when the
+// atlas has no slot to spare.
+static bool texstream_queue_load(struct texture_stream *stream,
+                                 uint32_t texture_index, uint32_t level,
+                                 uint32_t x, uint32_t y, bool pinned) {
+    const struct texstream_texture *texture =
+        &stream->textures[texture_index];
+    struct texstream_pool *pool = &stream->pools[texture->pool];
+    const uint32_t pages_x =
+        texstream_pages(texstream_level_size(texture->ktx.width, level));
+    const uint32_t entry =
+        texture->first_entry + texture->level_entries[level] + y * pages_x + x;
+    struct texstream_load *load = &stream->loads[stream->load_count];
+    const uint32_t slot = texstream_alloc_slot(stream, pool);
+
+    if (slot == TEXSTREAM_NO_ENTRY)
+        return false;
+    pool->slot_entries[slot] = entry;
+    pool->slot_used[slot] = pinned ? TEXSTREAM_PINNED : stream->frame;
+    pool->resident++;
+    stream->entry_slots[entry] = TEXSTREAM_LOADING;
+
+    load->texture = texture_index;
+    load->level = level;
+    load->x = x;
+    load->y = y;
+    load->entry = entry;
+    load->slot = slot;
+    load->offset = stream->load_count * stream->slot_bytes;
+    stream->load_count++;
+    return true;
+}
+
+static void texstream_create_buffer(struct renderinfo *render,
+                                    VkDeviceSize size, VkBufferUsageFlags usage,
+                                    VkMemoryPropertyFlags props,
+                                    struct gpu_buffer *buffer) {
+    // Empty buffers cannot be bound
+    create_buffer(render, size ? size : 16, usage, props, buffer);
+}
+
+void texture_stream_prepare(struct renderinfo *render,
+                            struct texture_stream *stream,
+                            struct texture_table *table) {
+    const uint32_t max_columns =
+        render->gpu_props.limits.maxImageDimension2D / TEXSTREAM_SLOT;
+    struct texstream_gpu_texture *gpu_textures;
+    struct gpu_buffer upload;
+    uint64_t demand = 0;
+    VkDeviceSize atlas_bytes = 0;
+    uint32_t i, p;
+
+    for (p = 0; p < stream->pool_count; p++)
+        demand += stream->pools[p].demand;
+    for (p = 0; p < stream->pool_count; p++) {
+        struct texstream_pool *pool = &stream->pools[p];
+        // Shares of the budget follow the texture data of each format, and
+        // every pool can hold its tails and a full load besides
+        uint64_t slots = (uint64_t)((double)stream->budget * pool->demand /
+                                    demand / pool->slot_bytes);
+        uint32_t rows;
+
+        if (slots < pool->tails + TEXSTREAM_LOADS_MAX)
+            slots = pool->tails + TEXSTREAM_LOADS_MAX;
+        pool->columns = (uint32_t)ceil(sqrt((double)slots));
+        if (pool->columns > max_columns)
+            pool->columns = max_columns;
+        rows = (uint32_t)((slots + pool->columns - 1) / pool->columns);
+        if (rows > max_columns)
+            rows = max_columns;
+        pool->slot_count = pool->columns * rows;
+        if (pool->slot_count < pool->tails + TEXSTREAM_LOADS_MAX) {
+            printf("Too many streamed textures of format %d for one atlas\n",
+                   pool->format);
+            fflush(stdout);
+            exit(1);
+        }
+        pool->slot_entries = malloc(pool->slot_count * sizeof(uint32_t));
+        pool->slot_used = calloc(pool->slot_count, sizeof(uint32_t));
+        assert(pool->slot_entries && pool->slot_used);
+        memset(pool->slot_entries, 0xff, pool->slot_count * sizeof(uint32_t));
+        pool->element =
+            texture_table_add_empty(render, table, pool->format,
+                                    pool->columns * TEXSTREAM_SLOT,
+                                    rows * TEXSTREAM_SLOT);
+        assert(pool->element != SCENE_NO_TEXTURE);
+        pool->atlas = &table->images[pool->element];
+        atlas_bytes += pool->slot_count * pool->slot_bytes;
+    }
+
+    stream->entry_slots = malloc((stream->entry_count + 1) * sizeof(uint32_t));
+    assert(stream->entry_slots);
+    memset(stream->entry_slots, 0xff,
+           (stream->entry_count + 1) * sizeof(uint32_t));
+
+    texstream_create_buffer(render,
+                            stream->texture_count * sizeof(*gpu_textures),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            &stream->gpu_textures);
+    texstream_create_buffer(render, (VkDeviceSize)stream->entry_count * 4,
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            &stream->page_table);
+    texstream_create_buffer(render, (VkDeviceSize)stream->entry_count * 4,
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            &stream->marks);
+    create_buffer(render,
+                  sizeof(struct texstream_feedback) +
+                      TEXSTREAM_FEEDBACK_MAX * sizeof(uint32_t),
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &stream->feedback);
+    create_buffer(render, stream->feedback.size,
+                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &stream->readback);
+
+    // Describe the textures, clear the page table and marks
+    const VkCommandBuffer cmd = get_setup_cmd(render);
+    texstream_create_buffer(render,
+                            stream->texture_count * sizeof(*gpu_textures),
+                            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                            &upload);
+    gpu_textures = upload.alloc.mapped;
+    for (i = 0; i < stream->texture_count; i++) {
+        const struct texstream_texture *texture = &stream->textures[i];
+        const struct texstream_pool *pool = &stream->pools[texture->pool];
+
+        memset(&gpu_textures[i], 0, sizeof(gpu_textures[i]));
+        gpu_textures[i].width = texture->ktx.width;
+        gpu_textures[i].height = texture->ktx.height;
+        gpu_textures[i].tail_level = texture->tail_level;
+        gpu_textures[i].atlas = pool->element;
+        gpu_textures[i].first_entry = texture->first_entry;
+        gpu_textures[i].columns = pool->columns;
+    }
+    const VkBufferCopy copy = {0, 0, upload.size};
+    vkCmdCopyBuffer(cmd, upload.buf, stream->gpu_textures.buf, 1, &copy);
+    vkCmdFillBuffer(cmd, stream->page_table.buf, 0, VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(cmd, stream->marks.buf, 0, VK_WHOLE_SIZE, 0);
+    flush_init_cmd(render);
+    destroy_buffer(render, &upload);
+
+    // Texels of the loads, then the values of their page table entries and
+    // those of the pages they evict. The workers write it in order, which
+    // device memory behind a large BAR takes as well as host memory.
+    texstream_create_buffer(render,
+                            TEXSTREAM_LOADS_MAX * stream->slot_bytes +
+                                2 * TEXSTREAM_LOADS_MAX * sizeof(uint32_t),
+                            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                                (render->upload_path == UPLOAD_REBAR
+                                     ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+                                     : 0),
+                            &stream->staging);
+
+    // Mip tails stay for good, so that every lookup finds some level
+    for (i = 0; i < stream->texture_count; i++) {
+        const bool ok = texstream_queue_load(
+            stream, i, stream->textures[i].tail_level, 0, 0, true);
+
+        assert(ok);
+        if (stream->load_count == TEXSTREAM_LOADS_MAX ||
+            i + 1 == stream->texture_count) {
+            task_parallel_for(render->tasks, stream->load_count,
+                              texstream_gather_task, stream);
+            texstream_upload(render, stream);
+        }
+    }
+    stream->bytes = 0;
+
+    if (stream->texture_count) {
+        printf("Streaming %u textures through %.1f MB of atlas, %u page table "
+               "entries\n",
+               stream->texture_count, atlas_bytes / (1024.0 * 1024.0),
+               stream->entry_count);
+        fflush(stdout);
+    }
+
+    // 2: the textures, 3: page table, 4: feedback, 5: marks
+    const VkDescriptorBufferInfo buffer_infos[4] = {
+        {stream->gpu_textures.buf, 0, VK_WHOLE_SIZE},
+        {stream->page_table.buf, 0, VK_WHOLE_SIZE},
+        {stream->feedback.buf, 0, VK_WHOLE_SIZE},
+        {stream->marks.buf, 0, VK_WHOLE_SIZE},
+    };
+    VkWriteDescriptorSet writes[4];
+    for (i = 0; i < 4; i++) {
+        memset(&writes[i], 0, sizeof(writes[i]));
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = table->set;
+        writes[i].dstBinding = 2 + i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    vkUpdateDescriptorSets(render->device, 4, writes, 0, NULL);
+}
+
+void texture_stream_record_begin(struct texture_stream *stream,
+                                 VkCommandBuffer cmd) {
+    if (stream->entry_count == 0)
+        return;
+
+    const VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdFillBuffer(cmd, stream->marks.buf, 0, VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(cmd, stream->feedback.buf, 0,
+                    sizeof(struct texstream_feedback), 0);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, NULL, 0, NULL);
+}
+
+void texture_stream_record_end(struct texture_stream *stream,
+                               VkCommandBuffer cmd) {
+    if (stream->entry_count == 0)
+        return;
+
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    };
+    const VkBufferCopy copy = {0, 0, stream->feedback.size};
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                         NULL, 0, NULL);
+    vkCmdCopyBuffer(cmd, stream->feedback.buf, stream->readback.buf, 1, &copy);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL,
+                         0, NULL);
+    stream->recorded = true;
+}
+
+// Marks the page of an entry and the resident pages of the levels above
+// it, which the tracer falls back to meanwhile, as used this frame. Returns
+// whether the page itself is resident.
+static bool texstream_touch(struct texture_stream *stream, uint32_t entry,
+                            uint32_t *texture_index, uint32_t *level,
+                            uint32_t *x, uint32_t *y) {
+    const struct texstream_texture *texture;
+    uint32_t pages_x, relative, l, slot;
+    bool resident;
+
+    *texture_index = texstream_find_texture(stream, entry);
+    texture = &stream->textures[*texture_index];
+    relative = entry - texture->first_entry;
+    *level = 0;
+    while (*level < texture->tail_level &&
+           texture->level_entries[*level + 1] <= relative)
+        (*level)++;
+    pages_x = texstream_pages(texstream_level_size(texture->ktx.width, *level));
+    *x = (relative - texture->level_entries[*level]) % pages_x;
+    *y = (relative - texture->level_entries[*level]) / pages_x;
+
+    slot = stream->entry_slots[entry];
+    resident = slot < TEXSTREAM_LOADING;
+    for (l = *level; l <= texture->tail_level; l++) {
+        const uint32_t lx = *x >> (l - *level), ly = *y >> (l - *level);
+        const uint32_t e =
+            texture->first_entry + texture->level_entries[l] +
+            ly * texstream_pages(texstream_level_size(texture->ktx.width, l)) +
+            lx;
+        struct texstream_pool *pool = &stream->pools[texture->pool];
+
+        slot = stream->entry_slots[e];
+        if (slot < TEXSTREAM_LOADING &&
+            pool->slot_used[slot] != TEXSTREAM_PINNED)
+            pool->slot_used[slot] = stream->frame;
+    }
+    return resident;
+}
+
+struct texstream_request {
+    uint32_t texture, level, x, y;
+};
+
+// Coarse levels first, they stand in for more of the finer ones
+static int texstream_compare_requests(const void *a, const void *b) {
+    const struct texstream_request *ra = a, *rb = b;
+
+    return ra->level != rb->level ? (ra->level < rb->level ? 1 : -1) : 0;
+}
+
+bool texture_stream_update(struct renderinfo *render,
+                           struct texture_stream *stream) {
+    const struct texstream_feedback *feedback = stream->readback.alloc.mapped;
+    const uint32_t *requests = (const uint32_t *)(feedback + 1);
+    struct texstream_request *missing;
+    uint32_t count, missing_count = 0, resident = 0, i;
+    bool uploaded = false;
+
+    if (stream->entry_count == 0)
+        return false;
+    stream->frame++;
+
+    // Gathered pages go up between frames, while the queue is idle
+    if (stream->gathering &&
+        __atomic_load_n(&stream->gather.pending, __ATOMIC_ACQUIRE) == 0) {
+        texstream_upload(render, stream);
+        stream->gathering = false;
+        uploaded = true;
+    }
+
+    if (stream->recorded) {
+        stream->recorded = false;
+        stream->lookups += feedback->lookups;
+        stream->hits += feedback->hits;
+        count = feedback->count;
+        if (count > TEXSTREAM_FEEDBACK_MAX) {
+            count = TEXSTREAM_FEEDBACK_MAX;
+            stream->overflows++;
+        }
+
+        missing = malloc((count ? count : 1) * sizeof(*missing));
+        assert(missing);
+        for (i = 0; i < count; i++) {
+            struct texstream_request *r = &missing[missing_count];
+
+            if (requests[i] >= stream->entry_count)
+                continue;
+            if (!texstream_touch(stream, requests[i], &r->texture, &r->level,
+                                 &r->x, &r->y) &&
+                stream->entry_slots[requests[i]] == TEXSTREAM_NO_SLOT)
+                missing_count++;
+        }
+
+        // One batch at a time, the next one is planned once it is up
+        if (!stream->gathering && missing_count > 0) {
+            qsort(missing, missing_count, sizeof(*missing),
+                  texstream_compare_requests);
+            for (i = 0; i < missing_count &&
+                        stream->load_count < TEXSTREAM_LOADS_MAX;
+                 i++) {
+                if (!texstream_queue_load(stream, missing[i].texture,
+                                          missing[i].level, missing[i].x,
+                                          missing[i].y, false))
+                    break;
+            }
+            if (stream->load_count > 0) {
+                stream->gather.pending = 0;
+                stream->gathering = true;
+                for (i = 0; i < stream->load_count; i++)
+                    task_spawn(render->tasks, &stream->gather,
+                               texstream_gather_task, stream, i);
+                // Without other workers nobody would take them
+                if (task_thread_count(render->tasks) == 1)
+                    task_wait(render->tasks, &stream->gather);
+            }
+        }
+        free(missing);
+    }
+
+    if (++stream->report_frames == TEXSTREAM_REPORT_FRAMES) {
+        for (i = 0; i < stream->pool_count; i++)
+            resident += stream->pools[i].resident;
+        if (stream->lookups > 0) {
+            printf("Texture streaming: %.1f%% of %llu lookups at the wanted "
+                   "level, %.2f MB per frame, %u pages resident",
+                   100.0 * stream->hits / stream->lookups,
+                   (unsigned long long)stream->lookups,
+                   stream->bytes / (1024.0 * 1024.0) / stream->report_frames,
+                   resident);
+            if (stream->overflows)
+                printf(", feedback overflowed in %u frames", stream->overflows);
+            printf("\n");
+            fflush(stdout);
+        }
+        stream->lookups = 0;
+        stream->hits = 0;
+        stream->bytes = 0;
+        stream->overflows = 0;
+        stream->report_frames = 0;
+    }
+    return uploaded;
+}
+
+void texture_stream_cleanup(struct renderinfo *render,
+                            struct texture_stream *stream) {
+    uint32_t i;
+
+    // The workers still copy out of the mappings
+    if (stream->gathering)
+        task_wait(render->tasks, &stream->gather);
+    for (i = 0; i < stream->texture_count; i++)
+        texfile_close_ktx2(&stream->textures[i].ktx);
+    for (i = 0; i < stream->pool_count; i++) {
+        free(stream->pools[i].slot_entries);
+        free(stream->pools[i].slot_used);
+    }
+    free(stream->textures);
+    free(stream->pools);
+    free(stream->entry_slots);
+    if (stream->gpu_textures.buf) {
+        destroy_buffer(render, &stream->gpu_textures);
+        destroy_buffer(render, &stream->page_table);
+        destroy_buffer(render, &stream->marks);
+        destroy_buffer(render, &stream->feedback);
+        destroy_buffer(render, &stream->readback);
+        destroy_buffer(render, &stream->staging);
+    }
+    memset(stream, 0, sizeof(*stream));
+}
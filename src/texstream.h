@@ -0,0 +1,129 @@
+#ifndef TEXSTREAM_H
+#define TEXSTREAM_H
+
+// Streamed textures, for scenes with more texture data than fits on the
+// device. Large KTX2 textures stay mapped and only the pages of their mip
+// levels that the tracer samples are copied to the device, into an atlas
+// per format that is an element of the texture table. A page table maps
+// every page of every level to its slot in the atlas, and the tracer falls
+// back to the coarsest level that is resident, down to the mip tail, which
+// always is.
+//
+// The tracer appends every page it wanted to sample to a feedback buffer,
+// once per frame each. After the frame the residency manager reads it
+// back, hands the missing pages to the task workers to be copied out of
+// the mapped files, and uploads them in a later frame once they are all
+// gathered, evicting pages no frame asked for lately when the atlas is
+// full. Only the interactive loop streams; the atlases are sized by a
+// fixed memory budget.
+
+#define TEXSTREAM_PAGE 128   // texels along each side of a page
+#define TEXSTREAM_BORDER 4   // texels around it repeated from its neighbours
+#define TEXSTREAM_SLOT (TEXSTREAM_PAGE + 2 * TEXSTREAM_BORDER)
+#define TEXSTREAM_FEEDBACK_MAX 4096 // pages reported per frame
+#define TEXSTREAM_LOADS_MAX 64      // pages gathered at a time
+#define TEXSTREAM_REPORT_FRAMES 120
+
+// Materials point at streamed textures with this bit set on their index
+#define TEXSTREAM_VIRTUAL_BIT 0x80000000u
+
+struct texture_table;
+struct texfile_ktx2;
+struct texstream_texture;
+struct texstream_pool;
+
+// Must match VirtualTexture in shaders/trace.comp (std430)
+struct texstream_gpu_texture {
+    uint32_t width, height; // of level 0
+    uint32_t tail_level;    // first level that fits in one page
+    uint32_t atlas;         // texture table element holding its pages
+    uint32_t first_entry;   // of level 0 in the page table
+    uint32_t columns;       // slots per atlas row
+    uint32_t pad[2];
+};
+
+// Header of the Feedback buffer in shaders/trace.comp
+struct texstream_feedback {
+    uint32_t lookups; // samples of streamed textures
+    uint32_t hits;    // at the level they wanted
+    uint32_t count;   // pages appended, may exceed TEXSTREAM_FEEDBACK_MAX
+    uint32_t pad;
+};
+
+// A gathered page, or a page table entry to clear
+struct texstream_load {
+    uint32_t texture;
+    uint32_t level;
+    uint32_t x, y;        // page in the level
+    uint32_t entry;
+    uint32_t slot;        // in the pool of the texture
+    VkDeviceSize offset;  // of its texels in the staging buffer
+};
+
+struct texture_stream {
+    VkDeviceSize budget; // bytes of atlas, 0: nothing is streamed
+
+    struct texstream_texture *textures;
+    uint32_t texture_count, texture_capacity;
+    struct texstream_pool *pools; // one per format
+    uint32_t pool_count;
+    uint32_t entry_count;         // of the page table
+    uint32_t *entry_slots;        // per entry, TEXSTREAM_NO_SLOT or the slot
+
+    struct gpu_buffer gpu_textures;
+    struct gpu_buffer page_table;
+    struct gpu_buffer marks;    // set by the tracer for pages it reported
+    struct gpu_buffer feedback;
+    struct gpu_buffer readback; // feedback of the last frame, host visible
+    struct gpu_buffer staging;  // texels of the loads, then entry values
+    VkDeviceSize slot_bytes;    // largest of any pool
+
+    // Pages the task workers copy into the staging buffer, uploaded once
+    // the counter drops to zero
+    struct task_counter gather;
+    struct texstream_load loads[TEXSTREAM_LOADS_MAX];
+    uint32_t load_count;
+    struct texstream_load evictions[TEXSTREAM_LOADS_MAX];
+    uint32_t eviction_count;
+    bool gathering;
+
+    bool recorded; // the tracer wrote feedback in the last frame
+    uint32_t frame;
+
+    // since the last report
+    uint64_t lookups, hits, bytes;
+    uint32_t report_frames, overflows;
+};
+
+void texture_stream_init(struct renderinfo *render,
+                         struct texture_stream *stream);
+
+// Takes over the mapping of ktx when it is large enough to stream, and
+// returns the index for materials, with TEXSTREAM_VIRTUAL_BIT set.
+// Returns SCENE_NO_TEXTURE when it is not streamed.
+uint32_t texture_stream_add(struct texture_stream *stream,
+                            struct texfile_ktx2 *ktx);
+
+// Creates the atlases and buffers for the textures added, loads their mip
+// tails and points bindings 2 to 5 of the texture table's set at them
+void texture_stream_prepare(struct renderinfo *render,
+                            struct texture_stream *stream,
+                            struct texture_table *table);
+
+// Around the tracer's dispatches in a frame: clears the feedback and then
+// copies it to where the host reads it
+void texture_stream_record_begin(struct texture_stream *stream,
+                                 VkCommandBuffer cmd);
+
+void texture_stream_record_end(struct texture_stream *stream,
+                               VkCommandBuffer cmd);
+
+// After the frame's fence. Returns true when pages were uploaded, which
+// changes what the tracer samples.
+bool texture_stream_update(struct renderinfo *render,
+                           struct texture_stream *stream);
+
+void texture_stream_cleanup(struct renderinfo *render,
+                            struct texture_stream *stream);
+
+#endif
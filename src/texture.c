@@ -0,0 +1,724 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "task.h"
+#include "bcn.h"
+#include "texfile.h"
+#include "texstream.h"
+
+static uint32_t texture_mip_levels(uint32_t width, uint32_t height) {
+    uint32_t size = width > height ? width : height, levels = 1;
+
+    while (size > 1) {
+        size >>= 1;
+        levels++;
+    }
+    return levels;
+}
+
+static const char *const upload_path_names[] = {
+    [UPLOAD_HOST_IMAGE_COPY] = "host image copy",
+    [UPLOAD_REBAR] = "staging in device-local host-visible memory",
+    [UPLOAD_STAGING] = "staging in host memory",
+};
+
+// Room for size bytes in the staging ring, at *offset in the buffer
+// returned. Copies out of the ring are recorded into the setup command
+// buffer and submitted together once it is full or the last texture is
+// in. Textures larger than the whole ring get a buffer of their own, which
+// texture_staging_done submits and releases.
+static const struct gpu_buffer *texture_staging(struct renderinfo *render,
+                                                struct texture_table *table,
+                                                VkDeviceSize size,
+                                                VkDeviceSize *offset) {
+    VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    // The copy engine reads it from device memory then, and the host
+    // writes cross the bus once
+    if (render->upload_path == UPLOAD_REBAR)
+        props |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    table->staged_bytes += size;
+    if (size > TEXTURE_STAGING_SIZE) {
+        create_buffer(render, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, props,
+                      &table->oversized);
+        *offset = 0;
+        return &table->oversized;
+    }
+
+    if (table->staging.buf == VK_NULL_HANDLE)
+        create_buffer(render, TEXTURE_STAGING_SIZE,
+                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT, props, &table->staging);
+    // Offsets of block compressed data must be multiples of the block
+    table->staging_head = (table->staging_head + 15) & ~(VkDeviceSize)15;
+    if (table->staging_head + size > TEXTURE_STAGING_SIZE) {
+        flush_init_cmd(render);
+        table->staging_head = 0;
+    }
+    *offset = table->staging_head;
+    table->staging_head += size;
+    return &table->staging;
+}
+
+static void texture_staging_done(struct renderinfo *render,
+                                 struct texture_table *table) {
+    if (table->oversized.buf == VK_NULL_HANDLE)
+        return;
+    flush_init_cmd(render);
+    destroy_buffer(render, &table->oversized);
+}
+
+// Uploads level 0 and blits it down the chain, each level from the one
+// above it. Blits of sRGB images filter in linear space.
+static void texture_upload(struct renderinfo *render,
+                           struct texture_table *table,
+                           struct gpu_image *image, const uint8_t *rgba8) {
+    const VkDeviceSize size = (VkDeviceSize)image->width * image->height * 4;
+    const struct gpu_buffer *staging;
+    VkCommandBuffer cmd;
+    VkDeviceSize offset;
+    VkImageMemoryBarrier barrier;
+    int32_t width = image->width, height = image->height;
+    uint32_t level;
+
+    staging = texture_staging(render, table, size, &offset);
+    memcpy((uint8_t *)staging->alloc.mapped + offset, rgba8, size);
+    table->uploaded_bytes += size;
+    // Staging may have flushed the setup command buffer to make room
+    cmd = get_setup_cmd(render);
+
+    memset(&barrier, 0, sizeof(barrier));
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image->image;
+    barrier.subresourceRange = (VkImageSubresourceRange){
+        VK_IMAGE_ASPECT_COLOR_BIT, 0, image->mip_levels, 0, 1};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+                         &barrier);
+
+    const VkBufferImageCopy region = {
+        .bufferOffset = offset,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {image->width, image->height, 1},
+    };
+    vkCmdCopyBufferToImage(cmd, staging->buf, image->image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    barrier.subresourceRange.levelCount = 1;
+    for (level = 1; level < image->mip_levels; level++) {
+        const int32_t next_width = width > 1 ? width / 2 : 1;
+        const int32_t next_height = height > 1 ? height / 2 : 1;
+
+        // The level above is written, it becomes the source
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.subresourceRange.baseMipLevel = level - 1;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0,
+                             NULL, 1, &barrier);
+
+        const VkImageBlit blit = {
+            .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1},
+            .srcOffsets = {{0, 0, 0}, {width, height, 1}},
+            .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+            .dstOffsets = {{0, 0, 0}, {next_width, next_height, 1}},
+        };
+        vkCmdBlitImage(cmd, image->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                       &blit, VK_FILTER_LINEAR);
+        width = next_width;
+        height = next_height;
+    }
+
+    // Every level but the last was a blit source
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = image->mip_levels - 1;
+    if (barrier.subresourceRange.levelCount > 0)
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+                             0, NULL, 1, &barrier);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.subresourceRange.baseMipLevel = image->mip_levels - 1;
+    barrier.subresourceRange.levelCount = 1;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0,
+                         NULL, 1, &barrier);
+
+    texture_staging_done(render, table);
+}
+
+// Uploads every level as it is stored, for formats that cannot be blitted
+static void texture_upload_levels(struct renderinfo *render,
+                                  struct texture_table *table,
+                                  struct gpu_image *image,
+                                  const uint8_t *const *levels,
+                                  const size_t *sizes) {
+    VkBufferImageCopy regions[TEXFILE_MAX_LEVELS];
+    VkCommandBuffer cmd;
+    const struct gpu_buffer *staging;
+    VkImageMemoryBarrier barrier;
+    VkDeviceSize size = 0, offset;
+    uint32_t level;
+
+    assert(image->mip_levels <= TEXFILE_MAX_LEVELS);
+    for (level = 0; level < image->mip_levels; level++) {
+        // Offsets of block compressed data must be multiples of the block
+        size = (size + 15) & ~(VkDeviceSize)15;
+        regions[level] = (VkBufferImageCopy){
+            .bufferOffset = size,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {image->width >> level ? image->width >> level : 1,
+                            image->height >> level ? image->height >> level
+                                                   : 1,
+                            1},
+        };
+        size += sizes[level];
+        table->uploaded_bytes += sizes[level];
+    }
+    staging = texture_staging(render, table, size, &offset);
+    for (level = 0; level < image->mip_levels; level++) {
+        regions[level].bufferOffset += offset;
+        memcpy((uint8_t *)staging->alloc.mapped + regions[level].bufferOffset,
+               levels[level], sizes[level]);
+    }
+    cmd = get_setup_cmd(render);
+
+    memset(&barrier, 0, sizeof(barrier));
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image->image;
+    barrier.subresourceRange = (VkImageSubresourceRange){
+        VK_IMAGE_ASPECT_COLOR_BIT, 0, image->mip_levels, 0, 1};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+                         &barrier);
+    vkCmdCopyBufferToImage(cmd, staging->buf, image->image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           image->mip_levels, regions);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0,
+                         NULL, 1, &barrier);
+
+    texture_staging_done(render, table);
+}
+
+// Writes every level straight from where it is, the mapped file, into the
+// image on the host, which the device has not seen yet. Nothing is staged
+// and nothing is submitted.
+static void texture_copy_levels(struct renderinfo *render,
+                                struct texture_table *table,
+                                struct gpu_image *image,
+                                const uint8_t *const *levels,
+                                const size_t *sizes) {
+    VkMemoryToImageCopyEXT regions[TEXFILE_MAX_LEVELS];
+    VkResult err;
+    uint32_t level;
+
+    assert(image->mip_levels <= TEXFILE_MAX_LEVELS);
+    const VkHostImageLayoutTransitionInfoEXT transition = {
+        .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT,
+        .pNext = NULL,
+        .image = image->image,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, image->mip_levels,
+                             0, 1},
+    };
+    err = vkTransitionImageLayoutEXT(render->device, 1, &transition);
+    assert(!err);
+
+    for (level = 0; level < image->mip_levels; level++) {
+        regions[level] = (VkMemoryToImageCopyEXT){
+            .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT,
+            .pNext = NULL,
+            .pHostPointer = levels[level],
+            .memoryRowLength = 0,
+            .memoryImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {image->width >> level ? image->width >> level : 1,
+                            image->height >> level ? image->height >> level
+                                                   : 1,
+                            1},
+        };
+        table->uploaded_bytes += sizes[level];
+    }
+    const VkCopyMemoryToImageInfoEXT copy_info = {
+        .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT,
+        .pNext = NULL,
+        .flags = 0,
+        .dstImage = image->image,
+        .dstImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .regionCount = image->mip_levels,
+        .pRegions = regions,
+    };
+    err = vkCopyMemoryToImageEXT(render->device, &copy_info);
+    assert(!err);
+}
+
+// Whether images of format can be written by host image copy without
+// making them slower for the tracer to sample
+static bool texture_host_copy_supported(struct renderinfo *render,
+                                        VkFormat format,
+                                        VkImageUsageFlags usage) {
+    VkFormatProperties3 props3 = {
+        .sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3,
+        .pNext = NULL,
+    };
+    VkFormatProperties2 props2 = {
+        .sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2,
+        .pNext = &props3,
+    };
+
+    if (render->upload_path != UPLOAD_HOST_IMAGE_COPY)
+        return false;
+    vkGetPhysicalDeviceFormatProperties2(render->gpu, format, &props2);
+    if (!(props3.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT))
+        return false;
+
+    const VkPhysicalDeviceImageFormatInfo2 format_info = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2,
+        .pNext = NULL,
+        .format = format,
+        .type = VK_IMAGE_TYPE_2D,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT,
+        .flags = 0,
+    };
+    VkHostImageCopyDevicePerformanceQueryEXT performance = {
+        .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT,
+        .pNext = NULL,
+    };
+    VkImageFormatProperties2 image_props = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2,
+        .pNext = &performance,
+    };
+    return vkGetPhysicalDeviceImageFormatProperties2(
+               render->gpu, &format_info, &image_props) == VK_SUCCESS &&
+           performance.optimalDeviceAccess;
+}
+
+// Whether images of format can be filtered by the tracer's sampler and
+// filled by copies
+static bool texture_format_supported(struct renderinfo *render,
+                                     VkFormat format) {
+    const VkFormatFeatureFlags needed =
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+        VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+    VkFormatProperties props;
+
+    vkGetPhysicalDeviceFormatProperties(render->gpu, format, &props);
+    return (props.optimalTilingFeatures & needed) == needed;
+}
+
+static bool texture_bcn_format(VkFormat format, enum bcn_format *bcn,
+                               bool *srgb) {
+    *srgb = false;
+    switch (format) {
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        *srgb = true;
+        /* fallthrough */
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        *bcn = BCN_BC1;
+        return true;
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+        *srgb = true;
+        /* fallthrough */
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+        *bcn = BCN_BC3;
+        return true;
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+        *bcn = BCN_BC5;
+        return true;
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        *srgb = true;
+        /* fallthrough */
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+        *bcn = BCN_BC7;
+        return true;
+    default:
+        return false;
+    }
+}
+
+void texture_table_init(struct renderinfo *render, struct texture_table *table) {
+    const uint8_t white[4] = {255, 255, 255, 255};
+    VkResult err;
+
+    memset(table, 0, sizeof(*table));
+    table->capacity = render->max_bindless_images < TEXTURE_TABLE_MAX
+                          ? render->max_bindless_images
+                          : TEXTURE_TABLE_MAX;
+    table->images = calloc(table->capacity, sizeof(struct gpu_image));
+    table->stream = calloc(1, sizeof(struct texture_stream));
+    assert(table->images && table->stream);
+    texture_stream_init(render, table->stream);
+
+    const VkSamplerCreateInfo sampler_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .pNext = NULL,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .mipLodBias = 0.0f,
+        .anisotropyEnable = VK_FALSE,
+        .maxAnisotropy = 1,
+        .compareOp = VK_COMPARE_OP_NEVER,
+        .minLod = 0.0f,
+        .maxLod = VK_LOD_CLAMP_NONE,
+        .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+        .unnormalizedCoordinates = VK_FALSE,
+    };
+    err = vkCreateSampler(render->device, &sampler_info, NULL, &table->sampler);
+    assert(!err);
+
+    // 0: the sampler, baked into the layout, 1: the textures, 2 to 5: the
+    // buffers of streamed textures
+    const VkDescriptorSetLayoutBinding bindings[6] = {
+        {
+         .binding = 0,
+         .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+         .descriptorCount = 1,
+         .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+         .pImmutableSamplers = &table->sampler,
+        },
+        {
+         .binding = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+         .descriptorCount = table->capacity,
+         .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+         .pImmutableSamplers = NULL,
+        },
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT,
+         NULL},
+        {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT,
+         NULL},
+        {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT,
+         NULL},
+        {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT,
+         NULL},
+    };
+    // Elements that frames in flight do not read may be written while they
+    // run if the device allows it, otherwise only between submits
+    const VkDescriptorBindingFlags binding_flags[6] = {
+        0,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            (render->update_unused_while_pending
+                 ? VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
+                 : 0),
+        0, 0, 0, 0,
+    };
+    const VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .pNext = NULL,
+        .bindingCount = 6,
+        .pBindingFlags = binding_flags,
+    };
+    const VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &flags_info,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 6,
+        .pBindings = bindings,
+    };
+    err = vkCreateDescriptorSetLayout(render->device, &layout_info, NULL,
+                                      &table->layout);
+    assert(!err);
+
+    const VkDescriptorPoolSize type_counts[3] = {
+        {VK_DESCRIPTOR_TYPE_SAMPLER, 1},
+        {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, table->capacity},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+    };
+    const VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 3,
+        .pPoolSizes = type_counts,
+    };
+    err = vkCreateDescriptorPool(render->device, &pool_info, NULL, &table->pool);
+    assert(!err);
+
+    const VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = NULL,
+        .descriptorPool = table->pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &table->layout,
+    };
+    err = vkAllocateDescriptorSets(render->device, &alloc_info, &table->set);
+    assert(!err);
+
+    create_image(render, VK_FORMAT_R8G8B8A8_SRGB, 1, 1,
+                 VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                 &table->fallback);
+    texture_upload(render, table, &table->fallback, white);
+}
+
+// Only this element changes, the set stays bound wherever it is
+static void texture_table_write(struct renderinfo *render,
+                                struct texture_table *table, uint32_t index,
+                                const struct gpu_image *image) {
+    const VkDescriptorImageInfo image_info = {
+        .sampler = VK_NULL_HANDLE,
+        .imageView = image->view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    const VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .pNext = NULL,
+        .dstSet = table->set,
+        .dstBinding = 1,
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .pImageInfo = &image_info,
+    };
+    vkUpdateDescriptorSets(render->device, 1, &write, 0, NULL);
+    table->count++;
+}
+
+uint32_t texture_table_add(struct renderinfo *render,
+                           struct texture_table *table, VkFormat format,
+                           uint32_t width, uint32_t height,
+                           const uint8_t *rgba8) {
+    const uint32_t index = table->count;
+    const struct gpu_image *image = &table->fallback;
+
+    if (index == table->capacity)
+        return SCENE_NO_TEXTURE;
+    if (rgba8) {
+        create_image_mips(render, format, width, height,
+                          texture_mip_levels(width, height),
+                          VK_IMAGE_USAGE_SAMPLED_BIT |
+                              VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                              VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                          &table->images[index]);
+        texture_upload(render, table, &table->images[index], rgba8);
+        image = &table->images[index];
+    }
+    texture_table_write(render, table, index, image);
+    return index;
+}
+
+uint32_t texture_table_add_levels(struct renderinfo *render,
+                                  struct texture_table *table, VkFormat format,
+                                  uint32_t width, uint32_t height,
+                                  uint32_t level_count,
+                                  const uint8_t *const *levels,
+                                  const size_t *sizes) {
+    const uint32_t index = table->count;
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+    bool host_copy;
+
+    if (index == table->capacity)
+        return SCENE_NO_TEXTURE;
+    host_copy = texture_host_copy_supported(render, format, usage);
+    usage |= host_copy ? VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT
+                       : VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    create_image_mips(render, format, width, height, level_count, usage,
+                      &table->images[index]);
+    if (host_copy)
+        texture_copy_levels(render, table, &table->images[index], levels,
+                            sizes);
+    else
+        texture_upload_levels(render, table, &table->images[index], levels,
+                              sizes);
+    texture_table_write(render, table, index, &table->images[index]);
+    return index;
+}
+
+uint32_t texture_table_add_empty(struct renderinfo *render,
+                                 struct texture_table *table, VkFormat format,
+                                 uint32_t width, uint32_t height) {
+    const uint32_t index = table->count;
+    VkImageMemoryBarrier barrier;
+
+    if (index == table->capacity)
+        return SCENE_NO_TEXTURE;
+    create_image(render, format, width, height,
+                 VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                 &table->images[index]);
+
+    memset(&barrier, 0, sizeof(barrier));
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = table->images[index].image;
+    barrier.subresourceRange =
+        (VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(get_setup_cmd(render),
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0,
+                         NULL, 1, &barrier);
+    flush_init_cmd(render);
+
+    texture_table_write(render, table, index, &table->images[index]);
+    return index;
+}
+
+// KTX2 files go to the GPU as they are stored when the device samples their
+// format. Block compressed ones it cannot sample are decoded here, and like
+// rgba8 files without a mip chain get theirs generated on the GPU.
+static uint32_t texture_table_load_ktx2(struct renderinfo *render,
+                                        struct texture_table *table,
+                                        const char *path) {
+    struct texfile_ktx2 ktx;
+    enum bcn_format bcn;
+    uint8_t *pixels;
+    uint32_t index;
+    bool srgb;
+
+    if (!texfile_open_ktx2(path, &ktx))
+        return texture_table_add(render, table, VK_FORMAT_R8G8B8A8_SRGB, 0, 0,
+                                 NULL);
+
+    // Streamed textures keep the file mapped, the stream closes it
+    if (texture_format_supported(render, ktx.format)) {
+        index = texture_stream_add(table->stream, &ktx);
+        if (index != SCENE_NO_TEXTURE)
+            return index;
+    }
+
+    if (texture_bcn_format(ktx.format, &bcn, &srgb)) {
+        if (texture_format_supported(render, ktx.format)) {
+            index = texture_table_add_levels(render, table, ktx.format,
+                                             ktx.width, ktx.height,
+                                             ktx.level_count, ktx.levels,
+                                             ktx.level_sizes);
+        } else {
+            printf("%s: format %d is not sampled by this device, decoding\n",
+                   path, ktx.format);
+            pixels = malloc((size_t)ktx.width * ktx.height * 4);
+            assert(pixels);
+            bcn_decode(bcn, ktx.levels[0], ktx.width, ktx.height, pixels);
+            index = texture_table_add(render, table,
+                                      srgb ? VK_FORMAT_R8G8B8A8_SRGB
+                                           : VK_FORMAT_R8G8B8A8_UNORM,
+                                      ktx.width, ktx.height, pixels);
+            free(pixels);
+        }
+    } else if (ktx.level_count == 1) {
+        index = texture_table_add(render, table, ktx.format, ktx.width,
+                                  ktx.height, ktx.levels[0]);
+    } else {
+        index = texture_table_add_levels(render, table, ktx.format, ktx.width,
+                                         ktx.height, ktx.level_count,
+                                         ktx.levels, ktx.level_sizes);
+    }
+    texfile_close_ktx2(&ktx);
+    return index;
+}
+
+uint32_t texture_table_load(struct renderinfo *render,
+                            struct texture_table *table, const char *path) {
+    const char *dot = strrchr(path, '.');
+    uint8_t *pixels = NULL;
+    uint32_t width = 0, height = 0, index;
+
+    if (dot && strcmp(dot, ".ktx2") == 0)
+        return texture_table_load_ktx2(render, table, path);
+
+    if (!texfile_load_ppm(path, &width, &height, &pixels))
+        pixels = NULL;
+    index = texture_table_add(render, table, VK_FORMAT_R8G8B8A8_SRGB, width,
+                              height, pixels);
+    free(pixels);
+    return index;
+}
+
+void texture_table_finish(struct renderinfo *render,
+                          struct texture_table *table) {
+    // What is still staged goes up with the first pages of the stream
+    texture_stream_prepare(render, table->stream, table);
+    flush_init_cmd(render);
+    table->staging_head = 0;
+    if (table->count > 1) {
+        printf("Uploaded %u textures, %.1f MB through %s, %.1f MB staged\n",
+               table->count, table->uploaded_bytes / (1024.0 * 1024.0),
+               upload_path_names[render->upload_path],
+               table->staged_bytes / (1024.0 * 1024.0));
+        fflush(stdout);
+    }
+}
+
+void texture_table_cleanup(struct renderinfo *render,
+                           struct texture_table *table) {
+    uint32_t i;
+
+    if (table->layout == VK_NULL_HANDLE)
+        return;
+    texture_stream_cleanup(render, table->stream);
+    free(table->stream);
+    destroy_buffer(render, &table->staging);
+    for (i = 0; i < table->count; i++)
+        destroy_image(render, &table->images[i]);
+    free(table->images);
+    destroy_image(render, &table->fallback);
+    vkDestroyDescriptorPool(render->device, table->pool, NULL);
+    vkDestroyDescriptorSetLayout(render->device, table->layout, NULL);
+    vkDestroySampler(render->device, table->sampler, NULL);
+    memset(table, 0, sizeof(*table));
+}
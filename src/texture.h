@@ -0,0 +1,75 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+// Bindless texture table of a scene. Every texture is an element of one
+// descriptor array in set 1 of the tracer's pipeline layout, the materials
+// hold indices into it and the shader picks the element per hit. The array
+// is partially bound and updated after bind, so textures are added while
+// the set is in use and nothing is rebuilt; elements that were never
+// written are never indexed.
+
+#define TEXTURE_TABLE_MAX 16384
+#define TEXTURE_STAGING_SIZE (32ull * 1024 * 1024)
+
+struct texture_table {
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+    VkSampler sampler;   // shared by every element
+    uint32_t capacity;   // elements in the array
+    struct gpu_image *images;
+    uint32_t count;      // elements written so far
+    struct gpu_image fallback; // 1x1 white, for textures that did not load
+    struct texture_stream *stream; // large KTX2 textures, see texstream.h
+
+    // Uploads that are not host image copies go through a ring that is
+    // only submitted when full, see render->upload_path
+    struct gpu_buffer staging;
+    VkDeviceSize staging_head;
+    struct gpu_buffer oversized; // a texture larger than the ring
+    uint64_t uploaded_bytes, staged_bytes;
+};
+
+void texture_table_init(struct renderinfo *render, struct texture_table *table);
+
+// Uploads width x height rgba8 pixels of an R8G8B8A8 format into the next
+// element and generates its mip chain on the GPU, or points it at the
+// fallback when rgba8 is NULL. Returns the element, SCENE_NO_TEXTURE once
+// the table is full.
+uint32_t texture_table_add(struct renderinfo *render,
+                           struct texture_table *table, VkFormat format,
+                           uint32_t width, uint32_t height,
+                           const uint8_t *rgba8);
+
+// Uploads a whole mip chain as it is stored, level 0 first, in a format the
+// device samples; block compressed formats cannot be blitted
+uint32_t texture_table_add_levels(struct renderinfo *render,
+                                  struct texture_table *table, VkFormat format,
+                                  uint32_t width, uint32_t height,
+                                  uint32_t level_count,
+                                  const uint8_t *const *levels,
+                                  const size_t *sizes);
+
+// Creates a width x height image of format with one level in the next
+// element, in the layout the tracer samples it in, for the caller to fill
+// with copies
+uint32_t texture_table_add_empty(struct renderinfo *render,
+                                 struct texture_table *table, VkFormat format,
+                                 uint32_t width, uint32_t height);
+
+// Adds a .ktx2 or PPM file, see texfile.h, the fallback when it does not
+// load. BCn formats the device cannot sample are decoded to rgba8. With a
+// texture memory budget, large KTX2 files with a mip chain are streamed
+// and the index returned has TEXSTREAM_VIRTUAL_BIT set.
+uint32_t texture_table_load(struct renderinfo *render,
+                            struct texture_table *table, const char *path);
+
+// After the last texture is loaded: sets up streaming of those that are,
+// submits what is still staged and reports the uploads
+void texture_table_finish(struct renderinfo *render,
+                          struct texture_table *table);
+
+void texture_table_cleanup(struct renderinfo *render,
+                           struct texture_table *table);
+
+#endif
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "tracer.h"
+#include "cmdpool.h"
+#include "image_writer.h"
+#include "tiler.h"
+
+uint32_t tiler_pick_tile_size(struct renderinfo *render) {
+    const VkPhysicalDeviceLimits *limits = &render->gpu_props.limits;
+    VkDeviceSize heap = 0;
+    uint32_t size, limit;
+    uint32_t i;
+
+    size = limits->maxImageDimension2D;
+
+    // The trace pass runs one workgroup per tracer tile in a 1D dispatch
+    limit = (uint32_t)sqrt((double)limits->maxComputeWorkGroupCount[0]) *
+            TRACE_TILE_SIZE;
+    if (limit < size)
+        size = limit;
+
+    for (i = 0; i < render->memory_properties.memoryHeapCount; i++) {
+        const VkMemoryHeap *h = &render->memory_properties.memoryHeaps[i];
+        if ((h->flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && h->size > heap)
+            heap = h->size;
+    }
+    limit = (uint32_t)sqrt((double)(heap / TILER_MEMORY_FRACTION) /
+                           TILER_BYTES_PER_PIXEL);
+    if (limit < size)
+        size = limit;
+
+    size -= size % TRACE_TILE_SIZE;
+    assert(size > 2 * TILER_GUARD_BAND);
+    return size - 2 * TILER_GUARD_BAND;
+}
+
+static void tiler_prepare_slots(struct renderinfo *render,
+                                struct tilerinfo *tiler) {
+    const VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+    };
+    const VkQueryPoolCreateInfo query_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2 * TILER_SLOTS,
+    };
+    uint32_t i;
+    VkResult err;
+
+    for (i = 0; i < TILER_SLOTS; i++) {
+        struct tiler_slot *slot = &tiler->slots[i];
+
+        cmd_frame_init(render, &slot->frame);
+        err = vkCreateFence(render->device, &fence_info, NULL, &slot->fence);
+        assert(!err);
+        create_buffer(render,
+                      (VkDeviceSize)tiler->tile_size * tiler->tile_size * 4,
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      &slot->readback);
+        slot->busy = false;
+    }
+
+    slice_budget_init(render, &tiler->budget);
+    if (render->timestamps) {
+        err = vkCreateQueryPool(render->device, &query_info, NULL,
+                                &tiler->timestamps);
+        assert(!err);
+    }
+}
+
+static void tiler_cleanup_slots(struct renderinfo *render,
+                                struct tilerinfo *tiler) {
+    uint32_t i;
+
+    for (i = 0; i < TILER_SLOTS; i++) {
+        struct tiler_slot *slot = &tiler->slots[i];
+
+        cmd_frame_cleanup(render, &slot->frame);
+        vkDestroyFence(render->device, slot->fence, NULL);
+        destroy_buffer(render, &slot->readback);
+    }
+    if (tiler->timestamps)
+        vkDestroyQueryPool(render->device, tiler->timestamps, NULL);
+}
+
+// Waits for the slot's submit, feeds its GPU time into the slice budget and
+// streams a finished tile to the file
+static bool tiler_retire_slot(struct renderinfo *render,
+                              struct tilerinfo *tiler, struct tiler_slot *slot) {
+    const uint32_t query = 2 * (uint32_t)(slot - tiler->slots);
+    uint64_t ticks[2];
+    VkResult err;
+
+    if (!slot->busy)
+        return true;
+    slot->busy = false;
+
+    err = vkWaitForFences(render->device, 1, &slot->fence, VK_TRUE, UINT64_MAX);
+    assert(!err);
+    err = vkResetFences(render->device, 1, &slot->fence);
+    assert(!err);
+
+    if (tiler->timestamps &&
+        vkGetQueryPoolResults(render->device, tiler->timestamps, query, 2,
+                              sizeof(ticks), ticks, sizeof(ticks[0]),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+        slice_budget_update(&tiler->budget, slot->tiles,
+                            timestamp_delta_ms(render, ticks));
+
+    if (!slot->has_tile)
+        return true;
+    return image_writer_write_region(&tiler->writer, slot->x, slot->y,
+                                     slot->width, slot->height,
+                                     slot->readback.alloc.mapped,
+                                     (size_t)slot->width * 4);
+}
+
+// Records the next slices of the current tile, as many as fit in the slice
+// budget, and the readback once its last pass is in. Returns true when the
+// tile is complete.
+static bool tiler_record_slices(struct renderinfo *render,
+                                struct tracerinfo *tracer,
+                                struct tilerinfo *tiler,
+                                struct tiler_slot *slot) {
+    const uint32_t query = 2 * (uint32_t)(slot - tiler->slots);
+    const VkCommandBuffer cmd = cmd_frame_begin(render, &slot->frame);
+    uint64_t remaining;
+    uint32_t budget;
+
+    if (tiler->timestamps) {
+        vkCmdResetQueryPool(cmd, tiler->timestamps, query, 2);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            tiler->timestamps, query);
+    }
+
+    // Without readback of the tile list every pass counts as a full one, the
+    // groups beyond its end exit at once
+    remaining = (uint64_t)(tiler->passes - tracer->sample_count) *
+                    tracer->tile_count -
+                tracer->slice_offset;
+    budget = slice_budget_tiles(&tiler->budget, remaining > UINT32_MAX
+                                                    ? UINT32_MAX
+                                                    : (uint32_t)remaining);
+    slot->tiles = tracer_record_slices(render, tracer, &slot->frame, budget,
+                                       tiler->passes);
+
+    slot->has_tile = tracer->sample_count == tiler->passes;
+    if (slot->has_tile) {
+        const VkMemoryBarrier copy_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                             &copy_barrier, 0, NULL, 0, NULL);
+
+        // Only the interior goes back to the host, the guard band is dropped
+        const VkBufferImageCopy region = {
+            .bufferOffset = 0,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            .imageOffset = {TILER_GUARD_BAND, TILER_GUARD_BAND, 0},
+            .imageExtent = {slot->width, slot->height, 1},
+        };
+        vkCmdCopyImageToBuffer(cmd, tracer->output.image,
+                               VK_IMAGE_LAYOUT_GENERAL, slot->readback.buf, 1,
+                               &region);
+
+        const VkMemoryBarrier host_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier,
+                             0, NULL, 0, NULL);
+    }
+
+    if (tiler->timestamps)
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            tiler->timestamps, query + 1);
+
+    cmd_frame_end(&slot->frame);
+    return slot->has_tile;
+}
+
+bool tiler_render(struct renderinfo *render, struct tracerinfo *tracer,
+                  const char *path, uint32_t width, uint32_t height) {
+    struct tilerinfo tiler;
+    enum image_format format;
+    uint32_t tile, tile_count, submits, i;
+    bool tile_started = false;
+    bool ok = true;
+    VkResult err;
+
+    memset(&tiler, 0, sizeof(tiler));
+    tiler.width = width;
+    tiler.height = height;
+    tiler.tile_size = tiler_pick_tile_size(render);
+    // No point in tiles larger than the image itself
+    i = (width > height ? width : height) + TRACE_TILE_SIZE - 1;
+    i -= i % TRACE_TILE_SIZE;
+    if (i < tiler.tile_size)
+        tiler.tile_size = i;
+    tiler.tiles_x = (width + tiler.tile_size - 1) / tiler.tile_size;
+    tiler.tiles_y = (height + tiler.tile_size - 1) / tiler.tile_size;
+    tiler.passes = render->spp_target ? render->spp_target : TILER_DEFAULT_SPP;
+    tile_count = tiler.tiles_x * tiler.tiles_y;
+
+    // Tiled images need not fit in memory, only PPM streams by region
+    if (!image_format_from_path(path, &format) || format != IMAGE_FORMAT_PPM) {
+        fprintf(stderr, "Tiled output is written as PPM, not to %s\n", path);
+        return false;
+    }
+    if (!image_writer_open(&tiler.writer, path, width, height)) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        return false;
+    }
+
+    tracer_resize(render, tracer, tiler.tile_size + 2 * TILER_GUARD_BAND,
+                  tiler.tile_size + 2 * TILER_GUARD_BAND);
+    tracer->view_width = width;
+    tracer->view_height = height;
+    tiler_prepare_slots(render, &tiler);
+
+    printf("Rendering %ux%u in %u tiles of %ux%u (%u passes each)\n", width,
+           height, tile_count, tiler.tile_size, tiler.tile_size, tiler.passes);
+    fflush(stdout);
+
+    // Submits alternate between the slots, while the GPU works on one the
+    // other is retired and, if it finished a tile, written out
+    tile = 0;
+    for (submits = 0; tile < tile_count && ok; submits++) {
+        struct tiler_slot *slot = &tiler.slots[submits % TILER_SLOTS];
+
+        ok = tiler_retire_slot(render, &tiler, slot);
+
+        if (!tile_started) {
+            tracer_reset(tracer);
+            tile_started = true;
+        }
+        slot->x = (tile % tiler.tiles_x) * tiler.tile_size;
+        slot->y = (tile / tiler.tiles_x) * tiler.tile_size;
+        slot->width = width - slot->x < tiler.tile_size ? width - slot->x
+                                                         : tiler.tile_size;
+        slot->height = height - slot->y < tiler.tile_size ? height - slot->y
+                                                           : tiler.tile_size;
+        tracer->view_x = (int32_t)slot->x - TILER_GUARD_BAND;
+        tracer->view_y = (int32_t)slot->y - TILER_GUARD_BAND;
+
+        if (tiler_record_slices(render, tracer, &tiler, slot)) {
+            tile++;
+            tile_started = false;
+            printf("\rTile %u/%u", tile, tile_count);
+            fflush(stdout);
+        }
+
+        const VkSubmitInfo submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = NULL,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &slot->frame.cmd,
+        };
+        err = vkQueueSubmit(render->queue, 1, &submit_info, slot->fence);
+        assert(!err);
+        slot->busy = true;
+    }
+    printf("\n");
+
+    for (i = 0; i < TILER_SLOTS; i++) {
+        struct tiler_slot *slot = &tiler.slots[(submits + i) % TILER_SLOTS];
+        if (!tiler_retire_slot(render, &tiler, slot))
+            ok = false;
+    }
+
+    if (tiler.budget.budget_ms > 0.0f)
+        printf("%u submits, %.4f ms of GPU time per tile list entry\n",
+               submits, tiler.budget.ms_per_tile);
+    tiler_cleanup_slots(render, &tiler);
+    if (!image_writer_close(&tiler.writer))
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Failed writing %s\n", path);
+    return ok;
+}
@@ -0,0 +1,47 @@
+#ifndef TILER_H
+#define TILER_H
+
+// Offline renders of images larger than the device can hold at once. The
+// output is split into tiles that each get a guard band of extra pixels for
+// reconstruction filters, every tile is traced to completion in the
+// tracer's storage images and its interior is read back and streamed to the
+// output file while the next tile renders. The passes of a tile are spread
+// over as many submits as the slice budget asks for.
+
+#define TILER_SLOTS 2
+// One tracer tile, keeps the tracer's tile grid aligned with the output
+#define TILER_GUARD_BAND TRACE_TILE_SIZE
+// Samples per pixel when neither --spp nor --noise bounds the render
+#define TILER_DEFAULT_SPP 64
+// Part of the largest device-local heap a tile may use
+#define TILER_MEMORY_FRACTION 4
+// accum, output, variance and heatmap texels plus one readback per slot
+#define TILER_BYTES_PER_PIXEL (16 + 4 + 4 + 4 + TILER_SLOTS * 4)
+
+struct tiler_slot {
+    struct cmd_frame frame;
+    VkFence fence;
+    struct gpu_buffer readback;
+    bool busy;
+    bool has_tile;  // the submit finishes a tile and reads it back
+    uint32_t tiles; // tile list entries recorded, for the slice budget
+    uint32_t x, y, width, height; // region of the output image
+};
+
+struct tilerinfo {
+    uint32_t width, height; // of the output image
+    uint32_t tile_size;     // interior of a tile, without the guard band
+    uint32_t tiles_x, tiles_y;
+    uint32_t passes;        // accumulation passes per tile
+    struct tiler_slot slots[TILER_SLOTS];
+    VkQueryPool timestamps; // two per slot
+    struct slice_budget budget;
+    struct image_writer writer;
+};
+
+uint32_t tiler_pick_tile_size(struct renderinfo *render);
+
+bool tiler_render(struct renderinfo *render, struct tracerinfo *tracer,
+                  const char *path, uint32_t width, uint32_t height);
+
+#endif
@@ -0,0 +1,1111 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define GLAD_VULKAN_IMPLEMENTATION
+#include "lib/glad-vulkan1.4/include/glad/vulkan.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "window.h"
+#include "memalloc.h"
+#include "render.h"
+#include "accel.h"
+#include "bvh.h"
+#include "texture.h"
+#include "scene.h"
+#include "tracer.h"
+#include "task.h"
+#include "cmdpool.h"
+#include "texstream.h"
+
+#include "trace_comp.h"
+#include "trace_rq_comp.h"
+#include "tile_compact_comp.h"
+
+#define TRACE_COMPACT_GROUP_SIZE 64
+// Below this many samples the noise estimate is too unreliable to stop on
+#define TRACE_MIN_SAMPLES 8
+
+const char *const trace_aov_names[TRACE_AOV_COUNT] = {
+    [TRACE_AOV_DEPTH] = "depth",
+    [TRACE_AOV_NORMAL] = "normal",
+    [TRACE_AOV_ALBEDO] = "albedo",
+    [TRACE_AOV_INSTANCE] = "id",
+    [TRACE_AOV_MOTION] = "motion",
+};
+
+static const VkFormat aov_formats[TRACE_AOV_COUNT] = {
+    [TRACE_AOV_DEPTH] = VK_FORMAT_R32_SFLOAT,
+    [TRACE_AOV_NORMAL] = VK_FORMAT_R16G16B16A16_SFLOAT,
+    [TRACE_AOV_ALBEDO] = VK_FORMAT_R16G16B16A16_SFLOAT,
+    [TRACE_AOV_INSTANCE] = VK_FORMAT_R32_UINT,
+    [TRACE_AOV_MOTION] = VK_FORMAT_R16G16B16A16_SFLOAT,
+};
+
+void slice_budget_init(struct renderinfo *render, struct slice_budget *budget) {
+    budget->budget_ms = render->slice_budget_ms;
+    budget->ms_per_tile = 0.0f;
+    budget->tiles = SLICE_INITIAL_TILES;
+}
+
+uint32_t slice_budget_tiles(const struct slice_budget *budget,
+                            uint32_t max_tiles) {
+    if (budget->budget_ms <= 0.0f || budget->tiles >= max_tiles)
+        return max_tiles;
+    return budget->tiles;
+}
+
+void slice_budget_update(struct slice_budget *budget, uint32_t tiles,
+                         float ms) {
+    float fit;
+
+    if (budget->budget_ms <= 0.0f || tiles == 0)
+        return;
+
+    // Tiles differ in cost across the image, smooth over a few slices
+    if (budget->ms_per_tile == 0.0f)
+        budget->ms_per_tile = ms / (float)tiles;
+    else
+        budget->ms_per_tile = 0.5f * (budget->ms_per_tile + ms / (float)tiles);
+
+    // Grow carefully, the next slice may cover more expensive tiles
+    fit = (float)budget->tiles * SLICE_MAX_GROWTH;
+    if (budget->ms_per_tile > 0.0f &&
+        budget->budget_ms / budget->ms_per_tile < fit)
+        fit = budget->budget_ms / budget->ms_per_tile;
+    if (fit > (float)(UINT32_MAX / SLICE_MAX_GROWTH))
+        fit = (float)(UINT32_MAX / SLICE_MAX_GROWTH);
+    budget->tiles = fit < 1.0f ? 1 : (uint32_t)fit;
+}
+
+float timestamp_delta_ms(struct renderinfo *render, const uint64_t *ticks) {
+    return (float)((double)(ticks[1] - ticks[0]) * render->timestamp_period *
+                   1e-6);
+}
+
+static void tracer_prepare_descriptor_layout(struct renderinfo *render,
+                                             struct tracerinfo *tracer,
+                                             const struct scene *scene) {
+    VkDescriptorSetLayoutBinding bindings[22];
+    uint32_t binding_count = 0;
+    uint32_t i;
+    VkResult err;
+
+    memset(bindings, 0, sizeof(bindings));
+
+    // 0: accumulation, 1: output
+    for (i = 0; i < 2; i++) {
+        bindings[binding_count].binding = binding_count;
+        bindings[binding_count].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[binding_count].descriptorCount = 1;
+        bindings[binding_count].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        binding_count++;
+    }
+    // 2: vertices, 3: indices, 4: meshes, 5: stats
+    for (i = 0; i < 4; i++) {
+        bindings[binding_count].binding = binding_count;
+        bindings[binding_count].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[binding_count].descriptorCount = 1;
+        bindings[binding_count].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        binding_count++;
+    }
+    if (render->use_accel_struct) {
+        // 6: TLAS
+        bindings[binding_count].binding = binding_count;
+        bindings[binding_count].descriptorType =
+            VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+        bindings[binding_count].descriptorCount = 1;
+        bindings[binding_count].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        binding_count++;
+    } else {
+        // 6: BVH nodes, 7: BVH triangles
+        for (i = 0; i < 2; i++) {
+            bindings[binding_count].binding = binding_count;
+            bindings[binding_count].descriptorType =
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[binding_count].descriptorCount = 1;
+            bindings[binding_count].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            binding_count++;
+        }
+    }
+    // 8: variance, 9: heatmap, 10: tile list, 11: tile state
+    for (i = 0; i < 4; i++) {
+        bindings[binding_count].binding = 8 + i;
+        bindings[binding_count].descriptorType =
+            i < 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                  : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[binding_count].descriptorCount = 1;
+        bindings[binding_count].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        binding_count++;
+    }
+    // 12-16: AOV images, 17: constants, 18: BVH triangle instances
+    for (i = 0; i < (render->use_accel_struct ? 6u : 7u); i++) {
+        bindings[binding_count].binding = 12 + i;
+        bindings[binding_count].descriptorType =
+            i < TRACE_AOV_COUNT    ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+            : i == TRACE_AOV_COUNT ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                                   : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[binding_count].descriptorCount = 1;
+        bindings[binding_count].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        binding_count++;
+    }
+    // 19: batch cameras, 20: materials, 21: material of each instance
+    for (i = 0; i < (render->use_accel_struct ? 2u : 3u); i++) {
+        bindings[binding_count].binding = 19 + i;
+        bindings[binding_count].descriptorType =
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[binding_count].descriptorCount = 1;
+        bindings[binding_count].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        binding_count++;
+    }
+
+    const VkDescriptorSetLayoutCreateInfo descriptor_layout = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = NULL,
+        .bindingCount = binding_count,
+        .pBindings = bindings,
+    };
+    err = vkCreateDescriptorSetLayout(render->device, &descriptor_layout, NULL,
+                                      &tracer->desc_layout);
+    assert(!err);
+
+    // Set 1 is the scene's texture table
+    const VkDescriptorSetLayout set_layouts[2] = {
+        tracer->desc_layout,
+        scene->texture_table.layout,
+    };
+    const VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pNext = NULL,
+        .setLayoutCount = 2,
+        .pSetLayouts = set_layouts,
+        .pushConstantRangeCount = 0,
+        .pPushConstantRanges = NULL,
+    };
+    err = vkCreatePipelineLayout(render->device, &pPipelineLayoutCreateInfo,
+                                 NULL, &tracer->pipeline_layout);
+    assert(!err);
+}
+
+static VkPipeline tracer_create_pipeline(struct renderinfo *render,
+                                         struct tracerinfo *tracer,
+                                         const uint32_t *code, size_t size,
+                                         const VkSpecializationInfo *spec) {
+    VkShaderModuleCreateInfo moduleCreateInfo;
+    VkShaderModule module;
+    VkPipeline result;
+    VkResult err;
+
+    moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleCreateInfo.pNext = NULL;
+    moduleCreateInfo.flags = 0;
+    moduleCreateInfo.codeSize = size;
+    moduleCreateInfo.pCode = code;
+    err = vkCreateShaderModule(render->device, &moduleCreateInfo, NULL, &module);
+    assert(!err);
+
+    const VkComputePipelineCreateInfo pipeline = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .stage =
+            {
+             .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+             .pNext = NULL,
+             .flags = 0,
+             .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+             .module = module,
+             .pName = "main",
+             .pSpecializationInfo = spec,
+            },
+        .layout = tracer->pipeline_layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = 0,
+    };
+    err = vkCreateComputePipelines(render->device, VK_NULL_HANDLE, 1, &pipeline,
+                                   NULL, &result);
+    assert(!err);
+
+    vkDestroyShaderModule(render->device, module, NULL);
+    return result;
+}
+
+// One pipeline compiled by a task, the driver does the heavy lifting
+struct tracer_pipeline_task {
+    struct renderinfo *render;
+    struct tracerinfo *tracer;
+    const uint32_t *code;
+    size_t size;
+    const VkSpecializationInfo *spec;
+    VkPipeline *pipeline;
+};
+
+// Everything the pipeline tasks read until they are waited on
+struct tracer_pipelines {
+    VkSpecializationMapEntry entries[TRACE_AOV_COUNT + 3];
+    struct {
+        VkBool32 enabled[TRACE_AOV_COUNT + 2];
+        uint32_t bvh_stack_size;
+    } values;
+    VkSpecializationInfo spec;
+    struct tracer_pipeline_task tasks[2];
+    struct task_counter counter;
+};
+
+static void tracer_pipeline_task(void *arg, uint32_t index) {
+    const struct tracer_pipeline_task *task =
+        &((const struct tracer_pipeline_task *)arg)[index];
+
+    *task->pipeline = tracer_create_pipeline(task->render, task->tracer,
+                                             task->code, task->size,
+                                             task->spec);
+}
+
+// Starts compiling the pipelines, they are done once pipelines->counter is
+static void tracer_prepare_pipeline(struct renderinfo *render,
+                                    struct tracerinfo *tracer,
+                                    struct tracer_pipelines *pipelines) {
+    uint32_t i;
+
+    memset(pipelines, 0, sizeof(*pipelines));
+    // constant_id i switches AOV i on, the two after them batch mode and
+    // quantized geometry, the last sizes the BVH traversal stack
+    for (i = 0; i < TRACE_AOV_COUNT + 2; i++) {
+        pipelines->entries[i].constantID = i;
+        pipelines->entries[i].offset = i * sizeof(VkBool32);
+        pipelines->entries[i].size = sizeof(VkBool32);
+        pipelines->values.enabled[i] =
+            (tracer->aovs & TRACE_AOV_BIT(i)) ? VK_TRUE : VK_FALSE;
+    }
+    pipelines->values.enabled[TRACE_AOV_COUNT] =
+        tracer->batch ? VK_TRUE : VK_FALSE;
+    pipelines->values.enabled[TRACE_AOV_COUNT + 1] =
+        render->quantize ? VK_TRUE : VK_FALSE;
+    pipelines->entries[i].constantID = i;
+    pipelines->entries[i].offset = sizeof(pipelines->values.enabled);
+    pipelines->entries[i].size = sizeof(uint32_t);
+    pipelines->values.bvh_stack_size = BVH_MAX_DEPTH;
+    pipelines->spec.mapEntryCount = TRACE_AOV_COUNT + 3;
+    pipelines->spec.pMapEntries = pipelines->entries;
+    pipelines->spec.dataSize = sizeof(pipelines->values);
+    pipelines->spec.pData = &pipelines->values;
+
+    for (i = 0; i < 2; i++) {
+        pipelines->tasks[i].render = render;
+        pipelines->tasks[i].tracer = tracer;
+    }
+    if (render->use_accel_struct) {
+        pipelines->tasks[0].code = trace_rq_comp;
+        pipelines->tasks[0].size = sizeof(trace_rq_comp);
+    } else {
+        pipelines->tasks[0].code = trace_comp;
+        pipelines->tasks[0].size = sizeof(trace_comp);
+    }
+    pipelines->tasks[0].spec = &pipelines->spec;
+    pipelines->tasks[0].pipeline = &tracer->pipeline;
+    pipelines->tasks[1].code = tile_compact_comp;
+    pipelines->tasks[1].size = sizeof(tile_compact_comp);
+    pipelines->tasks[1].pipeline = &tracer->compact_pipeline;
+
+    for (i = 0; i < 2; i++)
+        task_spawn(render->tasks, &pipelines->counter, tracer_pipeline_task,
+                   pipelines->tasks, i);
+}
+
+static void tracer_prepare_images(struct renderinfo *render,
+                                  struct tracerinfo *tracer, uint32_t width,
+                                  uint32_t height) {
+    VkImageMemoryBarrier barriers[4 + TRACE_AOV_COUNT];
+    uint32_t i;
+
+    tracer->width = width;
+    tracer->height = height;
+    tracer->view_x = 0;
+    tracer->view_y = 0;
+    tracer->view_width = width;
+    tracer->view_height = height;
+    tracer->tiles_x = (width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+    tracer->tile_count =
+        tracer->tiles_x * ((height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE);
+
+    // Transfers in and out of the accumulation let the render server set a
+    // preempted job aside
+    create_image(render, VK_FORMAT_R32G32B32A32_SFLOAT, width, height,
+                 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                 &tracer->accum);
+    create_image(render, VK_FORMAT_R8G8B8A8_UNORM, width, height,
+                 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                 &tracer->output);
+    create_image(render, VK_FORMAT_R32_SFLOAT, width, height,
+                 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                 &tracer->variance);
+    create_image(render, VK_FORMAT_R8G8B8A8_UNORM, width, height,
+                 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                 &tracer->heatmap);
+    for (i = 0; i < TRACE_AOV_COUNT; i++) {
+        const bool enabled = tracer->aovs & TRACE_AOV_BIT(i);
+
+        create_image(render, aov_formats[i], enabled ? width : 1,
+                     enabled ? height : 1,
+                     VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                     &tracer->aov_images[i]);
+    }
+
+    // Indirect dispatch args followed by one id per tile
+    create_buffer(render, 4 * sizeof(uint32_t) + tracer->tile_count * sizeof(uint32_t),
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &tracer->tile_list);
+    create_buffer(render, tracer->tile_count * 2 * sizeof(uint32_t),
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &tracer->tile_state);
+
+    // All images live in GENERAL for their whole lifetime
+    memset(barriers, 0, sizeof(barriers));
+    for (i = 0; i < 4 + TRACE_AOV_COUNT; i++) {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].srcAccessMask = 0;
+        barriers[i].dstAccessMask =
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].subresourceRange =
+            (VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    }
+    barriers[0].image = tracer->accum.image;
+    barriers[1].image = tracer->output.image;
+    barriers[2].image = tracer->variance.image;
+    barriers[3].image = tracer->heatmap.image;
+    for (i = 0; i < TRACE_AOV_COUNT; i++)
+        barriers[4 + i].image = tracer->aov_images[i].image;
+
+    vkCmdPipelineBarrier(get_setup_cmd(render), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0,
+                         NULL, 4 + TRACE_AOV_COUNT, barriers);
+    flush_init_cmd(render);
+}
+
+// Everything that depends on the render size
+static void tracer_write_image_descriptors(struct renderinfo *render,
+                                           struct tracerinfo *tracer) {
+    static const uint32_t image_bindings[4 + TRACE_AOV_COUNT] = {
+        0, 1, 8, 9, 12, 13, 14, 15, 16};
+    VkDescriptorImageInfo image_infos[4 + TRACE_AOV_COUNT];
+    VkDescriptorBufferInfo buffer_infos[2];
+    VkWriteDescriptorSet writes[6 + TRACE_AOV_COUNT];
+    const uint32_t image_count = 4 + TRACE_AOV_COUNT;
+    uint32_t i;
+
+    memset(image_infos, 0, sizeof(image_infos));
+    memset(buffer_infos, 0, sizeof(buffer_infos));
+    memset(writes, 0, sizeof(writes));
+    image_infos[0].imageView = tracer->accum.view;
+    image_infos[1].imageView = tracer->output.view;
+    image_infos[2].imageView = tracer->variance.view;
+    image_infos[3].imageView = tracer->heatmap.view;
+    for (i = 0; i < TRACE_AOV_COUNT; i++)
+        image_infos[4 + i].imageView = tracer->aov_images[i].view;
+    for (i = 0; i < image_count; i++) {
+        image_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = tracer->desc_set;
+        writes[i].dstBinding = image_bindings[i];
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writes[i].pImageInfo = &image_infos[i];
+    }
+
+    buffer_infos[0].buffer = tracer->tile_list.buf;
+    buffer_infos[1].buffer = tracer->tile_state.buf;
+    for (i = 0; i < 2; i++) {
+        VkWriteDescriptorSet *write = &writes[image_count + i];
+
+        buffer_infos[i].range = VK_WHOLE_SIZE;
+        write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write->dstSet = tracer->desc_set;
+        write->dstBinding = 10 + i;
+        write->descriptorCount = 1;
+        write->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write->pBufferInfo = &buffer_infos[i];
+    }
+
+    vkUpdateDescriptorSets(render->device, image_count + 2, writes, 0, NULL);
+}
+
+static void tracer_prepare_descriptor_set(struct renderinfo *render,
+                                          struct tracerinfo *tracer,
+                                          struct scene *scene) {
+    const VkDescriptorPoolSize type_counts[4] = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4 + TRACE_AOV_COUNT},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 12},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+        {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1},
+    };
+    const VkDescriptorPoolCreateInfo descriptor_pool = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .maxSets = 1,
+        .poolSizeCount = render->use_accel_struct ? 4 : 3,
+        .pPoolSizes = type_counts,
+    };
+    VkDescriptorBufferInfo buffer_infos[10];
+    VkWriteDescriptorSet writes[11];
+    uint32_t write_count = 0;
+    uint32_t i;
+    VkResult err;
+
+    err = vkCreateDescriptorPool(render->device, &descriptor_pool, NULL,
+                                 &tracer->desc_pool);
+    assert(!err);
+
+    VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = NULL,
+        .descriptorPool = tracer->desc_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &tracer->desc_layout};
+    err = vkAllocateDescriptorSets(render->device, &alloc_info,
+                                   &tracer->desc_set);
+    assert(!err);
+
+    tracer_write_image_descriptors(render, tracer);
+
+    memset(buffer_infos, 0, sizeof(buffer_infos));
+    memset(writes, 0, sizeof(writes));
+    buffer_infos[0].buffer = scene->vertex_buf.buf;
+    buffer_infos[1].buffer = scene->index_buf.buf;
+    buffer_infos[2].buffer = scene->mesh_buf.buf;
+    buffer_infos[3].buffer = tracer->stats.buf;
+    buffer_infos[4].buffer = scene->bvh_node_buf.buf;
+    buffer_infos[5].buffer = scene->bvh_tri_buf.buf;
+    buffer_infos[6].buffer = tracer->uniforms.buffer.buf;
+    buffer_infos[7].buffer = scene->bvh_instance_buf.buf;
+    buffer_infos[8].buffer = scene->material_buf.buf;
+    buffer_infos[9].buffer = scene->instance_material_buf.buf;
+
+    for (i = 0; i < 10; i++) {
+        // 2-5, 6-7 without the TLAS, then 17, 18 without the TLAS, then 20,
+        // 21 without the TLAS
+        if (render->use_accel_struct &&
+            (i == 4 || i == 5 || i == 7 || i == 9))
+            continue;
+        // The constants are one block at a dynamic offset into the ring
+        buffer_infos[i].range =
+            i == 6 ? sizeof(struct trace_constants) : VK_WHOLE_SIZE;
+        writes[write_count].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[write_count].dstSet = tracer->desc_set;
+        writes[write_count].dstBinding = i < 6   ? 2 + i
+                                         : i < 8 ? 11 + i
+                                                 : 12 + i;
+        writes[write_count].descriptorCount = 1;
+        writes[write_count].descriptorType =
+            i == 6 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                   : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[write_count].pBufferInfo = &buffer_infos[i];
+        write_count++;
+    }
+
+    const VkWriteDescriptorSetAccelerationStructureKHR as_write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+        .pNext = NULL,
+        .accelerationStructureCount = 1,
+        .pAccelerationStructures = &scene->accel.tlas.handle,
+    };
+    if (render->use_accel_struct) {
+        writes[write_count].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[write_count].pNext = &as_write;
+        writes[write_count].dstSet = tracer->desc_set;
+        writes[write_count].dstBinding = 6;
+        writes[write_count].descriptorCount = 1;
+        writes[write_count].descriptorType =
+            VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+        write_count++;
+    }
+
+    vkUpdateDescriptorSets(render->device, write_count, writes, 0, NULL);
+}
+
+void tracer_prepare(struct renderinfo *render, struct tracerinfo *tracer,
+                    struct scene *scene, uint32_t width, uint32_t height) {
+    struct tracer_pipelines pipelines;
+
+    memset(tracer, 0, sizeof(*tracer));
+
+    tracer->camera.pos[2] = -3.0f;
+    tracer->camera.fov = 60.0f;
+    tracer->aovs = render->aovs;
+    tracer->batch = render->cameras_path != NULL;
+
+    create_buffer(render, sizeof(struct trace_stats),
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &tracer->stats);
+    memset(tracer->stats.alloc.mapped, 0, sizeof(struct trace_stats));
+    // 256 is the coarsest alignment of dynamic offsets a device may have
+    uniform_ring_init(render, &tracer->uniforms,
+                      (VkDeviceSize)TRACE_UNIFORM_SLICES * 256,
+                      TRACE_UNIFORM_FRAMES);
+
+    slice_budget_init(render, &tracer->budget);
+    if (render->timestamps) {
+        const VkQueryPoolCreateInfo query_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2,
+        };
+        VkResult err = vkCreateQueryPool(render->device, &query_info, NULL,
+                                         &tracer->timestamps);
+        assert(!err);
+    }
+
+    // The pipelines compile on other threads while the images are made
+    tracer->texture_set = scene->texture_table.set;
+    tracer->texture_stream = scene->texture_table.stream;
+    tracer_prepare_descriptor_layout(render, tracer, scene);
+    tracer_prepare_pipeline(render, tracer, &pipelines);
+    tracer_prepare_images(render, tracer, width, height);
+    tracer_prepare_descriptor_set(render, tracer, scene);
+    tracer_prepare_batch(render, tracer, 1);
+    tracer_reset(tracer);
+    task_wait(render->tasks, &pipelines.counter);
+}
+
+void tracer_resize(struct renderinfo *render, struct tracerinfo *tracer,
+                   uint32_t width, uint32_t height) {
+    uint32_t i;
+
+    destroy_image(render, &tracer->accum);
+    destroy_image(render, &tracer->output);
+    destroy_image(render, &tracer->variance);
+    destroy_image(render, &tracer->heatmap);
+    for (i = 0; i < TRACE_AOV_COUNT; i++)
+        destroy_image(render, &tracer->aov_images[i]);
+    destroy_buffer(render, &tracer->tile_list);
+    destroy_buffer(render, &tracer->tile_state);
+    tracer_prepare_images(render, tracer, width, height);
+    tracer_write_image_descriptors(render, tracer);
+    tracer_reset(tracer);
+}
+
+void tracer_reset(struct tracerinfo *tracer) {
+    tracer->sample_count = 0;
+    tracer->slice_offset = 0;
+    tracer->samples_traced = 0;
+    tracer->active_tiles = tracer->tile_count;
+    tracer->noise = INFINITY;
+    tracer->converged = false;
+}
+
+void tracer_prepare_batch(struct renderinfo *render, struct tracerinfo *tracer,
+                          uint32_t capacity) {
+    VkDescriptorBufferInfo buffer_info;
+    VkWriteDescriptorSet write;
+
+    if (tracer->batch_cameras.buf)
+        destroy_buffer(render, &tracer->batch_cameras);
+    create_buffer(render, 16 + (VkDeviceSize)capacity * 64,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &tracer->batch_cameras);
+    tracer->batch_capacity = capacity;
+
+    memset(&buffer_info, 0, sizeof(buffer_info));
+    memset(&write, 0, sizeof(write));
+    buffer_info.buffer = tracer->batch_cameras.buf;
+    buffer_info.range = VK_WHOLE_SIZE;
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = tracer->desc_set;
+    write.dstBinding = 19;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(render->device, 1, &write, 0, NULL);
+}
+
+static void camera_basis(const struct camera *camera, struct trace_constants *push) {
+    const float yaw = camera->yaw * (float)M_PI / 180.0f;
+    const float pitch = camera->pitch * (float)M_PI / 180.0f;
+    const float f[3] = {cosf(pitch) * sinf(yaw), sinf(pitch),
+                        cosf(pitch) * cosf(yaw)};
+    float r[3] = {f[2], 0.0f, -f[0]};
+    const float len = sqrtf(r[0] * r[0] + r[2] * r[2]);
+
+    r[0] /= len;
+    r[2] /= len;
+
+    memcpy(push->cam_pos, camera->pos, sizeof(camera->pos));
+    push->cam_pos[3] = tanf(camera->fov * 0.5f * (float)M_PI / 180.0f);
+    memcpy(push->cam_forward, f, sizeof(f));
+    memcpy(push->cam_right, r, sizeof(r));
+    // up = forward x right
+    push->cam_up[0] = f[1] * r[2] - f[2] * r[1];
+    push->cam_up[1] = f[2] * r[0] - f[0] * r[2];
+    push->cam_up[2] = f[0] * r[1] - f[1] * r[0];
+}
+
+void tracer_record_batch(struct tracerinfo *tracer, VkCommandBuffer cmd,
+                         const struct camera *cameras, uint32_t count,
+                         uint32_t cell_width, uint32_t cell_height,
+                         uint32_t columns) {
+    const uint32_t grid[4] = {cell_width, cell_height, columns, count};
+    float basis[256][4][4]; // one vkCmdUpdateBuffer worth of cameras
+    struct trace_constants push;
+    uint32_t first, i;
+
+    assert(count > 0 && count <= tracer->batch_capacity);
+
+    // The previous batch may still read the cameras
+    const VkMemoryBarrier read_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &read_barrier, 0,
+                         NULL, 0, NULL);
+
+    vkCmdUpdateBuffer(cmd, tracer->batch_cameras.buf, 0, sizeof(grid), grid);
+    for (first = 0; first < count; first += i) {
+        for (i = 0; i < 256 && first + i < count; i++) {
+            camera_basis(&cameras[first + i], &push);
+            memcpy(basis[i][0], push.cam_pos, sizeof(basis[i][0]));
+            memcpy(basis[i][1], push.cam_right, sizeof(basis[i][1]));
+            memcpy(basis[i][2], push.cam_up, sizeof(basis[i][2]));
+            memcpy(basis[i][3], push.cam_forward, sizeof(basis[i][3]));
+        }
+        vkCmdUpdateBuffer(cmd, tracer->batch_cameras.buf,
+                          sizeof(grid) + (VkDeviceSize)first * sizeof(basis[0]),
+                          i * sizeof(basis[0]), basis);
+    }
+
+    const VkMemoryBarrier write_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &write_barrier, 0, NULL, 0, NULL);
+}
+
+// Lays out the next slice of an accumulation pass, covering at most
+// max_tiles entries of the tile list after the ones earlier slices took, and
+// writes its constants to the uniform ring. The first slice of a pass
+// rebuilds the tile list, a pass that fits in one slice is dispatched
+// indirectly with exactly one workgroup per active tile.
+bool tracer_plan_slice(struct renderinfo *render, struct tracerinfo *tracer,
+                       uint32_t max_tiles, struct trace_slice *slice) {
+    struct trace_constants constants;
+
+    memset(&constants, 0, sizeof(constants));
+    camera_basis(&tracer->camera, &constants);
+
+    // Motion vectors lead back to the camera the last accumulation started
+    // with, a fresh one stands still
+    if (tracer->slice_offset == 0 && tracer->sample_count == 0 &&
+        (tracer->aovs & TRACE_AOV_BIT(TRACE_AOV_MOTION))) {
+        float camera[4][4];
+
+        memcpy(camera[0], constants.cam_pos, sizeof(camera[0]));
+        memcpy(camera[1], constants.cam_right, sizeof(camera[1]));
+        memcpy(camera[2], constants.cam_up, sizeof(camera[2]));
+        memcpy(camera[3], constants.cam_forward, sizeof(camera[3]));
+        memcpy(tracer->motion_camera,
+               tracer->has_last_camera ? tracer->last_camera : camera,
+               sizeof(camera));
+        memcpy(tracer->last_camera, camera, sizeof(camera));
+        tracer->has_last_camera = true;
+    }
+    memcpy(constants.prev_cam, tracer->motion_camera,
+           sizeof(constants.prev_cam));
+
+    memset(slice, 0, sizeof(*slice));
+    slice->sample_index = tracer->sample_count;
+    slice->offset = tracer->slice_offset;
+    // Nothing is known about a new list until the host reads it back
+    slice->count = (tracer->slice_offset == 0 ? tracer->tile_count
+                                              : tracer->pass_tiles) -
+                   tracer->slice_offset;
+    if (slice->count > max_tiles)
+        slice->count = max_tiles;
+    slice->indirect =
+        tracer->slice_offset == 0 && slice->count == tracer->tile_count;
+
+    constants.width = tracer->width;
+    constants.height = tracer->height;
+    constants.sample_index = slice->sample_index;
+    constants.max_bounces = render->max_bounces;
+    constants.tiles_x = tracer->tiles_x;
+    constants.tile_count = tracer->tile_count;
+    constants.spp_target = render->spp_target;
+    constants.adaptive = render->adaptive;
+    constants.noise_threshold = render->noise_threshold;
+    constants.heatmap_max =
+        render->spp_target ? (float)render->spp_target : 1024.0f;
+    constants.origin[0] = tracer->view_x;
+    constants.origin[1] = tracer->view_y;
+    constants.extent[0] = tracer->view_width;
+    constants.extent[1] = tracer->view_height;
+    constants.tile_offset = slice->offset;
+    if (!uniform_ring_push(&tracer->uniforms, &constants, sizeof(constants),
+                           &slice->uniform_offset))
+        return false;
+
+    if (tracer->slice_offset == 0)
+        tracer->pass_tiles = tracer->tile_count;
+    tracer->slice_offset += slice->count;
+    tracer->slice_tiles = slice->count;
+    return true;
+}
+
+// Only reads the tracer, slices of one submit are recorded concurrently
+void tracer_record_slice(struct renderinfo *render,
+                         const struct tracerinfo *tracer, VkCommandBuffer cmd,
+                         const struct trace_slice *slice) {
+    // The previous slice (possibly from an earlier submit) wrote the images,
+    // the tile state and the tile list that may be about to be refilled
+    const VkMemoryBarrier pass_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                         VK_ACCESS_TRANSFER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &pass_barrier, 0, NULL, 0, NULL);
+
+    const VkDescriptorSet sets[2] = {tracer->desc_set, tracer->texture_set};
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            tracer->pipeline_layout, 0, 2, sets, 1,
+                            &slice->uniform_offset);
+
+    if (slice->offset == 0) {
+        // Reset the stats and the tile list to an empty (0, 1, 1) dispatch
+        if (slice->sample_index == 0)
+            vkCmdFillBuffer(cmd, tracer->tile_state.buf, 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(cmd, tracer->stats.buf, 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(cmd, tracer->tile_list.buf, 0, sizeof(uint32_t), 0);
+        vkCmdFillBuffer(cmd, tracer->tile_list.buf, sizeof(uint32_t),
+                        2 * sizeof(uint32_t), 1);
+
+        const VkMemoryBarrier fill_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask =
+                VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                             &fill_barrier, 0, NULL, 0, NULL);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          tracer->compact_pipeline);
+        vkCmdDispatch(cmd,
+                      (tracer->tile_count + TRACE_COMPACT_GROUP_SIZE - 1) /
+                          TRACE_COMPACT_GROUP_SIZE,
+                      1, 1);
+
+        const VkMemoryBarrier compact_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                             VK_ACCESS_SHADER_READ_BIT |
+                             VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &compact_barrier, 0, NULL, 0, NULL);
+    }
+
+    // One workgroup per tile that still needs samples
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, tracer->pipeline);
+    if (slice->indirect)
+        vkCmdDispatchIndirect(cmd, tracer->tile_list.buf, 0);
+    else
+        vkCmdDispatch(cmd, slice->count, 1, 1);
+
+    const VkMemoryBarrier stats_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &stats_barrier,
+                         0, NULL, 0, NULL);
+}
+
+struct tracer_slices_task {
+    struct renderinfo *render;
+    const struct tracerinfo *tracer;
+    uint32_t slice_count;
+};
+
+static void tracer_record_slices_task(void *arg, uint32_t index,
+                                      VkCommandBuffer cmd) {
+    const struct tracer_slices_task *task = arg;
+    const uint32_t first = index * TRACE_SLICES_PER_CMD;
+    uint32_t i;
+
+    for (i = first;
+         i < first + TRACE_SLICES_PER_CMD && i < task->slice_count; i++)
+        tracer_record_slice(task->render, task->tracer, cmd,
+                            &task->tracer->slices[i]);
+}
+
+uint32_t tracer_record_slices(struct renderinfo *render,
+                              struct tracerinfo *tracer,
+                              struct cmd_frame *frame, uint32_t max_tiles,
+                              uint32_t passes) {
+    struct tracer_slices_task task = {render, tracer, 0};
+    uint32_t tiles = 0;
+
+    // Laying the slices out is cheap and changes the tracer, recording them
+    // is neither
+    uniform_ring_next(&tracer->uniforms);
+    while (max_tiles > 0 && tracer->sample_count < passes) {
+        struct trace_slice *slice;
+
+        if (task.slice_count == tracer->slice_capacity) {
+            struct trace_slice *grown;
+
+            tracer->slice_capacity =
+                tracer->slice_capacity ? tracer->slice_capacity * 2 : 64;
+            grown = realloc(tracer->slices,
+                            tracer->slice_capacity * sizeof(*grown));
+            assert(grown);
+            tracer->slices = grown;
+        }
+        slice = &tracer->slices[task.slice_count];
+        if (!tracer_plan_slice(render, tracer, max_tiles, slice))
+            break;
+        task.slice_count++;
+        max_tiles -= slice->count;
+        tiles += slice->count;
+        if (tracer->slice_offset >= tracer->pass_tiles) {
+            tracer->slice_offset = 0;
+            tracer->sample_count++;
+        }
+    }
+
+    cmd_frame_record(render, frame,
+                     (task.slice_count + TRACE_SLICES_PER_CMD - 1) /
+                         TRACE_SLICES_PER_CMD,
+                     tracer_record_slices_task, &task);
+    return tiles;
+}
+
+void tracer_plan_frame(struct renderinfo *render, struct tracerinfo *tracer) {
+    uniform_ring_next(&tracer->uniforms);
+    // A pass too slow for one frame is spread over several
+    tracer->dispatched =
+        !tracer->converged &&
+        tracer_plan_slice(render, tracer,
+                          slice_budget_tiles(&tracer->budget,
+                                             tracer->tile_count),
+                          &tracer->frame_slice);
+}
+
+void tracer_record_trace(struct renderinfo *render,
+                         const struct tracerinfo *tracer,
+                         VkCommandBuffer cmd) {
+    if (!tracer->dispatched)
+        return;
+    if (tracer->timestamps) {
+        vkCmdResetQueryPool(cmd, tracer->timestamps, 0, 2);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            tracer->timestamps, 0);
+    }
+    texture_stream_record_begin(tracer->texture_stream, cmd);
+    tracer_record_slice(render, tracer, cmd, &tracer->frame_slice);
+    texture_stream_record_end(tracer->texture_stream, cmd);
+    if (tracer->timestamps)
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                            tracer->timestamps, 1);
+}
+
+void tracer_record_present(const struct tracerinfo *tracer,
+                           VkCommandBuffer cmd, VkImage target) {
+    VkImageMemoryBarrier barriers[2];
+
+    // Once converged only this blit of the last image is left per frame
+    memset(barriers, 0, sizeof(barriers));
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image =
+        tracer->show_heatmap ? tracer->heatmap.image : tracer->output.image;
+    barriers[0].subresourceRange =
+        (VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    barriers[1] = barriers[0];
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].image = target;
+    // The acquire semaphore is waited on at the transfer stage, so the
+    // transition of the swapchain image has to come after that stage too
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 2,
+                         barriers);
+
+    const VkImageBlit blit = {
+        .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .srcOffsets = {{0, 0, 0}, {tracer->width, tracer->height, 1}},
+        .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .dstOffsets = {{0, 0, 0}, {tracer->width, tracer->height, 1}},
+    };
+    vkCmdBlitImage(cmd, barriers[0].image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   VK_FILTER_NEAREST);
+
+    barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, NULL, 0, NULL, 2, barriers);
+}
+
+static void tracer_slice_done(struct renderinfo *render,
+                              struct tracerinfo *tracer) {
+    struct trace_stats *stats = tracer->stats.alloc.mapped;
+    const uint32_t slice_start = tracer->slice_offset - tracer->slice_tiles;
+    uint64_t ticks[2];
+    uint32_t done;
+
+    if (!tracer->dispatched)
+        return;
+    tracer->dispatched = false;
+
+    // Only now the length of the compacted tile list is known
+    if (slice_start == 0)
+        tracer->pass_tiles = stats->active_tiles;
+
+    if (tracer->timestamps &&
+        vkGetQueryPoolResults(render->device, tracer->timestamps, 0, 2,
+                              sizeof(ticks), ticks, sizeof(ticks[0]),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        // Groups beyond the end of the list exit at once and do not count
+        done = (tracer->slice_offset < tracer->pass_tiles ? tracer->slice_offset
+                                                          : tracer->pass_tiles) -
+               (slice_start < tracer->pass_tiles ? slice_start
+                                                 : tracer->pass_tiles);
+        slice_budget_update(&tracer->budget, done,
+                            timestamp_delta_ms(render, ticks));
+    }
+
+    // The rest of the pass goes into the next frames
+    if (tracer->slice_offset < tracer->pass_tiles)
+        return;
+    tracer->slice_offset = 0;
+    tracer->sample_count++;
+    tracer->active_tiles = stats->active_tiles;
+    tracer->samples_traced +=
+        (uint64_t)stats->active_tiles * TRACE_TILE_SIZE * TRACE_TILE_SIZE;
+
+    if (stats->noise_pixels > 0) {
+        const uint64_t noise_sum =
+            (uint64_t)stats->noise_sum_hi << 32 | stats->noise_sum_lo;
+
+        // mean relative standard error of the accumulated estimate
+        tracer->noise = (float)sqrt((double)noise_sum / TRACE_NOISE_SCALE /
+                                    stats->noise_pixels);
+    }
+
+    // In adaptive mode the noise only covers the tiles still being worked
+    // on, so stop once the compaction pass finds none left
+    if (tracer->active_tiles == 0 ||
+        (!render->adaptive &&
+         ((render->spp_target && tracer->sample_count >= render->spp_target) ||
+          (render->noise_threshold > 0.0f &&
+           tracer->sample_count >= TRACE_MIN_SAMPLES &&
+           tracer->noise < render->noise_threshold)))) {
+        const double pixels =
+            (double)tracer->tile_count * TRACE_TILE_SIZE * TRACE_TILE_SIZE;
+
+        tracer->converged = true;
+        printf("Converged after %u passes, %.1f samples per pixel on average "
+               "(noise %.4f)\n",
+               tracer->sample_count, (double)tracer->samples_traced / pixels,
+               tracer->noise);
+        fflush(stdout);
+    }
+}
+
+void tracer_frame_done(struct renderinfo *render, struct tracerinfo *tracer) {
+    tracer_slice_done(render, tracer);
+    // The image so far was traced with coarser pages
+    if (tracer->texture_stream &&
+        texture_stream_update(render, tracer->texture_stream))
+        tracer_reset(tracer);
+}
+
+void tracer_cleanup(struct renderinfo *render, struct tracerinfo *tracer) {
+    uint32_t i;
+
+    vkDestroyPipeline(render->device, tracer->pipeline, NULL);
+    vkDestroyPipeline(render->device, tracer->compact_pipeline, NULL);
+    if (tracer->timestamps)
+        vkDestroyQueryPool(render->device, tracer->timestamps, NULL);
+    vkDestroyPipelineLayout(render->device, tracer->pipeline_layout, NULL);
+    vkDestroyDescriptorPool(render->device, tracer->desc_pool, NULL);
+    vkDestroyDescriptorSetLayout(render->device, tracer->desc_layout, NULL);
+
+    destroy_image(render, &tracer->accum);
+    destroy_image(render, &tracer->output);
+    destroy_image(render, &tracer->variance);
+    destroy_image(render, &tracer->heatmap);
+    for (i = 0; i < TRACE_AOV_COUNT; i++)
+        destroy_image(render, &tracer->aov_images[i]);
+    destroy_buffer(render, &tracer->tile_list);
+    destroy_buffer(render, &tracer->tile_state);
+    destroy_buffer(render, &tracer->stats);
+    uniform_ring_cleanup(render, &tracer->uniforms);
+    destroy_buffer(render, &tracer->batch_cameras);
+    free(tracer->slices);
+    memset(tracer, 0, sizeof(*tracer));
+}
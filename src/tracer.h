@@ -0,0 +1,208 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#define TRACE_TILE_SIZE 8
+// Slices recorded into one secondary command buffer when a submit holds
+// many, enough of them to outweigh beginning and ending the buffer
+#define TRACE_SLICES_PER_CMD 16
+// Each slice takes a block of constants from the tracer's uniform ring,
+// which has room for this many per submit and as many regions as submits
+// any caller keeps in flight
+#define TRACE_UNIFORM_SLICES 1024
+#define TRACE_UNIFORM_FRAMES 2
+
+struct cmd_frame;
+
+// Must match the Constants block in shaders/common.glsl (std140)
+struct trace_constants {
+    float cam_pos[4];   // w = tan(fov / 2)
+    float cam_right[4];
+    float cam_up[4];
+    float cam_forward[4];
+    float prev_cam[4][4]; // basis the last accumulation started with
+    uint32_t width;
+    uint32_t height;
+    uint32_t sample_index;
+    uint32_t max_bounces;
+    uint32_t tiles_x;
+    uint32_t tile_count;
+    uint32_t spp_target;
+    uint32_t adaptive;
+    float noise_threshold;
+    float heatmap_max;
+    int32_t origin[2];
+    uint32_t extent[2];
+    uint32_t tile_offset;
+};
+
+// Extra outputs about the primary hit of every pixel, each one compiled
+// into the trace pipeline only when it is asked for
+enum trace_aov {
+    TRACE_AOV_DEPTH,    // r32f, view space distance
+    TRACE_AOV_NORMAL,   // rgba16f, shading normal facing the camera
+    TRACE_AOV_ALBEDO,   // rgba16f
+    TRACE_AOV_INSTANCE, // r32ui, scene instance, ~0 for the sky
+    TRACE_AOV_MOTION,   // rgba16f, pixels to the previous camera's view
+    TRACE_AOV_COUNT,
+};
+
+#define TRACE_AOV_BIT(aov) (1u << (aov))
+
+extern const char *const trace_aov_names[TRACE_AOV_COUNT];
+
+// noise_sum is fixed point, TRACE_NOISE_SCALE per unit
+#define TRACE_NOISE_SCALE 16777216.0
+
+struct trace_stats {
+    uint32_t noise_sum_lo;
+    uint32_t noise_sum_hi;
+    uint32_t noise_pixels;
+    uint32_t active_tiles;
+};
+
+// Sizes slices of a pass so that one submit stays within a GPU time budget,
+// long enough to keep driver watchdogs quiet and the queue free for the UI
+#define SLICE_INITIAL_TILES 256
+#define SLICE_MAX_GROWTH 2
+
+struct slice_budget {
+    float budget_ms;   // 0: never slice
+    float ms_per_tile; // running estimate, 0 until measured
+    uint32_t tiles;    // current slice size
+};
+
+// One slice of an accumulation pass, see tracer_plan_slice
+struct trace_slice {
+    uint32_t sample_index;
+    uint32_t offset, count;  // entries of the tile list
+    bool indirect;           // the whole pass, one group per active tile
+    uint32_t uniform_offset; // of its constants in the uniform ring
+};
+
+struct camera {
+    float pos[3];
+    float yaw, pitch;
+    float fov;
+};
+
+struct tracerinfo {
+    VkDescriptorSetLayout desc_layout;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipeline;
+    VkPipeline compact_pipeline;
+    VkDescriptorPool desc_pool;
+    VkDescriptorSet desc_set;
+    VkDescriptorSet texture_set; // of the scene, set 1
+    struct texture_stream *texture_stream; // of the scene's texture table
+
+    struct gpu_image accum;  // running mean in rgb, sample count in a
+    struct gpu_image output; // tonemapped, blitted to the swapchain
+    struct gpu_image variance; // per-pixel luminance M2 (Welford)
+    struct gpu_image heatmap;  // samples per pixel AOV
+    struct gpu_buffer stats;
+    struct gpu_buffer tile_list;  // indirect args + compacted tile ids
+    struct gpu_buffer tile_state; // per-tile error and sample count
+    struct gpu_image aov_images[TRACE_AOV_COUNT]; // 1x1 when not enabled
+    uint32_t aovs; // TRACE_AOV_BIT mask
+    float last_camera[4][4]; // basis the last accumulation started with
+    bool has_last_camera;
+    float motion_camera[4][4]; // previous camera of the pass being planned
+
+    // batch mode renders an atlas with a cell for each of these cameras
+    bool batch;
+    struct gpu_buffer batch_cameras; // grid followed by the camera bases
+    uint32_t batch_capacity;
+    uint32_t width, height;
+    uint32_t tiles_x, tile_count;
+    bool show_heatmap;
+
+    // window of the final image covered by the storage images, the whole
+    // image unless it is rendered in tiles
+    int32_t view_x, view_y;
+    uint32_t view_width, view_height;
+
+    struct camera camera;
+
+    // slicing of the current pass, see tracer_plan_slice
+    struct slice_budget budget;
+    uint32_t slice_offset; // tile list entries recorded so far
+    uint32_t slice_tiles;  // entries in the slice recorded last
+    uint32_t pass_tiles;   // upper bound on the entries in the tile list
+    VkQueryPool timestamps;
+    struct uniform_ring uniforms; // constants of the slices
+    struct trace_slice frame_slice; // of the interactive frame
+    struct trace_slice *slices;     // laid out by tracer_record_slices
+    uint32_t slice_capacity;
+
+    // progressive accumulation state
+    uint32_t sample_count;     // passes since the last reset
+    uint64_t samples_traced;   // pixel samples since the last reset
+    uint32_t active_tiles;
+    float noise;
+    bool converged;
+    bool dispatched;
+};
+
+void slice_budget_init(struct renderinfo *render, struct slice_budget *budget);
+
+uint32_t slice_budget_tiles(const struct slice_budget *budget,
+                            uint32_t max_tiles);
+
+void slice_budget_update(struct slice_budget *budget, uint32_t tiles,
+                         float ms);
+
+float timestamp_delta_ms(struct renderinfo *render, const uint64_t *ticks);
+
+void tracer_prepare(struct renderinfo *render, struct tracerinfo *tracer,
+                    struct scene *scene, uint32_t width, uint32_t height);
+
+void tracer_resize(struct renderinfo *render, struct tracerinfo *tracer,
+                   uint32_t width, uint32_t height);
+
+void tracer_reset(struct tracerinfo *tracer);
+
+// Room for capacity cameras in the batch camera buffer
+void tracer_prepare_batch(struct renderinfo *render, struct tracerinfo *tracer,
+                          uint32_t capacity);
+
+// Records the upload of the cameras of the next batch, laid out in columns
+// of cells of cell_width x cell_height pixels
+void tracer_record_batch(struct tracerinfo *tracer, VkCommandBuffer cmd,
+                         const struct camera *cameras, uint32_t count,
+                         uint32_t cell_width, uint32_t cell_height,
+                         uint32_t columns);
+
+// Returns false when the uniform ring has no room left for this submit
+bool tracer_plan_slice(struct renderinfo *render, struct tracerinfo *tracer,
+                       uint32_t max_tiles, struct trace_slice *slice);
+
+void tracer_record_slice(struct renderinfo *render,
+                         const struct tracerinfo *tracer, VkCommandBuffer cmd,
+                         const struct trace_slice *slice);
+
+// Lays out slices of up to max_tiles tile list entries in total, moving on
+// to the next pass until passes are done or the submit's part of the
+// uniform ring is full, and records them in parallel into the frame.
+// Returns the entries recorded.
+uint32_t tracer_record_slices(struct renderinfo *render,
+                              struct tracerinfo *tracer,
+                              struct cmd_frame *frame, uint32_t max_tiles,
+                              uint32_t passes);
+
+// The interactive loop plans its frame first and then records the trace and
+// the blit to the swapchain image as passes of their own
+void tracer_plan_frame(struct renderinfo *render, struct tracerinfo *tracer);
+
+void tracer_record_trace(struct renderinfo *render,
+                         const struct tracerinfo *tracer, VkCommandBuffer cmd);
+
+void tracer_record_present(const struct tracerinfo *tracer,
+                           VkCommandBuffer cmd, VkImage target);
+
+// After the frame's fence; pages of streamed textures that arrive restart
+// the accumulation
+void tracer_frame_done(struct renderinfo *render, struct tracerinfo *tracer);
+
+void tracer_cleanup(struct renderinfo *render, struct tracerinfo *tracer);
+
+#endif
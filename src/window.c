@@ -14,6 +14,27 @@
 #include "window.h"
 
 
+static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    struct windowinfo *info = glfwGetWindowUserPointer(window);
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_RELEASE)
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        info->show_heatmap = !info->show_heatmap;
+        info->damaged = true;
+    }
+}
+
+static void refresh_callback(GLFWwindow* window) {
+    struct windowinfo *info = glfwGetWindowUserPointer(window);
+    info->damaged = true;
+}
+
+static void resize_callback(GLFWwindow* window, int width, int height) {
+    struct windowinfo *info = glfwGetWindowUserPointer(window);
+    info->width = width;
+    info->height = height;
+    info->resized = true;
+}
 
 void create_window(struct windowinfo *window, char *APP_LONG_NAME) {
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -30,9 +51,9 @@ void create_window(struct windowinfo *window, char *APP_LONG_NAME) {
         exit(1);
     }
 
-    //glfwSetWindowUserPointer(demo->window, demo);
-    //glfwSetWindowRefreshCallback(demo->window, demo_refresh_callback);
-    //glfwSetFramebufferSizeCallback(demo->window, demo_resize_callback);
-    //glfwSetKeyCallback(demo->window, demo_key_callback);
+    glfwSetWindowUserPointer(window->window, window);
+    glfwSetWindowRefreshCallback(window->window, refresh_callback);
+    glfwSetFramebufferSizeCallback(window->window, resize_callback);
+    glfwSetKeyCallback(window->window, key_callback);
 }
 
@@ -4,7 +4,11 @@
 
 struct windowinfo {
     GLFWwindow* window;
+    VkSurfaceKHR surface;
     int width, height;
+    bool resized;
+    bool damaged;
+    bool show_heatmap;
     char APP_LONG_NAME;
     char APP_SHORT_NAME;
 };